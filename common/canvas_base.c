@@ -112,6 +112,10 @@ typedef struct LzData {
 typedef struct GlzData {
     SpiceGlzDecoder *decoder;
     LzDecodeUsrData decode_data;
+    /* kept from one image to the next, for data split in several
+     * chunks and for the GLZ stream of zlib-GLZ images */
+    SpiceBuffer chunks;
+    SpiceBuffer stream;
 } GlzData;
 
 typedef struct QuicData {
@@ -123,6 +127,69 @@ typedef struct QuicData {
     uint32_t current_chunk;
 } QuicData;
 
+/* An image handed to canvas_base_prefetch_images(), decoded on a worker
+ * thread and picked up by canvas_get_image_internal() */
+typedef struct PrefetchJob {
+    SpiceImage *image;
+    uint64_t id;
+    uint32_t canvas_format;
+    int done;
+    /* always in the original format, converted when taken if needed */
+    pixman_image_t *surface;
+} PrefetchJob;
+
+typedef struct PrefetchData {
+    GThreadPool *pool;
+    GMutex lock;
+    GCond done_cond;
+    GHashTable *jobs; /* SpiceImage * -> PrefetchJob * */
+} PrefetchData;
+
+/* Regions built from recently used clip rects and masks. Most draws of
+ * an update share the same clip, and masks often come from the image
+ * cache, so there is no need to rebuild them every time */
+#define CLIP_CACHE_SIZE 8
+#define MASK_CACHE_SIZE 8
+
+typedef struct ClipCacheEntry {
+    guint hash;
+    uint32_t num_rects; /* 0 for an unused entry */
+    SpiceRect *rects;
+    pixman_region32_t region;
+} ClipCacheEntry;
+
+typedef struct MaskCacheEntry {
+    pixman_image_t *image; /* NULL for an unused entry */
+    uint64_t id;
+    int invert;
+    pixman_region32_t region; /* in mask coordinates */
+} MaskCacheEntry;
+
+typedef struct RegionCache {
+    ClipCacheEntry clips[CLIP_CACHE_SIZE];
+    int next_clip;
+    MaskCacheEntry masks[MASK_CACHE_SIZE];
+    int next_mask;
+} RegionCache;
+
+/* Converted patterns of the image cache, repeated horizontally so that
+ * tiled rows are filled with large copies */
+#define PATTERN_CACHE_SIZE 8
+#define PATTERN_CACHE_MAX_PIXELS (128 * 128)
+#define PATTERN_MIN_ROW_BYTES 256
+
+typedef struct PatternCacheEntry {
+    pixman_image_t *source; /* NULL for an unused entry */
+    uint64_t id;
+    pixman_format_code_t format;
+    pixman_image_t *tile;
+} PatternCacheEntry;
+
+typedef struct PatternCache {
+    PatternCacheEntry entries[PATTERN_CACHE_SIZE];
+    int next;
+} PatternCache;
+
 typedef struct CanvasBase {
     SpiceCanvas parent;
     uint32_t color_shift;
@@ -144,7 +211,17 @@ typedef struct CanvasBase {
     LzData lz_data;
     GlzData glz_data;
     SpiceJpegDecoder* jpeg;
+    /* size the next JPEG image is drawn at, for the decoder to scale it
+     * down, 0, 0 to decode it at full size */
+    int jpeg_target_width;
+    int jpeg_target_height;
     SpiceZlibDecoder* zlib;
+
+    PrefetchData prefetch;
+    GHashTable *glyph_cache;
+    RegionCache region_cache;
+    PatternCache pattern_cache;
+    SpiceSpanArena span_arena;
 } CanvasBase;
 
 typedef enum {
@@ -359,11 +436,10 @@ static pixman_format_code_t canvas_get_target_format(CanvasBase *canvas,
     return format;
 }
 
-static pixman_image_t *canvas_get_quic(CanvasBase *canvas, SpiceImage *image,
-                                       int want_original)
+static pixman_image_t *canvas_decode_quic(QuicData *quic_data, uint32_t canvas_format,
+                                          SpiceImage *image, int want_original)
 {
     pixman_image_t *surface = NULL;
-    QuicData *quic_data = &canvas->quic_data;
     QuicImageType type, as_type;
     pixman_format_code_t pixman_format;
     uint8_t *dest;
@@ -402,8 +478,8 @@ static pixman_image_t *canvas_get_quic(CanvasBase *canvas, SpiceImage *image,
         break;
     case QUIC_IMAGE_TYPE_RGB16:
         if (!want_original &&
-            (canvas->format == SPICE_SURFACE_FMT_32_xRGB ||
-             canvas->format == SPICE_SURFACE_FMT_32_ARGB)) {
+            (canvas_format == SPICE_SURFACE_FMT_32_xRGB ||
+             canvas_format == SPICE_SURFACE_FMT_32_ARGB)) {
             as_type = QUIC_IMAGE_TYPE_RGB32;
             pixman_format = PIXMAN_LE_x8r8g8b8;
         } else {
@@ -441,6 +517,12 @@ static pixman_image_t *canvas_get_quic(CanvasBase *canvas, SpiceImage *image,
     return surface;
 }
 
+static pixman_image_t *canvas_get_quic(CanvasBase *canvas, SpiceImage *image,
+                                       int want_original)
+{
+    return canvas_decode_quic(&canvas->quic_data, canvas->format, image, want_original);
+}
+
 
 //#define DUMP_JPEG
 static void
@@ -469,6 +551,13 @@ dump_jpeg(SPICE_GNUC_UNUSED SpiceChunks* data, SPICE_GNUC_UNUSED uint32_t data_s
 #endif
 }
 
+static void canvas_jpeg_set_target_size(CanvasBase *canvas, int width, int height)
+{
+    if (canvas->jpeg->ops->set_target_size != NULL) {
+        canvas->jpeg->ops->set_target_size(canvas->jpeg, width, height);
+    }
+}
+
 static pixman_image_t *canvas_get_jpeg(CanvasBase *canvas, SpiceImage *image)
 {
     pixman_image_t *surface = NULL;
@@ -478,10 +567,17 @@ static pixman_image_t *canvas_get_jpeg(CanvasBase *canvas, SpiceImage *image)
     uint8_t *dest;
 
     spice_return_val_if_fail(image->u.jpeg.data->num_chunks == 1, NULL);
+    canvas_jpeg_set_target_size(canvas, canvas->jpeg_target_width, canvas->jpeg_target_height);
     canvas->jpeg->ops->begin_decode(canvas->jpeg, image->u.jpeg.data->chunk[0].data, image->u.jpeg.data->chunk[0].len,
                                     &width, &height);
-    spice_return_val_if_fail((uint32_t)width == image->descriptor.width, NULL);
-    spice_return_val_if_fail((uint32_t)height == image->descriptor.height, NULL);
+    if (canvas->jpeg_target_width > 0 || canvas->jpeg_target_height > 0) {
+        /* scaled down for canvas_get_image_for_scale() */
+        spice_return_val_if_fail(width > 0 && (uint32_t)width <= image->descriptor.width, NULL);
+        spice_return_val_if_fail(height > 0 && (uint32_t)height <= image->descriptor.height, NULL);
+    } else {
+        spice_return_val_if_fail((uint32_t)width == image->descriptor.width, NULL);
+        spice_return_val_if_fail((uint32_t)height == image->descriptor.height, NULL);
+    }
 
     surface = surface_create(PIXMAN_LE_x8r8g8b8,
                              width, height, FALSE);
@@ -518,7 +614,7 @@ static void canvas_fix_alignment(uint8_t *bits,
 #endif
 
 #ifdef USE_LZ4
-static pixman_image_t *canvas_get_lz4(CanvasBase *canvas, SpiceImage *image)
+static pixman_image_t *canvas_get_lz4(SpiceImage *image)
 {
     pixman_image_t *surface = NULL;
     int dec_size, enc_size, available;
@@ -632,6 +728,7 @@ static pixman_image_t *canvas_get_jpeg_alpha(CanvasBase *canvas, SpiceImage *ima
     int lz_alpha_width, lz_alpha_height, n_comp_pixels, lz_alpha_top_down;
 
     spice_return_val_if_fail(image->u.jpeg_alpha.data->num_chunks == 1, NULL);
+    canvas_jpeg_set_target_size(canvas, 0, 0);
     canvas->jpeg->ops->begin_decode(canvas->jpeg,
                                     image->u.jpeg_alpha.data->chunk[0].data,
                                     image->u.jpeg_alpha.jpeg_size,
@@ -643,6 +740,20 @@ static pixman_image_t *canvas_get_jpeg_alpha(CanvasBase *canvas, SpiceImage *ima
         alpha_top_down = TRUE;
     }
 
+    /* Both the colour and the alpha planes are decoded straight into the
+     * surface, check the alpha plane matches before decoding anything */
+    comp_alpha_buf = image->u.jpeg_alpha.data->chunk[0].data + image->u.jpeg_alpha.jpeg_size;
+    alpha_size = image->u.jpeg_alpha.data_size - image->u.jpeg_alpha.jpeg_size;
+
+    lz_decode_begin(lz_data->lz, comp_alpha_buf, alpha_size, &lz_alpha_type,
+                    &lz_alpha_width, &lz_alpha_height, &n_comp_pixels,
+                    &lz_alpha_top_down, NULL);
+    spice_return_val_if_fail(lz_alpha_type == LZ_IMAGE_TYPE_XXXA, NULL);
+    spice_return_val_if_fail(!!lz_alpha_top_down == !!alpha_top_down, NULL);
+    spice_return_val_if_fail(lz_alpha_width == width, NULL);
+    spice_return_val_if_fail(lz_alpha_height == height, NULL);
+    spice_return_val_if_fail(n_comp_pixels == width * height, NULL);
+
     surface = alloc_lz_image_surface(&lz_data->decode_data, PIXMAN_LE_a8r8g8b8,
                                      width, height, width*height, alpha_top_down);
 
@@ -656,18 +767,7 @@ static pixman_image_t *canvas_get_jpeg_alpha(CanvasBase *canvas, SpiceImage *ima
 
     canvas->jpeg->ops->decode(canvas->jpeg, dest, stride, SPICE_BITMAP_FMT_32BIT);
 
-    comp_alpha_buf = image->u.jpeg_alpha.data->chunk[0].data + image->u.jpeg_alpha.jpeg_size;
-    alpha_size = image->u.jpeg_alpha.data_size - image->u.jpeg_alpha.jpeg_size;
-
-    lz_decode_begin(lz_data->lz, comp_alpha_buf, alpha_size, &lz_alpha_type,
-                    &lz_alpha_width, &lz_alpha_height, &n_comp_pixels,
-                    &lz_alpha_top_down, NULL);
-    spice_return_val_if_fail(lz_alpha_type == LZ_IMAGE_TYPE_XXXA, NULL);
-    spice_return_val_if_fail(!!lz_alpha_top_down == !!alpha_top_down, NULL);
-    spice_return_val_if_fail(lz_alpha_width == width, NULL);
-    spice_return_val_if_fail(lz_alpha_height == height, NULL);
-    spice_return_val_if_fail(n_comp_pixels == width * height, NULL);
-
+    /* the alpha bytes are filled in place, over the decoded colours */
     if (!alpha_top_down) {
         decomp_alpha_buf = dest + stride * (height - 1);
     } else {
@@ -766,28 +866,25 @@ static inline SpicePalette *canvas_get_localized_palette(CanvasBase *canvas, Spi
     return copy;
 }
 
-static pixman_image_t *canvas_get_lz(CanvasBase *canvas, SpiceImage *image,
-                                     int want_original)
+/* Decodes an LZ image using the given context. For LZ_PLT images the
+ * palette has to be already localized to the canvas format. */
+static pixman_image_t *canvas_decode_lz(LzData *lz_data, uint32_t canvas_format,
+                                        SpiceImage *image, SpicePalette *palette,
+                                        int want_original)
 {
-    LzData *lz_data = &canvas->lz_data;
     uint8_t *comp_buf = NULL;
     int comp_size;
     uint8_t    *decomp_buf = NULL;
     pixman_format_code_t pixman_format;
     LzImageType type, as_type;
-    SpicePalette *palette = NULL;
     int n_comp_pixels;
     int width;
     int height;
     int top_down;
     int stride_encoded;
     int stride;
-    volatile int free_palette = FALSE;
 
     if (setjmp(lz_data->jmp_env)) {
-        if (free_palette)  {
-            free(palette);
-        }
         free(decomp_buf);
         g_warning("%s", lz_data->message_buf);
         return NULL;
@@ -797,14 +894,10 @@ static pixman_image_t *canvas_get_lz(CanvasBase *canvas, SpiceImage *image,
         spice_return_val_if_fail(image->u.lz_rgb.data->num_chunks == 1, NULL); /* TODO: Handle chunks */
         comp_buf = image->u.lz_rgb.data->chunk[0].data;
         comp_size = image->u.lz_rgb.data->chunk[0].len;
-        palette = NULL;
     } else if (image->descriptor.type == SPICE_IMAGE_TYPE_LZ_PLT) {
         spice_return_val_if_fail(image->u.lz_plt.data->num_chunks == 1, NULL); /* TODO: Handle chunks */
         comp_buf = image->u.lz_plt.data->chunk[0].data;
         comp_size = image->u.lz_plt.data->chunk[0].len;
-        palette = canvas_get_localized_palette(canvas, image->u.lz_plt.palette,
-                                               image->u.lz_plt.palette_id, image->u.lz_plt.flags,
-                                               (int*) &free_palette);
     } else {
         spice_warn_if_reached();
         return NULL;
@@ -837,8 +930,8 @@ static pixman_image_t *canvas_get_lz(CanvasBase *canvas, SpiceImage *image,
         break;
     case LZ_IMAGE_TYPE_RGB16:
         if (!want_original &&
-            (canvas->format == SPICE_SURFACE_FMT_32_xRGB ||
-             canvas->format == SPICE_SURFACE_FMT_32_ARGB)) {
+            (canvas_format == SPICE_SURFACE_FMT_32_xRGB ||
+             canvas_format == SPICE_SURFACE_FMT_32_ARGB)) {
             as_type = LZ_IMAGE_TYPE_RGB32;
             pixman_format = PIXMAN_LE_x8r8g8b8;
             stride_encoded *= 4;
@@ -873,11 +966,29 @@ static pixman_image_t *canvas_get_lz(CanvasBase *canvas, SpiceImage *image,
 
     canvas_fix_alignment(decomp_buf, stride_encoded, stride, height);
 
+    return lz_data->decode_data.out_surface;
+}
+
+static pixman_image_t *canvas_get_lz(CanvasBase *canvas, SpiceImage *image,
+                                     int want_original)
+{
+    pixman_image_t *surface;
+    SpicePalette *palette = NULL;
+    int free_palette = FALSE;
+
+    if (image->descriptor.type == SPICE_IMAGE_TYPE_LZ_PLT) {
+        palette = canvas_get_localized_palette(canvas, image->u.lz_plt.palette,
+                                               image->u.lz_plt.palette_id, image->u.lz_plt.flags,
+                                               &free_palette);
+    }
+
+    surface = canvas_decode_lz(&canvas->lz_data, canvas->format, image, palette, want_original);
+
     if (free_palette)  {
         free(palette);
     }
 
-    return lz_data->decode_data.out_surface;
+    return surface;
 }
 
 static pixman_image_t *canvas_get_glz_rgb_common(CanvasBase *canvas, uint8_t *data,
@@ -893,32 +1004,71 @@ static pixman_image_t *canvas_get_glz_rgb_common(CanvasBase *canvas, uint8_t *da
     return (canvas->glz_data.decode_data.out_surface);
 }
 
+/* Returns the data of the chunks in one piece. Split data is gathered in
+ * buffer, which is reused by the following images */
+static uint8_t *canvas_get_chunks_data(SpiceBuffer *buffer, SpiceChunks *chunks)
+{
+    uint32_t i;
+
+    if (chunks->num_chunks == 1) {
+        return chunks->chunk[0].data;
+    }
+
+    spice_buffer_reset(buffer);
+    spice_buffer_reserve(buffer, chunks->data_size);
+    for (i = 0; i < chunks->num_chunks; i++) {
+        spice_buffer_append(buffer, chunks->chunk[i].data, chunks->chunk[i].len);
+    }
+    return buffer->buffer;
+}
+
+/* The GLZ buffers are kept from one image to the next up to this size,
+ * larger ones are released once their image is decoded */
+#define GLZ_BUFFER_KEEP_SIZE (1024 * 1024)
+
+static void canvas_trim_glz_buffer(SpiceBuffer *buffer)
+{
+    if (buffer->capacity > GLZ_BUFFER_KEEP_SIZE) {
+        spice_buffer_free(buffer);
+    }
+}
+
 // don't handle plts since bitmaps with plt can be decoded globally to RGB32 (because
 // same byte sequence can be transformed to different RGB pixels by different plts)
 static pixman_image_t *canvas_get_glz(CanvasBase *canvas, SpiceImage *image,
                                       int want_original)
 {
+    pixman_image_t *surface;
+    uint8_t *data;
+
     spice_return_val_if_fail(image->descriptor.type == SPICE_IMAGE_TYPE_GLZ_RGB, NULL);
+    spice_return_val_if_fail(image->u.lz_rgb.data->num_chunks > 0, NULL);
 
-    spice_return_val_if_fail(image->u.lz_rgb.data->num_chunks == 1, NULL); /* TODO: Handle chunks */
-    return canvas_get_glz_rgb_common(canvas, image->u.lz_rgb.data->chunk[0].data, want_original);
+    data = canvas_get_chunks_data(&canvas->glz_data.chunks, image->u.lz_rgb.data);
+    surface = canvas_get_glz_rgb_common(canvas, data, want_original);
+    canvas_trim_glz_buffer(&canvas->glz_data.chunks);
+    return surface;
 }
 
 static pixman_image_t *canvas_get_zlib_glz_rgb(CanvasBase *canvas, SpiceImage *image,
                                                int want_original)
 {
-    uint8_t *glz_data;
+    SpiceBuffer *stream = &canvas->glz_data.stream;
     pixman_image_t *surface;
+    uint8_t *data;
 
     spice_return_val_if_fail(canvas->zlib != NULL, NULL);
+    spice_return_val_if_fail(image->u.zlib_glz.data->num_chunks > 0, NULL);
+
+    data = canvas_get_chunks_data(&canvas->glz_data.chunks, image->u.zlib_glz.data);
 
-    spice_return_val_if_fail(image->u.zlib_glz.data->num_chunks == 1, NULL); /* TODO: Handle chunks */
-    glz_data = (uint8_t*)spice_malloc(image->u.zlib_glz.glz_data_size);
-    canvas->zlib->ops->decode(canvas->zlib, image->u.zlib_glz.data->chunk[0].data,
-                              image->u.zlib_glz.data->chunk[0].len,
-                              glz_data, image->u.zlib_glz.glz_data_size);
-    surface = canvas_get_glz_rgb_common(canvas, glz_data, want_original);
-    free(glz_data);
+    spice_buffer_reset(stream);
+    spice_buffer_reserve(stream, image->u.zlib_glz.glz_data_size);
+    canvas->zlib->ops->decode(canvas->zlib, data, image->u.zlib_glz.data->data_size,
+                              stream->buffer, image->u.zlib_glz.glz_data_size);
+    surface = canvas_get_glz_rgb_common(canvas, stream->buffer, want_original);
+    canvas_trim_glz_buffer(&canvas->glz_data.chunks);
+    canvas_trim_glz_buffer(stream);
     return surface;
 }
 
@@ -1091,6 +1241,9 @@ static int image_has_palette_to_cache(SpiceImage *image)
 
 //#define DEBUG_LZ
 
+static pixman_image_t *canvas_prefetch_take(CanvasBase *canvas, SpiceImage *image,
+                                            int want_original);
+
 static pixman_image_t *get_surface_from_canvas(CanvasBase *canvas,
                                                SpiceImage *image,
                                                int want_original)
@@ -1123,7 +1276,7 @@ static pixman_image_t *get_surface_from_canvas(CanvasBase *canvas,
 
     case SPICE_IMAGE_TYPE_LZ4:
 #ifdef USE_LZ4
-        return canvas_get_lz4(canvas, image);
+        return canvas_get_lz4(image);
 #else
         g_warning("LZ4 compression algorithm not supported");
         return NULL;
@@ -1150,12 +1303,49 @@ static pixman_image_t *get_surface_from_canvas(CanvasBase *canvas,
  * you have to be able to handle any image format. This is useful to avoid
  * e.g. losing alpha when blending a argb32 image on a rgb16 surface.
  */
+static pixman_format_code_t canvas_get_image_target_format(CanvasBase *canvas,
+                                                           pixman_format_code_t surface_format)
+{
+    return canvas_get_target_format(canvas,
+#ifdef WORDS_BIGENDIAN
+                                    surface_format == PIXMAN_b8g8r8a8 ||
+#endif
+                                    surface_format == PIXMAN_a8r8g8b8);
+}
+
+/* Takes the surface reference and returns the surface in format */
+static pixman_image_t *canvas_convert_image(pixman_image_t *surface,
+                                            pixman_format_code_t format)
+{
+    pixman_image_t *converted;
+    pixman_format_code_t surface_format;
+
+    if (!spice_pixman_image_get_format(surface, &surface_format) ||
+        surface_format == format) {
+        return surface;
+    }
+
+    converted = surface_create(format,
+                               pixman_image_get_width(surface),
+                               pixman_image_get_height(surface),
+                               TRUE);
+    pixman_image_composite32 (PIXMAN_OP_SRC,
+                              surface, NULL, converted,
+                              0, 0,
+                              0, 0,
+                              0, 0,
+                              pixman_image_get_width(surface),
+                              pixman_image_get_height(surface));
+    pixman_image_unref (surface);
+    return converted;
+}
+
 static pixman_image_t *canvas_get_image_internal(CanvasBase *canvas, SpiceImage *image,
                                                  int want_original, int real_get)
 {
     SpiceImageDescriptor *descriptor = &image->descriptor;
-    pixman_image_t *surface, *converted;
-    pixman_format_code_t wanted_format, surface_format;
+    pixman_image_t *surface;
+    pixman_format_code_t surface_format;
     int saved_want_original;
 
     /* When touching, only really allocate if we need to cache, or
@@ -1169,6 +1359,10 @@ static pixman_image_t *canvas_get_image_internal(CanvasBase *canvas, SpiceImage
 #endif
         (descriptor->type != SPICE_IMAGE_TYPE_GLZ_RGB) &&
         (descriptor->type != SPICE_IMAGE_TYPE_ZLIB_GLZ_RGB)) {
+        surface = canvas_prefetch_take(canvas, image, want_original);
+        if (surface != NULL) {
+            pixman_image_unref(surface);
+        }
         return NULL;
     }
 
@@ -1181,7 +1375,10 @@ static pixman_image_t *canvas_get_image_internal(CanvasBase *canvas, SpiceImage
         want_original = TRUE;
     }
 
-    surface = get_surface_from_canvas(canvas, image, want_original);
+    surface = canvas_prefetch_take(canvas, image, want_original);
+    if (surface == NULL) {
+        surface = get_surface_from_canvas(canvas, image, want_original);
+    }
 
     spice_return_val_if_fail(surface != NULL, NULL);
     spice_return_val_if_fail(spice_pixman_image_get_format(surface, &surface_format), NULL);
@@ -1248,28 +1445,8 @@ static pixman_image_t *canvas_get_image_internal(CanvasBase *canvas, SpiceImage
            happen above (due to save/load to cache for instance, or
            maybe the reader didn't support conversion).
            If so we convert here. */
-
-        wanted_format = canvas_get_target_format(canvas,
-#ifdef WORDS_BIGENDIAN
-                                                 surface_format == PIXMAN_b8g8r8a8 ||
-#endif
-                                                 surface_format == PIXMAN_a8r8g8b8);
-
-        if (surface_format != wanted_format) {
-            converted = surface_create(wanted_format,
-                                       pixman_image_get_width(surface),
-                                       pixman_image_get_height(surface),
-                                       TRUE);
-            pixman_image_composite32 (PIXMAN_OP_SRC,
-                                      surface, NULL, converted,
-                                      0, 0,
-                                      0, 0,
-                                      0, 0,
-                                      pixman_image_get_width(surface),
-                                      pixman_image_get_height(surface));
-            pixman_image_unref (surface);
-            surface = converted;
-        }
+        surface = canvas_convert_image(surface,
+                                       canvas_get_image_target_format(canvas, surface_format));
     }
 
     return surface;
@@ -1291,22 +1468,156 @@ static pixman_image_t *canvas_get_image(CanvasBase *canvas, SpiceImage *image,
     return canvas_get_image_internal(canvas, image, want_original, TRUE);
 }
 
+/* Gets the image of a draw scaling src_area to dest_width x dest_height.
+ * When the whole of a JPEG image is scaled down, the decoder is asked to
+ * decode it at a reduced size, src_area is then changed to the whole of
+ * the smaller image. Cached images keep their full size. */
+static pixman_image_t *canvas_get_image_for_scale(CanvasBase *canvas, SpiceImage *image,
+                                                  SpiceRect *src_area,
+                                                  int dest_width, int dest_height)
+{
+    SpiceImageDescriptor *descriptor = &image->descriptor;
+    pixman_image_t *surface;
+
+    if (descriptor->type != SPICE_IMAGE_TYPE_JPEG ||
+        descriptor->flags & SPICE_IMAGE_FLAGS_CACHE_ME ||
+#ifdef SW_CANVAS_CACHE
+        descriptor->flags & SPICE_IMAGE_FLAGS_CACHE_REPLACE_ME ||
+#endif
+        canvas->jpeg == NULL || canvas->jpeg->ops->set_target_size == NULL ||
+        src_area->left != 0 || src_area->top != 0 ||
+        (uint32_t)src_area->right != descriptor->width ||
+        (uint32_t)src_area->bottom != descriptor->height ||
+        dest_width <= 0 || dest_height <= 0 ||
+        ((uint32_t)dest_width >= descriptor->width &&
+         (uint32_t)dest_height >= descriptor->height)) {
+        return canvas_get_image(canvas, image, FALSE);
+    }
+
+    canvas->jpeg_target_width = dest_width;
+    canvas->jpeg_target_height = dest_height;
+    surface = canvas_get_image(canvas, image, FALSE);
+    canvas->jpeg_target_width = 0;
+    canvas->jpeg_target_height = 0;
+
+    if (surface != NULL) {
+        src_area->right = pixman_image_get_width(surface);
+        src_area->bottom = pixman_image_get_height(surface);
+    }
+    return surface;
+}
+
 static void canvas_touch_image(CanvasBase *canvas, SpiceImage *image)
 {
     canvas_get_image_internal(canvas, image, TRUE, FALSE);
 }
 
+static int canvas_pattern_is_cacheable(SpiceImage *image)
+{
+    switch (image->descriptor.type) {
+    case SPICE_IMAGE_TYPE_FROM_CACHE:
+#ifdef SW_CANVAS_CACHE
+    case SPICE_IMAGE_TYPE_FROM_CACHE_LOSSLESS:
+#endif
+        return TRUE;
+    default:
+        return (image->descriptor.flags & SPICE_IMAGE_FLAGS_CACHE_ME) != 0;
+    }
+}
+
+/* Returns the pattern image in the canvas format, to be used as a tile.
+ * Patterns of the image cache are kept converted and repeated until their
+ * rows are PATTERN_MIN_ROW_BYTES wide. The entries keep a reference to the
+ * cached image they were made from, so a reused id is not mistaken for
+ * the previous image */
+static pixman_image_t *canvas_get_pattern(CanvasBase *canvas, SpiceImage *image)
+{
+    PatternCache *cache = &canvas->pattern_cache;
+    PatternCacheEntry *entry;
+    pixman_image_t *surface, *tile;
+    pixman_format_code_t surface_format, format;
+    int width, height, row_bytes, repeat, i;
+
+    if (!canvas_pattern_is_cacheable(image)) {
+        return canvas_get_image(canvas, image, FALSE);
+    }
+
+    /* the cached image, as it would be kept by the image cache */
+    surface = canvas_get_image(canvas, image, TRUE);
+    spice_return_val_if_fail(surface != NULL, NULL);
+    spice_return_val_if_fail(spice_pixman_image_get_format(surface, &surface_format), NULL);
+    format = canvas_get_image_target_format(canvas, surface_format);
+
+    width = pixman_image_get_width(surface);
+    height = pixman_image_get_height(surface);
+    if (width * height > PATTERN_CACHE_MAX_PIXELS) {
+        return canvas_convert_image(surface, format);
+    }
+
+    for (i = 0; i < PATTERN_CACHE_SIZE; i++) {
+        entry = &cache->entries[i];
+        if (entry->source != NULL && entry->id == image->descriptor.id &&
+            entry->format == format) {
+            if (entry->source == surface) {
+                pixman_image_unref(surface);
+                return pixman_image_ref(entry->tile);
+            }
+            break;
+        }
+    }
+
+    if (i == PATTERN_CACHE_SIZE) {
+        entry = &cache->entries[cache->next];
+        cache->next = (cache->next + 1) % PATTERN_CACHE_SIZE;
+    }
+    if (entry->source != NULL) {
+        pixman_image_unref(entry->tile);
+        pixman_image_unref(entry->source);
+    }
+
+    row_bytes = width * PIXMAN_FORMAT_BPP(format) / 8;
+    repeat = MAX(1, (PATTERN_MIN_ROW_BYTES + row_bytes - 1) / row_bytes);
+    tile = surface_create(format, width * repeat, height, TRUE);
+    for (i = 0; i < repeat; i++) {
+        pixman_image_composite32(PIXMAN_OP_SRC,
+                                 surface, NULL, tile,
+                                 0, 0,
+                                 0, 0,
+                                 i * width, 0,
+                                 width, height);
+    }
+
+    entry->source = surface;
+    entry->id = image->descriptor.id;
+    entry->format = format;
+    entry->tile = tile;
+    return pixman_image_ref(tile);
+}
+
+static void release_parent_image(pixman_image_t *image, void *data)
+{
+    pixman_image_unref((pixman_image_t *)data);
+}
+
+/* Returns an image of the area of the canvas for a draw operation to draw
+ * into.
+ * If is_view is not NULL, the canvas gives access to its pixels and none of
+ * the n_sources areas the operation reads from the canvas overlaps area,
+ * the image is a view on the canvas pixels and *is_view is set: the pixels
+ * drawn must then be reported with image_changed() instead of being blitted
+ * back. Otherwise the area is copied. */
 static pixman_image_t* canvas_get_image_from_self(SpiceCanvas *canvas,
-                                                  int x, int y,
-                                                  int32_t width, int32_t height,
-                                                  int force_opaque)
+                                                  const SpiceRect *area,
+                                                  const SpiceRect *sources, int n_sources,
+                                                  int force_opaque, int *is_view)
 {
     CanvasBase *canvas_base = (CanvasBase *)canvas;
     pixman_image_t *surface;
     uint8_t *dest;
     int dest_stride;
-    SpiceRect area;
+    int width, height;
     pixman_format_code_t format;
+    int i;
 
     format = spice_surface_format_to_pixman (canvas_base->format);
     if (force_opaque)
@@ -1318,6 +1629,36 @@ static pixman_image_t* canvas_get_image_from_self(SpiceCanvas *canvas,
             pixman_format_supported_destination (format), NULL);
     }
 
+    width = area->right - area->left;
+    height = area->bottom - area->top;
+
+    if (is_view) {
+        *is_view = canvas->ops->image_changed != NULL;
+        for (i = 0; i < n_sources && *is_view; i++) {
+            *is_view = !rect_intersects(area, &sources[i]);
+        }
+    }
+    if (is_view && *is_view) {
+        pixman_image_t *image = canvas->ops->get_image(canvas, FALSE);
+        int bpp = spice_pixman_image_get_bpp(image);
+
+        dest_stride = pixman_image_get_stride(image);
+        dest = (uint8_t *)pixman_image_get_data(image) +
+               area->top * dest_stride + area->left * bpp / 8;
+        /* pixman wants the lines to start on 32 bits */
+        surface = NULL;
+        if (bpp >= 8 && ((uintptr_t)dest & 3) == 0) {
+            surface = pixman_image_create_bits(spice_surface_format_to_pixman (canvas_base->format),
+                                               width, height, (uint32_t *)dest, dest_stride);
+        }
+        if (surface != NULL) {
+            pixman_image_set_destroy_function(surface, release_parent_image, image);
+            return surface;
+        }
+        pixman_image_unref(image);
+        *is_view = FALSE;
+    }
+
     surface = pixman_image_create_bits(spice_surface_format_to_pixman (canvas_base->format),
                                        width, height, NULL, 0);
     spice_return_val_if_fail(surface != NULL, NULL);
@@ -1325,72 +1666,12 @@ static pixman_image_t* canvas_get_image_from_self(SpiceCanvas *canvas,
     dest = (uint8_t *)pixman_image_get_data(surface);
     dest_stride = pixman_image_get_stride(surface);
 
-    area.left = x;
-    area.top = y;
-    area.right = x + width;
-    area.bottom = y + height;
-
-    canvas->ops->read_bits(canvas, dest, dest_stride, &area);
+    canvas->ops->read_bits(canvas, dest, dest_stride, area);
 
     return surface;
 }
 
 
-#ifdef REVERS_BITS_SLOW
-static inline uint8_t revers_bits(uint8_t byte)
-{
-    uint8_t ret = 0;
-    int i;
-
-    for (i = 0; i < 4; i++) {
-        int shift = 7 - i * 2;
-        ret |= (byte & (1 << i)) << shift;
-        ret |= (byte & (0x80 >> i)) >> shift;
-    }
-    return ret;
-}
-#else
-static inline uint8_t revers_bits(uint8_t byte)
-{
-    static const uint8_t revers[] = {
-        0x0, 0x80, 0x40, 0xc0, 0x20, 0xa0, 0x60, 0xe0,
-        0x10, 0x90, 0x50, 0xd0, 0x30, 0xb0, 0x70, 0xf0,
-        0x8, 0x88, 0x48, 0xc8, 0x28, 0xa8, 0x68, 0xe8,
-        0x18, 0x98, 0x58, 0xd8, 0x38, 0xb8, 0x78, 0xf8,
-        0x4, 0x84, 0x44, 0xc4, 0x24, 0xa4, 0x64, 0xe4,
-        0x14, 0x94, 0x54, 0xd4, 0x34, 0xb4, 0x74, 0xf4,
-        0xc, 0x8c, 0x4c, 0xcc, 0x2c, 0xac, 0x6c, 0xec,
-        0x1c, 0x9c, 0x5c, 0xdc, 0x3c, 0xbc, 0x7c, 0xfc,
-        0x2, 0x82, 0x42, 0xc2, 0x22, 0xa2, 0x62, 0xe2,
-        0x12, 0x92, 0x52, 0xd2, 0x32, 0xb2, 0x72, 0xf2,
-        0xa, 0x8a, 0x4a, 0xca, 0x2a, 0xaa, 0x6a, 0xea,
-        0x1a, 0x9a, 0x5a, 0xda, 0x3a, 0xba, 0x7a, 0xfa,
-        0x6, 0x86, 0x46, 0xc6, 0x26, 0xa6, 0x66, 0xe6,
-        0x16, 0x96, 0x56, 0xd6, 0x36, 0xb6, 0x76, 0xf6,
-        0xe, 0x8e, 0x4e, 0xce, 0x2e, 0xae, 0x6e, 0xee,
-        0x1e, 0x9e, 0x5e, 0xde, 0x3e, 0xbe, 0x7e, 0xfe,
-        0x1, 0x81, 0x41, 0xc1, 0x21, 0xa1, 0x61, 0xe1,
-        0x11, 0x91, 0x51, 0xd1, 0x31, 0xb1, 0x71, 0xf1,
-        0x9, 0x89, 0x49, 0xc9, 0x29, 0xa9, 0x69, 0xe9,
-        0x19, 0x99, 0x59, 0xd9, 0x39, 0xb9, 0x79, 0xf9,
-        0x5, 0x85, 0x45, 0xc5, 0x25, 0xa5, 0x65, 0xe5,
-        0x15, 0x95, 0x55, 0xd5, 0x35, 0xb5, 0x75, 0xf5,
-        0xd, 0x8d, 0x4d, 0xcd, 0x2d, 0xad, 0x6d, 0xed,
-        0x1d, 0x9d, 0x5d, 0xdd, 0x3d, 0xbd, 0x7d, 0xfd,
-        0x3, 0x83, 0x43, 0xc3, 0x23, 0xa3, 0x63, 0xe3,
-        0x13, 0x93, 0x53, 0xd3, 0x33, 0xb3, 0x73, 0xf3,
-        0xb, 0x8b, 0x4b, 0xcb, 0x2b, 0xab, 0x6b, 0xeb,
-        0x1b, 0x9b, 0x5b, 0xdb, 0x3b, 0xbb, 0x7b, 0xfb,
-        0x7, 0x87, 0x47, 0xc7, 0x27, 0xa7, 0x67, 0xe7,
-        0x17, 0x97, 0x57, 0xd7, 0x37, 0xb7, 0x77, 0xf7,
-        0xf, 0x8f, 0x4f, 0xcf, 0x2f, 0xaf, 0x6f, 0xef,
-        0x1f, 0x9f, 0x5f, 0xdf, 0x3f, 0xbf, 0x7f, 0xff
-    };
-
-    return revers[byte];
-}
-#endif
-
 static pixman_image_t *canvas_get_bitmap_mask(CanvasBase *canvas, SpiceBitmap* bitmap, int invers)
 {
     pixman_image_t *surface;
@@ -1422,23 +1703,12 @@ static pixman_image_t *canvas_get_bitmap_mask(CanvasBase *canvas, SpiceBitmap* b
         switch (bitmap->format) {
         case SPICE_BITMAP_FMT_1BIT_LE:
             for (; src_line != end_line; src_line += src_stride, dest_line += dest_stride) {
-                uint8_t *dest = dest_line;
-                uint8_t *now = src_line;
-                uint8_t *end = now + line_size;
-                while (now < end) {
-                    *(dest++) = ~*(now++);
-                }
+                spice_a1_invert_row(dest_line, src_line, line_size);
             }
             break;
         case SPICE_BITMAP_FMT_1BIT_BE:
             for (; src_line != end_line; src_line += src_stride, dest_line += dest_stride) {
-                uint8_t *dest = dest_line;
-                uint8_t *now = src_line;
-                uint8_t *end = now + line_size;
-
-                while (now < end) {
-                    *(dest++) = ~revers_bits(*(now++));
-                }
+                spice_a1_reverse_row(dest_line, src_line, line_size, TRUE);
             }
             break;
         default:
@@ -1456,13 +1726,7 @@ static pixman_image_t *canvas_get_bitmap_mask(CanvasBase *canvas, SpiceBitmap* b
             break;
         case SPICE_BITMAP_FMT_1BIT_BE:
             for (; src_line != end_line; src_line += src_stride, dest_line += dest_stride) {
-                uint8_t *dest = dest_line;
-                uint8_t *now = src_line;
-                uint8_t *end = now + line_size;
-
-                while (now < end) {
-                    *(dest++) = revers_bits(*(now++));
-                }
+                spice_a1_reverse_row(dest_line, src_line, line_size, FALSE);
             }
             break;
         default:
@@ -1485,7 +1749,7 @@ static inline pixman_image_t *canvas_A1_invers(pixman_image_t *src_surf)
 
     spice_return_val_if_fail(pixman_image_get_depth(src_surf) == 1, NULL);
 
-    invers = pixman_image_create_bits(PIXMAN_a1, width, height, NULL, 0);
+    invers = surface_create(PIXMAN_a1, width, height, TRUE);
     spice_return_val_if_fail(invers != NULL, NULL);
 
     src_line = (uint8_t *)pixman_image_get_data(src_surf);
@@ -1496,12 +1760,7 @@ static inline pixman_image_t *canvas_A1_invers(pixman_image_t *src_surf)
     dest_stride = pixman_image_get_stride(invers);
 
     for (; src_line != end_line; src_line += src_stride, dest_line += dest_stride) {
-        uint8_t *dest = dest_line;
-        uint8_t *now = src_line;
-        uint8_t *end = now + line_size;
-        while (now < end) {
-            *(dest++) = ~*(now++);
-        }
+        spice_a1_invert_row(dest_line, src_line, line_size);
     }
     return invers;
 }
@@ -1576,37 +1835,25 @@ static inline void canvas_raster_glyph_box(const SpiceRasterGlyph *glyph, SpiceR
     r->right = r->left + glyph->width;
 }
 
-static inline void __canvas_put_bits(uint8_t *dest, int offset, uint8_t val, int n)
+/* ORs n bits of the MSB first src row at bit dest_offset of the A1 dest row */
+static void canvas_put_bits(uint8_t *dest, int dest_offset, uint8_t *src, int n)
 {
-    uint8_t mask;
-    int now;
-
-    dest = dest + (offset >> 3);
-    offset &= 0x07;
-
-    now = MIN(8 - offset, n);
-
-    mask = (1 << now) - 1;
-    mask <<= offset;
-    val = revers_bits(val);
-    *dest = ((val << offset) & mask) | *dest;
-
-    if ((n = n - now)) {
-        mask = (1 << n) - 1;
-        dest++;
-        *dest = ((val >> now) & mask) | *dest;
-    }
-}
+    uint8_t buf[256];
 
-static inline void canvas_put_bits(uint8_t *dest, int dest_offset, uint8_t *src, int n)
-{
-    while (n) {
-        int now = MIN(n, 8);
+    dest += dest_offset >> 3;
+    dest_offset &= 0x07;
+    while (n > 0) {
+        int now = MIN(n, (int)sizeof(buf) * 8);
+        int len = (now + 7) >> 3;
 
+        spice_a1_reverse_row(buf, src, len, FALSE);
+        if (now & 0x07) {
+            buf[len - 1] &= (1 << (now & 0x07)) - 1;
+        }
+        spice_a1_or_row(dest, buf, now, dest_offset);
+        dest += len;
+        src += len;
         n -= now;
-        __canvas_put_bits(dest, dest_offset, *src, now);
-        dest_offset += now;
-        src++;
     }
 }
 
@@ -1672,9 +1919,10 @@ static void canvas_put_glyph_bits(SpiceRasterGlyph *glyph, int bpp, uint8_t *des
         src += width * lines;
         dest += glyph_box.left;
         end = dest + dest_stride * lines;
-        for (; dest != end; dest += dest_stride, src -= width) {
+        for (; dest != end; dest += dest_stride) {
             int i;
 
+            src -= width;
             for (i = 0; i < width; i++) {
                 dest[i] = MAX(dest[i], src[i]);
             }
@@ -1687,6 +1935,128 @@ static void canvas_put_glyph_bits(SpiceRasterGlyph *glyph, int bpp, uint8_t *des
     }
 }
 
+/* Glyphs are cached already rasterized in the string mask layout (top-down,
+ * pixman bit order for A1, one byte per pixel otherwise), so building a
+ * string mask only needs to shift/merge them in place */
+#define GLYPH_CACHE_MAX_ENTRIES 4096
+
+typedef struct GlyphCacheEntry {
+    guint hash;
+    int bpp;
+    int width;
+    int height;
+    int raw_size;
+    uint8_t *raw; /* glyph data as sent, used as key */
+    int stride;
+    uint8_t *bits;
+} GlyphCacheEntry;
+
+static int glyph_raw_size(int bpp, int width, int height)
+{
+    switch (bpp) {
+    case 1:
+        return (SPICE_ALIGN(width, 8) >> 3) * height;
+    case 4:
+        return (SPICE_ALIGN(width * 4, 8) >> 3) * height;
+    default:
+        return width * height;
+    }
+}
+
+static guint glyph_cache_hash(gconstpointer key)
+{
+    return ((const GlyphCacheEntry *)key)->hash;
+}
+
+static gboolean glyph_cache_equal(gconstpointer a, gconstpointer b)
+{
+    const GlyphCacheEntry *entry1 = a;
+    const GlyphCacheEntry *entry2 = b;
+
+    return entry1->hash == entry2->hash &&
+           entry1->bpp == entry2->bpp &&
+           entry1->width == entry2->width &&
+           entry1->height == entry2->height &&
+           memcmp(entry1->raw, entry2->raw, entry1->raw_size) == 0;
+}
+
+static void glyph_cache_key_init(GlyphCacheEntry *key, SpiceRasterGlyph *glyph, int bpp)
+{
+    uint32_t hash = 2166136261U; /* FNV-1a */
+    int i;
+
+    key->bpp = bpp;
+    key->width = glyph->width;
+    key->height = glyph->height;
+    key->raw_size = glyph_raw_size(bpp, glyph->width, glyph->height);
+    key->raw = glyph->data;
+
+    hash = (hash ^ (uint32_t)bpp) * 16777619U;
+    hash = (hash ^ (uint32_t)glyph->width) * 16777619U;
+    hash = (hash ^ (uint32_t)glyph->height) * 16777619U;
+    for (i = 0; i < key->raw_size; i++) {
+        hash = (hash ^ glyph->data[i]) * 16777619U;
+    }
+    key->hash = hash;
+}
+
+static GlyphCacheEntry *canvas_glyph_cache_get(CanvasBase *canvas, SpiceRasterGlyph *glyph,
+                                               int bpp)
+{
+    GlyphCacheEntry key, *entry;
+    SpiceRect box;
+
+    glyph_cache_key_init(&key, glyph, bpp);
+    entry = g_hash_table_lookup(canvas->glyph_cache, &key);
+    if (entry != NULL) {
+        return entry;
+    }
+
+    if (g_hash_table_size(canvas->glyph_cache) >= GLYPH_CACHE_MAX_ENTRIES) {
+        g_hash_table_remove_all(canvas->glyph_cache);
+    }
+
+    key.stride = (bpp == 1) ? SPICE_ALIGN(key.width, 8) >> 3 : key.width;
+    entry = spice_malloc0(sizeof(GlyphCacheEntry) + key.raw_size + key.stride * key.height);
+    *entry = key;
+    entry->raw = (uint8_t *)(entry + 1);
+    memcpy(entry->raw, glyph->data, key.raw_size);
+    entry->bits = entry->raw + key.raw_size;
+
+    /* rasterize the glyph alone, at offset 0 */
+    canvas_raster_glyph_box(glyph, &box);
+    canvas_put_glyph_bits(glyph, bpp, entry->bits, entry->stride, &box);
+
+    g_hash_table_add(canvas->glyph_cache, entry);
+    return entry;
+}
+
+static void canvas_put_cached_glyph(const GlyphCacheEntry *entry, uint8_t *dest, int dest_stride,
+                                    int x, int y)
+{
+    const uint8_t *src = entry->bits;
+    int i, j;
+
+    if (entry->width == 0) {
+        return;
+    }
+
+    dest += y * dest_stride;
+    if (entry->bpp == 1) {
+        dest += x >> 3;
+        for (i = 0; i < entry->height; i++, src += entry->stride, dest += dest_stride) {
+            spice_a1_or_row(dest, src, entry->width, x & 0x07);
+        }
+    } else {
+        dest += x;
+        for (i = 0; i < entry->height; i++, src += entry->stride, dest += dest_stride) {
+            for (j = 0; j < entry->width; j++) {
+                dest[j] = MAX(dest[j], src[j]);
+            }
+        }
+    }
+}
+
 static pixman_image_t *canvas_get_str_mask(CanvasBase *canvas, SpiceString *str, int bpp, SpicePoint *pos)
 {
     SpiceRasterGlyph *glyph;
@@ -1708,16 +2078,26 @@ static pixman_image_t *canvas_get_str_mask(CanvasBase *canvas, SpiceString *str,
         rect_union(&bounds, &glyph_box);
     }
 
-    str_mask = pixman_image_create_bits((bpp == 1) ? PIXMAN_a1 : PIXMAN_a8,
-                                        bounds.right - bounds.left,
-                                        bounds.bottom - bounds.top, NULL, 0);
+    str_mask = surface_create((bpp == 1) ? PIXMAN_a1 : PIXMAN_a8,
+                              bounds.right - bounds.left,
+                              bounds.bottom - bounds.top, TRUE);
     spice_return_val_if_fail(str_mask != NULL, NULL);
 
     dest = (uint8_t *)pixman_image_get_data(str_mask);
     dest_stride = pixman_image_get_stride(str_mask);
     for (i = 0; i < str->length; i++) {
+        GlyphCacheEntry *entry;
+        SpiceRect glyph_box;
+
         glyph = str->glyphs[i];
-        canvas_put_glyph_bits(glyph, bpp, dest, dest_stride, &bounds);
+        if (bpp != 1 && bpp != 4 && bpp != 8) {
+            spice_warn_if_reached();
+            break;
+        }
+        entry = canvas_glyph_cache_get(canvas, glyph, bpp);
+        canvas_raster_glyph_box(glyph, &glyph_box);
+        canvas_put_cached_glyph(entry, dest, dest_stride,
+                                glyph_box.left - bounds.left, glyph_box.top - bounds.top);
     }
 
     pos->x = bounds.left;
@@ -1731,13 +2111,29 @@ static pixman_image_t *canvas_scale_surface(pixman_image_t *src, const SpiceRect
     pixman_image_t *surface;
     pixman_transform_t transform;
     pixman_format_code_t format;
+    pixman_box32_t box;
     double sx, sy;
 
     spice_return_val_if_fail(spice_pixman_image_get_format (src, &format), NULL);
 
-    surface = pixman_image_create_bits(format, width, height, NULL, 0);
+    spice_return_val_if_fail(scale_mode == SPICE_IMAGE_SCALE_MODE_INTERPOLATE || scale_mode == SPICE_IMAGE_SCALE_MODE_NEAREST, NULL);
+
+    surface = surface_create(format, width, height, TRUE);
     spice_return_val_if_fail(surface != NULL, NULL);
 
+    box.x1 = 0;
+    box.y1 = 0;
+    box.x2 = width;
+    box.y2 = height;
+    if (spice_pixman_scale_rop(surface, src, src_area->left, src_area->top,
+                               src_area->right - src_area->left,
+                               src_area->bottom - src_area->top,
+                               0, 0, width, height, &box, 1,
+                               scale_mode == SPICE_IMAGE_SCALE_MODE_INTERPOLATE,
+                               SPICE_ROP_COPY, 0)) {
+        return surface;
+    }
+
     sx = (double)(src_area->right - src_area->left) / width;
     sy = (double)(src_area->bottom - src_area->top) / height;
 
@@ -1745,7 +2141,6 @@ static pixman_image_t *canvas_scale_surface(pixman_image_t *src, const SpiceRect
 
     pixman_image_set_transform (src, &transform);
     pixman_image_set_repeat(src, PIXMAN_REPEAT_NONE);
-    spice_return_val_if_fail(scale_mode == SPICE_IMAGE_SCALE_MODE_INTERPOLATE || scale_mode == SPICE_IMAGE_SCALE_MODE_NEAREST, NULL);
     pixman_image_set_filter(src,
                             (scale_mode == SPICE_IMAGE_SCALE_MODE_NEAREST) ?PIXMAN_FILTER_NEAREST : PIXMAN_FILTER_GOOD,
                             NULL, 0);
@@ -1859,10 +2254,397 @@ static int quic_usr_more_lines(QuicUsrContext *usr, uint8_t **lines)
     return 0;
 }
 
-static void canvas_base_destroy(CanvasBase *canvas)
+static int quic_data_init(QuicData *quic_data)
 {
-    quic_destroy(canvas->quic_data.quic);
-    lz_destroy(canvas->lz_data.lz);
+    quic_data->usr.error = quic_usr_error;
+    quic_data->usr.warn = quic_usr_warn;
+    quic_data->usr.info = quic_usr_warn;
+    quic_data->usr.malloc = quic_usr_malloc;
+    quic_data->usr.free = quic_usr_free;
+    quic_data->usr.more_space = quic_usr_more_space;
+    quic_data->usr.more_lines = quic_usr_more_lines;
+    quic_data->quic = quic_create(&quic_data->usr);
+    return quic_data->quic != NULL;
+}
+
+static int lz_data_init(LzData *lz_data)
+{
+    lz_data->usr.error = lz_usr_error;
+    lz_data->usr.warn = lz_usr_warn;
+    lz_data->usr.info = lz_usr_warn;
+    lz_data->usr.malloc = lz_usr_malloc;
+    lz_data->usr.free = lz_usr_free;
+    lz_data->usr.more_space = lz_usr_more_space;
+    lz_data->usr.more_lines = lz_usr_more_lines;
+    lz_data->lz = lz_create(&lz_data->usr);
+    return lz_data->lz != NULL;
+}
+
+/* Decoder contexts are not thread safe, each prefetch worker thread gets
+ * its own set, released when the thread exits */
+typedef struct PrefetchDecoders {
+    QuicData quic_data;
+    LzData lz_data;
+} PrefetchDecoders;
+
+static void prefetch_decoders_free(gpointer data)
+{
+    PrefetchDecoders *decoders = data;
+
+    if (decoders->quic_data.quic) {
+        quic_destroy(decoders->quic_data.quic);
+    }
+    if (decoders->lz_data.lz) {
+        lz_destroy(decoders->lz_data.lz);
+    }
+    free(decoders);
+}
+
+static GPrivate prefetch_decoders = G_PRIVATE_INIT(prefetch_decoders_free);
+
+static PrefetchDecoders *prefetch_get_decoders(void)
+{
+    PrefetchDecoders *decoders = g_private_get(&prefetch_decoders);
+
+    if (decoders == NULL) {
+        decoders = spice_new0(PrefetchDecoders, 1);
+        if (!quic_data_init(&decoders->quic_data) ||
+            !lz_data_init(&decoders->lz_data)) {
+            prefetch_decoders_free(decoders);
+            return NULL;
+        }
+        g_private_set(&prefetch_decoders, decoders);
+    }
+    return decoders;
+}
+
+/* Only images which can be decoded without touching the caches or the
+ * client provided decoders are prefetched, everything else (GLZ which
+ * depends on the decoding window, JPEG, images from cache, palettes...)
+ * keeps being decoded synchronously on the drawing thread */
+static int canvas_can_prefetch(SpiceImage *image)
+{
+    switch (image->descriptor.type) {
+    case SPICE_IMAGE_TYPE_QUIC:
+#ifdef SW_CANVAS_CACHE
+    case SPICE_IMAGE_TYPE_LZ_RGB:
+#endif
+#ifdef USE_LZ4
+    case SPICE_IMAGE_TYPE_LZ4:
+#endif
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+static void canvas_prefetch_worker(gpointer data, gpointer user_data)
+{
+    PrefetchJob *job = data;
+    PrefetchData *prefetch = user_data;
+    PrefetchDecoders *decoders = prefetch_get_decoders();
+    pixman_image_t *surface = NULL;
+
+    if (decoders != NULL) {
+        switch (job->image->descriptor.type) {
+        case SPICE_IMAGE_TYPE_QUIC:
+            surface = canvas_decode_quic(&decoders->quic_data, job->canvas_format,
+                                         job->image, TRUE);
+            break;
+#ifdef SW_CANVAS_CACHE
+        case SPICE_IMAGE_TYPE_LZ_RGB:
+            surface = canvas_decode_lz(&decoders->lz_data, job->canvas_format,
+                                       job->image, NULL, TRUE);
+            break;
+#endif
+#ifdef USE_LZ4
+        case SPICE_IMAGE_TYPE_LZ4:
+            surface = canvas_get_lz4(job->image);
+            break;
+#endif
+        default:
+            spice_warn_if_reached();
+            break;
+        }
+    }
+
+    g_mutex_lock(&prefetch->lock);
+    job->surface = surface;
+    job->done = TRUE;
+    g_cond_broadcast(&prefetch->done_cond);
+    g_mutex_unlock(&prefetch->lock);
+}
+
+static void canvas_base_prefetch_images(SpiceCanvas *spice_canvas,
+                                        SpiceImage **images, int n_images)
+{
+    CanvasBase *canvas = (CanvasBase *)spice_canvas;
+    PrefetchData *prefetch = &canvas->prefetch;
+    int i;
+
+    g_mutex_lock(&prefetch->lock);
+    if (prefetch->pool == NULL) {
+        prefetch->pool = g_thread_pool_new(canvas_prefetch_worker, prefetch,
+                                           MAX(g_get_num_processors() - 1, 1),
+                                           FALSE, NULL);
+    }
+
+    for (i = 0; i < n_images; i++) {
+        SpiceImage *image = images[i];
+        PrefetchJob *job;
+
+        if (!canvas_can_prefetch(image) ||
+            g_hash_table_contains(prefetch->jobs, image)) {
+            continue;
+        }
+
+        job = spice_new0(PrefetchJob, 1);
+        job->image = image;
+        job->id = image->descriptor.id;
+        job->canvas_format = canvas->format;
+        g_hash_table_insert(prefetch->jobs, image, job);
+        g_thread_pool_push(prefetch->pool, job, NULL);
+    }
+    g_mutex_unlock(&prefetch->lock);
+}
+
+/* Returns the prefetched surface for image, waiting for its decoding to
+ * complete if needed, or NULL if the image has not been prefetched */
+static pixman_image_t *canvas_prefetch_take(CanvasBase *canvas, SpiceImage *image,
+                                            int want_original)
+{
+    PrefetchData *prefetch = &canvas->prefetch;
+    PrefetchJob *job;
+    pixman_image_t *surface;
+    pixman_format_code_t surface_format;
+
+    g_mutex_lock(&prefetch->lock);
+    job = g_hash_table_lookup(prefetch->jobs, image);
+    if (job == NULL) {
+        g_mutex_unlock(&prefetch->lock);
+        return NULL;
+    }
+    g_hash_table_remove(prefetch->jobs, image);
+    while (!job->done) {
+        g_cond_wait(&prefetch->done_cond, &prefetch->lock);
+    }
+    g_mutex_unlock(&prefetch->lock);
+
+    surface = job->surface;
+    if (surface != NULL && job->id != image->descriptor.id) {
+        /* the image was reused for another one, decode it synchronously */
+        pixman_image_unref(surface);
+        surface = NULL;
+    }
+    free(job);
+
+    /* only 16 bits images differ from their original format, they are
+     * expanded to 32 bits for 32 bits canvases */
+    if (surface != NULL && !want_original &&
+        (canvas->format == SPICE_SURFACE_FMT_32_xRGB ||
+         canvas->format == SPICE_SURFACE_FMT_32_ARGB) &&
+        spice_pixman_image_get_format(surface, &surface_format) &&
+        surface_format == PIXMAN_x1r5g5b5) {
+        surface = canvas_convert_image(surface, PIXMAN_LE_x8r8g8b8);
+    }
+
+    return surface;
+}
+
+static void canvas_base_prefetch_reset(SpiceCanvas *spice_canvas)
+{
+    CanvasBase *canvas = (CanvasBase *)spice_canvas;
+    PrefetchData *prefetch = &canvas->prefetch;
+    GList *jobs, *l;
+
+    g_mutex_lock(&prefetch->lock);
+    jobs = g_hash_table_get_values(prefetch->jobs);
+    g_hash_table_remove_all(prefetch->jobs);
+    for (l = jobs; l != NULL; l = l->next) {
+        PrefetchJob *job = l->data;
+
+        while (!job->done) {
+            g_cond_wait(&prefetch->done_cond, &prefetch->lock);
+        }
+    }
+    g_mutex_unlock(&prefetch->lock);
+
+    for (l = jobs; l != NULL; l = l->next) {
+        PrefetchJob *job = l->data;
+
+        if (job->surface != NULL) {
+            pixman_image_unref(job->surface);
+        }
+        free(job);
+    }
+    g_list_free(jobs);
+}
+
+static void canvas_region_cache_reset(RegionCache *cache)
+{
+    int i;
+
+    for (i = 0; i < CLIP_CACHE_SIZE; i++) {
+        ClipCacheEntry *entry = &cache->clips[i];
+
+        if (entry->num_rects != 0) {
+            pixman_region32_fini(&entry->region);
+            free(entry->rects);
+            entry->num_rects = 0;
+        }
+    }
+    for (i = 0; i < MASK_CACHE_SIZE; i++) {
+        MaskCacheEntry *entry = &cache->masks[i];
+
+        if (entry->image != NULL) {
+            pixman_region32_fini(&entry->region);
+            pixman_image_unref(entry->image);
+            entry->image = NULL;
+        }
+    }
+}
+
+static void canvas_pattern_cache_reset(PatternCache *cache)
+{
+    int i;
+
+    for (i = 0; i < PATTERN_CACHE_SIZE; i++) {
+        PatternCacheEntry *entry = &cache->entries[i];
+
+        if (entry->source != NULL) {
+            pixman_image_unref(entry->tile);
+            pixman_image_unref(entry->source);
+            entry->source = NULL;
+        }
+    }
+}
+
+static void canvas_base_destroy(CanvasBase *canvas)
+{
+    g_hash_table_destroy(canvas->glyph_cache);
+    canvas_region_cache_reset(&canvas->region_cache);
+    canvas_pattern_cache_reset(&canvas->pattern_cache);
+    spice_buffer_free(&canvas->glz_data.chunks);
+    spice_buffer_free(&canvas->glz_data.stream);
+    spice_canvas_span_arena_fini(&canvas->span_arena);
+    canvas_base_prefetch_reset(&canvas->parent);
+    if (canvas->prefetch.pool != NULL) {
+        g_thread_pool_free(canvas->prefetch.pool, FALSE, TRUE);
+    }
+    g_hash_table_destroy(canvas->prefetch.jobs);
+    g_cond_clear(&canvas->prefetch.done_cond);
+    g_mutex_clear(&canvas->prefetch.lock);
+
+    quic_destroy(canvas->quic_data.quic);
+    lz_destroy(canvas->lz_data.lz);
+}
+
+static guint clip_rects_hash(const SpiceRect *rects, uint32_t n)
+{
+    const uint8_t *data = (const uint8_t *)rects;
+    uint32_t hash = 2166136261U; /* FNV-1a */
+    size_t i;
+
+    for (i = 0; i < n * sizeof(SpiceRect); i++) {
+        hash = (hash ^ data[i]) * 16777619U;
+    }
+    return hash;
+}
+
+/* Returns the region of the clip rects, or NULL if pixman could not build
+ * it, which is not cached */
+static pixman_region32_t *canvas_clip_cache_get(RegionCache *cache,
+                                                const SpiceRect *rects, uint32_t n)
+{
+    guint hash = clip_rects_hash(rects, n);
+    ClipCacheEntry *entry;
+    int i;
+
+    for (i = 0; i < CLIP_CACHE_SIZE; i++) {
+        entry = &cache->clips[i];
+        if (entry->num_rects == n && entry->hash == hash &&
+            memcmp(entry->rects, rects, n * sizeof(SpiceRect)) == 0) {
+            return &entry->region;
+        }
+    }
+
+    entry = &cache->clips[cache->next_clip];
+    cache->next_clip = (cache->next_clip + 1) % CLIP_CACHE_SIZE;
+    if (entry->num_rects != 0) {
+        pixman_region32_fini(&entry->region);
+        free(entry->rects);
+    }
+
+    if (!spice_pixman_region32_init_rects(&entry->region, rects, n)) {
+        /* not cached, the slot is left free */
+        entry->num_rects = 0;
+        return NULL;
+    }
+    entry->hash = hash;
+    entry->num_rects = n;
+    entry->rects = spice_memdup(rects, n * sizeof(SpiceRect));
+    return &entry->region;
+}
+
+/* Returns the region of the mask, inverted if needed, or NULL if the image
+ * can't be cached. The entries keep a reference to the image they were
+ * built from, a stale id coming back with another image is rebuilt */
+static pixman_region32_t *canvas_mask_cache_get(RegionCache *cache, SpiceImage *mask_image,
+                                                pixman_image_t *image, int invert)
+{
+    uint64_t id = mask_image->descriptor.id;
+    MaskCacheEntry *entry;
+    pixman_box32_t rect;
+    int i;
+
+    switch (mask_image->descriptor.type) {
+    case SPICE_IMAGE_TYPE_FROM_CACHE:
+#ifdef SW_CANVAS_CACHE
+    case SPICE_IMAGE_TYPE_FROM_CACHE_LOSSLESS:
+#endif
+        break;
+    case SPICE_IMAGE_TYPE_BITMAP:
+#ifdef SW_CANVAS_CACHE
+        if (mask_image->descriptor.flags & SPICE_IMAGE_FLAGS_CACHE_ME) {
+            break;
+        }
+#endif
+        return NULL;
+    default:
+        return NULL;
+    }
+
+    invert = !!invert;
+    for (i = 0; i < MASK_CACHE_SIZE; i++) {
+        entry = &cache->masks[i];
+        if (entry->image != NULL && entry->id == id && entry->invert == invert) {
+            if (entry->image == image) {
+                return &entry->region;
+            }
+            break;
+        }
+    }
+
+    if (i == MASK_CACHE_SIZE) {
+        entry = &cache->masks[cache->next_mask];
+        cache->next_mask = (cache->next_mask + 1) % MASK_CACHE_SIZE;
+    }
+    if (entry->image != NULL) {
+        pixman_region32_fini(&entry->region);
+        pixman_image_unref(entry->image);
+    }
+
+    pixman_region32_init_from_image(&entry->region, image);
+    if (invert) {
+        rect.x1 = rect.y1 = 0;
+        rect.x2 = pixman_image_get_width(image);
+        rect.y2 = pixman_image_get_height(image);
+        pixman_region32_inverse(&entry->region, &entry->region, &rect);
+    }
+    entry->image = pixman_image_ref(image);
+    entry->id = id;
+    entry->invert = invert;
+    return &entry->region;
 }
 
 static void canvas_clip_pixman(CanvasBase *canvas,
@@ -1880,7 +2662,18 @@ static void canvas_clip_pixman(CanvasBase *canvas,
 
         pixman_region32_t pixman_clip;
 
-        if (spice_pixman_region32_init_rects(&pixman_clip, now, n)) {
+        if (n == 1) {
+            pixman_region32_intersect_rect(dest_region, dest_region,
+                                           now->left, now->top,
+                                           now->right - now->left, now->bottom - now->top);
+        } else if (n > 1) {
+            pixman_region32_t *cached_clip = canvas_clip_cache_get(&canvas->region_cache,
+                                                                   now, n);
+
+            if (cached_clip != NULL) {
+                pixman_region32_intersect(dest_region, dest_region, cached_clip);
+            }
+        } else if (spice_pixman_region32_init_rects(&pixman_clip, now, n)) {
             pixman_region32_intersect(dest_region, dest_region, &pixman_clip);
             pixman_region32_fini(&pixman_clip);
         }
@@ -1900,7 +2693,7 @@ static void canvas_mask_pixman(CanvasBase *canvas,
     SpiceCanvas *surface_canvas;
     pixman_image_t *image, *subimage;
     int needs_invert;
-    pixman_region32_t mask_region;
+    pixman_region32_t mask_region, *cached_region;
     uint32_t *mask_data;
     uint8_t *mask_data_src;
     int mask_x, mask_y;
@@ -1920,6 +2713,17 @@ static void canvas_mask_pixman(CanvasBase *canvas,
         image = canvas_get_mask(canvas,
                                 mask,
                                 &needs_invert);
+        cached_region = canvas_mask_cache_get(&canvas->region_cache, mask->bitmap,
+                                              image, needs_invert);
+        if (cached_region != NULL) {
+            pixman_region32_init(&mask_region);
+            pixman_region32_copy(&mask_region, cached_region);
+            pixman_region32_translate(&mask_region, x - mask->pos.x, y - mask->pos.y);
+            pixman_region32_intersect(dest_region, dest_region, &mask_region);
+            pixman_region32_fini(&mask_region);
+            pixman_image_unref(image);
+            return;
+        }
     }
 
     mask_data = pixman_image_get_data(image);
@@ -2047,7 +2851,7 @@ static void draw_brush(SpiceCanvas *canvas,
                                                                rop);
             }
         } else {
-            tile = canvas_get_image(canvas_base, pattern->pat, FALSE);
+            tile = canvas_get_pattern(canvas_base, pattern->pat);
             spice_return_if_fail(tile != NULL);
 
             if (rop == SPICE_ROP_COPY) {
@@ -2119,6 +2923,7 @@ static void canvas_draw_copy(SpiceCanvas *spice_canvas, SpiceRect *bbox, SpiceCl
     pixman_region32_t dest_region;
     SpiceCanvas *surface_canvas;
     pixman_image_t *src_image;
+    SpiceRect src_area;
     SpiceROP rop;
 
     pixman_region32_init_rect(&dest_region,
@@ -2184,30 +2989,33 @@ static void canvas_draw_copy(SpiceCanvas *spice_canvas, SpiceRect *bbox, SpiceCl
             }
         }
     } else {
-        src_image = canvas_get_image(canvas, copy->src_bitmap, FALSE);
+        src_area = copy->src_area;
+        src_image = canvas_get_image_for_scale(canvas, copy->src_bitmap, &src_area,
+                                               bbox->right - bbox->left,
+                                               bbox->bottom - bbox->top);
         spice_return_if_fail(src_image != NULL);
 
-        if (rect_is_same_size(bbox, &copy->src_area)) {
+        if (rect_is_same_size(bbox, &src_area)) {
             if (rop == SPICE_ROP_COPY) {
                 spice_canvas->ops->blit_image(spice_canvas, &dest_region,
                                               src_image,
-                                              bbox->left - copy->src_area.left,
-                                              bbox->top - copy->src_area.top);
+                                              bbox->left - src_area.left,
+                                              bbox->top - src_area.top);
             } else {
                 spice_canvas->ops->blit_image_rop(spice_canvas, &dest_region,
                                                   src_image,
-                                                  bbox->left - copy->src_area.left,
-                                                  bbox->top - copy->src_area.top,
+                                                  bbox->left - src_area.left,
+                                                  bbox->top - src_area.top,
                                                   rop);
             }
         } else {
             if (rop == SPICE_ROP_COPY) {
                 spice_canvas->ops->scale_image(spice_canvas, &dest_region,
                                                src_image,
-                                               copy->src_area.left,
-                                               copy->src_area.top,
-                                               copy->src_area.right - copy->src_area.left,
-                                               copy->src_area.bottom - copy->src_area.top,
+                                               src_area.left,
+                                               src_area.top,
+                                               src_area.right - src_area.left,
+                                               src_area.bottom - src_area.top,
                                                bbox->left,
                                                bbox->top,
                                                bbox->right - bbox->left,
@@ -2216,10 +3024,10 @@ static void canvas_draw_copy(SpiceCanvas *spice_canvas, SpiceRect *bbox, SpiceCl
             } else {
                 spice_canvas->ops->scale_image_rop(spice_canvas, &dest_region,
                                                    src_image,
-                                                   copy->src_area.left,
-                                                   copy->src_area.top,
-                                                   copy->src_area.right - copy->src_area.left,
-                                                   copy->src_area.bottom - copy->src_area.top,
+                                                   src_area.left,
+                                                   src_area.top,
+                                                   src_area.right - src_area.left,
+                                                   src_area.bottom - src_area.top,
                                                    bbox->left,
                                                    bbox->top,
                                                    bbox->right - bbox->left,
@@ -2703,81 +3511,86 @@ typedef struct {
     int tile_offset_y;
 } StrokeGC;
 
-static void stroke_fill_spans(lineGC * pGC,
-                              int num_spans,
-                              SpicePoint *points,
-                              int *widths,
-                              int sorted,
-                              int foreground)
+static void stroke_fill_boxes(StrokeGC *strokeGC, pixman_box32_t *boxes, int num_boxes,
+                              SpiceROP rop)
 {
-    SpiceCanvas *canvas;
-    StrokeGC *strokeGC;
-    int i;
-    SpiceROP rop;
-
-    strokeGC = (StrokeGC *)pGC;
-    canvas = strokeGC->canvas;
-
-    num_spans = spice_canvas_clip_spans(&strokeGC->dest_region,
-                                        points, widths, num_spans,
-                                        points, widths, sorted);
-
-    if (foreground) {
-        rop = strokeGC->fore_rop;
-    } else {
-        rop = strokeGC->back_rop;
-    }
+    SpiceCanvas *canvas = strokeGC->canvas;
 
     if (strokeGC->solid) {
         if (rop == SPICE_ROP_COPY) {
-            canvas->ops->fill_solid_spans(canvas, points, widths, num_spans,
+            canvas->ops->fill_solid_rects(canvas, boxes, num_boxes,
                                           strokeGC->color);
         } else {
-            for (i = 0; i < num_spans; i++) {
-                pixman_box32_t r;
-                r.x1 = points[i].x;
-                r.y1 = points[i].y;
-                r.x2 = points[i].x + widths[i];
-                r.y2 = r.y1 + 1;
-                canvas->ops->fill_solid_rects_rop(canvas, &r, 1,
-                                                  strokeGC->color, rop);
-            }
+            canvas->ops->fill_solid_rects_rop(canvas, boxes, num_boxes,
+                                              strokeGC->color, rop);
         }
     } else {
         if (rop == SPICE_ROP_COPY) {
-            for (i = 0; i < num_spans; i++) {
-                pixman_box32_t r;
-                r.x1 = points[i].x;
-                r.y1 = points[i].y;
-                r.x2 = points[i].x + widths[i];
-                r.y2 = r.y1 + 1;
-                canvas->ops->fill_tiled_rects(canvas, &r, 1,
+            if (strokeGC->use_surface_canvas) {
+                canvas->ops->fill_tiled_rects_from_surface(canvas, boxes, num_boxes,
+                                                           strokeGC->surface_canvas,
+                                                           strokeGC->tile_offset_x,
+                                                           strokeGC->tile_offset_y);
+            } else {
+                canvas->ops->fill_tiled_rects(canvas, boxes, num_boxes,
                                               strokeGC->tile,
                                               strokeGC->tile_offset_x,
                                               strokeGC->tile_offset_y);
             }
         } else {
-            for (i = 0; i < num_spans; i++) {
-                pixman_box32_t r;
-                r.x1 = points[i].x;
-                r.y1 = points[i].y;
-                r.x2 = points[i].x + widths[i];
-                r.y2 = r.y1 + 1;
-                canvas->ops->fill_tiled_rects_rop(canvas, &r, 1,
+            if (strokeGC->use_surface_canvas) {
+                canvas->ops->fill_tiled_rects_rop_from_surface(canvas, boxes, num_boxes,
+                                                               strokeGC->surface_canvas,
+                                                               strokeGC->tile_offset_x,
+                                                               strokeGC->tile_offset_y,
+                                                               rop);
+            } else {
+                canvas->ops->fill_tiled_rects_rop(canvas, boxes, num_boxes,
                                                   strokeGC->tile,
                                                   strokeGC->tile_offset_x,
-                                                  strokeGC->tile_offset_y, rop);
+                                                  strokeGC->tile_offset_y,
+                                                  rop);
             }
         }
     }
 }
 
+static void stroke_fill_spans(lineGC * pGC,
+                              int num_spans,
+                              SpicePoint *points,
+                              int *widths,
+                              int sorted,
+                              int foreground)
+{
+    StrokeGC *strokeGC;
+    int num_boxes;
+    SpiceROP rop;
+
+    strokeGC = (StrokeGC *)pGC;
+
+    /* clip and merge the spans into rectangles so that they can be drawn
+       with a single call */
+    num_boxes = spice_canvas_clip_spans_to_boxes(&strokeGC->dest_region,
+                                                 points, widths, num_spans, sorted,
+                                                 strokeGC->base.span_arena);
+    if (num_boxes == 0) {
+        return;
+    }
+
+    if (foreground) {
+        rop = strokeGC->fore_rop;
+    } else {
+        rop = strokeGC->back_rop;
+    }
+
+    stroke_fill_boxes(strokeGC, strokeGC->base.span_arena->boxes, num_boxes, rop);
+}
+
 static void stroke_fill_rects(lineGC * pGC,
                               int num_rects,
                               pixman_rectangle32_t *rects,
                               int foreground)
 {
-    SpiceCanvas *canvas;
     pixman_region32_t area;
     pixman_box32_t *boxes;
     StrokeGC *strokeGC;
@@ -2787,7 +3600,6 @@ static void stroke_fill_rects(lineGC * pGC,
     int n_area_rects;
 
     strokeGC = (StrokeGC *)pGC;
-    canvas = strokeGC->canvas;
 
     if (foreground) {
         rop = strokeGC->fore_rop;
@@ -2811,43 +3623,7 @@ static void stroke_fill_rects(lineGC * pGC,
 
     area_rects = pixman_region32_rectangles(&area, &n_area_rects);
 
-    if (strokeGC->solid) {
-        if (rop == SPICE_ROP_COPY) {
-            canvas->ops->fill_solid_rects(canvas, area_rects, n_area_rects,
-                                          strokeGC->color);
-        } else {
-            canvas->ops->fill_solid_rects_rop(canvas, area_rects, n_area_rects,
-                                              strokeGC->color, rop);
-        }
-    } else {
-        if (rop == SPICE_ROP_COPY) {
-            if (strokeGC->use_surface_canvas) {
-                canvas->ops->fill_tiled_rects_from_surface(canvas, area_rects, n_area_rects,
-                                                           strokeGC->surface_canvas,
-                                                           strokeGC->tile_offset_x,
-                                                           strokeGC->tile_offset_y);
-            } else {
-                canvas->ops->fill_tiled_rects(canvas, area_rects, n_area_rects,
-                                              strokeGC->tile,
-                                              strokeGC->tile_offset_x,
-                                              strokeGC->tile_offset_y);
-            }
-        } else {
-            if (strokeGC->use_surface_canvas) {
-                canvas->ops->fill_tiled_rects_rop_from_surface(canvas, area_rects, n_area_rects,
-                                                               strokeGC->surface_canvas,
-                                                               strokeGC->tile_offset_x,
-                                                               strokeGC->tile_offset_y,
-                                                               rop);
-            } else {
-                canvas->ops->fill_tiled_rects_rop(canvas, area_rects, n_area_rects,
-                                                  strokeGC->tile,
-                                                  strokeGC->tile_offset_x,
-                                                  strokeGC->tile_offset_y,
-                                                  rop);
-            }
-        }
-    }
+    stroke_fill_boxes(strokeGC, area_rects, n_area_rects, rop);
 
    pixman_region32_fini(&area);
 }
@@ -2890,85 +3666,202 @@ static void stroke_lines_append_fix(StrokeLines *lines,
                         fix_to_int(point->y));
 }
 
-static inline int64_t dot(SPICE_FIXED28_4 x1,
-                          SPICE_FIXED28_4 y1,
-                          SPICE_FIXED28_4 x2,
-                          SPICE_FIXED28_4 y2)
+static void stroke_lines_reserve(StrokeLines *lines, int count)
 {
-    return (((int64_t)x1) *((int64_t)x2) +
-            ((int64_t)y1) *((int64_t)y2)) >> 4;
+    if (lines->num_points + count > lines->size) {
+        lines->size = MAX(lines->size * 2, lines->num_points + count);
+        lines->points = spice_renew(SpicePoint, lines->points, lines->size);
+    }
 }
 
-static inline int64_t dot2(SPICE_FIXED28_4 x,
-                           SPICE_FIXED28_4 y)
+/* Curves are subdivided in SPICE_FIXED28_4 scaled up by BEZIER_SHIFT bits so
+ * that the midpoints don't accumulate rounding errors */
+#define BEZIER_SHIFT 8
+/* Largest distance between a curve and its flattening, half a pixel */
+#define BEZIER_TOLERANCE ((int64_t)int_to_fix(1) << BEZIER_SHIFT >> 1)
+#define BEZIER_MAX_DEPTH 16
+
+typedef struct BezierPoint {
+    int64_t x;
+    int64_t y;
+} BezierPoint;
+
+/* Largest absolute value of the terms of the flatness bound below, they are
+ * divided by 4 at each subdivision */
+static int64_t bezier_deviation(const BezierPoint *p)
 {
-    return (((int64_t)x) *((int64_t)x) +
-            ((int64_t)y) *((int64_t)y)) >> 4;
+    int64_t ux = 3 * p[1].x - 2 * p[0].x - p[3].x;
+    int64_t uy = 3 * p[1].y - 2 * p[0].y - p[3].y;
+    int64_t vx = 3 * p[2].x - p[0].x - 2 * p[3].x;
+    int64_t vy = 3 * p[2].y - p[0].y - 2 * p[3].y;
+
+    return MAX(MAX(ABS(ux), ABS(uy)), MAX(ABS(vx), ABS(vy)));
 }
 
-static void subdivide_bezier(StrokeLines *lines,
-                             SpicePointFix point0,
-                             SpicePointFix point1,
-                             SpicePointFix point2,
-                             SpicePointFix point3)
+static int bit_length(uint64_t v)
 {
-    int64_t A2, B2, C2, AB, CB, h1, h2;
+    int n = 0;
 
-    A2 = dot2(point1.x - point0.x,
-              point1.y - point0.y);
-    B2 = dot2(point3.x - point0.x,
-              point3.y - point0.y);
-    C2 = dot2(point2.x - point3.x,
-              point2.y - point3.y);
-
-    AB = dot(point1.x - point0.x,
-             point1.y - point0.y,
-             point3.x - point0.x,
-             point3.y - point0.y);
-
-    CB = dot(point2.x - point3.x,
-             point2.y - point3.y,
-             point0.x - point3.x,
-             point0.y - point3.y);
-
-    h1 = (A2*B2 - AB*AB) >> 3;
-    h2 = (C2*B2 - CB*CB) >> 3;
+    while (v) {
+        v >>= 1;
+        n++;
+    }
+    return n;
+}
 
-    if (h1 < B2 && h2 < B2) {
-        /* deviation squared less than half a pixel, use straight line */
-        stroke_lines_append_fix(lines, &point3);
-    } else {
-        SpicePointFix point01, point23, point12, point012, point123, point0123;
+/* The curve is within BEZIER_TOLERANCE of the segment p[0]-p[3] if
+ * max(ux^2, vx^2) + max(uy^2, vy^2) <= 16 * tolerance^2, or if both control
+ * points are within 4/3 of the tolerance from the segment since the curve is
+ * at most 3/4 of their distance away */
+static int bezier_is_flat(const BezierPoint *p)
+{
+    int64_t ux = 3 * p[1].x - 2 * p[0].x - p[3].x;
+    int64_t uy = 3 * p[1].y - 2 * p[0].y - p[3].y;
+    int64_t vx = 3 * p[2].x - p[0].x - 2 * p[3].x;
+    int64_t vy = 3 * p[2].y - p[0].y - 2 * p[3].y;
+    int64_t bx = p[3].x - p[0].x;
+    int64_t by = p[3].y - p[0].y;
+    int64_t dx, dy, b2, limit, m;
+    int i, shift;
+
+    dx = MAX(ABS(ux), ABS(vx));
+    dy = MAX(ABS(uy), ABS(vy));
+    /* also keeps the squares below from overflowing */
+    if (dx <= 4 * BEZIER_TOLERANCE && dy <= 4 * BEZIER_TOLERANCE &&
+        dx * dx + dy * dy <= 16 * BEZIER_TOLERANCE * BEZIER_TOLERANCE) {
+        return TRUE;
+    }
 
-        point01.x = (point0.x + point1.x) / 2;
-        point01.y = (point0.y + point1.y) / 2;
-        point12.x = (point1.x + point2.x) / 2;
-        point12.y = (point1.y + point2.y) / 2;
-        point23.x = (point2.x + point3.x) / 2;
-        point23.y = (point2.y + point3.y) / 2;
-        point012.x = (point01.x + point12.x) / 2;
-        point012.y = (point01.y + point12.y) / 2;
-        point123.x = (point12.x + point23.x) / 2;
-        point123.y = (point12.y + point23.y) / 2;
-        point0123.x = (point012.x + point123.x) / 2;
-        point0123.y = (point012.y + point123.y) / 2;
+    if (bx == 0 && by == 0) {
+        return FALSE;
+    }
 
-        subdivide_bezier(lines, point0, point01, point012, point0123);
-        subdivide_bezier(lines, point0123, point123, point23, point3);
+    /* scale the vectors down to 13 bits so the products fit, the rounding
+     * only matters for curves thousands of pixels long */
+    m = MAX(ABS(bx), ABS(by));
+    for (i = 1; i <= 2; i++) {
+        m = MAX(m, MAX(ABS(p[i].x - p[0].x), ABS(p[i].y - p[0].y)));
+    }
+    shift = MAX(bit_length(m) - 13, 0);
+    bx >>= shift;
+    by >>= shift;
+    b2 = bx * bx + by * by;
+    if (b2 == 0) {
+        return FALSE;
     }
+    /* 9 * (4/3 tolerance)^2 * |b|^2 in the scaled units */
+    limit = 2 * shift < 63 ? (16 * BEZIER_TOLERANCE * BEZIER_TOLERANCE * b2) >> (2 * shift) : 0;
+    for (i = 1; i <= 2; i++) {
+        int64_t ax = (p[i].x - p[0].x) >> shift;
+        int64_t ay = (p[i].y - p[0].y) >> shift;
+        int64_t cross = ax * by - ay * bx;
+        int64_t proj = ax * bx + ay * by;
+        /* distance along the chord past its ends, times |b| */
+        int64_t over = proj < 0 ? -proj : MAX(proj - b2, 0);
+
+        if (9 * (cross * cross + over * over) > limit) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static void bezier_split(const BezierPoint *p, BezierPoint *left, BezierPoint *right)
+{
+    BezierPoint p01, p12, p23, p012, p123;
+
+#define MID(a, b, c) (c).x = ((a).x + (b).x) / 2; (c).y = ((a).y + (b).y) / 2
+    MID(p[0], p[1], p01);
+    MID(p[1], p[2], p12);
+    MID(p[2], p[3], p23);
+    MID(p01, p12, p012);
+    MID(p12, p23, p123);
+    left[0] = p[0];
+    left[1] = p01;
+    left[2] = p012;
+    MID(p012, p123, left[3]);
+    right[0] = left[3];
+    right[1] = p123;
+    right[2] = p23;
+    right[3] = p[3];
+#undef MID
 }
 
+/* Appends the flattened curve starting at the last point of lines. The curve
+ * is split until every piece is within BEZIER_TOLERANCE of its chord, the
+ * deviation bound of the whole curve gives the deepest split needed, so the
+ * points array is sized once up front */
 static void stroke_lines_append_bezier(StrokeLines *lines,
                                        SpicePointFix *point1,
                                        SpicePointFix *point2,
                                        SpicePointFix *point3)
 {
-    SpicePointFix point0;
+    BezierPoint stack[BEZIER_MAX_DEPTH + 1][4];
+    int depths[BEZIER_MAX_DEPTH + 1];
+    SpicePoint *last, *out;
+    int64_t deviation;
+    int max_depth, top;
+
+    last = &lines->points[lines->num_points - 1];
+    stack[0][0].x = (int64_t)int_to_fix(last->x) << BEZIER_SHIFT;
+    stack[0][0].y = (int64_t)int_to_fix(last->y) << BEZIER_SHIFT;
+    stack[0][1].x = (int64_t)point1->x << BEZIER_SHIFT;
+    stack[0][1].y = (int64_t)point1->y << BEZIER_SHIFT;
+    stack[0][2].x = (int64_t)point2->x << BEZIER_SHIFT;
+    stack[0][2].y = (int64_t)point2->y << BEZIER_SHIFT;
+    stack[0][3].x = (int64_t)point3->x << BEZIER_SHIFT;
+    stack[0][3].y = (int64_t)point3->y << BEZIER_SHIFT;
+    depths[0] = 0;
+
+    /* one more level than the bound asks for absorbs the rounding */
+    deviation = bezier_deviation(stack[0]);
+    for (max_depth = 0; max_depth < BEZIER_MAX_DEPTH &&
+         deviation > 2 * BEZIER_TOLERANCE; max_depth++) {
+        deviation /= 4;
+    }
+    max_depth = MIN(max_depth + 1, BEZIER_MAX_DEPTH);
+
+    stroke_lines_reserve(lines, 1 << max_depth);
+    last = &lines->points[lines->num_points - 1];
+    out = last + 1;
+
+    top = 0;
+    while (top >= 0) {
+        BezierPoint *p = stack[top];
+        int depth = depths[top];
+
+        if (depth < max_depth && !bezier_is_flat(p)) {
+            BezierPoint left[4];
+
+            /* the right half replaces p and the left one is done first */
+            bezier_split(p, left, p);
+            memcpy(stack[++top], left, sizeof(left));
+            depths[top - 1] = depths[top] = depth + 1;
+            continue;
+        }
+        top--;
+
+        out->x = fix_to_int((SPICE_FIXED28_4)(p[3].x >> BEZIER_SHIFT));
+        out->y = fix_to_int((SPICE_FIXED28_4)(p[3].y >> BEZIER_SHIFT));
+        /* pieces shorter than a pixel add nothing to the line */
+        if (out->x != last->x || out->y != last->y) {
+            last = out++;
+        }
+    }
+    lines->num_points = out - lines->points;
+}
 
-    point0.x = int_to_fix(lines->points[lines->num_points-1].x);
-    point0.y = int_to_fix(lines->points[lines->num_points-1].y);
+static int stroke_lines_draw_solid(StrokeLines *lines, StrokeGC *strokeGC)
+{
+    SpiceCanvas *canvas = strokeGC->canvas;
 
-    subdivide_bezier(lines, point0, *point1, *point2, *point3);
+    if (!strokeGC->solid || canvas->ops->draw_solid_lines == NULL) {
+        return FALSE;
+    }
+    /* zero width lines only paint foreground pixels */
+    return canvas->ops->draw_solid_lines(canvas, &strokeGC->dest_region,
+                                         lines->points, lines->num_points,
+                                         strokeGC->color, strokeGC->fore_rop);
 }
 
 static void stroke_lines_draw(StrokeLines *lines,
@@ -2979,7 +3872,7 @@ static void stroke_lines_draw(StrokeLines *lines,
         if (dashed) {
             spice_canvas_zero_dash_line(gc, CoordModeOrigin,
                                         lines->num_points, lines->points);
-        } else {
+        } else if (!stroke_lines_draw_solid(lines, (StrokeGC *)gc)) {
             spice_canvas_zero_line(gc, CoordModeOrigin,
                                    lines->num_points, lines->points);
         }
@@ -3039,6 +3932,7 @@ static void canvas_draw_stroke(SpiceCanvas *spice_canvas, SpiceRect *bbox,
     gc.base.capStyle = CapNotLast;
     gc.base.joinStyle = JoinMiter;
     gc.base.ops = &ops;
+    gc.base.span_arena = &canvas->span_arena;
 
     dashed = 0;
     if (stroke->attr.flags & SPICE_LINE_FLAGS_STYLED) {
@@ -3154,6 +4048,22 @@ static void canvas_draw_stroke(SpiceCanvas *spice_canvas, SpiceRect *bbox,
 }
 
 
+/* Area to draw into for a draw operation, the extents of its region */
+static void canvas_get_draw_area(pixman_region32_t *dest_region, SpiceRect *bbox,
+                                 SpiceRect *area)
+{
+    pixman_box32_t *extents = pixman_region32_extents(dest_region);
+
+    if (!pixman_region32_not_empty(dest_region)) {
+        *area = *bbox;
+        return;
+    }
+    area->left = extents->x1;
+    area->top = extents->y1;
+    area->right = extents->x2;
+    area->bottom = extents->y2;
+}
+
 //need surfaces handling here !!!
 static void canvas_draw_rop3(SpiceCanvas *spice_canvas, SpiceRect *bbox,
                              SpiceClip *clip, SpiceRop3 *rop3)
@@ -3163,7 +4073,12 @@ static void canvas_draw_rop3(SpiceCanvas *spice_canvas, SpiceRect *bbox,
     pixman_region32_t dest_region;
     pixman_image_t *d;
     pixman_image_t *s;
+    pixman_image_t *p = NULL;
     SpicePoint src_pos;
+    SpiceRect area;
+    SpiceRect sources[2];
+    int n_sources = 0;
+    int is_view = FALSE;
     int width;
     int heigth;
 
@@ -3179,7 +4094,6 @@ static void canvas_draw_rop3(SpiceCanvas *spice_canvas, SpiceRect *bbox,
     width = bbox->right - bbox->left;
     heigth = bbox->bottom - bbox->top;
 
-    d = canvas_get_image_from_self(spice_canvas, bbox->left, bbox->top, width, heigth, FALSE);
     surface_canvas = canvas_get_surface(canvas, rop3->src_bitmap);
     if (surface_canvas) {
         s = surface_canvas->ops->get_image(surface_canvas, FALSE);
@@ -3197,6 +4111,9 @@ static void canvas_draw_rop3(SpiceCanvas *spice_canvas, SpiceRect *bbox,
     } else {
         src_pos.x = rop3->src_area.left;
         src_pos.y = rop3->src_area.top;
+        if (surface_canvas == spice_canvas) {
+            sources[n_sources++] = rop3->src_area;
+        }
     }
     if (pixman_image_get_width(s) - src_pos.x < width ||
         pixman_image_get_height(s) - src_pos.y < heigth) {
@@ -3205,7 +4122,6 @@ static void canvas_draw_rop3(SpiceCanvas *spice_canvas, SpiceRect *bbox,
     }
     if (rop3->brush.type == SPICE_BRUSH_TYPE_PATTERN) {
         SpiceCanvas *_surface_canvas;
-        pixman_image_t *p;
 
         _surface_canvas = canvas_get_surface(canvas, rop3->brush.u.pattern.pat);
         if (_surface_canvas) {
@@ -3213,10 +4129,29 @@ static void canvas_draw_rop3(SpiceCanvas *spice_canvas, SpiceRect *bbox,
         } else {
             p = canvas_get_image(canvas, rop3->brush.u.pattern.pat, FALSE);
         }
+        if (_surface_canvas == spice_canvas) {
+            /* the pattern repeats over the whole canvas */
+            sources[n_sources].left = 0;
+            sources[n_sources].top = 0;
+            sources[n_sources].right = canvas->width;
+            sources[n_sources].bottom = canvas->height;
+            n_sources++;
+        }
+    }
+
+    /* Only the pixels of the region are needed. The rop writes all of d,
+     * drawing in place needs the region to be that single rectangle */
+    canvas_get_draw_area(&dest_region, bbox, &area);
+    d = canvas_get_image_from_self(spice_canvas, &area, sources, n_sources, FALSE,
+                                   pixman_region32_n_rects(&dest_region) == 1 ? &is_view : NULL);
+    src_pos.x += area.left - bbox->left;
+    src_pos.y += area.top - bbox->top;
+
+    if (p) {
         SpicePoint pat_pos;
 
-        pat_pos.x = (bbox->left - rop3->brush.u.pattern.pos.x) % pixman_image_get_width(p);
-        pat_pos.y = (bbox->top - rop3->brush.u.pattern.pos.y) % pixman_image_get_height(p);
+        pat_pos.x = (area.left - rop3->brush.u.pattern.pos.x) % pixman_image_get_width(p);
+        pat_pos.y = (area.top - rop3->brush.u.pattern.pos.y) % pixman_image_get_height(p);
         do_rop3_with_pattern(rop3->rop3, d, s, &src_pos, p, &pat_pos);
         pixman_image_unref(p);
     } else {
@@ -3224,9 +4159,13 @@ static void canvas_draw_rop3(SpiceCanvas *spice_canvas, SpiceRect *bbox,
     }
     pixman_image_unref(s);
 
-    spice_canvas->ops->blit_image(spice_canvas, &dest_region, d,
-                                  bbox->left,
-                                  bbox->top);
+    if (is_view) {
+        spice_canvas->ops->image_changed(spice_canvas, &dest_region);
+    } else {
+        spice_canvas->ops->blit_image(spice_canvas, &dest_region, d,
+                                      area.left,
+                                      area.top);
+    }
 
     pixman_image_unref(d);
 
@@ -3253,6 +4192,25 @@ static void transform_to_pixman_transform(SpiceTransform *transform,
 #define EXTRACT(v, lo, hi)                                              \
     ((v & MASK(lo, hi)) >> lo)
 
+/* Area of the canvas read for a composite source or mask, the whole canvas
+ * unless the pixels come straight from the given origin */
+static void composite_source_area(CanvasBase *canvas, int has_transform,
+                                  pixman_repeat_t repeat, const SpicePoint16 *origin,
+                                  int width, int height, SpiceRect *area)
+{
+    if (has_transform || repeat != PIXMAN_REPEAT_NONE) {
+        area->left = 0;
+        area->top = 0;
+        area->right = canvas->width;
+        area->bottom = canvas->height;
+    } else {
+        area->left = origin->x;
+        area->top = origin->y;
+        area->right = origin->x + width;
+        area->bottom = origin->y + height;
+    }
+}
+
 static void canvas_draw_composite(SpiceCanvas *spice_canvas, SpiceRect *bbox,
                                   SpiceClip *clip, SpiceComposite *composite)
 {
@@ -3266,7 +4224,12 @@ static void canvas_draw_composite(SpiceCanvas *spice_canvas, SpiceRect *bbox,
     pixman_filter_t src_filter;
     pixman_op_t op;
     pixman_transform_t transform;
+    SpiceRect area;
+    SpiceRect sources[2];
+    int n_sources = 0;
+    int is_view = FALSE;
     int width, height;
+    int dx, dy;
 
     pixman_region32_init_rect(&dest_region,
                               bbox->left, bbox->top,
@@ -3278,15 +4241,18 @@ static void canvas_draw_composite(SpiceCanvas *spice_canvas, SpiceRect *bbox,
     width = bbox->right - bbox->left;
     height = bbox->bottom - bbox->top;
 
-    /* Dest */
-    d = canvas_get_image_from_self(spice_canvas, bbox->left, bbox->top, width, height,
-                                   (composite->flags & SPICE_COMPOSITE_DEST_OPAQUE));
-
     /* Src */
+    src_filter = (pixman_filter_t) EXTRACT (composite->flags, 8, 11);
+    src_repeat = (pixman_repeat_t) EXTRACT (composite->flags, 14, 16);
     surface_canvas = canvas_get_surface(canvas, composite->src_bitmap);
     if (surface_canvas) {
         s = surface_canvas->ops->get_image(surface_canvas,
                                            (composite->flags & SPICE_COMPOSITE_SOURCE_OPAQUE));
+        if (surface_canvas == spice_canvas) {
+            composite_source_area(canvas, composite->flags & SPICE_COMPOSITE_HAS_SRC_TRANSFORM,
+                                  src_repeat, &composite->src_origin, width, height,
+                                  &sources[n_sources++]);
+        }
     } else {
         s = canvas_get_image(canvas, composite->src_bitmap, FALSE);
     }
@@ -3295,8 +4261,6 @@ static void canvas_draw_composite(SpiceCanvas *spice_canvas, SpiceRect *bbox,
         transform_to_pixman_transform (&composite->src_transform, &transform);
         pixman_image_set_transform (s, &transform);
     }
-    src_filter = (pixman_filter_t) EXTRACT (composite->flags, 8, 11);
-    src_repeat = (pixman_repeat_t) EXTRACT (composite->flags, 14, 16);
     pixman_image_set_filter (s, src_filter, NULL, 0);
     pixman_image_set_repeat (s, src_repeat);
 
@@ -3310,6 +4274,12 @@ static void canvas_draw_composite(SpiceCanvas *spice_canvas, SpiceRect *bbox,
         surface_canvas = canvas_get_surface(canvas, composite->mask_bitmap);
         if (surface_canvas) {
             m = surface_canvas->ops->get_image(surface_canvas, FALSE);
+            if (surface_canvas == spice_canvas) {
+                composite_source_area(canvas,
+                                      composite->flags & SPICE_COMPOSITE_HAS_MASK_TRANSFORM,
+                                      mask_repeat, &composite->mask_origin, width, height,
+                                      &sources[n_sources++]);
+            }
         } else {
             m = canvas_get_image(canvas, composite->mask_bitmap, FALSE);
         }
@@ -3324,20 +4294,42 @@ static void canvas_draw_composite(SpiceCanvas *spice_canvas, SpiceRect *bbox,
         pixman_image_set_component_alpha (m, component_alpha);
     }
 
+    /* Dest, only the pixels of the region are needed */
+    canvas_get_draw_area(&dest_region, bbox, &area);
+    d = canvas_get_image_from_self(spice_canvas, &area, sources, n_sources,
+                                   (composite->flags & SPICE_COMPOSITE_DEST_OPAQUE),
+                                   &is_view);
+    dx = area.left - bbox->left;
+    dy = area.top - bbox->top;
+    if (is_view) {
+        /* drawing in place, keep to the region */
+        pixman_region32_t clip_region;
+
+        pixman_region32_init(&clip_region);
+        pixman_region32_copy(&clip_region, &dest_region);
+        pixman_region32_translate(&clip_region, -area.left, -area.top);
+        pixman_image_set_clip_region32(d, &clip_region);
+        pixman_region32_fini(&clip_region);
+    }
+
     op = (pixman_op_t) EXTRACT (composite->flags, 0, 8);
 
     pixman_image_composite32 (op, s, m, d,
-                              composite->src_origin.x, composite->src_origin.y,
-                              composite->mask_origin.x, composite->mask_origin.y,
-                              0, 0, width, height);
+                              composite->src_origin.x + dx, composite->src_origin.y + dy,
+                              composite->mask_origin.x + dx, composite->mask_origin.y + dy,
+                              0, 0, area.right - area.left, area.bottom - area.top);
 
     pixman_image_unref(s);
     if (m)
         pixman_image_unref(m);
 
-    spice_canvas->ops->blit_image(spice_canvas, &dest_region, d,
-                                  bbox->left,
-                                  bbox->top);
+    if (is_view) {
+        spice_canvas->ops->image_changed(spice_canvas, &dest_region);
+    } else {
+        spice_canvas->ops->blit_image(spice_canvas, &dest_region, d,
+                                      area.left,
+                                      area.top);
+    }
 
     pixman_image_unref(d);
 
@@ -3434,6 +4426,8 @@ inline static void canvas_base_init_ops(SpiceCanvasOps *ops)
     ops->draw_composite = canvas_draw_composite;
     ops->group_start = canvas_base_group_start;
     ops->group_end = canvas_base_group_end;
+    ops->prefetch_images = canvas_base_prefetch_images;
+    ops->prefetch_reset = canvas_base_prefetch_reset;
 }
 
 static int canvas_base_init(CanvasBase *canvas, SpiceCanvasOps *ops,
@@ -3449,25 +4443,21 @@ static int canvas_base_init(CanvasBase *canvas, SpiceCanvasOps *ops,
                             )
 {
     canvas->parent.ops = ops;
-    canvas->quic_data.usr.error = quic_usr_error;
-    canvas->quic_data.usr.warn = quic_usr_warn;
-    canvas->quic_data.usr.info = quic_usr_warn;
-    canvas->quic_data.usr.malloc = quic_usr_malloc;
-    canvas->quic_data.usr.free = quic_usr_free;
-    canvas->quic_data.usr.more_space = quic_usr_more_space;
-    canvas->quic_data.usr.more_lines = quic_usr_more_lines;
-    if (!(canvas->quic_data.quic = quic_create(&canvas->quic_data.usr))) {
+    g_mutex_init(&canvas->prefetch.lock);
+    g_cond_init(&canvas->prefetch.done_cond);
+    canvas->prefetch.jobs = g_hash_table_new(g_direct_hash, g_direct_equal);
+    canvas->glyph_cache = g_hash_table_new_full(glyph_cache_hash, glyph_cache_equal,
+                                                free, NULL);
+    memset(&canvas->region_cache, 0, sizeof(canvas->region_cache));
+    memset(&canvas->pattern_cache, 0, sizeof(canvas->pattern_cache));
+    memset(&canvas->glz_data.chunks, 0, sizeof(canvas->glz_data.chunks));
+    memset(&canvas->glz_data.stream, 0, sizeof(canvas->glz_data.stream));
+
+    if (!quic_data_init(&canvas->quic_data)) {
             return 0;
     }
 
-    canvas->lz_data.usr.error = lz_usr_error;
-    canvas->lz_data.usr.warn = lz_usr_warn;
-    canvas->lz_data.usr.info = lz_usr_warn;
-    canvas->lz_data.usr.malloc = lz_usr_malloc;
-    canvas->lz_data.usr.free = lz_usr_free;
-    canvas->lz_data.usr.more_space = lz_usr_more_space;
-    canvas->lz_data.usr.more_lines = lz_usr_more_lines;
-    if (!(canvas->lz_data.lz = lz_create(&canvas->lz_data.usr))) {
+    if (!lz_data_init(&canvas->lz_data)) {
             return 0;
     }
 
@@ -104,6 +104,13 @@ typedef struct SpiceJpegDecoderOps {
                    uint8_t* dest,
                    int stride,
                    int format);
+    /* Optional, makes the following begin_decode() calls scale the images
+     * down to no less than width x height pixels if the decoder can, or
+     * decode them at full size for 0, 0. The canvas sets it before each
+     * image, and accepts a smaller image only when it asked for one. */
+    void (*set_target_size)(SpiceJpegDecoder *decoder,
+                            int width,
+                            int height);
 } SpiceJpegDecoderOps;
 
 struct _SpiceJpegDecoder {
@@ -145,6 +152,12 @@ typedef struct {
     void (*read_bits)(SpiceCanvas *canvas, uint8_t *dest, int dest_stride, const SpiceRect *area);
     void (*group_start)(SpiceCanvas *canvas, QRegion *region);
     void (*group_end)(SpiceCanvas *canvas);
+    /* Starts decoding the images of upcoming draw commands on worker threads,
+     * the draw commands then pick up the decoded surfaces. Cache updates still
+     * happen when the images are drawn, in command order. The images must stay
+     * valid until they are drawn or prefetch_reset() is called. */
+    void (*prefetch_images)(SpiceCanvas *canvas, SpiceImage **images, int n_images);
+    void (*prefetch_reset)(SpiceCanvas *canvas);
     void (*destroy)(SpiceCanvas *canvas);
 
     /* Implementation vfuncs */
@@ -162,6 +175,15 @@ typedef struct {
                                  int n_rects,
                                  uint32_t color,
                                  SpiceROP rop);
+    /* Draws a solid zero width polyline clipped to region, the way
+     * spice_canvas_zero_line() does. Can be NULL, and returns FALSE if the
+     * canvas can't draw the line, it is then drawn through spans. */
+    int (*draw_solid_lines)(SpiceCanvas *canvas,
+                            pixman_region32_t *region,
+                            SpicePoint *points,
+                            int n_points,
+                            uint32_t color,
+                            SpiceROP rop);
     void (*fill_tiled_rects)(SpiceCanvas *canvas,
                              pixman_box32_t *rects,
                              int n_rects,
@@ -302,6 +324,10 @@ typedef struct {
                         pixman_region32_t *dest_region,
                         int dx, int dy);
     pixman_image_t *(*get_image)(SpiceCanvas *canvas, int force_opaque);
+    /* Called after drawing in region directly through the pixels of the
+     * image returned by get_image(). Can be NULL, drawing then always goes
+     * through a copy blitted back */
+    void (*image_changed)(SpiceCanvas *canvas, pixman_region32_t *region);
 } SpiceCanvasOps;
 
 struct _SpiceCanvas {
@@ -17,11 +17,202 @@
 */
 #include <config.h>
 
+#include <string.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
 #include "canvas_utils.h"
 #include "mem.h"
 
-typedef struct PixmanData {
+/* Pixel buffers are served from a pool of size classes so that the decoded
+ * images and temporaries created for every draw do not go through the
+ * allocator (and, for large ones, fault in fresh pages) each time.
+ * Classes are four steps per power of two from PIXEL_POOL_MIN_SIZE up to
+ * PIXEL_POOL_MAX_SIZE; larger buffers are not cached. */
+#define PIXEL_POOL_ALIGN 64
+#define PIXEL_POOL_MIN_SHIFT 12
+#define PIXEL_POOL_MAX_SHIFT 26
+#define PIXEL_POOL_MIN_SIZE ((size_t)1 << PIXEL_POOL_MIN_SHIFT)
+#define PIXEL_POOL_MAX_SIZE ((size_t)1 << PIXEL_POOL_MAX_SHIFT)
+#define PIXEL_POOL_N_CLASSES (1 + (PIXEL_POOL_MAX_SHIFT - PIXEL_POOL_MIN_SHIFT) * 4)
+/* high-water limits: buffers kept per class and bytes kept in total */
+#define PIXEL_POOL_CLASS_MAX_FREE 4
+#define PIXEL_POOL_MAX_CACHED ((size_t)128 * 1024 * 1024)
+/* buffers at least this big are mapped directly, huge page aligned */
+#define PIXEL_POOL_HUGE_SIZE ((size_t)2 * 1024 * 1024)
+
+typedef struct PixelBuffer {
+    void *alloc;
     uint8_t *data;
+    size_t size;
+    int pool_class;
+    int mapped;
+    int zeroed;
+} PixelBuffer;
+
+typedef struct PixelPool {
+    GMutex lock;
+    PixelBuffer free_bufs[PIXEL_POOL_N_CLASSES][PIXEL_POOL_CLASS_MAX_FREE];
+    int n_free[PIXEL_POOL_N_CLASSES];
+    size_t cached;
+} PixelPool;
+
+static PixelPool pixel_pool;
+
+static int pixel_pool_get_class(size_t size)
+{
+    size_t step;
+    int shift = PIXEL_POOL_MIN_SHIFT;
+
+    if (size <= PIXEL_POOL_MIN_SIZE) {
+        return 0;
+    }
+    if (size > PIXEL_POOL_MAX_SIZE) {
+        return -1;
+    }
+    while (((size_t)1 << shift) < size) {
+        shift++;
+    }
+    /* size is in (2^(shift-1), 2^shift], split in four steps */
+    step = (size_t)1 << (shift - 3);
+    return 1 + (shift - PIXEL_POOL_MIN_SHIFT - 1) * 4 +
+           (int)((size - ((size_t)1 << (shift - 1)) + step - 1) / step) - 1;
+}
+
+static size_t pixel_pool_class_size(int pool_class)
+{
+    int shift;
+
+    if (pool_class == 0) {
+        return PIXEL_POOL_MIN_SIZE;
+    }
+    pool_class--;
+    shift = PIXEL_POOL_MIN_SHIFT + 1 + pool_class / 4;
+    return ((size_t)1 << (shift - 1)) + (pool_class % 4 + 1) * ((size_t)1 << (shift - 3));
+}
+
+static void pixel_buffer_free(PixelBuffer *buf)
+{
+#ifdef HAVE_SYS_MMAN_H
+    if (buf->mapped) {
+        munmap(buf->alloc, buf->size);
+        return;
+    }
+#endif
+    free(buf->alloc);
+}
+
+static int pixel_buffer_map(PixelBuffer *buf, size_t size)
+{
+#ifdef HAVE_SYS_MMAN_H
+    uint8_t *map, *start;
+    size_t head;
+
+    size = SPICE_ALIGN(size, 4096);
+    /* over-map so the buffer can be aligned for transparent huge pages */
+    map = mmap(NULL, size + PIXEL_POOL_HUGE_SIZE, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        return FALSE;
+    }
+    start = (uint8_t *)SPICE_ALIGN((uintptr_t)map, PIXEL_POOL_HUGE_SIZE);
+    head = start - map;
+    if (head) {
+        munmap(map, head);
+    }
+    munmap(start + size, PIXEL_POOL_HUGE_SIZE - head);
+#ifdef MADV_HUGEPAGE
+    madvise(start, size, MADV_HUGEPAGE);
+#endif
+    buf->alloc = start;
+    buf->data = start;
+    buf->size = size;
+    buf->mapped = TRUE;
+    buf->zeroed = TRUE;
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+static void pixel_buffer_alloc(PixelBuffer *buf, size_t size)
+{
+    int pool_class = pixel_pool_get_class(size);
+
+    if (pool_class >= 0) {
+        g_mutex_lock(&pixel_pool.lock);
+        if (pixel_pool.n_free[pool_class] > 0) {
+            *buf = pixel_pool.free_bufs[pool_class][--pixel_pool.n_free[pool_class]];
+            pixel_pool.cached -= buf->size;
+            g_mutex_unlock(&pixel_pool.lock);
+            buf->zeroed = FALSE;
+            return;
+        }
+        g_mutex_unlock(&pixel_pool.lock);
+        size = pixel_pool_class_size(pool_class);
+    }
+
+    buf->pool_class = pool_class;
+    if (size >= PIXEL_POOL_HUGE_SIZE && pixel_buffer_map(buf, size)) {
+        return;
+    }
+    buf->alloc = spice_malloc(size + PIXEL_POOL_ALIGN - 1);
+    buf->data = (uint8_t *)SPICE_ALIGN((uintptr_t)buf->alloc, PIXEL_POOL_ALIGN);
+    buf->size = size;
+    buf->mapped = FALSE;
+    buf->zeroed = FALSE;
+}
+
+static void pixel_buffer_release(PixelBuffer *buf)
+{
+    int pool_class = buf->pool_class;
+
+    if (pool_class >= 0) {
+        g_mutex_lock(&pixel_pool.lock);
+        if (pixel_pool.n_free[pool_class] < PIXEL_POOL_CLASS_MAX_FREE &&
+            pixel_pool.cached + buf->size <= PIXEL_POOL_MAX_CACHED) {
+            pixel_pool.free_bufs[pool_class][pixel_pool.n_free[pool_class]++] = *buf;
+            pixel_pool.cached += buf->size;
+            g_mutex_unlock(&pixel_pool.lock);
+            return;
+        }
+        g_mutex_unlock(&pixel_pool.lock);
+    }
+    pixel_buffer_free(buf);
+}
+
+void surface_pool_flush(void)
+{
+    int i;
+
+    g_mutex_lock(&pixel_pool.lock);
+    for (i = 0; i < PIXEL_POOL_N_CLASSES; i++) {
+        while (pixel_pool.n_free[i] > 0) {
+            pixel_buffer_free(&pixel_pool.free_bufs[i][--pixel_pool.n_free[i]]);
+        }
+    }
+    pixel_pool.cached = 0;
+    g_mutex_unlock(&pixel_pool.lock);
+}
+
+int surface_pool_get_n_free(size_t *cached)
+{
+    int i, n_free = 0;
+
+    g_mutex_lock(&pixel_pool.lock);
+    for (i = 0; i < PIXEL_POOL_N_CLASSES; i++) {
+        n_free += pixel_pool.n_free[i];
+    }
+    if (cached) {
+        *cached = pixel_pool.cached;
+    }
+    g_mutex_unlock(&pixel_pool.lock);
+    return n_free;
+}
+
+typedef struct PixmanData {
+    PixelBuffer buf;
     pixman_format_code_t format;
 } PixmanData;
 
@@ -30,7 +221,9 @@ static void release_data(SPICE_GNUC_UNUSED pixman_image_t *image,
 {
     PixmanData *data = (PixmanData *)release_data;
 
-    free(data->data);
+    if (data->buf.data) {
+        pixel_buffer_release(&data->buf);
+    }
 
     free(data);
 }
@@ -81,46 +274,55 @@ int spice_pixman_image_get_format(pixman_image_t *image, pixman_format_code_t *f
     return 0;
 }
 
-pixman_image_t *surface_create_stride(pixman_format_code_t format, int width, int height,
-                                      int stride)
+static pixman_image_t *surface_create_from_pool(pixman_format_code_t format, int width,
+                                                int height, int stride, int zero)
 {
-    uint8_t *data;
+    PixelBuffer buf;
     uint8_t *stride_data;
     pixman_image_t *surface;
     PixmanData *pixman_data;
 
-    data = (uint8_t *)spice_malloc_n(abs(stride), height);
+    if (abs(stride) != 0 && (size_t)height > SIZE_MAX / abs(stride)) {
+        spice_error("create surface failed, out of memory");
+    }
+    pixel_buffer_alloc(&buf, (size_t)abs(stride) * height);
+    if (zero && !buf.zeroed) {
+        memset(buf.data, 0, (size_t)abs(stride) * height);
+    }
     if (stride < 0) {
-        stride_data = data + (-stride) * (height - 1);
+        stride_data = buf.data + (-stride) * (height - 1);
     } else {
-        stride_data = data;
+        stride_data = buf.data;
     }
 
     surface = pixman_image_create_bits(format, width, height, (uint32_t *)stride_data, stride);
 
     if (surface == NULL) {
-        free(data);
-        data = NULL;
+        pixel_buffer_release(&buf);
         spice_error("create surface failed, out of memory");
     }
 
     pixman_data = pixman_image_add_data(surface);
-    pixman_data->data = data;
+    pixman_data->buf = buf;
     pixman_data->format = format;
 
     return surface;
 }
 
+pixman_image_t *surface_create_stride(pixman_format_code_t format, int width, int height,
+                                      int stride)
+{
+    return surface_create_from_pool(format, width, height, stride, FALSE);
+}
+
 pixman_image_t * surface_create(pixman_format_code_t format, int width, int height, int top_down)
 {
     if (top_down) {
-        pixman_image_t *surface;
-        PixmanData *data;
+        /* cleared like the pixman allocated bits callers used to get, with
+         * rows aligned for the SIMD kernels */
+        int stride = SPICE_ALIGN((width * PIXMAN_FORMAT_BPP(format) + 7) / 8, PIXEL_POOL_ALIGN);
 
-        surface = pixman_image_create_bits(format, width, height, NULL, 0);
-        data = pixman_image_add_data(surface);
-        data->format = format;
-        return surface;
+        return surface_create_from_pool(format, width, height, stride, TRUE);
     } else {
         // NOTE: we assume here that the lz decoders always decode to RGB32.
         int stride = 0;
@@ -37,6 +37,13 @@ pixman_image_t *surface_create(pixman_format_code_t format, int width, int heigh
 pixman_image_t *surface_create_stride(pixman_format_code_t format, int width, int height,
                                       int stride);
 
+/* Frees the pixel buffers cached for reuse by the surface_create*() calls */
+void surface_pool_flush(void);
+
+/* Returns the number of pixel buffers cached for reuse and, if cached is not
+ * NULL, their total size, mostly for the tests */
+int surface_pool_get_n_free(size_t *cached);
+
 
 typedef struct LzDecodeUsrData {
     pixman_image_t       *out_surface;
@@ -0,0 +1,287 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include <config.h>
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "image_classify.h"
+#include "log.h"
+#include "macros.h"
+
+/* The image is sampled on about CLASSIFY_LINES lines, each one giving
+ * CLASSIFY_SEGMENTS runs of CLASSIFY_SEGMENT_WIDTH pixels. This is a few
+ * thousand pixels whatever the image size */
+#define CLASSIFY_LINES 64
+#define CLASSIFY_SEGMENTS 8
+#define CLASSIFY_SEGMENT_WIDTH 16
+
+/* Largest channel difference between neighbours still considered a smooth
+ * gradient, and smallest one considered an edge */
+#define CLASSIFY_SMOOTH_DIFF 24
+#define CLASSIFY_EDGE_DIFF 96
+
+/* Per mille of edges past which an image is kept lossless */
+#define CLASSIFY_SHARP_EDGES 200
+
+#define COLOR_SET_BITS 11
+#define COLOR_SET_SIZE (1 << COLOR_SET_BITS)
+#define COLOR_SET_EMPTY 0xffffffffu
+
+typedef struct ColorSet {
+    uint32_t table[COLOR_SET_SIZE];
+    int has_empty;
+    uint32_t count;
+} ColorSet;
+
+typedef struct PairCounts {
+    uint32_t pairs;
+    uint32_t flat;
+    uint32_t smooth;
+    uint32_t edges;
+} PairCounts;
+
+typedef uint32_t (*ReadPixelFunc)(const uint8_t *pixel);
+
+static void color_set_init(ColorSet *set)
+{
+    SPICE_VERIFY(COLOR_SET_SIZE >= 2 * SPICE_IMAGE_CLASSIFY_MAX_COLORS);
+
+    memset(set->table, 0xff, sizeof(set->table));
+    set->has_empty = FALSE;
+    set->count = 0;
+}
+
+static void color_set_add(ColorSet *set, uint32_t color)
+{
+    uint32_t i;
+
+    if (set->count >= SPICE_IMAGE_CLASSIFY_MAX_COLORS) {
+        return;
+    }
+    /* the empty marker is a valid colour, track it apart */
+    if (color == COLOR_SET_EMPTY) {
+        if (!set->has_empty) {
+            set->has_empty = TRUE;
+            set->count++;
+        }
+        return;
+    }
+
+    i = (color * 0x9e3779b1u) >> (32 - COLOR_SET_BITS);
+    while (set->table[i] != COLOR_SET_EMPTY) {
+        if (set->table[i] == color) {
+            return;
+        }
+        i = (i + 1) & (COLOR_SET_SIZE - 1);
+    }
+    set->table[i] = color;
+    set->count++;
+}
+
+static uint32_t read_pixel_32(const uint8_t *pixel)
+{
+    uint32_t value;
+
+    memcpy(&value, pixel, 4);
+    return value;
+}
+
+/* alpha in the low byte, move it to the top one */
+static uint32_t read_pixel_32_bgra(const uint8_t *pixel)
+{
+    uint32_t value;
+
+    memcpy(&value, pixel, 4);
+    return (value >> 8) | (value << 24);
+}
+
+static uint32_t read_pixel_24(const uint8_t *pixel)
+{
+    return pixel[0] | (pixel[1] << 8) | (pixel[2] << 16);
+}
+
+static uint32_t read_pixel_565(const uint8_t *pixel)
+{
+    uint16_t value;
+
+    memcpy(&value, pixel, 2);
+    return ((value & 0xf800) << 8) | ((value & 0x07e0) << 5) | ((value & 0x001f) << 3);
+}
+
+static uint32_t read_pixel_555(const uint8_t *pixel)
+{
+    uint16_t value;
+
+    memcpy(&value, pixel, 2);
+    return ((value & 0x7c00) << 9) | ((value & 0x03e0) << 6) | ((value & 0x001f) << 3);
+}
+
+static void count_pair(PairCounts *counts, uint32_t a, uint32_t b)
+{
+    int diff = 0;
+    int shift;
+
+    for (shift = 0; shift < 32; shift += 8) {
+        int d = abs((int)((a >> shift) & 0xff) - (int)((b >> shift) & 0xff));
+        diff = MAX(diff, d);
+    }
+
+    counts->pairs++;
+    if (diff == 0) {
+        counts->flat++;
+    } else if (diff <= CLASSIFY_SMOOTH_DIFF) {
+        counts->smooth++;
+    } else if (diff >= CLASSIFY_EDGE_DIFF) {
+        counts->edges++;
+    }
+}
+
+/* The thresholds come from comparing the encoders on desktop captures,
+ * the expected ratios are only an order of magnitude */
+static void classify_decide(SpiceImageClass *result, int allow_lossy)
+{
+    double flat = result->flat / 1000.0;
+    double smooth = result->smooth / 1000.0;
+
+    if (result->colors <= 16 || (result->colors <= 256 && result->flat >= 500)) {
+        /* text and flat UI, LZ finds long matches */
+        result->type = SPICE_IMAGE_TYPE_LZ_RGB;
+        result->expected_ratio = 1.0 / (1.0 - 0.95 * flat);
+    } else if (result->flat >= 350) {
+        /* synthetic content with anti-aliasing or gradients, still
+         * repetitive enough for a fast dictionary coder */
+        result->type = SPICE_IMAGE_TYPE_LZ4;
+        result->expected_ratio = MAX(1.0, 0.8 / (1.0 - 0.9 * flat));
+    } else if (result->edges >= CLASSIFY_SHARP_EDGES) {
+        /* dense text or line art over a busy background, JPEG would ring
+         * around the edges and QUIC predicts them badly */
+        result->type = SPICE_IMAGE_TYPE_LZ_RGB;
+        result->expected_ratio = 1.0 / (1.0 - 0.8 * flat);
+    } else if (allow_lossy) {
+        /* photos and video-like content */
+        result->type = result->uses_alpha ? SPICE_IMAGE_TYPE_JPEG_ALPHA : SPICE_IMAGE_TYPE_JPEG;
+        result->expected_ratio = 6.0 + 14.0 * smooth;
+        if (result->uses_alpha) {
+            result->expected_ratio *= 0.7;
+        }
+    } else {
+        result->type = SPICE_IMAGE_TYPE_QUIC;
+        result->expected_ratio = 1.5 + 2.5 * smooth;
+    }
+}
+
+int spice_image_classify(pixman_image_t *image, const SpiceRect *area,
+                         int allow_lossy, SpiceImageClass *result)
+{
+    pixman_format_code_t format = pixman_image_get_format(image);
+    int bpp = PIXMAN_FORMAT_BPP(format);
+    int bytes_per_pixel = bpp / 8;
+    int stride = pixman_image_get_stride(image);
+    uint8_t *data = (uint8_t *)pixman_image_get_data(image);
+    uint32_t mask = 0xffffffff;
+    int has_alpha = FALSE;
+    ReadPixelFunc read_pixel;
+    ColorSet colors;
+    PairCounts counts = { 0, };
+    int x1, y1, x2, y2;
+    int line_step, segment_step;
+    int x, y;
+
+    memset(result, 0, sizeof(*result));
+
+    switch (bpp) {
+    case 32:
+        if (PIXMAN_FORMAT_TYPE(format) == PIXMAN_TYPE_BGRA) {
+            read_pixel = read_pixel_32_bgra;
+        } else if (PIXMAN_FORMAT_TYPE(format) == PIXMAN_TYPE_ARGB ||
+                   PIXMAN_FORMAT_TYPE(format) == PIXMAN_TYPE_ABGR) {
+            read_pixel = read_pixel_32;
+        } else {
+            return FALSE;
+        }
+        has_alpha = PIXMAN_FORMAT_A(format) != 0;
+        if (!has_alpha) {
+            mask = 0x00ffffff;
+        }
+        break;
+    case 24:
+        read_pixel = read_pixel_24;
+        break;
+    case 16:
+        read_pixel = PIXMAN_FORMAT_G(format) == 6 ? read_pixel_565 : read_pixel_555;
+        break;
+    default:
+        return FALSE;
+    }
+
+    x1 = 0;
+    y1 = 0;
+    x2 = pixman_image_get_width(image);
+    y2 = pixman_image_get_height(image);
+    if (area) {
+        x1 = MAX(x1, area->left);
+        y1 = MAX(y1, area->top);
+        x2 = MIN(x2, area->right);
+        y2 = MIN(y2, area->bottom);
+    }
+    if (x1 >= x2 || y1 >= y2) {
+        return FALSE;
+    }
+
+    line_step = MAX(1, (y2 - y1) / CLASSIFY_LINES);
+    segment_step = MAX(CLASSIFY_SEGMENT_WIDTH, (x2 - x1) / CLASSIFY_SEGMENTS);
+    color_set_init(&colors);
+
+    for (y = y1; y < y2; y += line_step) {
+        const uint8_t *line = data + y * stride;
+        const uint8_t *below = y + 1 < y2 ? line + stride : NULL;
+        int segment;
+
+        for (segment = x1; segment < x2; segment += segment_step) {
+            int end = MIN(segment + CLASSIFY_SEGMENT_WIDTH, x2);
+            uint32_t pixel = read_pixel(line + segment * bytes_per_pixel) & mask;
+
+            for (x = segment; x < end; x++) {
+                result->samples++;
+                color_set_add(&colors, pixel);
+                if (has_alpha && (pixel >> 24) != 0xff) {
+                    result->uses_alpha = TRUE;
+                }
+                if (below) {
+                    count_pair(&counts, pixel, read_pixel(below + x * bytes_per_pixel) & mask);
+                }
+                if (x + 1 < x2) {
+                    uint32_t right = read_pixel(line + (x + 1) * bytes_per_pixel) & mask;
+
+                    count_pair(&counts, pixel, right);
+                    pixel = right;
+                }
+            }
+        }
+    }
+
+    result->colors = colors.count;
+    if (counts.pairs) {
+        result->flat = (uint64_t)counts.flat * 1000 / counts.pairs;
+        result->smooth = (uint64_t)counts.smooth * 1000 / counts.pairs;
+        result->edges = (uint64_t)counts.edges * 1000 / counts.pairs;
+    }
+    classify_decide(result, allow_lossy);
+    return TRUE;
+}
@@ -0,0 +1,57 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef H_SPICE_COMMON_IMAGE_CLASSIFY
+#define H_SPICE_COMMON_IMAGE_CLASSIFY
+
+#include <stdint.h>
+#include <spice/enums.h>
+#include <spice/macros.h>
+
+#include "pixman_utils.h"
+
+SPICE_BEGIN_DECLS
+
+/* Colours are counted up to this value */
+#define SPICE_IMAGE_CLASSIFY_MAX_COLORS 1024
+
+/* Statistics computed on a sample of the pixels of an image.
+ * The flat, smooth and edges ratios are in per mille of the pairs of
+ * neighbour pixels sampled. */
+typedef struct SpiceImageClass {
+    uint32_t samples;
+    uint32_t colors;
+    uint32_t flat;
+    uint32_t smooth;
+    uint32_t edges;
+    int uses_alpha;
+
+    /* recommended encoding and rough expected compression ratio */
+    SpiceImageType type;
+    double expected_ratio;
+} SpiceImageClass;
+
+/* Sample the area of image (or the whole image if area is NULL) and pick
+ * between QUIC, LZ, LZ4 and, if allow_lossy is set, JPEG.
+ * Returns FALSE if the format is not supported or the area is empty. */
+int spice_image_classify(pixman_image_t *image, const SpiceRect *area,
+                         int allow_lossy, SpiceImageClass *result);
+
+SPICE_END_DECLS
+
+#endif
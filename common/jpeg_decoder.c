@@ -0,0 +1,250 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include <config.h>
+
+#include "jpeg_decoder.h"
+
+#ifdef HAVE_JPEG
+
+#include <stdio.h>
+#include <setjmp.h>
+#include <jpeglib.h>
+
+#include "mem.h"
+#include "log.h"
+
+#ifndef JCS_EXTENSIONS
+#error "the JPEG decoder needs libjpeg-turbo"
+#endif
+
+/* number of lines given to each jpeg_read_scanlines() call */
+#define JPEG_MAX_LINES 16
+
+typedef struct JpegErrorManager {
+    struct jpeg_error_mgr base;
+    jmp_buf jmp;
+} JpegErrorManager;
+
+typedef struct JpegDecoder {
+    SpiceJpegDecoder base;
+    struct jpeg_decompress_struct cinfo;
+    JpegErrorManager error;
+    /* begin_decode() read a header which decode() did not use yet */
+    int header_read;
+    int target_width;
+    int target_height;
+    /* a 32 bits line, for the formats libjpeg can't write directly */
+    uint8_t *line;
+    int line_size;
+} JpegDecoder;
+
+static void jpeg_decoder_error_exit(j_common_ptr cinfo)
+{
+    JpegErrorManager *error = SPICE_CONTAINEROF(cinfo->err, JpegErrorManager, base);
+    char message[JMSG_LENGTH_MAX];
+
+    cinfo->err->format_message(cinfo, message);
+    g_warning("jpeg decoding failed: %s", message);
+    longjmp(error->jmp, 1);
+}
+
+static void jpeg_decoder_output_message(j_common_ptr cinfo)
+{
+}
+
+/* Picks the smallest scale_num / 8 giving at least the target size */
+static void jpeg_decoder_set_scale(JpegDecoder *decoder)
+{
+    struct jpeg_decompress_struct *cinfo = &decoder->cinfo;
+    unsigned int num;
+
+    cinfo->scale_denom = 8;
+    for (num = 1; num < 8; num++) {
+        if ((cinfo->image_width * num + 7) / 8 >= (unsigned int)decoder->target_width &&
+            (cinfo->image_height * num + 7) / 8 >= (unsigned int)decoder->target_height) {
+            break;
+        }
+    }
+    cinfo->scale_num = num;
+}
+
+static void jpeg_decoder_begin_decode(SpiceJpegDecoder *spice_decoder,
+                                      uint8_t *data, int data_size,
+                                      int *out_width, int *out_height)
+{
+    JpegDecoder *decoder = SPICE_CONTAINEROF(spice_decoder, JpegDecoder, base);
+
+    *out_width = 0;
+    *out_height = 0;
+    if (setjmp(decoder->error.jmp)) {
+        jpeg_abort_decompress(&decoder->cinfo);
+        decoder->header_read = FALSE;
+        return;
+    }
+
+    /* forget about any image which was not decoded */
+    jpeg_abort_decompress(&decoder->cinfo);
+    decoder->header_read = FALSE;
+
+    jpeg_mem_src(&decoder->cinfo, data, data_size);
+    jpeg_read_header(&decoder->cinfo, TRUE);
+    if (decoder->target_width > 0 || decoder->target_height > 0) {
+        jpeg_decoder_set_scale(decoder);
+    }
+    jpeg_calc_output_dimensions(&decoder->cinfo);
+
+    decoder->header_read = TRUE;
+    *out_width = decoder->cinfo.output_width;
+    *out_height = decoder->cinfo.output_height;
+}
+
+static void jpeg_decoder_pack_555(uint16_t *dest, const uint8_t *line, int width)
+{
+    int x;
+
+    for (x = 0; x < width; x++, line += 4) {
+        dest[x] = ((line[2] >> 3) << 10) | ((line[1] >> 3) << 5) | (line[0] >> 3);
+    }
+}
+
+static void jpeg_decoder_decode(SpiceJpegDecoder *spice_decoder,
+                                uint8_t *dest, int stride, int format)
+{
+    JpegDecoder *decoder = SPICE_CONTAINEROF(spice_decoder, JpegDecoder, base);
+    struct jpeg_decompress_struct *cinfo = &decoder->cinfo;
+    JSAMPROW lines[JPEG_MAX_LINES];
+    int through_line;
+
+    spice_return_if_fail(decoder->header_read);
+    decoder->header_read = FALSE;
+
+    switch (format) {
+    case SPICE_BITMAP_FMT_32BIT:
+    case SPICE_BITMAP_FMT_RGBA:
+        /* libjpeg-turbo sets the unused byte to 0xff, opaque for RGBA */
+        cinfo->out_color_space = JCS_EXT_BGRX;
+        through_line = FALSE;
+        break;
+    case SPICE_BITMAP_FMT_24BIT:
+        cinfo->out_color_space = JCS_EXT_BGR;
+        through_line = FALSE;
+        break;
+    case SPICE_BITMAP_FMT_16BIT:
+        cinfo->out_color_space = JCS_EXT_BGRX;
+        through_line = TRUE;
+        break;
+    default:
+        g_warning("unsupported jpeg output format %d", format);
+        jpeg_abort_decompress(cinfo);
+        return;
+    }
+
+    if (setjmp(decoder->error.jmp)) {
+        jpeg_abort_decompress(cinfo);
+        return;
+    }
+
+    jpeg_start_decompress(cinfo);
+    if (through_line && decoder->line_size < (int)cinfo->output_width * 4) {
+        decoder->line_size = cinfo->output_width * 4;
+        decoder->line = spice_realloc(decoder->line, decoder->line_size);
+    }
+
+    while (cinfo->output_scanline < cinfo->output_height) {
+        int y = cinfo->output_scanline;
+        int i, n;
+
+        if (through_line) {
+            lines[0] = decoder->line;
+            if (jpeg_read_scanlines(cinfo, lines, 1) == 1) {
+                jpeg_decoder_pack_555((uint16_t *)(dest + y * stride), decoder->line,
+                                      cinfo->output_width);
+            }
+            continue;
+        }
+
+        n = MIN(JPEG_MAX_LINES, cinfo->output_height - y);
+        for (i = 0; i < n; i++) {
+            lines[i] = dest + (y + i) * stride;
+        }
+        jpeg_read_scanlines(cinfo, lines, n);
+    }
+    jpeg_finish_decompress(cinfo);
+}
+
+static void jpeg_decoder_set_target_size(SpiceJpegDecoder *spice_decoder, int width, int height)
+{
+    JpegDecoder *decoder = SPICE_CONTAINEROF(spice_decoder, JpegDecoder, base);
+
+    decoder->target_width = MAX(width, 0);
+    decoder->target_height = MAX(height, 0);
+}
+
+static SpiceJpegDecoderOps jpeg_decoder_ops = {
+    jpeg_decoder_begin_decode,
+    jpeg_decoder_decode,
+    jpeg_decoder_set_target_size,
+};
+
+SpiceJpegDecoder *spice_jpeg_decoder_new(void)
+{
+    JpegDecoder *decoder = spice_new0(JpegDecoder, 1);
+
+    decoder->base.ops = &jpeg_decoder_ops;
+    decoder->cinfo.err = jpeg_std_error(&decoder->error.base);
+    decoder->error.base.error_exit = jpeg_decoder_error_exit;
+    decoder->error.base.output_message = jpeg_decoder_output_message;
+    jpeg_create_decompress(&decoder->cinfo);
+    return &decoder->base;
+}
+
+void spice_jpeg_decoder_free(SpiceJpegDecoder *spice_decoder)
+{
+    JpegDecoder *decoder;
+
+    if (spice_decoder == NULL) {
+        return;
+    }
+    decoder = SPICE_CONTAINEROF(spice_decoder, JpegDecoder, base);
+    jpeg_destroy_decompress(&decoder->cinfo);
+    free(decoder->line);
+    free(decoder);
+}
+
+void spice_jpeg_decoder_set_target_size(SpiceJpegDecoder *spice_decoder, int width, int height)
+{
+    spice_return_if_fail(spice_decoder != NULL);
+    jpeg_decoder_set_target_size(spice_decoder, width, height);
+}
+
+#else
+
+SpiceJpegDecoder *spice_jpeg_decoder_new(void)
+{
+    return NULL;
+}
+
+void spice_jpeg_decoder_free(SpiceJpegDecoder *decoder)
+{
+}
+
+void spice_jpeg_decoder_set_target_size(SpiceJpegDecoder *decoder, int width, int height)
+{
+}
+
+#endif
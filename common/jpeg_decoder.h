@@ -0,0 +1,49 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef H_SPICE_COMMON_JPEG_DECODER
+#define H_SPICE_COMMON_JPEG_DECODER
+
+#include <spice/macros.h>
+
+#include "canvas_base.h"
+
+SPICE_BEGIN_DECLS
+
+/* Returns a SpiceJpegDecoder using libjpeg-turbo, or NULL if spice-common
+ * was built without it. The decoder writes the pixels straight in the
+ * SPICE_BITMAP_FMT_32BIT, RGBA, 24BIT or 16BIT layout asked by decode(),
+ * so 32 bits output can go directly to an x8r8g8b8 pixman surface. The
+ * libjpeg decompressor is kept from one image to the next. */
+SpiceJpegDecoder *spice_jpeg_decoder_new(void);
+
+void spice_jpeg_decoder_free(SpiceJpegDecoder *decoder);
+
+/* Makes the following begin_decode() calls scale the images down while
+ * decoding, using the smallest DCT scaling (from 1/8 to 1) giving at least
+ * width x height pixels. begin_decode() then returns the scaled size.
+ * Use 0, 0 to decode at full size again.
+ *
+ * This is the set_target_size() op of the decoder. A canvas sets it itself
+ * before each JPEG image it decodes: to the drawn size when a whole image
+ * is drawn scaled down, to 0, 0 otherwise. */
+void spice_jpeg_decoder_set_target_size(SpiceJpegDecoder *decoder, int width, int height);
+
+SPICE_END_DECLS
+
+#endif
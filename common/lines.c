@@ -458,7 +458,7 @@ miSubtractSpans (SpanGroup * spanGroup, Spans * sub)
     ymax = YMAX (sub);
     spans = spanGroup->group;
     for (i = spanGroup->count; i; i--, spans++) {
-        if (YMIN (spans) <= ymax && ymin <= YMAX (spans)) {
+        if (spans->count && YMIN (spans) <= ymax && ymin <= YMAX (spans)) {
             subCount = sub->count;
             subPt = sub->points;
             subWid = sub->widths;
@@ -720,17 +720,41 @@ UniquifySpansX (Spans * spans, DDXPointRec * newPoints, int *newWidths)
     return (newWidths - startNewWidths) + 1;
 }                               /* UniquifySpansX */
 
+/* Arena storage, contents are not preserved when growing */
+
 static void
-miDisposeSpanGroup (SpanGroup * spanGroup)
+miArenaReserveSpans (DDXPointPtr * points, int **widths, int *size, int count)
 {
-    int i;
-    Spans *spans;
+    if (count > *size) {
+        *size = MAX (count, *size * 2);
+        xfree (*points);
+        xfree (*widths);
+        *points = (DDXPointRec *)xalloc (*size * sizeof (DDXPointRec));
+        *widths = (int *)xalloc (*size * sizeof (int));
+    }
+}
 
-    for (i = 0; i < spanGroup->count; i++) {
-        spans = spanGroup->group + i;
-        xfree (spans->points);
-        xfree (spans->widths);
+static int *
+miArenaBuckets (SpiceSpanArena * arena, int count)
+{
+    if (count > arena->buckets_size) {
+        arena->buckets_size = MAX (count, arena->buckets_size * 2);
+        xfree (arena->buckets);
+        arena->buckets = (int *)xalloc (arena->buckets_size * sizeof (int));
     }
+    return arena->buckets;
+}
+
+void
+spice_canvas_span_arena_fini (SpiceSpanArena * arena)
+{
+    xfree (arena->group_points);
+    xfree (arena->group_widths);
+    xfree (arena->sort_points);
+    xfree (arena->sort_widths);
+    xfree (arena->buckets);
+    xfree (arena->boxes);
+    memset (arena, 0, sizeof (*arena));
 }
 
 static void
@@ -738,9 +762,9 @@ miFillUniqueSpanGroup (GCPtr pGC, SpanGroup * spanGroup, Boolean foreground)
 {
     int i;
     Spans *spans;
-    Spans *yspans;
-    int *ysizes;
+    int *ybuckets;
     int ymin, ylength;
+    SpiceSpanArena localArena, *arena;
 
     /* Outgoing spans for one big call to FillSpans */
     DDXPointPtr points;
@@ -758,114 +782,92 @@ miFillUniqueSpanGroup (GCPtr pGC, SpanGroup * spanGroup, Boolean foreground)
         xfree (spans->points);
         xfree (spans->widths);
     } else {
-        /* Yuck.  Gross.  Radix sort into y buckets, then sort x and uniquify */
-        /* This seems to be the fastest thing to do.  I've tried sorting on
-           both x and y at the same time rather than creating into all those
-           y buckets, but it was somewhat slower. */
+        /* Counting sort into y buckets stored back to back in the arena,
+           then sort x and uniquify each bucket in place */
+
+        arena = pGC->span_arena;
+        if (!arena) {
+            memset (&localArena, 0, sizeof (localArena));
+            arena = &localArena;
+        }
 
         ymin = spanGroup->ymin;
         ylength = spanGroup->ymax - ymin + 1;
 
-        /* Allocate Spans for y buckets */
-        yspans = (Spans*)xalloc (ylength * sizeof (Spans));
-        ysizes = (int *)xalloc (ylength * sizeof (int));
+        ybuckets = miArenaBuckets (arena, ylength + 1);
+        memset (ybuckets, 0, (ylength + 1) * sizeof (int));
 
-        if (!yspans || !ysizes) {
-            xfree (yspans);
-            xfree (ysizes);
-            miDisposeSpanGroup (spanGroup);
-            return;
-        }
+        /* Count the spans of every scanline, ymin and ymax only come from
+           the first and last spans of each group so check the range */
+        count = 0;
+        for (i = 0, spans = spanGroup->group; i != spanGroup->count; i++, spans++) {
+            int j;
 
-        for (i = 0; i != ylength; i++) {
-            ysizes[i] = 0;
-            yspans[i].count = 0;
-            yspans[i].points = NULL;
-            yspans[i].widths = NULL;
+            for (j = 0, points = spans->points; j != spans->count; j++, points++) {
+                int index = points->y - ymin;
+
+                if (index >= 0 && index < ylength) {
+                    ybuckets[index + 1]++;
+                    count++;
+                }
+            }
+        }
+        for (i = 1; i <= ylength; i++) {
+            ybuckets[i] += ybuckets[i - 1];
         }
 
-        /* Go through every single span and put it into the correct bucket */
-        count = 0;
+        /* Scatter, ybuckets[index] becomes the end of the bucket */
+        miArenaReserveSpans (&arena->group_points, &arena->group_widths,
+                             &arena->group_size, count);
         for (i = 0, spans = spanGroup->group; i != spanGroup->count; i++, spans++) {
-            int index;
             int j;
 
             for (j = 0, points = spans->points, widths = spans->widths;
                  j != spans->count; j++, points++, widths++) {
-                index = points->y - ymin;
-                if (index >= 0 && index < ylength) {
-                    Spans *newspans = &(yspans[index]);
-                    if (newspans->count == ysizes[index]) {
-                        DDXPointPtr newpoints;
-                        int *newwidths;
-                        ysizes[index] = (ysizes[index] + 8) * 2;
-                        newpoints = xrealloc (newspans->points,
-                                              ysizes[index] * sizeof (DDXPointRec));
-                        newwidths = xrealloc (newspans->widths,
-                                              ysizes[index] * sizeof (int));
-                        if (!newpoints || !newwidths) {
-                            for (i = 0; i < ylength; i++) {
-                                xfree (yspans[i].points);
-                                xfree (yspans[i].widths);
-                            }
-                            xfree (yspans);
-                            xfree (ysizes);
-                            xfree (newpoints);
-                            xfree (newwidths);
-                            miDisposeSpanGroup (spanGroup);
-                            return;
-                        }
-                        newspans->points = newpoints;
-                        newspans->widths = newwidths;
-                    }
-                    newspans->points[newspans->count] = *points;
-                    newspans->widths[newspans->count] = *widths;
-                    (newspans->count)++;
-                }               /* if y value of span in range */
-            }                   /* for j through spans */
-            count += spans->count;
+                int index = points->y - ymin;
+                int pos;
+
+                if (index < 0 || index >= ylength) {
+                    continue;
+                }
+                pos = ybuckets[index]++;
+                arena->group_points[pos] = *points;
+                arena->group_widths[pos] = *widths;
+            }
             xfree (spans->points);
             spans->points = NULL;
             xfree (spans->widths);
             spans->widths = NULL;
-        }                       /* for i thorough Spans */
-
-        /* Now sort by x and uniquify each bucket into the final array */
-        points = (DDXPointRec*)xalloc (count * sizeof (DDXPointRec));
-        widths = (int *)xalloc (count * sizeof (int));
-        if (!points || !widths) {
-            for (i = 0; i < ylength; i++) {
-                xfree (yspans[i].points);
-                xfree (yspans[i].widths);
-            }
-            xfree (yspans);
-            xfree (ysizes);
-            xfree (points);
-            xfree (widths);
-            return;
         }
+
+        /* Now sort by x and uniquify each bucket, the output never
+           overtakes the bucket being read */
+        points = arena->group_points;
+        widths = arena->group_widths;
         count = 0;
         for (i = 0; i != ylength; i++) {
-            int ycount = yspans[i].count;
-            if (ycount > 0) {
-                if (ycount > 1) {
-                    QuickSortSpansX (yspans[i].points, yspans[i].widths, ycount);
-                    count += UniquifySpansX (&(yspans[i]), &(points[count]), &(widths[count]));
-                } else {
-                    points[count] = yspans[i].points[0];
-                    widths[count] = yspans[i].widths[0];
-                    count++;
-                }
-                xfree (yspans[i].points);
-                xfree (yspans[i].widths);
+            int start = i ? ybuckets[i - 1] : 0;
+            int ycount = ybuckets[i] - start;
+
+            if (ycount > 1) {
+                Spans bucket;
+
+                bucket.count = ycount;
+                bucket.points = &points[start];
+                bucket.widths = &widths[start];
+                QuickSortSpansX (bucket.points, bucket.widths, ycount);
+                count += UniquifySpansX (&bucket, &(points[count]), &(widths[count]));
+            } else if (ycount == 1) {
+                points[count] = points[start];
+                widths[count] = widths[start];
+                count++;
             }
         }
 
         (*pGC->ops->FillSpans) (pGC, count, points, widths, TRUE, foreground);
-        xfree (points);
-        xfree (widths);
-        xfree (yspans);
-        xfree (ysizes);         /* use (DE)xalloc for these? */
+
+        if (arena == &localArena)
+            spice_canvas_span_arena_fini (&localArena);
     }
 
     spanGroup->count = 0;
@@ -1452,6 +1454,28 @@ miZeroClipLine (int xmin, int ymin, int xmax, int ymax,
     }\
 }
 
+/* The spans of a segment are monotonic in y, upward segments are reversed
+ * so that FillSpans always gets them sorted */
+static void
+miZeroLineFillSpans (GCPtr pGC, int Nspans, DDXPointPtr pspanInit, int *pwidthInit,
+                     int signdy)
+{
+    if (signdy < 0) {
+        int i, j;
+
+        for (i = 0, j = Nspans - 1; i < j; i++, j--) {
+            DDXPointRec tpt = pspanInit[i];
+            int tw = pwidthInit[i];
+
+            pspanInit[i] = pspanInit[j];
+            pwidthInit[i] = pwidthInit[j];
+            pspanInit[j] = tpt;
+            pwidthInit[j] = tw;
+        }
+    }
+    (*pGC->ops->FillSpans) (pGC, Nspans, pspanInit, pwidthInit, TRUE, TRUE);
+}
+
 void
 miZeroLine (GCPtr pGC, int mode,        /* Origin or Previous */
             int npt,            /* number of points */
@@ -1468,7 +1492,7 @@ miZeroLine (GCPtr pGC, int mode,        /* Origin or Previous */
     int result;
     int pt1_clipped, pt2_clipped = 0;
     Boolean new_span;
-    int signdx, signdy;
+    int signdx, signdy = 1;
     int clipdx, clipdy;
     int width, height;
     int adx, ady;
@@ -1522,7 +1546,7 @@ miZeroLine (GCPtr pGC, int mode,        /* Origin or Previous */
 
     while (--npt > 0) {
         if (Nspans > 0)
-            (*pGC->ops->FillSpans) (pGC, Nspans, pspanInit, pwidthInit, FALSE, TRUE);
+            miZeroLineFillSpans (pGC, Nspans, pspanInit, pwidthInit, signdy);
         Nspans = 0;
         new_span = TRUE;
         spans = pspanInit - 1;
@@ -1673,7 +1697,7 @@ miZeroLine (GCPtr pGC, int mode,        /* Origin or Previous */
     }
 
     if (Nspans > 0)
-        (*pGC->ops->FillSpans) (pGC, Nspans, pspanInit, pwidthInit, FALSE, TRUE);
+        miZeroLineFillSpans (pGC, Nspans, pspanInit, pwidthInit, signdy);
 
 out:
     xfree (pwidthInit);
@@ -3486,6 +3510,57 @@ static void QuickSortSpans(
     } while (numSpans > 1);
 }
 
+/* Sorts spans by y. Dense inputs use a counting sort through the arena,
+   small or sparse ones QuickSortSpans() */
+static void
+SortSpansY (SpiceSpanArena * arena, DDXPointPtr spans, int *widths, int numSpans)
+{
+    int *ybuckets;
+    int ymin, ymax, ylength;
+    int i, sorted = TRUE;
+
+    if (numSpans < 2)
+        return;
+
+    ymin = ymax = spans[0].y;
+    for (i = 1; i < numSpans; i++) {
+        int y = spans[i].y;
+
+        if (y < spans[i - 1].y)
+            sorted = FALSE;
+        if (y < ymin)
+            ymin = y;
+        else if (y > ymax)
+            ymax = y;
+    }
+    if (sorted)
+        return;
+
+    ylength = ymax - ymin + 1;
+    if (numSpans < 32 || ylength > 4 * numSpans) {
+        QuickSortSpans (spans, widths, numSpans);
+        return;
+    }
+
+    ybuckets = miArenaBuckets (arena, ylength + 1);
+    memset (ybuckets, 0, (ylength + 1) * sizeof (int));
+    for (i = 0; i < numSpans; i++)
+        ybuckets[spans[i].y - ymin + 1]++;
+    for (i = 1; i <= ylength; i++)
+        ybuckets[i] += ybuckets[i - 1];
+
+    miArenaReserveSpans (&arena->sort_points, &arena->sort_widths,
+                         &arena->sort_size, numSpans);
+    for (i = 0; i < numSpans; i++) {
+        int pos = ybuckets[spans[i].y - ymin]++;
+
+        arena->sort_points[pos] = spans[i];
+        arena->sort_widths[pos] = widths[i];
+    }
+    memcpy (spans, arena->sort_points, numSpans * sizeof (DDXPointRec));
+    memcpy (widths, arena->sort_widths, numSpans * sizeof (int));
+}
+
 #define NextBand()                                                  \
 {                                                                   \
     clipy1 = pboxBandStart->y1;                                     \
@@ -3607,3 +3682,130 @@ int spice_canvas_clip_spans(pixman_region32_t *prgnDst,
     }
     return (pwidthNew - pwidthNewStart);
 }
+
+/* Number of previously emitted boxes looked at when merging a span */
+#define SPAN_MERGE_WINDOW 8
+
+static void
+AppendSpanBox(SpiceSpanArena *arena, int *pcount, int nspans,
+              int x1, int x2, int y)
+{
+    pixman_box32_t *boxes = arena->boxes;
+    pixman_box32_t *box;
+    int count = *pcount;
+    int i;
+
+    /* extend a box ending on the previous scanline with the same extent */
+    for (i = count - 1; i >= 0 && i >= count - SPAN_MERGE_WINDOW; i--) {
+        box = &boxes[i];
+        if (box->y2 == y && box->x1 == x1 && box->x2 == x2) {
+            box->y2++;
+            return;
+        }
+    }
+
+    if (count == arena->boxes_size) {
+        arena->boxes_size = MAX(MAX(arena->boxes_size * 2, nspans), 64);
+        boxes = xrealloc(boxes, arena->boxes_size * sizeof(pixman_box32_t));
+        arena->boxes = boxes;
+    }
+    box = &boxes[count];
+    box->x1 = x1;
+    box->y1 = y;
+    box->x2 = x2;
+    box->y2 = y + 1;
+    *pcount = count + 1;
+}
+
+/*
+    Same as spice_canvas_clip_spans(), but the clipped scanlines are merged
+    into rectangles as they are produced: a span with the same extent as
+    one on the scanline just above extends its rectangle.  The rectangles
+    are stored in arena->boxes, unsorted spans are sorted using the arena.
+    returns the number of rectangles.
+*/
+
+int spice_canvas_clip_spans_to_boxes(pixman_region32_t *prgnDst,
+                                     DDXPointPtr ppt,
+                                     int         *pwidth,
+                                     int                 nspans,
+                                     int                 fSorted,
+                                     SpiceSpanArena      *arena)
+{
+    DDXPointPtr pptLast;
+    int         y, x1, x2;
+    int         numRects;
+    int         numBoxes = 0;
+    int         nspansIn = nspans;
+    pixman_box32_t *pboxBandStart;
+
+    pptLast = ppt + nspans;
+
+    pboxBandStart = pixman_region32_rectangles (prgnDst, &numRects);
+
+    if (numRects == 1) {
+        int clipx1, clipx2, clipy1, clipy2;
+
+        clipx1 = pboxBandStart->x1;
+        clipy1 = pboxBandStart->y1;
+        clipx2 = pboxBandStart->x2;
+        clipy2 = pboxBandStart->y2;
+
+        for (; ppt != pptLast; ppt++, pwidth++) {
+            y = ppt->y;
+            x1 = ppt->x;
+            if (clipy1 <= y && y < clipy2) {
+                x2 = x1 + *pwidth;
+                if (x1 < clipx1)
+                    x1 = clipx1;
+                if (x2 > clipx2)
+                    x2 = clipx2;
+                if (x1 < x2) {
+                    AppendSpanBox(arena, &numBoxes, nspansIn, x1, x2, y);
+                }
+            }
+        }
+    } else if (numRects != 0) {
+        pixman_box32_t *pboxBandEnd, *pbox, *pboxLast;
+        int clipy1, clipy2;
+
+        if (! fSorted)
+            SortSpansY(arena, ppt, pwidth, nspans);
+
+        pboxLast = pboxBandStart + numRects;
+
+        NextBand();
+
+        for (; ppt != pptLast; ) {
+            y = ppt->y;
+            if (y < clipy2) {
+                pbox = pboxBandStart;
+                x1 = ppt->x;
+                x2 = x1 + *pwidth;
+                do {
+                    int newx1, newx2;
+
+                    newx1 = x1;
+                    newx2 = x2;
+                    if (newx1 < pbox->x1)
+                        newx1 = pbox->x1;
+                    if (newx2 > pbox->x2)
+                        newx2 = pbox->x2;
+                    if (newx1 < newx2) {
+                        AppendSpanBox(arena, &numBoxes, nspansIn,
+                                      newx1, newx2, y);
+                    }
+                    pbox++;
+                } while (pbox != pboxBandEnd);
+                ppt++;
+                pwidth++;
+            } else {
+                pboxBandStart = pboxBandEnd;
+                if (pboxBandStart == pboxLast)
+                    break;
+                NextBand();
+            }
+        }
+    }
+    return numBoxes;
+}
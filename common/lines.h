@@ -60,6 +60,22 @@ SPICE_BEGIN_DECLS
 
 typedef struct lineGC lineGC;
 
+/* Scratch storage used to sort, merge and clip spans. It can be kept
+ * across calls and strokes, and is released with
+ * spice_canvas_span_arena_fini() */
+typedef struct SpiceSpanArena {
+    SpicePoint *group_points;
+    int *group_widths;
+    int group_size;
+    SpicePoint *sort_points;
+    int *sort_widths;
+    int sort_size;
+    int *buckets;
+    int buckets_size;
+    pixman_box32_t *boxes;
+    int boxes_size;
+} SpiceSpanArena;
+
 typedef struct {
     void (*FillSpans)(lineGC * pGC,
                       int num_spans, SpicePoint * points, int *widths,
@@ -81,6 +97,8 @@ struct lineGC {
     unsigned int capStyle:2;
     unsigned int joinStyle:2;
     lineGCOps *ops;
+    /* optional, a temporary arena is used when NULL */
+    SpiceSpanArena *span_arena;
 };
 
 /* CoordinateMode for drawing routines */
@@ -130,6 +148,13 @@ extern int spice_canvas_clip_spans(pixman_region32_t *clip_region,
                                    SpicePoint *new_points,
                                    int *new_widths,
                                    int sorted);
+extern int spice_canvas_clip_spans_to_boxes(pixman_region32_t *clip_region,
+                                            SpicePoint *points,
+                                            int *widths,
+                                            int num_spans,
+                                            int sorted,
+                                            SpiceSpanArena *arena);
+extern void spice_canvas_span_arena_fini(SpiceSpanArena *arena);
 
 SPICE_END_DECLS
 
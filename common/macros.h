@@ -63,4 +63,16 @@
 #define SPICE_UNREACHABLE for(;;) continue
 #endif
 
+/* Functions compiled for a specific instruction set, to be selected at
+ * runtime with spice_cpu_supports() */
+#if defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define SPICE_X86_SIMD 1
+#define SPICE_ATTR_TARGET(isa) __attribute__((target(isa)))
+#define spice_cpu_supports(isa) (__builtin_cpu_init(), __builtin_cpu_supports(isa))
+#else
+#define SPICE_ATTR_TARGET(isa)
+#define spice_cpu_supports(isa) 0
+#endif
+
 #endif // H_SPICE_COMMON_MACROS
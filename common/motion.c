@@ -0,0 +1,726 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include <config.h>
+
+#include <string.h>
+#include <stdlib.h>
+#include <glib.h>
+
+#include "motion.h"
+#include "mem.h"
+#include "log.h"
+#include "macros.h"
+#include "utils.h"
+
+#ifdef SPICE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/* Changes are tracked per line, in spans of this many pixels */
+#define MOTION_TILE_WIDTH 16
+
+/* Lines and columns are hashed in strips of this many pixels */
+#define MOTION_STRIP_SIZE 64
+
+/* Minimum number of line or column strips which must agree on a shift */
+#define MOTION_MIN_VOTES 4
+
+#define MOTION_HASH_MULT UINT64_C(0x9e3779b97f4a7c15)
+
+/* Bands of blocks compared by each thread of spice_diff_bits() */
+#define DIFF_MIN_BANDS_PER_THREAD 4
+
+typedef struct LineHash {
+    uint64_t hash;
+    int pos;
+} LineHash;
+
+/* Spans collected line by line. Lines with the same spans as the previous
+ * one extend the current band, so a scrolled block ends up as a few boxes */
+typedef struct MotionBands {
+    pixman_box32_t *boxes;
+    int num_boxes;
+    int max_boxes;
+    pixman_box32_t *band;
+    int band_size;
+    pixman_box32_t *line;
+    int line_size;
+} MotionBands;
+
+typedef struct DiffJob {
+    const uint8_t *old_data;
+    const uint8_t *new_data;
+    int old_stride;
+    int new_stride;
+    int width;
+    int bytes_per_pixel;
+    int block_size;
+    MotionBands bands;
+    int changed;
+} DiffJob;
+
+/* Returns TRUE if the len bytes at a and b differ */
+static int diff_bytes_c(const uint8_t *a, const uint8_t *b, size_t len)
+{
+    return memcmp(a, b, len) != 0;
+}
+
+static int (*diff_bytes_impl)(const uint8_t *a, const uint8_t *b, size_t len) = diff_bytes_c;
+
+#ifdef SPICE_X86_SIMD
+SPICE_ATTR_TARGET("sse2")
+static inline int diff_m128(__m128i a, __m128i b)
+{
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) != 0xffff;
+}
+
+SPICE_ATTR_TARGET("sse2")
+static int diff_bytes_sse2(const uint8_t *a, const uint8_t *b, size_t len)
+{
+    size_t i;
+
+    if (len < 16) {
+        return diff_bytes_c(a, b, len);
+    }
+    /* check 64 bytes at a time, differences are rare */
+    for (i = 0; i + 64 <= len; i += 64) {
+        __m128i a0 = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i a1 = _mm_loadu_si128((const __m128i *)(a + i + 16));
+        __m128i a2 = _mm_loadu_si128((const __m128i *)(a + i + 32));
+        __m128i a3 = _mm_loadu_si128((const __m128i *)(a + i + 48));
+        __m128i x0 = _mm_xor_si128(a0, _mm_loadu_si128((const __m128i *)(b + i)));
+        __m128i x1 = _mm_xor_si128(a1, _mm_loadu_si128((const __m128i *)(b + i + 16)));
+        __m128i x2 = _mm_xor_si128(a2, _mm_loadu_si128((const __m128i *)(b + i + 32)));
+        __m128i x3 = _mm_xor_si128(a3, _mm_loadu_si128((const __m128i *)(b + i + 48)));
+
+        if (diff_m128(_mm_or_si128(_mm_or_si128(x0, x1), _mm_or_si128(x2, x3)),
+                      _mm_setzero_si128())) {
+            return TRUE;
+        }
+    }
+    for (; i + 16 <= len; i += 16) {
+        if (diff_m128(_mm_loadu_si128((const __m128i *)(a + i)),
+                      _mm_loadu_si128((const __m128i *)(b + i)))) {
+            return TRUE;
+        }
+    }
+    /* the last vector overlaps the previous one */
+    if (i < len) {
+        return diff_m128(_mm_loadu_si128((const __m128i *)(a + len - 16)),
+                         _mm_loadu_si128((const __m128i *)(b + len - 16)));
+    }
+    return FALSE;
+}
+
+SPICE_ATTR_TARGET("avx2")
+static int diff_bytes_avx2(const uint8_t *a, const uint8_t *b, size_t len)
+{
+    size_t i;
+
+    if (len < 32) {
+        return diff_bytes_sse2(a, b, len);
+    }
+    for (i = 0; i + 128 <= len; i += 128) {
+        __m256i x0 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(a + i)),
+                                      _mm256_loadu_si256((const __m256i *)(b + i)));
+        __m256i x1 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(a + i + 32)),
+                                      _mm256_loadu_si256((const __m256i *)(b + i + 32)));
+        __m256i x2 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(a + i + 64)),
+                                      _mm256_loadu_si256((const __m256i *)(b + i + 64)));
+        __m256i x3 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(a + i + 96)),
+                                      _mm256_loadu_si256((const __m256i *)(b + i + 96)));
+        __m256i x = _mm256_or_si256(_mm256_or_si256(x0, x1), _mm256_or_si256(x2, x3));
+
+        if (!_mm256_testz_si256(x, x)) {
+            return TRUE;
+        }
+    }
+    for (; i + 32 <= len; i += 32) {
+        __m256i x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(a + i)),
+                                     _mm256_loadu_si256((const __m256i *)(b + i)));
+        if (!_mm256_testz_si256(x, x)) {
+            return TRUE;
+        }
+    }
+    if (i < len) {
+        __m256i x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(a + len - 32)),
+                                     _mm256_loadu_si256((const __m256i *)(b + len - 32)));
+        return !_mm256_testz_si256(x, x);
+    }
+    return FALSE;
+}
+#endif
+
+static inline uint64_t hash_mix(uint64_t hash, uint64_t value)
+{
+    hash = (hash ^ value) * MOTION_HASH_MULT;
+    return hash ^ (hash >> 29);
+}
+
+static uint64_t hash_bytes(const uint8_t *data, size_t len)
+{
+    uint64_t hash = len;
+    uint64_t value;
+
+    for (; len >= 8; data += 8, len -= 8) {
+        memcpy(&value, data, 8);
+        hash = hash_mix(hash, value);
+    }
+    if (len) {
+        value = 0;
+        memcpy(&value, data, len);
+        hash = hash_mix(hash, value);
+    }
+    return hash;
+}
+
+static void hash_lines(const uint8_t *line, int stride, int line_len,
+                       int height, uint64_t *hashes)
+{
+    int y;
+
+    for (y = 0; y < height; y++, line += stride) {
+        hashes[y] = hash_bytes(line, line_len);
+    }
+}
+
+static void hash_columns(const uint8_t *line, int stride, int bytes_per_pixel,
+                         int width, int height, uint64_t *hashes)
+{
+    uint64_t value = 0;
+    int x, y;
+
+    for (x = 0; x < width; x++) {
+        hashes[x] = height;
+    }
+    for (y = 0; y < height; y++, line += stride) {
+        const uint8_t *pixel = line;
+
+        for (x = 0; x < width; x++, pixel += bytes_per_pixel) {
+            memcpy(&value, pixel, bytes_per_pixel);
+            hashes[x] = hash_mix(hashes[x], value);
+        }
+    }
+}
+
+static int line_hash_cmp(const void *a, const void *b)
+{
+    const LineHash *ha = a;
+    const LineHash *hb = b;
+
+    if (ha->hash != hb->hash) {
+        return ha->hash < hb->hash ? -1 : 1;
+    }
+    return ha->pos - hb->pos;
+}
+
+/* Adds a vote for d to histogram for each changed line i which is a copy
+ * of old line i - d. Only lines whose content appears once in the old frame
+ * vote, so blank lines can't make up a shift on their own.
+ * Returns the number of changed lines. */
+static int vote_shifts(const uint64_t *old_hashes, const uint64_t *new_hashes,
+                       int n, int max_shift, int *histogram, LineHash *sorted)
+{
+    int i, d, changed = 0;
+
+    for (i = 0; i < n; i++) {
+        sorted[i].hash = old_hashes[i];
+        sorted[i].pos = i;
+    }
+    qsort(sorted, n, sizeof(LineHash), line_hash_cmp);
+
+    for (i = 0; i < n; i++) {
+        uint64_t hash = new_hashes[i];
+        int lo = 0, hi = n;
+
+        if (hash == old_hashes[i]) {
+            continue;
+        }
+        changed++;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (sorted[mid].hash < hash) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        if (lo == n || sorted[lo].hash != hash ||
+            (lo + 1 < n && sorted[lo + 1].hash == hash)) {
+            continue;
+        }
+        d = i - sorted[lo].pos;
+        if (abs(d) <= max_shift) {
+            histogram[d + max_shift]++;
+        }
+    }
+    return changed;
+}
+
+static int best_shift(const int *histogram, int max_shift, int *votes)
+{
+    int d, best = 0;
+
+    *votes = 0;
+    for (d = -max_shift; d <= max_shift; d++) {
+        if (histogram[d + max_shift] > *votes) {
+            *votes = histogram[d + max_shift];
+            best = d;
+        }
+    }
+    if (*votes < MOTION_MIN_VOTES) {
+        *votes = 0;
+        return 0;
+    }
+    return best;
+}
+
+static void bands_init(MotionBands *bands, int max_spans)
+{
+    bands->num_boxes = 0;
+    bands->max_boxes = 16;
+    bands->boxes = spice_new(pixman_box32_t, bands->max_boxes);
+    bands->band = spice_new(pixman_box32_t, max_spans);
+    bands->band_size = 0;
+    bands->line = spice_new(pixman_box32_t, max_spans);
+    bands->line_size = 0;
+}
+
+static void bands_add_span(MotionBands *bands, int x1, int x2)
+{
+    if (bands->line_size && bands->line[bands->line_size - 1].x2 == x1) {
+        bands->line[bands->line_size - 1].x2 = x2;
+        return;
+    }
+    bands->line[bands->line_size].x1 = x1;
+    bands->line[bands->line_size].x2 = x2;
+    bands->line_size++;
+}
+
+static void bands_flush(MotionBands *bands, int y)
+{
+    int i;
+
+    if (bands->num_boxes + bands->band_size > bands->max_boxes) {
+        while (bands->num_boxes + bands->band_size > bands->max_boxes) {
+            bands->max_boxes *= 2;
+        }
+        bands->boxes = spice_renew(pixman_box32_t, bands->boxes, bands->max_boxes);
+    }
+    for (i = 0; i < bands->band_size; i++) {
+        pixman_box32_t *box = &bands->boxes[bands->num_boxes++];
+
+        *box = bands->band[i];
+        box->y2 = y;
+    }
+    bands->band_size = 0;
+}
+
+static void bands_end_line(MotionBands *bands, int y)
+{
+    pixman_box32_t *tmp;
+    int i;
+
+    if (bands->line_size == bands->band_size) {
+        for (i = 0; i < bands->line_size; i++) {
+            if (bands->line[i].x1 != bands->band[i].x1 ||
+                bands->line[i].x2 != bands->band[i].x2) {
+                break;
+            }
+        }
+        if (i == bands->line_size) {
+            bands->line_size = 0;
+            return;
+        }
+    }
+
+    bands_flush(bands, y);
+    for (i = 0; i < bands->line_size; i++) {
+        bands->line[i].y1 = y;
+    }
+    tmp = bands->band;
+    bands->band = bands->line;
+    bands->band_size = bands->line_size;
+    bands->line = tmp;
+    bands->line_size = 0;
+}
+
+static void bands_free(MotionBands *bands)
+{
+    free(bands->boxes);
+    free(bands->band);
+    free(bands->line);
+}
+
+static void bands_finish(MotionBands *bands, int y, QRegion *region)
+{
+    bands_flush(bands, y);
+    pixman_region32_fini(region);
+    pixman_region32_init_rects(region, bands->boxes, bands->num_boxes);
+    bands_free(bands);
+}
+
+/* Compares the lines [y1, y2) in bands of block_size lines.
+ * Each line is first compared as a whole, so the unchanged parts of the
+ * frame only cost a pass over the memory, and a block is not compared
+ * anymore once it is known to differ */
+static void diff_worker(void *data, int y1, int y2)
+{
+    DiffJob *job = data;
+    int line_bytes = job->width * job->bytes_per_pixel;
+    int block_bytes = job->block_size * job->bytes_per_pixel;
+    int n_blocks = (job->width + job->block_size - 1) / job->block_size;
+    uint8_t *dirty = spice_malloc(n_blocks);
+    int y, b;
+
+    bands_init(&job->bands, n_blocks);
+    for (y = y1; y < y2; y += job->block_size) {
+        int band_end = MIN(y + job->block_size, y2);
+        int line, n_dirty = 0;
+
+        memset(dirty, 0, n_blocks);
+        for (line = y; line < band_end && n_dirty < n_blocks; line++) {
+            const uint8_t *old_line = job->old_data + line * job->old_stride;
+            const uint8_t *new_line = job->new_data + line * job->new_stride;
+
+            if (!diff_bytes_impl(old_line, new_line, line_bytes)) {
+                continue;
+            }
+            for (b = 0; b < n_blocks; b++) {
+                int offset = b * block_bytes;
+
+                if (!dirty[b] &&
+                    diff_bytes_impl(old_line + offset, new_line + offset,
+                                    MIN(block_bytes, line_bytes - offset))) {
+                    dirty[b] = TRUE;
+                    n_dirty++;
+                }
+            }
+        }
+
+        for (b = 0; b < n_blocks && n_dirty; b++) {
+            if (dirty[b]) {
+                bands_add_span(&job->bands, b * job->block_size,
+                               MIN((b + 1) * job->block_size, job->width));
+            }
+        }
+        job->changed |= n_dirty != 0;
+        bands_end_line(&job->bands, y);
+    }
+    bands_flush(&job->bands, y2);
+    free(dirty);
+}
+
+static void motion_clip_area(pixman_image_t *image, const SpiceRect *area,
+                             int *x1, int *y1, int *x2, int *y2)
+{
+    *x1 = 0;
+    *y1 = 0;
+    *x2 = pixman_image_get_width(image);
+    *y2 = pixman_image_get_height(image);
+    if (area) {
+        *x1 = MAX(*x1, area->left);
+        *y1 = MAX(*y1, area->top);
+        *x2 = MIN(*x2, area->right);
+        *y2 = MIN(*y2, area->bottom);
+    }
+}
+
+int spice_diff_bits(const uint8_t *old_data, int old_stride,
+                    const uint8_t *new_data, int new_stride,
+                    int width, int height, int bpp,
+                    int block_size, int n_threads, QRegion *damage)
+{
+    DiffJob *jobs;
+    pixman_box32_t *boxes;
+    int n_bands, num_boxes, i;
+    int changed = FALSE;
+
+    spice_return_val_if_fail(bpp >= 8 && bpp % 8 == 0, FALSE);
+    spice_return_val_if_fail(block_size > 0, FALSE);
+
+    pixman_region32_clear(damage);
+    if (width <= 0 || height <= 0) {
+        return FALSE;
+    }
+
+    n_bands = (height + block_size - 1) / block_size;
+    if (n_threads <= 0) {
+        n_threads = g_get_num_processors();
+    }
+    n_threads = MAX(1, MIN(n_threads, n_bands / DIFF_MIN_BANDS_PER_THREAD));
+
+    jobs = spice_new0(DiffJob, n_threads);
+    for (i = 0; i < n_threads; i++) {
+        DiffJob *job = &jobs[i];
+
+        job->old_data = old_data;
+        job->new_data = new_data;
+        job->old_stride = old_stride;
+        job->new_stride = new_stride;
+        job->width = width;
+        job->bytes_per_pixel = bpp / 8;
+        job->block_size = block_size;
+    }
+    spice_run_bands(diff_worker, jobs, sizeof(DiffJob), n_threads, 0, height, block_size);
+
+    num_boxes = 0;
+    for (i = 0; i < n_threads; i++) {
+        num_boxes += jobs[i].bands.num_boxes;
+        changed |= jobs[i].changed;
+    }
+
+    if (n_threads == 1) {
+        boxes = jobs[0].bands.boxes;
+    } else {
+        boxes = spice_new(pixman_box32_t, MAX(num_boxes, 1));
+        num_boxes = 0;
+        for (i = 0; i < n_threads; i++) {
+            /* the last jobs are not run if there are less bands than jobs */
+            if (jobs[i].bands.num_boxes == 0) {
+                continue;
+            }
+            memcpy(boxes + num_boxes, jobs[i].bands.boxes,
+                   jobs[i].bands.num_boxes * sizeof(pixman_box32_t));
+            num_boxes += jobs[i].bands.num_boxes;
+        }
+    }
+    pixman_region32_fini(damage);
+    pixman_region32_init_rects(damage, boxes, num_boxes);
+
+    if (boxes != jobs[0].bands.boxes) {
+        free(boxes);
+    }
+    for (i = 0; i < n_threads; i++) {
+        bands_free(&jobs[i].bands);
+    }
+    free(jobs);
+    return changed;
+}
+
+int spice_diff_images(pixman_image_t *old_image, pixman_image_t *new_image,
+                      const SpiceRect *area, int block_size, int n_threads,
+                      QRegion *damage)
+{
+    pixman_format_code_t format = pixman_image_get_format(new_image);
+    int bytes_per_pixel = PIXMAN_FORMAT_BPP(format) / 8;
+    int old_stride = pixman_image_get_stride(old_image);
+    int new_stride = pixman_image_get_stride(new_image);
+    int x1, y1, x2, y2, changed;
+
+    spice_return_val_if_fail(pixman_image_get_format(old_image) == format, FALSE);
+    spice_return_val_if_fail(pixman_image_get_width(old_image) ==
+                             pixman_image_get_width(new_image), FALSE);
+    spice_return_val_if_fail(pixman_image_get_height(old_image) ==
+                             pixman_image_get_height(new_image), FALSE);
+
+    motion_clip_area(new_image, area, &x1, &y1, &x2, &y2);
+    changed = spice_diff_bits((uint8_t *)pixman_image_get_data(old_image) +
+                              y1 * old_stride + x1 * bytes_per_pixel, old_stride,
+                              (uint8_t *)pixman_image_get_data(new_image) +
+                              y1 * new_stride + x1 * bytes_per_pixel, new_stride,
+                              x2 - x1, y2 - y1, PIXMAN_FORMAT_BPP(format),
+                              block_size, n_threads, damage);
+    pixman_region32_translate(damage, x1, y1);
+    return changed;
+}
+
+void spice_motion_init(SpiceMotion *motion)
+{
+    motion->dx = 0;
+    motion->dy = 0;
+    pixman_region32_init(&motion->copy_region);
+    pixman_region32_init(&motion->damage);
+}
+
+void spice_motion_destroy(SpiceMotion *motion)
+{
+    pixman_region32_fini(&motion->copy_region);
+    pixman_region32_fini(&motion->damage);
+}
+
+int spice_motion_detect(pixman_image_t *old_image, pixman_image_t *new_image,
+                        const SpiceRect *area, int max_shift,
+                        SpiceMotion *motion)
+{
+    pixman_format_code_t format;
+    MotionBands copy, damage;
+    uint64_t *old_hashes, *new_hashes;
+    uint8_t *old_data, *new_data;
+    int stride, bytes_per_pixel;
+    int x1, y1, x2, y2, width, height;
+    uint8_t *old_origin, *new_origin;
+    LineHash *sorted;
+    int *histogram;
+    int x, y, dx = 0, dy = 0;
+    int v_max, h_max, v_votes, h_votes = 0, changed;
+
+    format = pixman_image_get_format(new_image);
+    spice_return_val_if_fail(pixman_image_get_format(old_image) == format, FALSE);
+    spice_return_val_if_fail(pixman_image_get_width(old_image) ==
+                             pixman_image_get_width(new_image), FALSE);
+    spice_return_val_if_fail(pixman_image_get_height(old_image) ==
+                             pixman_image_get_height(new_image), FALSE);
+    spice_return_val_if_fail(pixman_image_get_stride(old_image) ==
+                             pixman_image_get_stride(new_image), FALSE);
+    spice_return_val_if_fail(PIXMAN_FORMAT_BPP(format) >= 8 &&
+                             PIXMAN_FORMAT_BPP(format) % 8 == 0, FALSE);
+
+    motion->dx = 0;
+    motion->dy = 0;
+    pixman_region32_clear(&motion->copy_region);
+    pixman_region32_clear(&motion->damage);
+
+    motion_clip_area(new_image, area, &x1, &y1, &x2, &y2);
+    if (x1 >= x2 || y1 >= y2) {
+        return FALSE;
+    }
+    width = x2 - x1;
+    height = y2 - y1;
+
+    bytes_per_pixel = PIXMAN_FORMAT_BPP(format) / 8;
+    stride = pixman_image_get_stride(new_image);
+    old_data = (uint8_t *)pixman_image_get_data(old_image);
+    new_data = (uint8_t *)pixman_image_get_data(new_image);
+
+    old_origin = old_data + y1 * stride + x1 * bytes_per_pixel;
+    new_origin = new_data + y1 * stride + x1 * bytes_per_pixel;
+    old_hashes = spice_new(uint64_t, MAX(width, height));
+    new_hashes = spice_new(uint64_t, MAX(width, height));
+    sorted = spice_new(LineHash, MAX(width, height));
+
+    /* The lines are hashed in strips so that a window scrolling inside the
+     * area still gives matching hashes away from its edges */
+    v_max = max_shift <= 0 || max_shift >= height ? height - 1 : max_shift;
+    histogram = spice_new0(int, 2 * v_max + 1);
+    for (x = 0, changed = 0; x < width; x += MOTION_STRIP_SIZE) {
+        int strip_width = MIN(MOTION_STRIP_SIZE, width - x);
+
+        hash_lines(old_origin + x * bytes_per_pixel, stride,
+                   strip_width * bytes_per_pixel, height, old_hashes);
+        hash_lines(new_origin + x * bytes_per_pixel, stride,
+                   strip_width * bytes_per_pixel, height, new_hashes);
+        changed += vote_shifts(old_hashes, new_hashes, height, v_max,
+                               histogram, sorted);
+    }
+    dy = best_shift(histogram, v_max, &v_votes);
+    free(histogram);
+
+    if (changed) {
+        h_max = max_shift <= 0 || max_shift >= width ? width - 1 : max_shift;
+        histogram = spice_new0(int, 2 * h_max + 1);
+        for (y = 0; y < height; y += MOTION_STRIP_SIZE) {
+            int strip_height = MIN(MOTION_STRIP_SIZE, height - y);
+
+            hash_columns(old_origin + y * stride, stride, bytes_per_pixel,
+                         width, strip_height, old_hashes);
+            hash_columns(new_origin + y * stride, stride, bytes_per_pixel,
+                         width, strip_height, new_hashes);
+            vote_shifts(old_hashes, new_hashes, width, h_max, histogram, sorted);
+        }
+        dx = best_shift(histogram, h_max, &h_votes);
+        free(histogram);
+    }
+
+    free(sorted);
+    free(old_hashes);
+    free(new_hashes);
+    if (!changed) {
+        return FALSE;
+    }
+
+    /* keep the shift which explains the most pixels */
+    if (v_votes >= h_votes) {
+        dx = 0;
+    } else {
+        dy = 0;
+    }
+
+    bands_init(&copy, width / MOTION_TILE_WIDTH + 3);
+    bands_init(&damage, width / MOTION_TILE_WIDTH + 3);
+
+    for (y = y1; y < y2; y++) {
+        const uint8_t *old_line = old_data + y * stride;
+        const uint8_t *new_line = new_data + y * stride;
+        const uint8_t *src_line = NULL;
+        int copy_x1 = x2, copy_x2 = x2;
+
+        if (!diff_bytes_impl(new_line + x1 * bytes_per_pixel, old_line + x1 * bytes_per_pixel,
+                             width * bytes_per_pixel)) {
+            bands_end_line(&copy, y);
+            bands_end_line(&damage, y);
+            continue;
+        }
+
+        if ((dx || dy) && y - dy >= y1 && y - dy < y2) {
+            src_line = old_data + (y - dy) * stride;
+            copy_x1 = MAX(x1, x1 + dx);
+            copy_x2 = MIN(x2, x2 + dx);
+        }
+
+        for (x = x1; x < x2; ) {
+            int tile_end = MIN(x + MOTION_TILE_WIDTH, x2);
+
+            /* split the tile where the shifted source starts or ends */
+            while (x < tile_end) {
+                int end, offset, len;
+
+                if (x < copy_x1) {
+                    end = MIN(tile_end, copy_x1);
+                } else if (x < copy_x2) {
+                    end = MIN(tile_end, copy_x2);
+                } else {
+                    end = tile_end;
+                }
+                offset = x * bytes_per_pixel;
+                len = (end - x) * bytes_per_pixel;
+
+                if (x >= copy_x1 && x < copy_x2 &&
+                    !diff_bytes_impl(new_line + offset, src_line + (x - dx) * bytes_per_pixel, len)) {
+                    bands_add_span(&copy, x, end);
+                } else if (diff_bytes_impl(new_line + offset, old_line + offset, len)) {
+                    bands_add_span(&damage, x, end);
+                }
+                x = end;
+            }
+        }
+        bands_end_line(&copy, y);
+        bands_end_line(&damage, y);
+    }
+
+    bands_finish(&copy, y2, &motion->copy_region);
+    bands_finish(&damage, y2, &motion->damage);
+
+    if (!pixman_region32_not_empty(&motion->copy_region)) {
+        return FALSE;
+    }
+    motion->dx = dx;
+    motion->dy = dy;
+    return TRUE;
+}
+
+SPICE_CONSTRUCTOR_FUNC(motion_global_init)
+{
+#ifdef SPICE_X86_SIMD
+    if (spice_cpu_supports("avx2")) {
+        diff_bytes_impl = diff_bytes_avx2;
+    } else if (spice_cpu_supports("sse2")) {
+        diff_bytes_impl = diff_bytes_sse2;
+    }
+#endif
+}
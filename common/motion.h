@@ -0,0 +1,72 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef H_SPICE_COMMON_MOTION
+#define H_SPICE_COMMON_MOTION
+
+#include <stdint.h>
+#include <spice/macros.h>
+
+#include "region.h"
+
+SPICE_BEGIN_DECLS
+
+/* Result of comparing two frames.
+ * If (dx, dy) is not (0, 0) the pixels of copy_region in the new frame are
+ * the pixels of the old frame at (x - dx, y - dy), so they can be sent as a
+ * COPY_BITS from copy_region translated by (-dx, -dy).
+ * damage holds the pixels that still differ once the copy is done. */
+typedef struct SpiceMotion {
+    int32_t dx;
+    int32_t dy;
+    QRegion copy_region;
+    QRegion damage;
+} SpiceMotion;
+
+void spice_motion_init(SpiceMotion *motion);
+void spice_motion_destroy(SpiceMotion *motion);
+
+/* Look for a vertical or horizontal shift of the area between old_image
+ * and new_image, which must have the same size and format.
+ * If area is NULL the whole image is used; shifts are searched inside the
+ * area only and are limited to max_shift pixels (no limit if <= 0).
+ * Returns TRUE if a shift was found, the damage is filled in any case. */
+int spice_motion_detect(pixman_image_t *old_image, pixman_image_t *new_image,
+                        const SpiceRect *area, int max_shift,
+                        SpiceMotion *motion);
+
+/* Fill damage with the blocks of block_size x block_size pixels which differ
+ * between the two buffers of width x height pixels of bpp bits.
+ * The comparison is split in bands over n_threads threads, or one per CPU
+ * if n_threads <= 0, when the buffers are large enough.
+ * Returns TRUE if the buffers differ. */
+int spice_diff_bits(const uint8_t *old_data, int old_stride,
+                    const uint8_t *new_data, int new_stride,
+                    int width, int height, int bpp,
+                    int block_size, int n_threads, QRegion *damage);
+
+/* Same as spice_diff_bits() for the area of two images of the same size
+ * and format, or the whole images if area is NULL. The blocks start at the
+ * top left corner of the area */
+int spice_diff_images(pixman_image_t *old_image, pixman_image_t *new_image,
+                      const SpiceRect *area, int block_size, int n_threads,
+                      QRegion *damage);
+
+SPICE_END_DECLS
+
+#endif
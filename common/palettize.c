@@ -0,0 +1,268 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include <config.h>
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "palettize.h"
+#include "mem.h"
+#include "log.h"
+#include "macros.h"
+
+#ifdef SPICE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#define PALETTE_MAX_COLORS 256
+#define PALETTE_HASH_BITS 10
+#define PALETTE_HASH_SIZE (1 << PALETTE_HASH_BITS)
+
+/* set in the hash keys so that 0 marks an empty slot */
+#define PALETTE_KEY_USED 0x80000000u
+
+#define PALETTE_RGB_MASK 0x00ffffffu
+
+/* never matches a masked pixel */
+#define PALETTE_NO_COLOR 0xffffffffu
+
+typedef struct PaletteBuilder {
+    uint32_t keys[PALETTE_HASH_SIZE];
+    uint8_t indexes[PALETTE_HASH_SIZE];
+    uint32_t colors[PALETTE_MAX_COLORS];
+    int num_colors;
+    int max_colors;
+    /* last colour looked up, pixels mostly come in runs */
+    uint32_t last_color;
+    uint8_t last_index;
+} PaletteBuilder;
+
+typedef int (*IndexLineFunc)(PaletteBuilder *builder, const uint32_t *line,
+                             uint8_t *out, int width);
+
+static int palette_lookup(PaletteBuilder *builder, uint32_t color)
+{
+    uint32_t key = color | PALETTE_KEY_USED;
+    uint32_t i = (color * 0x9e3779b1u) >> (32 - PALETTE_HASH_BITS);
+
+    while (builder->keys[i]) {
+        if (builder->keys[i] == key) {
+            return builder->indexes[i];
+        }
+        i = (i + 1) & (PALETTE_HASH_SIZE - 1);
+    }
+    if (builder->num_colors == builder->max_colors) {
+        return -1;
+    }
+    builder->keys[i] = key;
+    builder->indexes[i] = builder->num_colors;
+    builder->colors[builder->num_colors] = color;
+    return builder->num_colors++;
+}
+
+/* Writes the palette index of each pixel of the line. Returns FALSE if
+ * there are too many colours */
+static int index_line_c(PaletteBuilder *builder, const uint32_t *line,
+                        uint8_t *out, int width)
+{
+    int x;
+
+    for (x = 0; x < width; x++) {
+        uint32_t color = line[x] & PALETTE_RGB_MASK;
+
+        if (color != builder->last_color) {
+            int index = palette_lookup(builder, color);
+
+            if (index < 0) {
+                return FALSE;
+            }
+            builder->last_color = color;
+            builder->last_index = index;
+        }
+        out[x] = builder->last_index;
+    }
+    return TRUE;
+}
+
+static IndexLineFunc index_line_impl = index_line_c;
+
+/* The SIMD versions only skip over the runs of the last colour, which are
+ * most of the pixels of the images worth converting */
+#ifdef SPICE_X86_SIMD
+SPICE_ATTR_TARGET("sse2")
+static int index_line_sse2(PaletteBuilder *builder, const uint32_t *line,
+                           uint8_t *out, int width)
+{
+    const __m128i mask = _mm_set1_epi32(PALETTE_RGB_MASK);
+    int x;
+
+    for (x = 0; x + 4 <= width; x += 4) {
+        __m128i p = _mm_and_si128(_mm_loadu_si128((const __m128i *)(line + x)), mask);
+        __m128i eq = _mm_cmpeq_epi32(p, _mm_set1_epi32(builder->last_color));
+
+        if (_mm_movemask_epi8(eq) == 0xffff) {
+            memset(out + x, builder->last_index, 4);
+        } else if (!index_line_c(builder, line + x, out + x, 4)) {
+            return FALSE;
+        }
+    }
+    return index_line_c(builder, line + x, out + x, width - x);
+}
+
+SPICE_ATTR_TARGET("avx2")
+static int index_line_avx2(PaletteBuilder *builder, const uint32_t *line,
+                           uint8_t *out, int width)
+{
+    const __m256i mask = _mm256_set1_epi32(PALETTE_RGB_MASK);
+    int x;
+
+    for (x = 0; x + 8 <= width; x += 8) {
+        __m256i p = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(line + x)), mask);
+        __m256i eq = _mm256_cmpeq_epi32(p, _mm256_set1_epi32(builder->last_color));
+
+        if (_mm256_movemask_epi8(eq) == -1) {
+            memset(out + x, builder->last_index, 8);
+        } else if (!index_line_c(builder, line + x, out + x, 8)) {
+            return FALSE;
+        }
+    }
+    return index_line_sse2(builder, line + x, out + x, width - x);
+}
+#endif
+
+/* Packs the lines of 8 bits indexes in place, to 4 or 1 bits per pixel
+ * with the first pixel in the most significant bits. A packed line never
+ * starts after the unpacked one, so nothing is overwritten before being
+ * read */
+static void pack_indexes(uint8_t *data, int width, int height, int bits, int packed_stride)
+{
+    int per_byte = 8 / bits;
+    int x, y;
+
+    for (y = 0; y < height; y++) {
+        const uint8_t *src = data + y * width;
+        uint8_t *dest = data + y * packed_stride;
+
+        for (x = 0; x < width; x += per_byte) {
+            int n = MIN(per_byte, width - x);
+            uint8_t byte = 0;
+            int i;
+
+            for (i = 0; i < n; i++) {
+                byte |= src[x + i] << (8 - bits * (i + 1));
+            }
+            dest[x / per_byte] = byte;
+        }
+    }
+}
+
+SpiceBitmap *spice_palettize_rgb32(const uint8_t *data, int stride,
+                                   int width, int height, int max_colors)
+{
+    PaletteBuilder *builder;
+    SpiceBitmap *bitmap;
+    SpicePalette *palette;
+    uint8_t *indexes;
+    int bits, packed_stride, y;
+
+    spice_return_val_if_fail(width > 0 && height > 0, NULL);
+    spice_return_val_if_fail(max_colors > 0, NULL);
+
+    builder = spice_new(PaletteBuilder, 1);
+    memset(builder->keys, 0, sizeof(builder->keys));
+    builder->num_colors = 0;
+    builder->max_colors = MIN(max_colors, PALETTE_MAX_COLORS);
+    builder->last_color = PALETTE_NO_COLOR;
+    builder->last_index = 0;
+
+    indexes = spice_malloc_n(width, height);
+    for (y = 0; y < height; y++, data += stride) {
+        if (!index_line_impl(builder, (const uint32_t *)data, indexes + y * width, width)) {
+            free(indexes);
+            free(builder);
+            return NULL;
+        }
+    }
+
+    if (builder->num_colors <= 2) {
+        bits = 1;
+    } else if (builder->num_colors <= 16) {
+        bits = 4;
+    } else {
+        bits = 8;
+    }
+    packed_stride = (width * bits + 7) / 8;
+    if (bits < 8) {
+        pack_indexes(indexes, width, height, bits, packed_stride);
+        indexes = spice_realloc(indexes, packed_stride * height);
+    }
+
+    palette = spice_malloc_n_m(builder->num_colors, sizeof(uint32_t), sizeof(SpicePalette));
+    palette->unique = 0;
+    palette->num_ents = builder->num_colors;
+    memcpy(palette->ents, builder->colors, builder->num_colors * sizeof(uint32_t));
+    free(builder);
+
+    bitmap = spice_new0(SpiceBitmap, 1);
+    bitmap->format = bits == 1 ? SPICE_BITMAP_FMT_1BIT_BE :
+                     bits == 4 ? SPICE_BITMAP_FMT_4BIT_BE : SPICE_BITMAP_FMT_8BIT;
+    bitmap->flags = SPICE_BITMAP_FLAGS_TOP_DOWN;
+    bitmap->x = width;
+    bitmap->y = height;
+    bitmap->stride = packed_stride;
+    bitmap->palette = palette;
+    bitmap->data = spice_chunks_new_linear(indexes, packed_stride * height);
+    bitmap->data->flags |= SPICE_CHUNKS_FLAGS_FREE;
+    return bitmap;
+}
+
+void spice_palettized_bitmap_free(SpiceBitmap *bitmap)
+{
+    if (bitmap == NULL) {
+        return;
+    }
+    spice_chunks_destroy(bitmap->data);
+    free(bitmap->palette);
+    free(bitmap);
+}
+
+LzImageType spice_palettized_lz_type(const SpiceBitmap *bitmap)
+{
+    switch (bitmap->format) {
+    case SPICE_BITMAP_FMT_1BIT_BE:
+        return LZ_IMAGE_TYPE_PLT1_BE;
+    case SPICE_BITMAP_FMT_4BIT_BE:
+        return LZ_IMAGE_TYPE_PLT4_BE;
+    case SPICE_BITMAP_FMT_8BIT:
+        return LZ_IMAGE_TYPE_PLT8;
+    default:
+        spice_warn_if_reached();
+        return LZ_IMAGE_TYPE_INVALID;
+    }
+}
+
+SPICE_CONSTRUCTOR_FUNC(palettize_global_init)
+{
+#ifdef SPICE_X86_SIMD
+    if (spice_cpu_supports("avx2")) {
+        index_line_impl = index_line_avx2;
+    } else if (spice_cpu_supports("sse2")) {
+        index_line_impl = index_line_sse2;
+    }
+#endif
+}
@@ -0,0 +1,47 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef H_SPICE_COMMON_PALETTIZE
+#define H_SPICE_COMMON_PALETTIZE
+
+#include <stdint.h>
+#include <spice/macros.h>
+
+#include "draw.h"
+#include "lz_common.h"
+
+SPICE_BEGIN_DECLS
+
+/* Convert a 32 bits RGB image to a palette bitmap if it has at most
+ * max_colors (up to 256) colours, the unused byte of the pixels being
+ * ignored. Lines are read from data, moving by stride bytes (which may be
+ * negative for bottom-up images), and are stored top-down in the bitmap.
+ * The bitmap uses 1, 4 or 8 bits per pixel depending on the number of
+ * colours, with the minimal stride as lz_encode() expects.
+ * Returns NULL if there are too many colours. */
+SpiceBitmap *spice_palettize_rgb32(const uint8_t *data, int stride,
+                                   int width, int height, int max_colors);
+
+void spice_palettized_bitmap_free(SpiceBitmap *bitmap);
+
+/* LZ image type to use to compress a bitmap returned by spice_palettize_rgb32() */
+LzImageType spice_palettized_lz_type(const SpiceBitmap *bitmap);
+
+SPICE_END_DECLS
+
+#endif
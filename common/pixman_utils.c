@@ -20,7 +20,13 @@
 #include "pixman_utils.h"
 
 #include <string.h>
+#include <glib.h>
+#ifdef SPICE_X86_SIMD
+#include <immintrin.h>
+#endif
 #include "mem.h"
+#include "macros.h"
+#include "utils.h"
 
 /*
  * src is used for most OPs, hidden within _equation attribute. For some
@@ -177,6 +183,150 @@ ROP_TABLE(uint8_t, 8)
 ROP_TABLE(uint16_t, 16)
 ROP_TABLE(uint32_t, 32)
 
+/* Row versions of the raster ops working on bytes, the ops being bitwise
+ * the depth doesn't matter. For a given source bit the result is one of
+ * 0, 1, dst or ~dst, that is (dst & a[src]) ^ b[src] */
+typedef struct RopMasks {
+    uint8_t a[2];
+    uint8_t b[2];
+} RopMasks;
+
+static void rop_masks_init(RopMasks *masks, SpiceROP rop)
+{
+    int src;
+
+    /* bit 3 - ((src << 1) | dst) of rop is the result for those inputs */
+    for (src = 0; src < 2; src++) {
+        int r0 = (rop >> (3 - 2 * src)) & 1;
+        int r1 = (rop >> (2 - 2 * src)) & 1;
+
+        masks->a[src] = r0 != r1 ? 0xff : 0;
+        masks->b[src] = r0 ? 0xff : 0;
+    }
+}
+
+/* For a solid source the masks only depend on the pixel value, repeated
+ * over 32 bits for the smaller depths */
+static void rop_solid_masks(const RopMasks *masks, uint32_t value, int depth,
+                            uint32_t *and_mask, uint32_t *xor_mask)
+{
+    uint32_t pattern;
+
+    if (depth == 8) {
+        pattern = (value & 0xff) * 0x01010101u;
+    } else if (depth == 16) {
+        pattern = (value & 0xffff) * 0x00010001u;
+    } else {
+        pattern = value;
+    }
+    *and_mask = ((masks->a[0] * 0x01010101u) & ~pattern) | ((masks->a[1] * 0x01010101u) & pattern);
+    *xor_mask = ((masks->b[0] * 0x01010101u) & ~pattern) | ((masks->b[1] * 0x01010101u) & pattern);
+}
+
+/* The masks repeat every 4 bytes from the start of the row, they are in
+ * memory order */
+static void rop_solid_row_c(uint8_t *dest, int len, uint32_t and_mask, uint32_t xor_mask)
+{
+    uint8_t a[4], x[4];
+    int i;
+
+    memcpy(a, &and_mask, 4);
+    memcpy(x, &xor_mask, 4);
+    for (i = 0; i < len; i++) {
+        dest[i] = (dest[i] & a[i & 3]) ^ x[i & 3];
+    }
+}
+
+static void rop_copy_row_c(uint8_t *dest, const uint8_t *src, int len, const RopMasks *masks)
+{
+    uint8_t a_diff = masks->a[0] ^ masks->a[1];
+    uint8_t b_diff = masks->b[0] ^ masks->b[1];
+    int i;
+
+    for (i = 0; i < len; i++) {
+        uint8_t a = masks->a[0] ^ (a_diff & src[i]);
+        uint8_t b = masks->b[0] ^ (b_diff & src[i]);
+
+        dest[i] = (dest[i] & a) ^ b;
+    }
+}
+
+#ifdef SPICE_X86_SIMD
+SPICE_ATTR_TARGET("sse2")
+static void rop_solid_row_sse2(uint8_t *dest, int len, uint32_t and_mask, uint32_t xor_mask)
+{
+    const __m128i a = _mm_set1_epi32(and_mask);
+    const __m128i x = _mm_set1_epi32(xor_mask);
+    int i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        __m128i d = _mm_loadu_si128((const __m128i *)(dest + i));
+        _mm_storeu_si128((__m128i *)(dest + i), _mm_xor_si128(_mm_and_si128(d, a), x));
+    }
+    rop_solid_row_c(dest + i, len - i, and_mask, xor_mask);
+}
+
+SPICE_ATTR_TARGET("sse2")
+static void rop_copy_row_sse2(uint8_t *dest, const uint8_t *src, int len, const RopMasks *masks)
+{
+    const __m128i a0 = _mm_set1_epi8(masks->a[0]);
+    const __m128i b0 = _mm_set1_epi8(masks->b[0]);
+    const __m128i a_diff = _mm_set1_epi8(masks->a[0] ^ masks->a[1]);
+    const __m128i b_diff = _mm_set1_epi8(masks->b[0] ^ masks->b[1]);
+    int i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i d = _mm_loadu_si128((const __m128i *)(dest + i));
+        __m128i a = _mm_xor_si128(a0, _mm_and_si128(a_diff, s));
+        __m128i b = _mm_xor_si128(b0, _mm_and_si128(b_diff, s));
+
+        _mm_storeu_si128((__m128i *)(dest + i), _mm_xor_si128(_mm_and_si128(d, a), b));
+    }
+    rop_copy_row_c(dest + i, src + i, len - i, masks);
+}
+
+SPICE_ATTR_TARGET("avx2")
+static void rop_solid_row_avx2(uint8_t *dest, int len, uint32_t and_mask, uint32_t xor_mask)
+{
+    const __m256i a = _mm256_set1_epi32(and_mask);
+    const __m256i x = _mm256_set1_epi32(xor_mask);
+    int i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        __m256i d = _mm256_loadu_si256((const __m256i *)(dest + i));
+        _mm256_storeu_si256((__m256i *)(dest + i), _mm256_xor_si256(_mm256_and_si256(d, a), x));
+    }
+    rop_solid_row_sse2(dest + i, len - i, and_mask, xor_mask);
+}
+
+SPICE_ATTR_TARGET("avx2")
+static void rop_copy_row_avx2(uint8_t *dest, const uint8_t *src, int len, const RopMasks *masks)
+{
+    const __m256i a0 = _mm256_set1_epi8(masks->a[0]);
+    const __m256i b0 = _mm256_set1_epi8(masks->b[0]);
+    const __m256i a_diff = _mm256_set1_epi8(masks->a[0] ^ masks->a[1]);
+    const __m256i b_diff = _mm256_set1_epi8(masks->b[0] ^ masks->b[1]);
+    int i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i d = _mm256_loadu_si256((const __m256i *)(dest + i));
+        __m256i a = _mm256_xor_si256(a0, _mm256_and_si256(a_diff, s));
+        __m256i b = _mm256_xor_si256(b0, _mm256_and_si256(b_diff, s));
+
+        _mm256_storeu_si256((__m256i *)(dest + i), _mm256_xor_si256(_mm256_and_si256(d, a), b));
+    }
+    rop_copy_row_sse2(dest + i, src + i, len - i, masks);
+}
+#endif
+
+/* NULL unless the CPU has a SIMD version, the per depth handlers above are
+ * used otherwise */
+static void (*rop_solid_row_impl)(uint8_t *dest, int len, uint32_t and_mask, uint32_t xor_mask);
+static void (*rop_copy_row_impl)(uint8_t *dest, const uint8_t *src, int len,
+                                 const RopMasks *masks);
+
 /* We can't get the real bits per pixel info from pixman_image_t,
    only the DEPTH which is the sum of all a+r+g+b bits, which
    is e.g. 24 for 32bit xRGB. We really want the bpp, so
@@ -310,7 +460,19 @@ void spice_pixman_fill_rect_rop(pixman_image_t *dest,
     spice_assert(y + height <= pixman_image_get_height(dest));
     spice_assert(rop < 16);
 
-    if (depth == 8) {
+    if (rop_solid_row_impl) {
+        RopMasks masks;
+        uint32_t and_mask, xor_mask;
+        int bytes_pp = depth / 8;
+
+        rop_masks_init(&masks, rop);
+        rop_solid_masks(&masks, value, depth, &and_mask, &xor_mask);
+        byte_line = ((uint8_t *)bits) + stride * y + x * bytes_pp;
+        while (height--) {
+            rop_solid_row_impl(byte_line, width * bytes_pp, and_mask, xor_mask);
+            byte_line += stride;
+        }
+    } else if (depth == 8) {
         solid_rop_8_func_t rop_func = solid_rops_8[rop];
 
         byte_line = ((uint8_t *)bits) + stride * y + x;
@@ -338,6 +500,250 @@ void spice_pixman_fill_rect_rop(pixman_image_t *dest,
     }
 }
 
+/* Octants in which a zero width line takes the axial step when the error
+ * term is zero, must match DEFAULTZEROLINEBIAS in lines.c */
+#define ZERO_LINE_X_DECREASING 4
+#define ZERO_LINE_Y_DECREASING 2
+#define ZERO_LINE_Y_MAJOR 1
+#define ZERO_LINE_BIAS ((1 << (ZERO_LINE_Y_DECREASING | ZERO_LINE_Y_MAJOR)) | \
+                        (1 << (ZERO_LINE_X_DECREASING | ZERO_LINE_Y_DECREASING | ZERO_LINE_Y_MAJOR)) | \
+                        (1 << (ZERO_LINE_X_DECREASING | ZERO_LINE_Y_DECREASING)) | \
+                        (1 << (ZERO_LINE_X_DECREASING)))
+
+static inline void zero_line_fill_run(uint8_t *bits, int stride, int depth,
+                                      int x, int y, int len,
+                                      uint32_t value, SpiceROP rop)
+{
+    uint8_t *line = bits + (intptr_t)stride * y;
+
+    if (depth == 16) {
+        uint16_t *ptr = (uint16_t *)line + x;
+
+        if (rop == SPICE_ROP_COPY) {
+            while (len--) {
+                *ptr++ = (uint16_t)value;
+            }
+        } else {
+            solid_rops_16[rop](ptr, len, (uint16_t)value);
+        }
+    } else {
+        uint32_t *ptr = (uint32_t *)line + x;
+
+        if (rop == SPICE_ROP_COPY) {
+            while (len--) {
+                *ptr++ = value;
+            }
+        } else {
+            solid_rops_32[rop](ptr, len, value);
+        }
+    }
+}
+
+/* Draws pixels i_start..i_end of a line stepping along its major axis from
+ * (major, minor), i_start/i_end being already clipped to the box */
+static void zero_line_draw_range(uint8_t *bits, int stride, int depth,
+                                 int y_major, int major, int minor,
+                                 int major_step, int minor_step,
+                                 int64_t e_init, int64_t e1, int64_t two_amajor,
+                                 int64_t i_start, int64_t i_end,
+                                 const pixman_box32_t *box,
+                                 uint32_t value, SpiceROP rop)
+{
+    int64_t n, m, e, i;
+    int run_start, run_len;
+
+    /* minor steps taken before pixel i_start and the error term there */
+    n = e_init + i_start * e1 + two_amajor;
+    m = n / two_amajor;
+    e = n - m * two_amajor - two_amajor;
+    major += (int)(i_start * major_step);
+    minor += (int)(m * minor_step);
+
+    if (y_major) {
+        for (i = i_start; i <= i_end; i++) {
+            if (minor >= box->x1 && minor < box->x2) {
+                zero_line_fill_run(bits, stride, depth, minor, major, 1, value, rop);
+            }
+            e += e1;
+            if (e >= 0) {
+                minor += minor_step;
+                e -= two_amajor;
+            }
+            major += major_step;
+        }
+        return;
+    }
+
+    /* x major, pixels on the same row are filled as one run */
+    run_start = major;
+    run_len = 0;
+    for (i = i_start; i <= i_end; i++) {
+        run_len++;
+        e += e1;
+        if (e >= 0 || i == i_end) {
+            if (minor >= box->y1 && minor < box->y2) {
+                zero_line_fill_run(bits, stride, depth,
+                                   major_step > 0 ? run_start : major,
+                                   minor, run_len, value, rop);
+            }
+            if (e >= 0) {
+                minor += minor_step;
+                e -= two_amajor;
+            }
+            run_start = major + major_step;
+            run_len = 0;
+        }
+        major += major_step;
+    }
+}
+
+static void zero_line_draw_segment(uint8_t *bits, int stride, int depth,
+                                   const pixman_box32_t *boxes, int n_boxes,
+                                   int x1, int y1, int x2, int y2,
+                                   uint32_t value, SpiceROP rop)
+{
+    int64_t adx, ady, amajor, e1, two_amajor, e_init, length;
+    int sx = 1, sy = 1, octant = 0;
+    int y_major;
+    int i;
+
+    adx = (int64_t)x2 - x1;
+    if (adx < 0) {
+        adx = -adx;
+        sx = -1;
+        octant |= ZERO_LINE_X_DECREASING;
+    }
+    ady = (int64_t)y2 - y1;
+    if (ady < 0) {
+        ady = -ady;
+        sy = -1;
+        octant |= ZERO_LINE_Y_DECREASING;
+    }
+    y_major = adx <= ady;
+    if (y_major) {
+        octant |= ZERO_LINE_Y_MAJOR;
+        amajor = ady;
+        e1 = adx << 1;
+    } else {
+        amajor = adx;
+        e1 = ady << 1;
+    }
+    /* the last point is not drawn (CapNotLast) */
+    length = amajor;
+    if (length == 0) {
+        return;
+    }
+    two_amajor = amajor << 1;
+    e_init = -amajor - ((ZERO_LINE_BIAS >> octant) & 1);
+
+    for (i = 0; i < n_boxes; i++) {
+        const pixman_box32_t *box = &boxes[i];
+        int64_t major_lo, major_hi, minor_lo, minor_hi;
+        int64_t i_start, i_end, major0, minor0;
+        int major_step, minor_step;
+
+        if (y_major) {
+            major_lo = box->y1; major_hi = box->y2 - 1;
+            minor_lo = box->x1; minor_hi = box->x2 - 1;
+            major0 = y1; minor0 = x1;
+            major_step = sy; minor_step = sx;
+        } else {
+            major_lo = box->x1; major_hi = box->x2 - 1;
+            minor_lo = box->y1; minor_hi = box->y2 - 1;
+            major0 = x1; minor0 = y1;
+            major_step = sx; minor_step = sy;
+        }
+
+        /* pixels whose major coordinate is inside the box */
+        if (major_step > 0) {
+            i_start = major_lo - major0;
+            i_end = major_hi - major0;
+        } else {
+            i_start = major0 - major_hi;
+            i_end = major0 - major_lo;
+        }
+        /* count of minor steps that land inside the box */
+        if (minor_step > 0) {
+            minor_lo -= minor0;
+            minor_hi -= minor0;
+        } else {
+            int64_t tmp = minor0 - minor_hi;
+            minor_hi = minor0 - minor_lo;
+            minor_lo = tmp;
+        }
+        if (minor_hi < 0) {
+            continue;
+        }
+        if (minor_lo > 0) {
+            if (e1 == 0) {
+                continue;
+            }
+            /* first pixel with at least minor_lo minor steps */
+            i_start = MAX(i_start, (minor_lo * two_amajor - two_amajor - e_init + e1 - 1) / e1);
+        }
+        if (e1 != 0) {
+            /* last pixel with at most minor_hi minor steps */
+            i_end = MIN(i_end, ((minor_hi + 1) * two_amajor - two_amajor - e_init - 1) / e1);
+        }
+        i_start = MAX(i_start, 0);
+        i_end = MIN(i_end, length - 1);
+        if (i_start > i_end) {
+            continue;
+        }
+        zero_line_draw_range(bits, stride, depth, y_major, (int)major0, (int)minor0,
+                             major_step, minor_step, e_init, e1, two_amajor,
+                             i_start, i_end, box, value, rop);
+    }
+}
+
+int spice_pixman_draw_zero_lines(pixman_image_t *dest,
+                                 const pixman_box32_t *clip_rects, int n_clip_rects,
+                                 const SpicePoint *points, int n_points,
+                                 uint32_t value, SpiceROP rop)
+{
+    uint8_t *bits;
+    int stride, depth;
+    int i;
+
+    depth = spice_pixman_image_get_bpp(dest);
+    if (depth != 16 && depth != 32) {
+        return FALSE;
+    }
+    spice_return_val_if_fail(rop < 16, FALSE);
+
+    bits = (uint8_t *)pixman_image_get_data(dest);
+    stride = pixman_image_get_stride(dest);
+
+    for (i = 0; i < n_clip_rects; i++) {
+        spice_return_val_if_fail(clip_rects[i].x1 >= 0 && clip_rects[i].y1 >= 0, FALSE);
+        spice_return_val_if_fail(clip_rects[i].x2 <= pixman_image_get_width(dest), FALSE);
+        spice_return_val_if_fail(clip_rects[i].y2 <= pixman_image_get_height(dest), FALSE);
+    }
+
+    for (i = 1; i < n_points; i++) {
+        zero_line_draw_segment(bits, stride, depth, clip_rects, n_clip_rects,
+                               points[i - 1].x, points[i - 1].y,
+                               points[i].x, points[i].y,
+                               value, rop);
+    }
+    return TRUE;
+}
+
+/* Copies width pixels of a tile line, starting at tile_start_x and wrapping
+ * around. Tiles repeated to wide rows are copied in large runs. The tile
+ * may come from the destination image itself */
+static void tile_line_copy(uint8_t *dest, const uint8_t *tile_line, int tile_start_x,
+                           int tile_width, int width, int bytes_pp)
+{
+    int n = MIN(tile_width - tile_start_x, width);
+
+    memmove(dest, tile_line + tile_start_x * bytes_pp, n * bytes_pp);
+    for (dest += n * bytes_pp, width -= n; width > 0; dest += n * bytes_pp, width -= n) {
+        n = MIN(tile_width, width);
+        memmove(dest, tile_line, n * bytes_pp);
+    }
+}
+
 void spice_pixman_tile_rect(pixman_image_t *dest,
                             int x, int y,
                             int width, int height,
@@ -346,11 +752,11 @@ void spice_pixman_tile_rect(pixman_image_t *dest,
                             int offset_y)
 {
     uint32_t *bits, *tile_bits;
-    int stride, depth;
+    int stride, depth, bytes_pp;
     int tile_width, tile_height, tile_stride;
     uint8_t *byte_line;
     uint8_t *tile_line;
-    int tile_start_x, tile_start_y, tile_end_dx;
+    int tile_start_x, tile_start_y;
 
     bits = pixman_image_get_data(dest);
     stride = pixman_image_get_stride(dest);
@@ -378,56 +784,25 @@ void spice_pixman_tile_rect(pixman_image_t *dest,
     if (tile_start_y < 0) {
         tile_start_y += tile_height;
     }
-    tile_end_dx = tile_width - tile_start_x;
-
-    if (depth == 8) {
-        byte_line = ((uint8_t *)bits) + stride * y + x;
-        tile_line = ((uint8_t *)tile_bits) + tile_stride * tile_start_y + tile_start_x;
-        while (height--) {
-            tiled_rop_copy_8((uint8_t *)byte_line, width,
-                             (uint8_t *)tile_line, (uint8_t *)tile_line + tile_end_dx,
-                             tile_width);
-            byte_line += stride;
-            tile_line += tile_stride;
-            if (++tile_start_y == tile_height) {
-                tile_line -= tile_height * tile_stride;
-                tile_start_y = 0;
-            }
-        }
-
-    } else if (depth == 16) {
-        byte_line = ((uint8_t *)bits) + stride * y + x * 2;
-        tile_line = ((uint8_t *)tile_bits) + tile_stride * tile_start_y + tile_start_x * 2;
-        while (height--) {
-            tiled_rop_copy_16((uint16_t *)byte_line, width,
-                              (uint16_t *)tile_line, (uint16_t *)tile_line + tile_end_dx,
-                              tile_width);
-            byte_line += stride;
-            tile_line += tile_stride;
-            if (++tile_start_y == tile_height) {
-                tile_line -= tile_height * tile_stride;
-                tile_start_y = 0;
-            }
-        }
-    }  else {
-        spice_assert (depth == 32);
+    spice_assert(depth == 8 || depth == 16 || depth == 32);
+    bytes_pp = depth / 8;
 
-        byte_line = ((uint8_t *)bits) + stride * y + x * 4;
-        tile_line = ((uint8_t *)tile_bits) + tile_stride * tile_start_y + tile_start_x * 4;
-        while (height--) {
-            tiled_rop_copy_32((uint32_t *)byte_line, width,
-                              (uint32_t *)tile_line, (uint32_t *)tile_line + tile_end_dx,
-                              tile_width);
-            byte_line += stride;
-            tile_line += tile_stride;
-            if (++tile_start_y == tile_height) {
-                tile_line -= tile_height * tile_stride;
-                tile_start_y = 0;
-            }
+    byte_line = ((uint8_t *)bits) + stride * y + x * bytes_pp;
+    tile_line = ((uint8_t *)tile_bits) + tile_stride * tile_start_y;
+    while (height--) {
+        tile_line_copy(byte_line, tile_line, tile_start_x, tile_width, width, bytes_pp);
+        byte_line += stride;
+        tile_line += tile_stride;
+        if (++tile_start_y == tile_height) {
+            tile_line -= tile_height * tile_stride;
+            tile_start_y = 0;
         }
     }
 }
 
+/* Size of the stack buffer the tile lines are repeated in for the rop rows */
+#define TILE_ROP_ROW_BYTES 1024
+
 void spice_pixman_tile_rect_rop(pixman_image_t *dest,
                                 int x, int y,
                                 int width, int height,
@@ -472,7 +847,48 @@ void spice_pixman_tile_rect_rop(pixman_image_t *dest,
     }
     tile_end_dx = tile_width - tile_start_x;
 
-    if (depth == 8) {
+    if (rop_copy_row_impl) {
+        int bytes_pp = depth / 8;
+        int row_size = width * bytes_pp;
+        int tile_row_size = tile_width * bytes_pp;
+        uint8_t row[TILE_ROP_ROW_BYTES];
+        RopMasks masks;
+
+        spice_assert(depth == 8 || depth == 16 || depth == 32);
+
+        rop_masks_init(&masks, rop);
+        byte_line = ((uint8_t *)bits) + stride * y + x * bytes_pp;
+        tile_line = ((uint8_t *)tile_bits) + tile_stride * tile_start_y;
+        while (height--) {
+            int pos, n;
+
+            if (tile_row_size <= TILE_ROP_ROW_BYTES) {
+                /* repeat the tile line over as many whole tile periods as
+                 * fit in row, then apply row again and again */
+                int period = MIN(TILE_ROP_ROW_BYTES / tile_row_size * tile_row_size, row_size);
+
+                tile_line_copy(row, tile_line, tile_start_x, tile_width, period / bytes_pp,
+                               bytes_pp);
+                for (pos = 0; pos < row_size; pos += n) {
+                    n = MIN(period, row_size - pos);
+                    rop_copy_row_impl(byte_line + pos, row, n, &masks);
+                }
+            } else {
+                n = MIN(tile_end_dx * bytes_pp, row_size);
+                rop_copy_row_impl(byte_line, tile_line + tile_start_x * bytes_pp, n, &masks);
+                for (pos = n; pos < row_size; pos += n) {
+                    n = MIN(tile_row_size, row_size - pos);
+                    rop_copy_row_impl(byte_line + pos, tile_line, n, &masks);
+                }
+            }
+            byte_line += stride;
+            tile_line += tile_stride;
+            if (++tile_start_y == tile_height) {
+                tile_line -= tile_height * tile_stride;
+                tile_start_y = 0;
+            }
+        }
+    } else if (depth == 8) {
         tiled_rop_8_func_t rop_func = tiled_rops_8[rop];
 
         byte_line = ((uint8_t *)bits) + stride * y + x;
@@ -681,7 +1097,21 @@ void spice_pixman_blit_rop (pixman_image_t *dest,
     spice_assert(src_y + height <= pixman_image_get_height(src));
     spice_assert(depth == src_depth);
 
-    if (depth == 8) {
+    if (rop_copy_row_impl) {
+        int bytes_pp = depth / 8;
+        RopMasks masks;
+
+        spice_assert(depth == 8 || depth == 16 || depth == 32);
+
+        rop_masks_init(&masks, rop);
+        byte_line = ((uint8_t *)bits) + stride * dest_y + dest_x * bytes_pp;
+        src_line = ((uint8_t *)src_bits) + src_stride * src_y + src_x * bytes_pp;
+        while (height--) {
+            rop_copy_row_impl(byte_line, src_line, width * bytes_pp, &masks);
+            byte_line += stride;
+            src_line += src_stride;
+        }
+    } else if (depth == 8) {
         copy_rop_8_func_t rop_func = copy_rops_8[rop];
 
         byte_line = ((uint8_t *)bits) + stride * dest_y + dest_x;
@@ -719,6 +1149,105 @@ void spice_pixman_blit_rop (pixman_image_t *dest,
 
 }
 
+static void colorkey_row_16_c(uint16_t *dest, const uint16_t *src, int len, uint32_t key)
+{
+    int x;
+
+    for (x = 0; x < len; x++) {
+        if (src[x] != (uint16_t)key) {
+            dest[x] = src[x];
+        }
+    }
+}
+
+static void colorkey_row_32_c(uint32_t *dest, const uint32_t *src, int len, uint32_t key)
+{
+    int x;
+
+    key &= 0xffffff;
+    for (x = 0; x < len; x++) {
+        if ((src[x] & 0xffffff) != key) {
+            dest[x] = src[x];
+        }
+    }
+}
+
+#ifdef SPICE_X86_SIMD
+SPICE_ATTR_TARGET("sse2")
+static void colorkey_row_16_sse2(uint16_t *dest, const uint16_t *src, int len, uint32_t key)
+{
+    const __m128i k = _mm_set1_epi16(key);
+    int x;
+
+    for (x = 0; x + 8 <= len; x += 8) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + x));
+        __m128i d = _mm_loadu_si128((const __m128i *)(dest + x));
+        __m128i transparent = _mm_cmpeq_epi16(s, k);
+
+        d = _mm_or_si128(_mm_and_si128(transparent, d), _mm_andnot_si128(transparent, s));
+        _mm_storeu_si128((__m128i *)(dest + x), d);
+    }
+    colorkey_row_16_c(dest + x, src + x, len - x, key);
+}
+
+SPICE_ATTR_TARGET("sse2")
+static void colorkey_row_32_sse2(uint32_t *dest, const uint32_t *src, int len, uint32_t key)
+{
+    const __m128i k = _mm_set1_epi32(key & 0xffffff);
+    const __m128i rgb_mask = _mm_set1_epi32(0xffffff);
+    int x;
+
+    for (x = 0; x + 4 <= len; x += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + x));
+        __m128i d = _mm_loadu_si128((const __m128i *)(dest + x));
+        __m128i transparent = _mm_cmpeq_epi32(_mm_and_si128(s, rgb_mask), k);
+
+        d = _mm_or_si128(_mm_and_si128(transparent, d), _mm_andnot_si128(transparent, s));
+        _mm_storeu_si128((__m128i *)(dest + x), d);
+    }
+    colorkey_row_32_c(dest + x, src + x, len - x, key);
+}
+
+SPICE_ATTR_TARGET("avx2")
+static void colorkey_row_16_avx2(uint16_t *dest, const uint16_t *src, int len, uint32_t key)
+{
+    const __m256i k = _mm256_set1_epi16(key);
+    int x;
+
+    for (x = 0; x + 16 <= len; x += 16) {
+        __m256i s = _mm256_loadu_si256((const __m256i *)(src + x));
+        __m256i d = _mm256_loadu_si256((const __m256i *)(dest + x));
+
+        d = _mm256_blendv_epi8(s, d, _mm256_cmpeq_epi16(s, k));
+        _mm256_storeu_si256((__m256i *)(dest + x), d);
+    }
+    colorkey_row_16_sse2(dest + x, src + x, len - x, key);
+}
+
+SPICE_ATTR_TARGET("avx2")
+static void colorkey_row_32_avx2(uint32_t *dest, const uint32_t *src, int len, uint32_t key)
+{
+    const __m256i k = _mm256_set1_epi32(key & 0xffffff);
+    const __m256i rgb_mask = _mm256_set1_epi32(0xffffff);
+    int x;
+
+    for (x = 0; x + 8 <= len; x += 8) {
+        __m256i s = _mm256_loadu_si256((const __m256i *)(src + x));
+        __m256i d = _mm256_loadu_si256((const __m256i *)(dest + x));
+        __m256i transparent = _mm256_cmpeq_epi32(_mm256_and_si256(s, rgb_mask), k);
+
+        d = _mm256_blendv_epi8(s, d, transparent);
+        _mm256_storeu_si256((__m256i *)(dest + x), d);
+    }
+    colorkey_row_32_sse2(dest + x, src + x, len - x, key);
+}
+#endif
+
+static void (*colorkey_row_16_impl)(uint16_t *dest, const uint16_t *src, int len, uint32_t key) =
+    colorkey_row_16_c;
+static void (*colorkey_row_32_impl)(uint32_t *dest, const uint32_t *src, int len, uint32_t key) =
+    colorkey_row_32_c;
+
 void spice_pixman_blit_colorkey (pixman_image_t *dest,
                                  pixman_image_t *src,
                                  int src_x, int src_y,
@@ -800,17 +1329,8 @@ void spice_pixman_blit_colorkey (pixman_image_t *dest,
         src_line = ((uint8_t *)src_bits) + src_stride * src_y + src_x * 2;
 
         while (height--) {
-            uint16_t *d = (uint16_t *)byte_line;
-            uint16_t *s = (uint16_t *)src_line;
-
-            for (x = 0; x < width; x++) {
-                uint16_t val = *s;
-                if (val != (uint16_t)transparent_color) {
-                    *d = val;
-                }
-                s++; d++;
-            }
-
+            colorkey_row_16_impl((uint16_t *)byte_line, (uint16_t *)src_line,
+                                 width, transparent_color);
             byte_line += stride;
             src_line += src_stride;
         }
@@ -820,27 +1340,720 @@ void spice_pixman_blit_colorkey (pixman_image_t *dest,
         src_line = ((uint8_t *)src_bits) + src_stride * src_y + src_x * 4;
 
         while (height--) {
-            uint32_t *d = (uint32_t *)byte_line;
-            uint32_t *s = (uint32_t *)src_line;
-
-            transparent_color &= 0xffffff;
-            for (x = 0; x < width; x++) {
-                uint32_t val = *s;
-                if ((0xffffff & val) != transparent_color) {
-                    *d = val;
-                }
-                s++; d++;
-            }
-
+            colorkey_row_32_impl((uint32_t *)byte_line, (uint32_t *)src_line,
+                                 width, transparent_color);
             byte_line += stride;
             src_line += src_stride;
         }
     }
 }
 
-static void copy_bits_up(uint8_t *data, const int stride, int bpp,
-                         const int src_x, const int src_y,
-                         const int width, const int height,
+/* Same rounding as pixman for a nearest filtered scale transform, gives the
+ * 16.16 source position of the first sample minus pixman_fixed_e */
+static int64_t scale_nearest_start(int64_t scale, int dest_offset, int src_offset)
+{
+    return ((scale * (((int64_t)dest_offset << 16) + 0x8000) + 0x8000) >> 16) +
+           ((int64_t)src_offset << 16) - 1;
+}
+
+#define SCALE_COLORKEY_CHUNK 256
+
+int spice_pixman_scale_colorkey(pixman_image_t *dest,
+                                pixman_image_t *src,
+                                int src_x, int src_y,
+                                int src_width, int src_height,
+                                int dest_x, int dest_y,
+                                int dest_width, int dest_height,
+                                const pixman_box32_t *boxes, int n_boxes,
+                                uint32_t transparent_color)
+{
+    uint32_t buf[SCALE_COLORKEY_CHUNK];
+    uint8_t *bits, *src_bits;
+    int stride, src_stride, depth;
+    int64_t fsx, fsy;
+    int i;
+
+    depth = spice_pixman_image_get_bpp(dest);
+    if ((depth != 16 && depth != 32) || depth != spice_pixman_image_get_bpp(src)) {
+        return FALSE;
+    }
+    if (dest_width <= 0 || dest_height <= 0 || src_x < 0 || src_y < 0 ||
+        src_x + src_width > pixman_image_get_width(src) ||
+        src_y + src_height > pixman_image_get_height(src)) {
+        return FALSE;
+    }
+    fsx = ((int64_t)src_width << 16) / dest_width;
+    fsy = ((int64_t)src_height << 16) / dest_height;
+    /* with positive scales all the samples are inside the source area */
+    if (fsx <= 0 || fsy <= 0) {
+        return FALSE;
+    }
+
+    bits = (uint8_t *)pixman_image_get_data(dest);
+    stride = pixman_image_get_stride(dest);
+    src_bits = (uint8_t *)pixman_image_get_data(src);
+    src_stride = pixman_image_get_stride(src);
+
+    for (i = 0; i < n_boxes; i++) {
+        int x1 = MAX(boxes[i].x1, dest_x);
+        int y1 = MAX(boxes[i].y1, dest_y);
+        int x2 = MIN(boxes[i].x2, dest_x + dest_width);
+        int y2 = MIN(boxes[i].y2, dest_y + dest_height);
+        int64_t vy;
+        int y;
+
+        if (x1 >= x2 || y1 >= y2) {
+            continue;
+        }
+        spice_assert(x1 >= 0 && y1 >= 0);
+        spice_assert(x2 <= pixman_image_get_width(dest));
+        spice_assert(y2 <= pixman_image_get_height(dest));
+
+        vy = scale_nearest_start(fsy, y1 - dest_y, src_y);
+        for (y = y1; y < y2; y++, vy += fsy) {
+            uint8_t *src_line = src_bits + (vy >> 16) * src_stride;
+            uint8_t *dest_line = bits + y * stride;
+            int64_t vx = scale_nearest_start(fsx, x1 - dest_x, src_x);
+            int x = x1;
+
+            /* sample a chunk of the row, then key it into dest */
+            while (x < x2) {
+                int n = MIN(x2 - x, SCALE_COLORKEY_CHUNK);
+                int j;
+
+                if (depth == 32) {
+                    for (j = 0; j < n; j++, vx += fsx) {
+                        buf[j] = ((uint32_t *)src_line)[vx >> 16];
+                    }
+                    colorkey_row_32_impl((uint32_t *)dest_line + x, buf, n, transparent_color);
+                } else {
+                    uint16_t *buf16 = (uint16_t *)buf;
+
+                    for (j = 0; j < n; j++, vx += fsx) {
+                        buf16[j] = ((uint16_t *)src_line)[vx >> 16];
+                    }
+                    colorkey_row_16_impl((uint16_t *)dest_line + x, buf16, n, transparent_color);
+                }
+                x += n;
+            }
+        }
+    }
+    return TRUE;
+}
+
+/* Bilinear filtering uses the same fixed point steps as pixman: the sample
+ * position is the one of the pixel centre minus half a pixel, weights have
+ * 7 bits and pixels outside the source image are 0.
+ * It is done in two passes, a source line is first interpolated
+ * horizontally into 16 bits channels (l * (256 - dx) + r * dx) and two of
+ * these are then interpolated vertically, the final >> 16 makes the result
+ * the same as pixman's single pass. Horizontal lines are kept from one
+ * destination line to the next as upscaling uses them several times. */
+
+/* Past this many pixels the scale is split in bands over several threads */
+#define SCALE_MIN_BAND_PIXELS (128 * 1024)
+
+typedef struct ScaleJob {
+    uint8_t *bits;
+    int stride;
+    const uint8_t *src_bits;
+    int src_stride;
+    int src_image_width;
+    int src_image_height;
+    int depth;
+    int green_565;
+    int src_x, src_y;
+    int dest_x, dest_y;
+    int dest_width, dest_height;
+    int64_t fsx, fsy;
+    int bilinear;
+    SpiceROP rop;
+    const pixman_box32_t *boxes;
+    int n_boxes;
+    int max_width;
+    /* band of destination lines */
+    int y1, y2;
+} ScaleJob;
+
+/* Horizontal pass of a source line, 4 channels per pixel */
+typedef struct ScaleLine {
+    uint16_t *values;
+    int src_line;
+    int used;
+} ScaleLine;
+
+static void scale_nearest_row_32_c(uint32_t *dest, const uint32_t *src,
+                                   int64_t vx, int64_t fsx, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++, vx += fsx) {
+        dest[i] = src[vx >> 16];
+    }
+}
+
+static void scale_nearest_row_16(uint16_t *dest, const uint16_t *src,
+                                 int64_t vx, int64_t fsx, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++, vx += fsx) {
+        dest[i] = src[vx >> 16];
+    }
+}
+
+/* vx is relative to src, both vx >> 16 and (vx >> 16) + 1 must be inside
+ * it for all the n pixels */
+static void scale_bilinear_h_c(uint16_t *out, const uint32_t *src,
+                               int64_t vx, int64_t fsx, int n)
+{
+    int i, c;
+
+    for (i = 0; i < n; i++, vx += fsx) {
+        const uint8_t *p = (const uint8_t *)(src + (vx >> 16));
+        int dx = ((vx >> 9) & 0x7f) << 1;
+
+        for (c = 0; c < 4; c++) {
+            out[i * 4 + c] = p[c] * (256 - dx) + p[4 + c] * dx;
+        }
+    }
+}
+
+static void scale_bilinear_v_c(uint32_t *dest, const uint16_t *top, const uint16_t *bottom,
+                               int dy, int n)
+{
+    uint8_t *d = (uint8_t *)dest;
+    int i;
+
+    for (i = 0; i < n * 4; i++) {
+        d[i] = ((uint32_t)top[i] * (256 - dy) + (uint32_t)bottom[i] * dy) >> 16;
+    }
+}
+
+static void (*scale_nearest_row_32_impl)(uint32_t *dest, const uint32_t *src,
+                                         int64_t vx, int64_t fsx, int n) = scale_nearest_row_32_c;
+static void (*scale_bilinear_h_impl)(uint16_t *out, const uint32_t *src,
+                                     int64_t vx, int64_t fsx, int n) = scale_bilinear_h_c;
+static void (*scale_bilinear_v_impl)(uint32_t *dest, const uint16_t *top, const uint16_t *bottom,
+                                     int dy, int n) = scale_bilinear_v_c;
+
+#ifdef SPICE_X86_SIMD
+SPICE_ATTR_TARGET("avx2")
+static void scale_nearest_row_32_avx2(uint32_t *dest, const uint32_t *src,
+                                      int64_t vx, int64_t fsx, int n)
+{
+    __m256i pos = _mm256_set_epi64x(vx + 3 * fsx, vx + 2 * fsx, vx + fsx, vx);
+    const __m256i step = _mm256_set1_epi64x(4 * fsx);
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m128i lo = _mm256_i64gather_epi32((const int *)src, _mm256_srli_epi64(pos, 16), 4);
+        __m128i hi;
+
+        pos = _mm256_add_epi64(pos, step);
+        hi = _mm256_i64gather_epi32((const int *)src, _mm256_srli_epi64(pos, 16), 4);
+        pos = _mm256_add_epi64(pos, step);
+        _mm_storeu_si128((__m128i *)(dest + i), lo);
+        _mm_storeu_si128((__m128i *)(dest + i + 4), hi);
+    }
+    scale_nearest_row_32_c(dest + i, src, vx + i * fsx, fsx, n - i);
+}
+
+/* Two pixels at a time, each one loads its left and right source pixels
+ * together. The products fit in 16 bits as the weights add up to 256 */
+SPICE_ATTR_TARGET("sse2")
+static void scale_bilinear_h_sse2(uint16_t *out, const uint32_t *src,
+                                  int64_t vx, int64_t fsx, int n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i full = _mm_set1_epi16(256);
+    int i;
+
+    for (i = 0; i + 2 <= n; i += 2, vx += 2 * fsx) {
+        int64_t vx1 = vx + fsx;
+        __m128i p0 = _mm_loadl_epi64((const __m128i *)(src + (vx >> 16)));
+        __m128i p1 = _mm_loadl_epi64((const __m128i *)(src + (vx1 >> 16)));
+        /* left pixels then right pixels */
+        __m128i p = _mm_unpacklo_epi32(p0, p1);
+        int dx0 = ((vx >> 9) & 0x7f) << 1;
+        int dx1 = ((vx1 >> 9) & 0x7f) << 1;
+        __m128i wr = _mm_set_epi16(dx1, dx1, dx1, dx1, dx0, dx0, dx0, dx0);
+        __m128i l = _mm_mullo_epi16(_mm_unpacklo_epi8(p, zero), _mm_sub_epi16(full, wr));
+        __m128i r = _mm_mullo_epi16(_mm_unpackhi_epi8(p, zero), wr);
+
+        _mm_storeu_si128((__m128i *)(out + i * 4), _mm_add_epi16(l, r));
+    }
+    scale_bilinear_h_c(out + i * 4, src, vx, fsx, n - i);
+}
+
+/* The horizontal values are even, halving them makes them fit the signed
+ * 16 bits multiply-add with no loss */
+SPICE_ATTR_TARGET("sse2")
+static void scale_bilinear_v_sse2(uint32_t *dest, const uint16_t *top, const uint16_t *bottom,
+                                  int dy, int n)
+{
+    const __m128i w = _mm_set1_epi32((dy << 16) | (256 - dy));
+    int i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128i t0 = _mm_srli_epi16(_mm_loadu_si128((const __m128i *)(top + i * 4)), 1);
+        __m128i t1 = _mm_srli_epi16(_mm_loadu_si128((const __m128i *)(top + i * 4 + 8)), 1);
+        __m128i b0 = _mm_srli_epi16(_mm_loadu_si128((const __m128i *)(bottom + i * 4)), 1);
+        __m128i b1 = _mm_srli_epi16(_mm_loadu_si128((const __m128i *)(bottom + i * 4 + 8)), 1);
+        __m128i r0 = _mm_srai_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(t0, b0), w), 15);
+        __m128i r1 = _mm_srai_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(t0, b0), w), 15);
+        __m128i r2 = _mm_srai_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(t1, b1), w), 15);
+        __m128i r3 = _mm_srai_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(t1, b1), w), 15);
+
+        _mm_storeu_si128((__m128i *)(dest + i),
+                         _mm_packus_epi16(_mm_packs_epi32(r0, r1), _mm_packs_epi32(r2, r3)));
+    }
+    scale_bilinear_v_c(dest + i, top + i * 4, bottom + i * 4, dy, n - i);
+}
+
+SPICE_ATTR_TARGET("avx2")
+static void scale_bilinear_v_avx2(uint32_t *dest, const uint16_t *top, const uint16_t *bottom,
+                                  int dy, int n)
+{
+    const __m256i w = _mm256_set1_epi32((dy << 16) | (256 - dy));
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256i t0 = _mm256_srli_epi16(_mm256_loadu_si256((const __m256i *)(top + i * 4)), 1);
+        __m256i t1 = _mm256_srli_epi16(_mm256_loadu_si256((const __m256i *)(top + i * 4 + 16)), 1);
+        __m256i b0 = _mm256_srli_epi16(_mm256_loadu_si256((const __m256i *)(bottom + i * 4)), 1);
+        __m256i b1 = _mm256_srli_epi16(_mm256_loadu_si256((const __m256i *)(bottom + i * 4 + 16)), 1);
+        __m256i r0 = _mm256_srai_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(t0, b0), w), 15);
+        __m256i r1 = _mm256_srai_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(t0, b0), w), 15);
+        __m256i r2 = _mm256_srai_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(t1, b1), w), 15);
+        __m256i r3 = _mm256_srai_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(t1, b1), w), 15);
+        /* packing works inside the 128 bits lanes, put the pixels back in order */
+        __m256i p = _mm256_packus_epi16(_mm256_packs_epi32(r0, r1), _mm256_packs_epi32(r2, r3));
+
+        _mm256_storeu_si256((__m256i *)(dest + i),
+                            _mm256_permute4x64_epi64(p, _MM_SHUFFLE(3, 1, 2, 0)));
+    }
+    scale_bilinear_v_sse2(dest + i, top + i * 4, bottom + i * 4, dy, n - i);
+}
+#endif
+
+static void scale_expand_16(uint32_t *dest, const uint16_t *src, int n, int green_565)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        uint32_t r, g, b;
+
+        if (green_565) {
+            r = (src[i] >> 11) & 0x1f;
+            g = (src[i] >> 5) & 0x3f;
+            g = (g << 2) | (g >> 4);
+        } else {
+            r = (src[i] >> 10) & 0x1f;
+            g = (src[i] >> 5) & 0x1f;
+            g = (g << 3) | (g >> 2);
+        }
+        b = src[i] & 0x1f;
+        dest[i] = 0xff000000 | (((r << 3) | (r >> 2)) << 16) | (g << 8) | (b << 3) | (b >> 2);
+    }
+}
+
+static void scale_pack_16(uint16_t *dest, const uint32_t *src, int n, int green_565)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (green_565) {
+            dest[i] = ((src[i] >> 8) & 0xf800) | ((src[i] >> 5) & 0x07e0) | ((src[i] >> 3) & 0x001f);
+        } else {
+            dest[i] = ((src[i] >> 9) & 0x7c00) | ((src[i] >> 6) & 0x03e0) | ((src[i] >> 3) & 0x001f);
+        }
+    }
+}
+
+static void scale_bilinear_h_edge(uint16_t *out, const uint32_t *src, int len, int64_t vx)
+{
+    int x = vx >> 16;
+    int dx = ((vx >> 9) & 0x7f) << 1;
+    uint32_t l = x >= 0 && x < len ? src[x] : 0;
+    uint32_t r = x + 1 >= 0 && x + 1 < len ? src[x + 1] : 0;
+    int c;
+
+    for (c = 0; c < 4; c++) {
+        out[c] = ((l >> (c * 8)) & 0xff) * (256 - dx) + ((r >> (c * 8)) & 0xff) * dx;
+    }
+}
+
+/* Horizontal pass of the n pixels starting at vx of a source line of
+ * len pixels, or of a line of zeros if src is NULL */
+static void scale_bilinear_h_line(uint16_t *out, const uint32_t *src, int len,
+                                  int64_t vx, int64_t fsx, int n)
+{
+    int64_t end;
+    int i = 0;
+
+    if (src == NULL) {
+        memset(out, 0, n * 4 * sizeof(uint16_t));
+        return;
+    }
+
+    /* positions before end have both source pixels inside the line */
+    end = (int64_t)(len - 1) << 16;
+
+    for (; i < n && vx < 0; i++, vx += fsx) {
+        scale_bilinear_h_edge(out + i * 4, src, len, vx);
+    }
+    if (i < n && vx < end) {
+        int inner = MIN(n - i, (end - vx + fsx - 1) / fsx);
+
+        scale_bilinear_h_impl(out + i * 4, src, vx, fsx, inner);
+        i += inner;
+        vx += inner * fsx;
+    }
+    for (; i < n; i++, vx += fsx) {
+        scale_bilinear_h_edge(out + i * 4, src, len, vx);
+    }
+}
+
+/* Horizontal pass of a source line for the current box, kept in whichever
+ * of the two cached lines is not the keep one */
+static const uint16_t *scale_bilinear_get_line(const ScaleJob *job, ScaleLine *lines,
+                                               uint32_t *expanded, int lo, int hi,
+                                               int src_line, int keep,
+                                               int64_t vx, int n)
+{
+    ScaleLine *line;
+
+    if (lines[0].used && lines[0].src_line == src_line) {
+        return lines[0].values;
+    }
+    if (lines[1].used && lines[1].src_line == src_line) {
+        return lines[1].values;
+    }
+    line = lines[0].used && lines[0].src_line == keep ? &lines[1] : &lines[0];
+    line->used = TRUE;
+    line->src_line = src_line;
+
+    if (src_line < 0 || src_line >= job->src_image_height || lo > hi) {
+        scale_bilinear_h_line(line->values, NULL, 0, vx, job->fsx, n);
+    } else if (job->depth == 32) {
+        scale_bilinear_h_line(line->values,
+                              (const uint32_t *)(job->src_bits + src_line * job->src_stride),
+                              job->src_image_width, vx, job->fsx, n);
+    } else {
+        /* only the source pixels used by the box */
+        const uint16_t *src = (const uint16_t *)(job->src_bits + src_line * job->src_stride);
+
+        scale_expand_16(expanded, src + lo, hi - lo + 1, job->green_565);
+        scale_bilinear_h_line(line->values, expanded, hi - lo + 1,
+                              vx - ((int64_t)lo << 16), job->fsx, n);
+    }
+    return line->values;
+}
+
+static void scale_box(const ScaleJob *job, const pixman_box32_t *box,
+                      uint32_t *line_buf, uint16_t *line_buf_16,
+                      ScaleLine *lines, uint32_t *expanded)
+{
+    void (*rop_row)(uint8_t *dest, const uint8_t *src, int len, const RopMasks *masks);
+    int x1 = MAX(box->x1, job->dest_x);
+    int y1 = MAX(MAX(box->y1, job->dest_y), job->y1);
+    int x2 = MIN(box->x2, job->dest_x + job->dest_width);
+    int y2 = MIN(MIN(box->y2, job->dest_y + job->dest_height), job->y2);
+    int bytes_pp = job->depth / 8;
+    int copy = job->rop == SPICE_ROP_COPY;
+    RopMasks masks;
+    int64_t vx, vy;
+    int n, y;
+
+    if (x1 >= x2 || y1 >= y2) {
+        return;
+    }
+    n = x2 - x1;
+    rop_masks_init(&masks, job->rop);
+    rop_row = rop_copy_row_impl ? rop_copy_row_impl : rop_copy_row_c;
+
+    vx = scale_nearest_start(job->fsx, x1 - job->dest_x, job->src_x);
+    vy = scale_nearest_start(job->fsy, y1 - job->dest_y, job->src_y);
+
+    if (!job->bilinear) {
+        for (y = y1; y < y2; y++, vy += job->fsy) {
+            const uint8_t *src_line = job->src_bits + (vy >> 16) * job->src_stride;
+            uint8_t *dest_line = job->bits + y * job->stride + x1 * bytes_pp;
+            const uint8_t *scaled;
+
+            if (job->depth == 32) {
+                uint32_t *out = copy ? (uint32_t *)dest_line : line_buf;
+
+                scale_nearest_row_32_impl(out, (const uint32_t *)src_line, vx, job->fsx, n);
+                scaled = (const uint8_t *)line_buf;
+            } else {
+                uint16_t *out = copy ? (uint16_t *)dest_line : line_buf_16;
+
+                scale_nearest_row_16(out, (const uint16_t *)src_line, vx, job->fsx, n);
+                scaled = (const uint8_t *)line_buf_16;
+            }
+            if (!copy) {
+                rop_row(dest_line, scaled, n * bytes_pp, &masks);
+            }
+        }
+    } else {
+        int lo = 0, hi = 0;
+
+        /* centre of the pixel minus half a pixel */
+        vx += 1 - 0x8000;
+        vy += 1 - 0x8000;
+        if (job->depth == 16) {
+            lo = MAX(0, vx >> 16);
+            hi = MIN(job->src_image_width - 1, ((vx + (n - 1) * job->fsx) >> 16) + 1);
+        }
+        lines[0].used = FALSE;
+        lines[1].used = FALSE;
+
+        for (y = y1; y < y2; y++, vy += job->fsy) {
+            int src_line = vy >> 16;
+            int dy = ((vy >> 9) & 0x7f) << 1;
+            uint8_t *dest_line = job->bits + y * job->stride + x1 * bytes_pp;
+            const uint16_t *top, *bottom;
+            uint32_t *out;
+
+            top = scale_bilinear_get_line(job, lines, expanded, lo, hi,
+                                          src_line, src_line + 1, vx, n);
+            /* with no vertical weight the bottom line is not needed */
+            bottom = dy == 0 ? top : scale_bilinear_get_line(job, lines, expanded, lo, hi,
+                                                             src_line + 1, src_line, vx, n);
+
+            out = copy && job->depth == 32 ? (uint32_t *)dest_line : line_buf;
+            scale_bilinear_v_impl(out, top, bottom, dy, n);
+            if (job->depth == 32) {
+                if (!copy) {
+                    rop_row(dest_line, (const uint8_t *)line_buf, n * 4, &masks);
+                }
+            } else if (copy) {
+                scale_pack_16((uint16_t *)dest_line, line_buf, n, job->green_565);
+            } else {
+                scale_pack_16(line_buf_16, line_buf, n, job->green_565);
+                rop_row(dest_line, (const uint8_t *)line_buf_16, n * 2, &masks);
+            }
+        }
+    }
+}
+
+static void scale_worker(void *data, int y1, int y2)
+{
+    ScaleJob *job = data;
+    uint32_t *line_buf = spice_new(uint32_t, job->max_width);
+    uint16_t *line_buf_16 = spice_new(uint16_t, job->max_width);
+    ScaleLine lines[2] = { { NULL, 0, FALSE }, { NULL, 0, FALSE } };
+    uint32_t *expanded = NULL;
+    int i;
+
+    job->y1 = y1;
+    job->y2 = y2;
+    if (job->bilinear) {
+        lines[0].values = spice_new(uint16_t, job->max_width * 4);
+        lines[1].values = spice_new(uint16_t, job->max_width * 4);
+        if (job->depth == 16) {
+            expanded = spice_new(uint32_t, job->src_image_width);
+        }
+    }
+
+    for (i = 0; i < job->n_boxes; i++) {
+        scale_box(job, &job->boxes[i], line_buf, line_buf_16, lines, expanded);
+    }
+
+    free(expanded);
+    free(lines[0].values);
+    free(lines[1].values);
+    free(line_buf_16);
+    free(line_buf);
+}
+
+/* The pixels are interpolated as stored, the source can't have padding
+ * bits where the destination has alpha */
+static int scale_formats_supported(pixman_format_code_t dest, pixman_format_code_t src)
+{
+    if (PIXMAN_FORMAT_BPP(dest) != PIXMAN_FORMAT_BPP(src)) {
+        return FALSE;
+    }
+    switch (PIXMAN_FORMAT_BPP(dest)) {
+    case 16:
+        return dest == src && (dest == PIXMAN_r5g6b5 || dest == PIXMAN_x1r5g5b5);
+    case 32:
+        return PIXMAN_FORMAT_TYPE(dest) == PIXMAN_FORMAT_TYPE(src) &&
+               PIXMAN_FORMAT_R(dest) == 8 && PIXMAN_FORMAT_R(src) == 8 &&
+               PIXMAN_FORMAT_G(dest) == 8 && PIXMAN_FORMAT_G(src) == 8 &&
+               PIXMAN_FORMAT_B(dest) == 8 && PIXMAN_FORMAT_B(src) == 8 &&
+               (PIXMAN_FORMAT_A(dest) == 0 || PIXMAN_FORMAT_A(src) == 8);
+    default:
+        return FALSE;
+    }
+}
+
+int spice_pixman_scale_rop(pixman_image_t *dest,
+                           pixman_image_t *src,
+                           int src_x, int src_y,
+                           int src_width, int src_height,
+                           int dest_x, int dest_y,
+                           int dest_width, int dest_height,
+                           const pixman_box32_t *boxes, int n_boxes,
+                           int bilinear, SpiceROP rop, int n_threads)
+{
+    ScaleJob *jobs;
+    int64_t n_pixels = 0;
+    int band_y1 = 0, band_y2 = 0;
+    int max_width = 0;
+    int i;
+    ScaleJob job;
+
+    if (!scale_formats_supported(pixman_image_get_format(dest), pixman_image_get_format(src))) {
+        return FALSE;
+    }
+    if (dest_width <= 0 || dest_height <= 0 || src_x < 0 || src_y < 0 ||
+        src_x + src_width > pixman_image_get_width(src) ||
+        src_y + src_height > pixman_image_get_height(src)) {
+        return FALSE;
+    }
+    /* the lines are read while others are written */
+    if (pixman_image_get_data(src) == pixman_image_get_data(dest)) {
+        return FALSE;
+    }
+
+    memset(&job, 0, sizeof(job));
+    job.fsx = ((int64_t)src_width << 16) / dest_width;
+    job.fsy = ((int64_t)src_height << 16) / dest_height;
+    if (job.fsx <= 0 || job.fsy <= 0) {
+        return FALSE;
+    }
+    job.bits = (uint8_t *)pixman_image_get_data(dest);
+    job.stride = pixman_image_get_stride(dest);
+    job.src_bits = (const uint8_t *)pixman_image_get_data(src);
+    job.src_stride = pixman_image_get_stride(src);
+    job.src_image_width = pixman_image_get_width(src);
+    job.src_image_height = pixman_image_get_height(src);
+    job.depth = spice_pixman_image_get_bpp(dest);
+    job.green_565 = PIXMAN_FORMAT_G(pixman_image_get_format(dest)) == 6;
+    job.src_x = src_x;
+    job.src_y = src_y;
+    job.dest_x = dest_x;
+    job.dest_y = dest_y;
+    job.dest_width = dest_width;
+    job.dest_height = dest_height;
+    job.bilinear = bilinear;
+    job.rop = rop;
+    job.boxes = boxes;
+    job.n_boxes = n_boxes;
+
+    for (i = 0; i < n_boxes; i++) {
+        int x1 = MAX(boxes[i].x1, dest_x);
+        int y1 = MAX(boxes[i].y1, dest_y);
+        int x2 = MIN(boxes[i].x2, dest_x + dest_width);
+        int y2 = MIN(boxes[i].y2, dest_y + dest_height);
+
+        if (x1 >= x2 || y1 >= y2) {
+            continue;
+        }
+        spice_assert(x1 >= 0 && y1 >= 0);
+        spice_assert(x2 <= pixman_image_get_width(dest));
+        spice_assert(y2 <= pixman_image_get_height(dest));
+
+        if (n_pixels == 0) {
+            band_y1 = y1;
+            band_y2 = y2;
+        }
+        band_y1 = MIN(band_y1, y1);
+        band_y2 = MAX(band_y2, y2);
+        max_width = MAX(max_width, x2 - x1);
+        n_pixels += (int64_t)(x2 - x1) * (y2 - y1);
+    }
+    if (n_pixels == 0) {
+        return TRUE;
+    }
+    job.max_width = max_width;
+
+    if (n_threads <= 0) {
+        n_threads = g_get_num_processors();
+    }
+    n_threads = MAX(1, MIN(n_threads, MIN(n_pixels / SCALE_MIN_BAND_PIXELS, band_y2 - band_y1)));
+
+    jobs = spice_new(ScaleJob, n_threads);
+    for (i = 0; i < n_threads; i++) {
+        jobs[i] = job;
+    }
+    spice_run_bands(scale_worker, jobs, sizeof(ScaleJob), n_threads, band_y1, band_y2, 1);
+    free(jobs);
+    return TRUE;
+}
+
+/* Past this size a scroll goes through memory anyway, streaming the
+ * stores avoids reading the destination in and evicting everything else */
+#define COPY_BLOCK_NT_THRESHOLD (2 * 1024 * 1024)
+
+#ifdef SPICE_X86_SIMD
+/* The copy goes in the direction reading each chunk of the source before
+ * it gets overwritten, this needs dest and src to be at least a chunk
+ * apart */
+SPICE_ATTR_TARGET("sse2")
+static void copy_block_nt_sse2(uint8_t *dest, const uint8_t *src, size_t size)
+{
+    if (dest < src) {
+        size_t head = MIN((-(uintptr_t)dest) & 15, size);
+
+        memmove(dest, src, head);
+        dest += head;
+        src += head;
+        size -= head;
+        for (; size >= 64; size -= 64, dest += 64, src += 64) {
+            __m128i a = _mm_loadu_si128((const __m128i *)src);
+            __m128i b = _mm_loadu_si128((const __m128i *)(src + 16));
+            __m128i c = _mm_loadu_si128((const __m128i *)(src + 32));
+            __m128i d = _mm_loadu_si128((const __m128i *)(src + 48));
+
+            _mm_stream_si128((__m128i *)dest, a);
+            _mm_stream_si128((__m128i *)(dest + 16), b);
+            _mm_stream_si128((__m128i *)(dest + 32), c);
+            _mm_stream_si128((__m128i *)(dest + 48), d);
+        }
+        _mm_sfence();
+        memmove(dest, src, size);
+    } else {
+        size_t tail = MIN((uintptr_t)(dest + size) & 15, size);
+
+        size -= tail;
+        memmove(dest + size, src + size, tail);
+        for (; size >= 64; size -= 64) {
+            __m128i a = _mm_loadu_si128((const __m128i *)(src + size - 64));
+            __m128i b = _mm_loadu_si128((const __m128i *)(src + size - 48));
+            __m128i c = _mm_loadu_si128((const __m128i *)(src + size - 32));
+            __m128i d = _mm_loadu_si128((const __m128i *)(src + size - 16));
+
+            _mm_stream_si128((__m128i *)(dest + size - 64), a);
+            _mm_stream_si128((__m128i *)(dest + size - 48), b);
+            _mm_stream_si128((__m128i *)(dest + size - 32), c);
+            _mm_stream_si128((__m128i *)(dest + size - 16), d);
+        }
+        _mm_sfence();
+        memmove(dest, src, size);
+    }
+}
+#endif
+
+static void (*copy_block_nt_impl)(uint8_t *dest, const uint8_t *src, size_t size);
+
+/* memmove() for a block of the image */
+static void copy_block(uint8_t *dest, const uint8_t *src, size_t size)
+{
+    if (copy_block_nt_impl && size >= COPY_BLOCK_NT_THRESHOLD &&
+        (dest < src ? src - dest : dest - src) >= 64) {
+        copy_block_nt_impl(dest, src, size);
+    } else {
+        memmove(dest, src, size);
+    }
+}
+
+static void copy_bits_up(uint8_t *data, const int stride, int bpp,
+                         const int src_x, const int src_y,
+                         const int width, const int height,
                          const int dest_x, const int dest_y)
 {
     uint8_t *src = data + src_y * stride + src_x * bpp;
@@ -891,6 +2104,20 @@ void spice_pixman_copy_rect (pixman_image_t *image,
     stride = pixman_image_get_stride(image);
     bpp = spice_pixman_image_get_bpp(image) / 8;
 
+    /* Rows spanning the whole image are contiguous save for the stride
+     * padding, which can be moved along, so a vertical scroll of those is a
+     * single block copy, starting from the lowest row address for bottom
+     * up images */
+    if (src_x == 0 && dest_x == 0 && width == pixman_image_get_width(image) &&
+        src_y != dest_y && height > 0 && bpp > 0) {
+        int first_row = stride < 0 ? height - 1 : 0;
+
+        copy_block(data + (dest_y + first_row) * stride,
+                   data + (src_y + first_row) * stride,
+                   (size_t)(height - 1) * ABS(stride) + width * bpp);
+        return;
+    }
+
     if (dest_y > src_y) {
         copy_bits_down(data, stride, bpp,
                        src_x, src_y,
@@ -1054,6 +2281,191 @@ static inline uint16_t rgb_32_to_16_555(uint32_t color)
         (((color) >> 9) & 0x7c00);
 }
 
+/* Row converters, runtime selected like the other SIMD helpers */
+static void convert_row_24_to_32_c(uint32_t *dest, const uint8_t *src, int width)
+{
+    int x;
+
+    for (x = 0; x < width; x++, src += 3) {
+        dest[x] = (src[2] << 16) | (src[1] << 8) | src[0];
+    }
+}
+
+static void convert_row_16_to_32_c(uint32_t *dest, const uint16_t *src, int width,
+                                   uint32_t alpha)
+{
+    int x;
+
+    for (x = 0; x < width; x++) {
+        dest[x] = rgb_16_555_to_32(UINT16_FROM_LE(src[x])) | alpha;
+    }
+}
+
+static void convert_row_32_to_16_555_c(uint16_t *dest, const uint32_t *src, int width)
+{
+    int x;
+
+    for (x = 0; x < width; x++) {
+        dest[x] = rgb_32_to_16_555(UINT32_FROM_LE(src[x]));
+    }
+}
+
+static void convert_row_24_to_16_555_c(uint16_t *dest, const uint8_t *src, int width)
+{
+    int x;
+
+    for (x = 0; x < width; x++, src += 3) {
+        dest[x] = rgb_32_to_16_555((src[2] << 16) | (src[1] << 8) | src[0]);
+    }
+}
+
+static void convert_row_8_to_32_c(uint32_t *dest, const uint8_t *src, int width,
+                                  const uint32_t *ents)
+{
+    int x;
+
+    for (x = 0; x < width; x++) {
+        dest[x] = ents[src[x]];
+    }
+}
+
+#ifdef SPICE_X86_SIMD
+/* spreads 4 packed BGR pixels to xRGB */
+#define BGR_TO_XRGB_SHUFFLE 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1
+
+SPICE_ATTR_TARGET("ssse3")
+static inline __m128i rgb_32_to_16_555_m128(__m128i lo, __m128i hi)
+{
+    const __m128i b_mask = _mm_set1_epi32(0x001f);
+    const __m128i g_mask = _mm_set1_epi32(0x03e0);
+    const __m128i r_mask = _mm_set1_epi32(0x7c00);
+
+    lo = _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_srli_epi32(lo, 3), b_mask),
+                                   _mm_and_si128(_mm_srli_epi32(lo, 6), g_mask)),
+                      _mm_and_si128(_mm_srli_epi32(lo, 9), r_mask));
+    hi = _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_srli_epi32(hi, 3), b_mask),
+                                   _mm_and_si128(_mm_srli_epi32(hi, 6), g_mask)),
+                      _mm_and_si128(_mm_srli_epi32(hi, 9), r_mask));
+    /* the values fit in 15 bits so the signed saturation never kicks in */
+    return _mm_packs_epi32(lo, hi);
+}
+
+SPICE_ATTR_TARGET("ssse3")
+static inline __m128i rgb_16_555_to_32_m128(__m128i p, __m128i alpha)
+{
+    __m128i b = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(p, _mm_set1_epi32(0x001f)), 3),
+                             _mm_srli_epi32(_mm_and_si128(p, _mm_set1_epi32(0x001c)), 2));
+    __m128i g = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(p, _mm_set1_epi32(0x03e0)), 6),
+                             _mm_slli_epi32(_mm_and_si128(p, _mm_set1_epi32(0x0380)), 1));
+    __m128i r = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(p, _mm_set1_epi32(0x7c00)), 9),
+                             _mm_slli_epi32(_mm_and_si128(p, _mm_set1_epi32(0x7000)), 4));
+
+    return _mm_or_si128(_mm_or_si128(b, g), _mm_or_si128(r, alpha));
+}
+
+SPICE_ATTR_TARGET("ssse3")
+static void convert_row_24_to_32_ssse3(uint32_t *dest, const uint8_t *src, int width)
+{
+    const __m128i shuffle = _mm_setr_epi8(BGR_TO_XRGB_SHUFFLE);
+    int x;
+
+    /* each load reads 16 bytes for 12 used, stay inside the row */
+    for (x = 0; (x + 4) * 3 + 4 <= width * 3; x += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + x * 3));
+        _mm_storeu_si128((__m128i *)(dest + x), _mm_shuffle_epi8(v, shuffle));
+    }
+    convert_row_24_to_32_c(dest + x, src + x * 3, width - x);
+}
+
+SPICE_ATTR_TARGET("ssse3")
+static void convert_row_16_to_32_ssse3(uint32_t *dest, const uint16_t *src, int width,
+                                       uint32_t alpha)
+{
+    const __m128i a = _mm_set1_epi32(alpha);
+    const __m128i zero = _mm_setzero_si128();
+    int x;
+
+    for (x = 0; x + 8 <= width; x += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + x));
+        __m128i lo = rgb_16_555_to_32_m128(_mm_unpacklo_epi16(v, zero), a);
+        __m128i hi = rgb_16_555_to_32_m128(_mm_unpackhi_epi16(v, zero), a);
+
+        _mm_storeu_si128((__m128i *)(dest + x), lo);
+        _mm_storeu_si128((__m128i *)(dest + x + 4), hi);
+    }
+    convert_row_16_to_32_c(dest + x, src + x, width - x, alpha);
+}
+
+SPICE_ATTR_TARGET("ssse3")
+static void convert_row_32_to_16_555_ssse3(uint16_t *dest, const uint32_t *src, int width)
+{
+    int x;
+
+    for (x = 0; x + 8 <= width; x += 8) {
+        __m128i lo = _mm_loadu_si128((const __m128i *)(src + x));
+        __m128i hi = _mm_loadu_si128((const __m128i *)(src + x + 4));
+        _mm_storeu_si128((__m128i *)(dest + x), rgb_32_to_16_555_m128(lo, hi));
+    }
+    convert_row_32_to_16_555_c(dest + x, src + x, width - x);
+}
+
+SPICE_ATTR_TARGET("ssse3")
+static void convert_row_24_to_16_555_ssse3(uint16_t *dest, const uint8_t *src, int width)
+{
+    const __m128i shuffle = _mm_setr_epi8(BGR_TO_XRGB_SHUFFLE);
+    int x;
+
+    for (x = 0; (x + 8) * 3 + 4 <= width * 3; x += 8) {
+        __m128i lo = _mm_loadu_si128((const __m128i *)(src + x * 3));
+        __m128i hi = _mm_loadu_si128((const __m128i *)(src + x * 3 + 12));
+
+        lo = _mm_shuffle_epi8(lo, shuffle);
+        hi = _mm_shuffle_epi8(hi, shuffle);
+        _mm_storeu_si128((__m128i *)(dest + x), rgb_32_to_16_555_m128(lo, hi));
+    }
+    convert_row_24_to_16_555_c(dest + x, src + x * 3, width - x);
+}
+
+SPICE_ATTR_TARGET("avx2")
+static void convert_row_24_to_32_avx2(uint32_t *dest, const uint8_t *src, int width)
+{
+    const __m256i shuffle = _mm256_setr_epi8(BGR_TO_XRGB_SHUFFLE, BGR_TO_XRGB_SHUFFLE);
+    int x;
+
+    for (x = 0; (x + 8) * 3 + 4 <= width * 3; x += 8) {
+        __m256i v = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(src + x * 3))),
+            _mm_loadu_si128((const __m128i *)(src + x * 3 + 12)), 1);
+        _mm256_storeu_si256((__m256i *)(dest + x), _mm256_shuffle_epi8(v, shuffle));
+    }
+    convert_row_24_to_32_ssse3(dest + x, src + x * 3, width - x);
+}
+
+SPICE_ATTR_TARGET("avx2")
+static void convert_row_8_to_32_avx2(uint32_t *dest, const uint8_t *src, int width,
+                                     const uint32_t *ents)
+{
+    int x;
+
+    for (x = 0; x + 8 <= width; x += 8) {
+        __m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + x)));
+        _mm256_storeu_si256((__m256i *)(dest + x),
+                            _mm256_i32gather_epi32((const int *)ents, idx, 4));
+    }
+    convert_row_8_to_32_c(dest + x, src + x, width - x, ents);
+}
+#endif
+
+static void (*convert_row_24_to_32_impl)(uint32_t *dest, const uint8_t *src, int width) =
+    convert_row_24_to_32_c;
+static void (*convert_row_16_to_32_impl)(uint32_t *dest, const uint16_t *src, int width,
+                                         uint32_t alpha) = convert_row_16_to_32_c;
+static void (*convert_row_32_to_16_555_impl)(uint16_t *dest, const uint32_t *src, int width) =
+    convert_row_32_to_16_555_c;
+static void (*convert_row_24_to_16_555_impl)(uint16_t *dest, const uint8_t *src, int width) =
+    convert_row_24_to_16_555_c;
+static void (*convert_row_8_to_32_impl)(uint32_t *dest, const uint8_t *src, int width,
+                                        const uint32_t *ents) = convert_row_8_to_32_c;
 
 static void bitmap_32_to_32(uint8_t* dest, int dest_stride,
                             uint8_t* src, int src_stride,
@@ -1090,17 +2502,7 @@ static void bitmap_24_to_32(uint8_t* dest, int dest_stride,
                             int width, uint8_t* end)
 {
     for (; src != end; src += src_stride, dest += dest_stride) {
-        uint8_t* src_line = src;
-        uint8_t* src_line_end = src_line + width * 3;
-        uint32_t* dest_line = (uint32_t *)dest;
-
-        for (; src_line < src_line_end; ++dest_line) {
-            uint32_t r, g, b;
-            b = *(src_line++);
-            g = *(src_line++);
-            r = *(src_line++);
-            *dest_line = (r << 16) | (g << 8) | (b);
-        }
+        convert_row_24_to_32_impl((uint32_t *)dest, src, width);
     }
 }
 
@@ -1161,13 +2563,7 @@ static void bitmap_8_32_to_32(uint8_t *dest, int dest_stride,
     }
 
     for (; src != end; src += src_stride, dest += dest_stride) {
-        uint32_t *dest_line = (uint32_t*)dest;
-        uint8_t *src_line = src;
-        uint8_t *src_line_end = src_line + width;
-
-        while (src_line < src_line_end) {
-            *(dest_line++) = ents[*(src_line++)];
-        }
+        convert_row_8_to_32_impl((uint32_t *)dest, src, width, ents);
     }
 }
 
@@ -1385,20 +2781,12 @@ static void bitmap_1be_16_to_16_555(uint8_t* dest, int dest_stride,
     }
 }
 
-#ifdef NOT_USED_ATM
-
 static void bitmap_16_to_32(uint8_t* dest, int dest_stride,
                             uint8_t* src, int src_stride,
-                            int width, uint8_t* end)
+                            int width, uint8_t* end, uint32_t alpha)
 {
     for (; src != end; src += src_stride, dest += dest_stride) {
-        uint16_t* src_line = (uint16_t*)src;
-        uint16_t* src_line_end = src_line + width;
-        uint32_t* dest_line = (uint32_t*)dest;
-
-        for (; src_line < src_line_end; ++dest_line, src_line++) {
-            *dest_line = rgb_16_555_to_32(UINT16_FROM_LE(*src_line));
-        }
+        convert_row_16_to_32_impl((uint32_t *)dest, (uint16_t *)src, width, alpha);
     }
 }
 
@@ -1407,38 +2795,19 @@ static void bitmap_32_to_16_555(uint8_t* dest, int dest_stride,
                                 int width, uint8_t* end)
 {
     for (; src != end; src += src_stride, dest += dest_stride) {
-        uint32_t* src_line = (uint32_t *)src;
-        uint32_t* src_line_end = src_line + width;
-        uint16_t* dest_line = (uint16_t *)dest;
-
-        for (; src_line < src_line_end; ++dest_line, ++src_line) {
-            *dest_line = rgb_32_to_16_555(UINT16_FROM_LE(*src_line));
-        }
+        convert_row_32_to_16_555_impl((uint16_t *)dest, (uint32_t *)src, width);
     }
 }
 
-
 static void bitmap_24_to_16_555(uint8_t* dest, int dest_stride,
                                 uint8_t* src, int src_stride,
                                 int width, uint8_t* end)
 {
     for (; src != end; src += src_stride, dest += dest_stride) {
-        uint8_t* src_line = src;
-        uint8_t* src_line_end = src_line + width * 3;
-        uint16_t* dest_line = (uint16_t *)dest;
-
-        for (; src_line < src_line_end; ++dest_line) {
-            uint8_t r, g, b;
-            b = *(src_line++);
-            g = *(src_line++);
-            r = *(src_line++);
-            *dest_line = rgb_32_to_16_555(r << 24 | g << 16 | b);
-        }
+        convert_row_24_to_16_555_impl((uint16_t *)dest, src, width);
     }
 }
 
-#endif
-
 /* This assumes that the dest, if set is the same format as
    spice_bitmap_format_to_pixman would have picked */
 pixman_image_t *spice_bitmap_to_pixman(pixman_image_t *dest_image,
@@ -1542,6 +2911,57 @@ static int pixman_format_compatible (pixman_format_code_t dest_format,
     return FALSE;
 }
 
+/* Converts the bitmap formats the canvas commonly gets for a surface of
+ * another depth straight into dest_image, doing what a pixman SRC composite
+ * would. Returns FALSE if there is no direct conversion. */
+static int bitmap_convert_direct(pixman_format_code_t dest_format,
+                                 pixman_image_t *dest_image,
+                                 int src_format, int flags,
+                                 int width, int height,
+                                 uint8_t *src, int src_stride)
+{
+    uint8_t *dest;
+    int dest_stride;
+    uint8_t *end;
+
+    if (dest_format == PIXMAN_x1r5g5b5) {
+        if (src_format != SPICE_BITMAP_FMT_32BIT && src_format != SPICE_BITMAP_FMT_RGBA &&
+            src_format != SPICE_BITMAP_FMT_24BIT) {
+            return FALSE;
+        }
+    } else if (dest_format == PIXMAN_x8r8g8b8 || dest_format == PIXMAN_a8r8g8b8) {
+        if (src_format != SPICE_BITMAP_FMT_16BIT) {
+            return FALSE;
+        }
+    } else {
+        return FALSE;
+    }
+
+    dest = (uint8_t *)pixman_image_get_data(dest_image);
+    dest_stride = pixman_image_get_stride(dest_image);
+    if (!(flags & SPICE_BITMAP_FLAGS_TOP_DOWN)) {
+        spice_assert(height > 0);
+        dest += dest_stride * (height - 1);
+        dest_stride = -dest_stride;
+    }
+    end = src + (height * src_stride);
+
+    switch (src_format) {
+    case SPICE_BITMAP_FMT_32BIT:
+    case SPICE_BITMAP_FMT_RGBA:
+        bitmap_32_to_16_555(dest, dest_stride, src, src_stride, width, end);
+        break;
+    case SPICE_BITMAP_FMT_24BIT:
+        bitmap_24_to_16_555(dest, dest_stride, src, src_stride, width, end);
+        break;
+    case SPICE_BITMAP_FMT_16BIT:
+        bitmap_16_to_32(dest, dest_stride, src, src_stride, width, end,
+                        dest_format == PIXMAN_a8r8g8b8 ? 0xff000000 : 0);
+        break;
+    }
+    return TRUE;
+}
+
 pixman_image_t *spice_bitmap_convert_to_pixman(pixman_format_code_t dest_format,
                                                pixman_image_t *dest_image,
                                                int src_format,
@@ -1573,6 +2993,11 @@ pixman_image_t *spice_bitmap_convert_to_pixman(pixman_format_code_t dest_format,
                                       palette_surface_format, palette);
     }
 
+    if (bitmap_convert_direct(dest_format, dest_image, src_format, flags,
+                              width, height, src, src_stride)) {
+        return dest_image;
+    }
+
     src_image = spice_bitmap_try_as_pixman(src_format,
                                            flags, width,height,
                                            src, src_stride);
@@ -1602,3 +3027,352 @@ pixman_image_t *spice_bitmap_convert_to_pixman(pixman_format_code_t dest_format,
 
     return dest_image;
 }
+
+static const uint8_t a1_revers_table[256] = {
+    0x0, 0x80, 0x40, 0xc0, 0x20, 0xa0, 0x60, 0xe0,
+    0x10, 0x90, 0x50, 0xd0, 0x30, 0xb0, 0x70, 0xf0,
+    0x8, 0x88, 0x48, 0xc8, 0x28, 0xa8, 0x68, 0xe8,
+    0x18, 0x98, 0x58, 0xd8, 0x38, 0xb8, 0x78, 0xf8,
+    0x4, 0x84, 0x44, 0xc4, 0x24, 0xa4, 0x64, 0xe4,
+    0x14, 0x94, 0x54, 0xd4, 0x34, 0xb4, 0x74, 0xf4,
+    0xc, 0x8c, 0x4c, 0xcc, 0x2c, 0xac, 0x6c, 0xec,
+    0x1c, 0x9c, 0x5c, 0xdc, 0x3c, 0xbc, 0x7c, 0xfc,
+    0x2, 0x82, 0x42, 0xc2, 0x22, 0xa2, 0x62, 0xe2,
+    0x12, 0x92, 0x52, 0xd2, 0x32, 0xb2, 0x72, 0xf2,
+    0xa, 0x8a, 0x4a, 0xca, 0x2a, 0xaa, 0x6a, 0xea,
+    0x1a, 0x9a, 0x5a, 0xda, 0x3a, 0xba, 0x7a, 0xfa,
+    0x6, 0x86, 0x46, 0xc6, 0x26, 0xa6, 0x66, 0xe6,
+    0x16, 0x96, 0x56, 0xd6, 0x36, 0xb6, 0x76, 0xf6,
+    0xe, 0x8e, 0x4e, 0xce, 0x2e, 0xae, 0x6e, 0xee,
+    0x1e, 0x9e, 0x5e, 0xde, 0x3e, 0xbe, 0x7e, 0xfe,
+    0x1, 0x81, 0x41, 0xc1, 0x21, 0xa1, 0x61, 0xe1,
+    0x11, 0x91, 0x51, 0xd1, 0x31, 0xb1, 0x71, 0xf1,
+    0x9, 0x89, 0x49, 0xc9, 0x29, 0xa9, 0x69, 0xe9,
+    0x19, 0x99, 0x59, 0xd9, 0x39, 0xb9, 0x79, 0xf9,
+    0x5, 0x85, 0x45, 0xc5, 0x25, 0xa5, 0x65, 0xe5,
+    0x15, 0x95, 0x55, 0xd5, 0x35, 0xb5, 0x75, 0xf5,
+    0xd, 0x8d, 0x4d, 0xcd, 0x2d, 0xad, 0x6d, 0xed,
+    0x1d, 0x9d, 0x5d, 0xdd, 0x3d, 0xbd, 0x7d, 0xfd,
+    0x3, 0x83, 0x43, 0xc3, 0x23, 0xa3, 0x63, 0xe3,
+    0x13, 0x93, 0x53, 0xd3, 0x33, 0xb3, 0x73, 0xf3,
+    0xb, 0x8b, 0x4b, 0xcb, 0x2b, 0xab, 0x6b, 0xeb,
+    0x1b, 0x9b, 0x5b, 0xdb, 0x3b, 0xbb, 0x7b, 0xfb,
+    0x7, 0x87, 0x47, 0xc7, 0x27, 0xa7, 0x67, 0xe7,
+    0x17, 0x97, 0x57, 0xd7, 0x37, 0xb7, 0x77, 0xf7,
+    0xf, 0x8f, 0x4f, 0xcf, 0x2f, 0xaf, 0x6f, 0xef,
+    0x1f, 0x9f, 0x5f, 0xdf, 0x3f, 0xbf, 0x7f, 0xff
+};
+
+static void a1_reverse_row_c(uint8_t *dest, const uint8_t *src, int len, int invert)
+{
+    uint8_t xor_mask = invert ? 0xff : 0x00;
+    int i;
+
+    for (i = 0; i < len; i++) {
+        dest[i] = a1_revers_table[src[i]] ^ xor_mask;
+    }
+}
+
+static void a1_invert_row_c(uint8_t *dest, const uint8_t *src, int len)
+{
+    int i;
+
+    for (i = 0; i < len; i++) {
+        dest[i] = ~src[i];
+    }
+}
+
+/* ORs dest[from..n_dest) with the src bytes shifted by shift bits */
+static inline void a1_or_row_tail(uint8_t *dest, const uint8_t *src, int from,
+                                  int n_src, int n_dest, int shift)
+{
+    int i;
+
+    if (shift == 0) {
+        for (i = from; i < n_src; i++) {
+            dest[i] |= src[i];
+        }
+        return;
+    }
+    if (from == 0) {
+        dest[0] |= src[0] << shift;
+        from = 1;
+    }
+    for (i = from; i < n_dest; i++) {
+        uint8_t val = src[i - 1] >> (8 - shift);
+
+        if (i < n_src) {
+            val |= src[i] << shift;
+        }
+        dest[i] |= val;
+    }
+}
+
+static void a1_or_row_c(uint8_t *dest, const uint8_t *src, int n_bits, int shift)
+{
+    a1_or_row_tail(dest, src, 0, (n_bits + 7) >> 3, (shift + n_bits + 7) >> 3, shift);
+}
+
+#ifdef SPICE_X86_SIMD
+/* bit reversal through two nibble lookups */
+#define A1_REVERSE_NIBBLES 0x0, 0x8, 0x4, 0xc, 0x2, 0xa, 0x6, 0xe, \
+                           0x1, 0x9, 0x5, 0xd, 0x3, 0xb, 0x7, 0xf
+#define A1_REVERSE_NIBBLES_HI 0x00, 0x80, 0x40, 0xc0, 0x20, 0xa0, 0x60, 0xe0, \
+                              0x10, 0x90, 0x50, 0xd0, 0x30, 0xb0, 0x70, 0xf0
+
+SPICE_ATTR_TARGET("ssse3")
+static void a1_reverse_row_ssse3(uint8_t *dest, const uint8_t *src, int len, int invert)
+{
+    const __m128i lo_table = _mm_setr_epi8(A1_REVERSE_NIBBLES_HI);
+    const __m128i hi_table = _mm_setr_epi8(A1_REVERSE_NIBBLES);
+    const __m128i nibble_mask = _mm_set1_epi8(0x0f);
+    const __m128i xor_mask = _mm_set1_epi8(invert ? 0xff : 0x00);
+    int i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i lo = _mm_and_si128(v, nibble_mask);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibble_mask);
+
+        v = _mm_or_si128(_mm_shuffle_epi8(lo_table, lo), _mm_shuffle_epi8(hi_table, hi));
+        _mm_storeu_si128((__m128i *)(dest + i), _mm_xor_si128(v, xor_mask));
+    }
+    a1_reverse_row_c(dest + i, src + i, len - i, invert);
+}
+
+SPICE_ATTR_TARGET("ssse3")
+static void a1_invert_row_ssse3(uint8_t *dest, const uint8_t *src, int len)
+{
+    const __m128i ones = _mm_set1_epi8(0xff);
+    int i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dest + i), _mm_xor_si128(v, ones));
+    }
+    a1_invert_row_c(dest + i, src + i, len - i);
+}
+
+SPICE_ATTR_TARGET("ssse3")
+static void a1_or_row_ssse3(uint8_t *dest, const uint8_t *src, int n_bits, int shift)
+{
+    int n_src = (n_bits + 7) >> 3;
+    int n_dest = (shift + n_bits + 7) >> 3;
+    const __m128i lo_mask = _mm_set1_epi8((uint8_t)(0xff << shift));
+    const __m128i hi_mask = _mm_set1_epi8(0xff >> (8 - shift));
+    const __m128i lo_count = _mm_cvtsi32_si128(shift);
+    const __m128i hi_count = _mm_cvtsi32_si128(8 - shift);
+    int i = 0;
+
+    if (shift == 0) {
+        for (; i + 16 <= n_src; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+            __m128i d = _mm_loadu_si128((const __m128i *)(dest + i));
+            _mm_storeu_si128((__m128i *)(dest + i), _mm_or_si128(d, v));
+        }
+    } else if (n_src > 0) {
+        dest[0] |= src[0] << shift;
+        /* byte i gets src[i] << shift | src[i - 1] >> (8 - shift) */
+        for (i = 1; i + 16 <= n_src; i += 16) {
+            __m128i cur = _mm_loadu_si128((const __m128i *)(src + i));
+            __m128i prev = _mm_loadu_si128((const __m128i *)(src + i - 1));
+            __m128i d = _mm_loadu_si128((const __m128i *)(dest + i));
+
+            cur = _mm_and_si128(_mm_sll_epi16(cur, lo_count), lo_mask);
+            prev = _mm_and_si128(_mm_srl_epi16(prev, hi_count), hi_mask);
+            d = _mm_or_si128(d, _mm_or_si128(cur, prev));
+            _mm_storeu_si128((__m128i *)(dest + i), d);
+        }
+    }
+    a1_or_row_tail(dest, src, i, n_src, n_dest, shift);
+}
+
+SPICE_ATTR_TARGET("avx2")
+static void a1_reverse_row_avx2(uint8_t *dest, const uint8_t *src, int len, int invert)
+{
+    const __m256i lo_table = _mm256_setr_epi8(A1_REVERSE_NIBBLES_HI, A1_REVERSE_NIBBLES_HI);
+    const __m256i hi_table = _mm256_setr_epi8(A1_REVERSE_NIBBLES, A1_REVERSE_NIBBLES);
+    const __m256i nibble_mask = _mm256_set1_epi8(0x0f);
+    const __m256i xor_mask = _mm256_set1_epi8(invert ? 0xff : 0x00);
+    int i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i lo = _mm256_and_si256(v, nibble_mask);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble_mask);
+
+        v = _mm256_or_si256(_mm256_shuffle_epi8(lo_table, lo),
+                            _mm256_shuffle_epi8(hi_table, hi));
+        _mm256_storeu_si256((__m256i *)(dest + i), _mm256_xor_si256(v, xor_mask));
+    }
+    a1_reverse_row_ssse3(dest + i, src + i, len - i, invert);
+}
+
+SPICE_ATTR_TARGET("avx2")
+static void a1_invert_row_avx2(uint8_t *dest, const uint8_t *src, int len)
+{
+    const __m256i ones = _mm256_set1_epi8(0xff);
+    int i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+        _mm256_storeu_si256((__m256i *)(dest + i), _mm256_xor_si256(v, ones));
+    }
+    a1_invert_row_ssse3(dest + i, src + i, len - i);
+}
+
+SPICE_ATTR_TARGET("avx2")
+static void a1_or_row_avx2(uint8_t *dest, const uint8_t *src, int n_bits, int shift)
+{
+    int n_src = (n_bits + 7) >> 3;
+    int n_dest = (shift + n_bits + 7) >> 3;
+    const __m256i lo_mask = _mm256_set1_epi8((uint8_t)(0xff << shift));
+    const __m256i hi_mask = _mm256_set1_epi8(0xff >> (8 - shift));
+    const __m128i lo_count = _mm_cvtsi32_si128(shift);
+    const __m128i hi_count = _mm_cvtsi32_si128(8 - shift);
+    int i = 0;
+
+    if (shift == 0) {
+        for (; i + 32 <= n_src; i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+            __m256i d = _mm256_loadu_si256((const __m256i *)(dest + i));
+            _mm256_storeu_si256((__m256i *)(dest + i), _mm256_or_si256(d, v));
+        }
+    } else if (n_src > 0) {
+        dest[0] |= src[0] << shift;
+        for (i = 1; i + 32 <= n_src; i += 32) {
+            __m256i cur = _mm256_loadu_si256((const __m256i *)(src + i));
+            __m256i prev = _mm256_loadu_si256((const __m256i *)(src + i - 1));
+            __m256i d = _mm256_loadu_si256((const __m256i *)(dest + i));
+
+            cur = _mm256_and_si256(_mm256_sll_epi16(cur, lo_count), lo_mask);
+            prev = _mm256_and_si256(_mm256_srl_epi16(prev, hi_count), hi_mask);
+            d = _mm256_or_si256(d, _mm256_or_si256(cur, prev));
+            _mm256_storeu_si256((__m256i *)(dest + i), d);
+        }
+    }
+    a1_or_row_tail(dest, src, i, n_src, n_dest, shift);
+}
+#endif
+
+static void (*a1_reverse_row_impl)(uint8_t *dest, const uint8_t *src, int len, int invert) =
+    a1_reverse_row_c;
+static void (*a1_invert_row_impl)(uint8_t *dest, const uint8_t *src, int len) =
+    a1_invert_row_c;
+static void (*a1_or_row_impl)(uint8_t *dest, const uint8_t *src, int n_bits, int shift) =
+    a1_or_row_c;
+
+void spice_a1_reverse_row(uint8_t *dest, const uint8_t *src, int len, int invert)
+{
+    a1_reverse_row_impl(dest, src, len, invert);
+}
+
+void spice_a1_invert_row(uint8_t *dest, const uint8_t *src, int len)
+{
+    a1_invert_row_impl(dest, src, len);
+}
+
+void spice_a1_or_row(uint8_t *dest, const uint8_t *src, int n_bits, int shift)
+{
+    if (n_bits <= 0) {
+        return;
+    }
+    a1_or_row_impl(dest, src, n_bits, shift);
+}
+
+/* Returns TRUE if every row with a SIMD version got it */
+static int pixman_utils_select_rows(int simd)
+{
+    a1_reverse_row_impl = a1_reverse_row_c;
+    a1_invert_row_impl = a1_invert_row_c;
+    a1_or_row_impl = a1_or_row_c;
+    rop_solid_row_impl = NULL;
+    rop_copy_row_impl = NULL;
+    colorkey_row_16_impl = colorkey_row_16_c;
+    colorkey_row_32_impl = colorkey_row_32_c;
+    scale_nearest_row_32_impl = scale_nearest_row_32_c;
+    scale_bilinear_h_impl = scale_bilinear_h_c;
+    scale_bilinear_v_impl = scale_bilinear_v_c;
+    copy_block_nt_impl = NULL;
+    convert_row_24_to_32_impl = convert_row_24_to_32_c;
+    convert_row_16_to_32_impl = convert_row_16_to_32_c;
+    convert_row_32_to_16_555_impl = convert_row_32_to_16_555_c;
+    convert_row_24_to_16_555_impl = convert_row_24_to_16_555_c;
+    convert_row_8_to_32_impl = convert_row_8_to_32_c;
+    if (!simd) {
+        return FALSE;
+    }
+
+#ifdef SPICE_X86_SIMD
+    if (spice_cpu_supports("avx2")) {
+        a1_reverse_row_impl = a1_reverse_row_avx2;
+        a1_invert_row_impl = a1_invert_row_avx2;
+        a1_or_row_impl = a1_or_row_avx2;
+    } else if (spice_cpu_supports("ssse3")) {
+        a1_reverse_row_impl = a1_reverse_row_ssse3;
+        a1_invert_row_impl = a1_invert_row_ssse3;
+        a1_or_row_impl = a1_or_row_ssse3;
+    }
+
+    if (spice_cpu_supports("avx2")) {
+        rop_solid_row_impl = rop_solid_row_avx2;
+        rop_copy_row_impl = rop_copy_row_avx2;
+        colorkey_row_16_impl = colorkey_row_16_avx2;
+        colorkey_row_32_impl = colorkey_row_32_avx2;
+        scale_nearest_row_32_impl = scale_nearest_row_32_avx2;
+        scale_bilinear_h_impl = scale_bilinear_h_sse2;
+        scale_bilinear_v_impl = scale_bilinear_v_avx2;
+    } else if (spice_cpu_supports("sse2")) {
+        rop_solid_row_impl = rop_solid_row_sse2;
+        rop_copy_row_impl = rop_copy_row_sse2;
+        colorkey_row_16_impl = colorkey_row_16_sse2;
+        colorkey_row_32_impl = colorkey_row_32_sse2;
+        scale_bilinear_h_impl = scale_bilinear_h_sse2;
+        scale_bilinear_v_impl = scale_bilinear_v_sse2;
+    }
+
+    if (spice_cpu_supports("avx2")) {
+        convert_row_24_to_32_impl = convert_row_24_to_32_avx2;
+        convert_row_8_to_32_impl = convert_row_8_to_32_avx2;
+    } else if (spice_cpu_supports("ssse3")) {
+        convert_row_24_to_32_impl = convert_row_24_to_32_ssse3;
+    }
+    if (spice_cpu_supports("sse2")) {
+        copy_block_nt_impl = copy_block_nt_sse2;
+    }
+    if (spice_cpu_supports("ssse3")) {
+        convert_row_16_to_32_impl = convert_row_16_to_32_ssse3;
+        convert_row_32_to_16_555_impl = convert_row_32_to_16_555_ssse3;
+        convert_row_24_to_16_555_impl = convert_row_24_to_16_555_ssse3;
+    }
+
+    return a1_reverse_row_impl != a1_reverse_row_c &&
+           a1_invert_row_impl != a1_invert_row_c &&
+           a1_or_row_impl != a1_or_row_c &&
+           rop_solid_row_impl != NULL &&
+           rop_copy_row_impl != NULL &&
+           colorkey_row_16_impl != colorkey_row_16_c &&
+           colorkey_row_32_impl != colorkey_row_32_c &&
+           scale_nearest_row_32_impl != scale_nearest_row_32_c &&
+           scale_bilinear_h_impl != scale_bilinear_h_c &&
+           scale_bilinear_v_impl != scale_bilinear_v_c &&
+           copy_block_nt_impl != NULL &&
+           convert_row_24_to_32_impl != convert_row_24_to_32_c &&
+           convert_row_16_to_32_impl != convert_row_16_to_32_c &&
+           convert_row_32_to_16_555_impl != convert_row_32_to_16_555_c &&
+           convert_row_24_to_16_555_impl != convert_row_24_to_16_555_c &&
+           convert_row_8_to_32_impl != convert_row_8_to_32_c;
+#else
+    return FALSE;
+#endif
+}
+
+SPICE_CONSTRUCTOR_FUNC(pixman_utils_global_init)
+{
+    pixman_utils_select_rows(TRUE);
+}
+
+int spice_pixman_set_simd_enabled(int enabled)
+{
+    return pixman_utils_select_rows(enabled);
+}
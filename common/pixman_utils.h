@@ -103,6 +103,13 @@ void spice_pixman_fill_rect_rop(pixman_image_t *dest,
                                 int w, int h,
                                 uint32_t value,
                                 SpiceROP rop);
+/* Draws a zero width polyline the way spice_canvas_zero_line() does with
+ * CapNotLast, clipped to clip_rects which must be inside dest.
+ * Only 16 and 32 bpp images are handled, returns FALSE otherwise. */
+int spice_pixman_draw_zero_lines(pixman_image_t *dest,
+                                 const pixman_box32_t *clip_rects, int n_clip_rects,
+                                 const SpicePoint *points, int n_points,
+                                 uint32_t value, SpiceROP rop);
 void spice_pixman_tile_rect(pixman_image_t *dest,
                             int x, int y,
                             int w, int h,
@@ -133,11 +140,56 @@ void spice_pixman_blit_colorkey(pixman_image_t *dest,
                                 int dest_x, int dest_y,
                                 int width, int height,
                                 uint32_t transparent_color);
+/* Nearest neighbour scales the src_width x src_height area at src_x, src_y
+ * of src to the dest_width x dest_height one at dest_x, dest_y of dest,
+ * sampling the same pixels as pixman, and draws its pixels that are not
+ * transparent_color inside the boxes without any intermediate image.
+ * Returns FALSE without drawing anything if the images are not 16 or 32 bpp
+ * or the source area is not inside src. */
+int spice_pixman_scale_colorkey(pixman_image_t *dest,
+                                pixman_image_t *src,
+                                int src_x, int src_y,
+                                int src_width, int src_height,
+                                int dest_x, int dest_y,
+                                int dest_width, int dest_height,
+                                const pixman_box32_t *boxes, int n_boxes,
+                                uint32_t transparent_color);
+/* Scales the src_width x src_height area at src_x, src_y of src to the
+ * dest_width x dest_height one at dest_x, dest_y of dest like a pixman
+ * nearest or, if bilinear is set, PIXMAN_FILTER_GOOD transform, and
+ * combines its pixels inside the boxes with dest using rop, without any
+ * intermediate image. Large areas are split in bands of lines over up to
+ * n_threads threads, or one per CPU if n_threads <= 0.
+ * Returns FALSE without drawing anything if the formats are not supported,
+ * the source area is not inside src or src and dest share their pixels. */
+int spice_pixman_scale_rop(pixman_image_t *dest,
+                           pixman_image_t *src,
+                           int src_x, int src_y,
+                           int src_width, int src_height,
+                           int dest_x, int dest_y,
+                           int dest_width, int dest_height,
+                           const pixman_box32_t *boxes, int n_boxes,
+                           int bilinear, SpiceROP rop, int n_threads);
 void spice_pixman_copy_rect(pixman_image_t *image,
                             int src_x, int src_y,
                             int w, int h,
                             int dest_x, int dest_y);
 
+/* A1 row helpers, len is in bytes. Rows use the pixman a1 bit order,
+ * spice_a1_reverse_row() converts from/to MSB first rows. */
+void spice_a1_reverse_row(uint8_t *dest, const uint8_t *src, int len, int invert);
+void spice_a1_invert_row(uint8_t *dest, const uint8_t *src, int len);
+/* ORs n_bits bits from src at bit offset shift (0-7) of dest. Bits of the
+ * last src byte past n_bits must be 0. */
+void spice_a1_or_row(uint8_t *dest, const uint8_t *src, int n_bits, int shift);
+
+/* Enable or disable the SIMD code paths (enabled by default), mostly useful to
+ * compare them with the C ones. Returns TRUE if they are enabled and this
+ * CPU runs the SIMD version of every row, FALSE if some or all of the rows
+ * still use the C code. Not thread safe, nothing must be drawing while this
+ * is called. */
+int spice_pixman_set_simd_enabled(int enabled);
+
 SPICE_END_DECLS
 
 #endif // H_SPICE_COMMON_PIXMAN_UTILS
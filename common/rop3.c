@@ -17,7 +17,14 @@
 */
 #include <config.h>
 
+#include <string.h>
+
 #include "rop3.h"
+#include "macros.h"
+
+#ifdef SPICE_X86_SIMD
+#include <immintrin.h>
+#endif
 
 typedef void (*rop3_with_pattern_handler_t)(pixman_image_t *d, pixman_image_t *s,
                                             SpicePoint *src_pos, pixman_image_t *p,
@@ -28,6 +35,18 @@ typedef void (*rop3_with_color_handler_t)(pixman_image_t *d, pixman_image_t *s,
 
 typedef void (*rop3_test_handler_t)(void);
 
+/* The SIMD rop3 code evaluates the truth table of the operation directly.
+ * For each of the 4 combinations of the pattern and source bits the result
+ * is either 0, 1, D or ~D, that is (D & a) ^ b, and selecting between them
+ * with S and P gives the result. */
+typedef struct Rop3Masks {
+    uint8_t a[4]; /* indexed by (P << 1) | S */
+    uint8_t b[4];
+} Rop3Masks;
+
+typedef void (*rop3_row_handler_t)(uint8_t *dest, const uint8_t *src, const uint8_t *pat,
+                                   int len, const Rop3Masks *masks);
+
 #define ROP3_NUM_OPS 256
 
 static rop3_with_pattern_handler_t rop3_with_pattern_handlers_32[ROP3_NUM_OPS];
@@ -36,6 +55,8 @@ static rop3_with_color_handler_t rop3_with_color_handlers_32[ROP3_NUM_OPS];
 static rop3_with_color_handler_t rop3_with_color_handlers_16[ROP3_NUM_OPS];
 static rop3_test_handler_t rop3_test_handlers_32[ROP3_NUM_OPS];
 static rop3_test_handler_t rop3_test_handlers_16[ROP3_NUM_OPS];
+static rop3_row_handler_t rop3_row_handler;
+static int rop3_simd_enabled = TRUE;
 
 
 static void default_rop3_with_pattern_handler(SPICE_GNUC_UNUSED pixman_image_t *d,
@@ -365,6 +386,191 @@ ROP3_HANDLERS(PSDnoo, ~*dest | *src | *pat, 0xfd);
 ROP3_HANDLERS(DPSoo, *src | *pat | *dest, 0xfe);
 
 
+static void rop3_masks_init(Rop3Masks *masks, uint8_t rop3)
+{
+    int i;
+
+    /* bit (P << 2) | (S << 1) | D of rop3 is the result for those inputs */
+    for (i = 0; i < 4; i++) {
+        int r0 = (rop3 >> (i * 2)) & 1;
+        int r1 = (rop3 >> (i * 2 + 1)) & 1;
+
+        masks->a[i] = r0 != r1 ? 0xff : 0;
+        masks->b[i] = r0 ? 0xff : 0;
+    }
+}
+
+static inline uint8_t rop3_eval(const Rop3Masks *masks, uint8_t d, uint8_t s, uint8_t p)
+{
+    uint8_t r0 = (d & masks->a[0]) ^ masks->b[0];
+    uint8_t r1 = (d & masks->a[1]) ^ masks->b[1];
+    uint8_t r2 = (d & masks->a[2]) ^ masks->b[2];
+    uint8_t r3 = (d & masks->a[3]) ^ masks->b[3];
+
+    r0 ^= (r0 ^ r1) & s;
+    r2 ^= (r2 ^ r3) & s;
+    return r0 ^ ((r0 ^ r2) & p);
+}
+
+#ifdef SPICE_X86_SIMD
+SPICE_ATTR_TARGET("sse2")
+static void rop3_row_sse2(uint8_t *dest, const uint8_t *src, const uint8_t *pat,
+                          int len, const Rop3Masks *masks)
+{
+    const __m128i a0 = _mm_set1_epi8(masks->a[0]), b0 = _mm_set1_epi8(masks->b[0]);
+    const __m128i a1 = _mm_set1_epi8(masks->a[1]), b1 = _mm_set1_epi8(masks->b[1]);
+    const __m128i a2 = _mm_set1_epi8(masks->a[2]), b2 = _mm_set1_epi8(masks->b[2]);
+    const __m128i a3 = _mm_set1_epi8(masks->a[3]), b3 = _mm_set1_epi8(masks->b[3]);
+    int i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        __m128i d = _mm_loadu_si128((const __m128i *)(dest + i));
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i p = _mm_loadu_si128((const __m128i *)(pat + i));
+        __m128i r0 = _mm_xor_si128(_mm_and_si128(d, a0), b0);
+        __m128i r1 = _mm_xor_si128(_mm_and_si128(d, a1), b1);
+        __m128i r2 = _mm_xor_si128(_mm_and_si128(d, a2), b2);
+        __m128i r3 = _mm_xor_si128(_mm_and_si128(d, a3), b3);
+
+        r0 = _mm_xor_si128(r0, _mm_and_si128(_mm_xor_si128(r0, r1), s));
+        r2 = _mm_xor_si128(r2, _mm_and_si128(_mm_xor_si128(r2, r3), s));
+        r0 = _mm_xor_si128(r0, _mm_and_si128(_mm_xor_si128(r0, r2), p));
+        _mm_storeu_si128((__m128i *)(dest + i), r0);
+    }
+    for (; i < len; i++) {
+        dest[i] = rop3_eval(masks, dest[i], src[i], pat[i]);
+    }
+}
+
+SPICE_ATTR_TARGET("avx2")
+static void rop3_row_avx2(uint8_t *dest, const uint8_t *src, const uint8_t *pat,
+                          int len, const Rop3Masks *masks)
+{
+    const __m256i a0 = _mm256_set1_epi8(masks->a[0]), b0 = _mm256_set1_epi8(masks->b[0]);
+    const __m256i a1 = _mm256_set1_epi8(masks->a[1]), b1 = _mm256_set1_epi8(masks->b[1]);
+    const __m256i a2 = _mm256_set1_epi8(masks->a[2]), b2 = _mm256_set1_epi8(masks->b[2]);
+    const __m256i a3 = _mm256_set1_epi8(masks->a[3]), b3 = _mm256_set1_epi8(masks->b[3]);
+    int i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        __m256i d = _mm256_loadu_si256((const __m256i *)(dest + i));
+        __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i p = _mm256_loadu_si256((const __m256i *)(pat + i));
+        __m256i r0 = _mm256_xor_si256(_mm256_and_si256(d, a0), b0);
+        __m256i r1 = _mm256_xor_si256(_mm256_and_si256(d, a1), b1);
+        __m256i r2 = _mm256_xor_si256(_mm256_and_si256(d, a2), b2);
+        __m256i r3 = _mm256_xor_si256(_mm256_and_si256(d, a3), b3);
+
+        r0 = _mm256_xor_si256(r0, _mm256_and_si256(_mm256_xor_si256(r0, r1), s));
+        r2 = _mm256_xor_si256(r2, _mm256_and_si256(_mm256_xor_si256(r2, r3), s));
+        r0 = _mm256_xor_si256(r0, _mm256_and_si256(_mm256_xor_si256(r0, r2), p));
+        _mm256_storeu_si256((__m256i *)(dest + i), r0);
+    }
+    for (; i < len; i++) {
+        dest[i] = rop3_eval(masks, dest[i], src[i], pat[i]);
+    }
+}
+#endif
+
+/* Fill rows of width pixels with the pattern, repeating it horizontally
+ * starting at pat_x, one row for each pattern row starting at pat_y */
+static void rop3_tile_pattern(uint8_t *tile, int width, int rows, int bytes_pp,
+                              pixman_image_t *p, int pat_x, int pat_y)
+{
+    int pat_width = pixman_image_get_width(p);
+    int pat_height = pixman_image_get_height(p);
+    int pat_stride = pixman_image_get_stride(p);
+    uint8_t *pat_base = (uint8_t *)pixman_image_get_data(p);
+    int row_size = width * bytes_pp;
+    int r;
+
+    for (r = 0; r < rows; r++, tile += row_size) {
+        uint8_t *pat_line = pat_base + ((pat_y + r) % pat_height) * pat_stride;
+        int x = pat_x;
+        int pos = 0;
+
+        while (pos < row_size) {
+            int n = MIN((pat_width - x) * bytes_pp, row_size - pos);
+
+            memcpy(tile + pos, pat_line + x * bytes_pp, n);
+            pos += n;
+            x = 0;
+        }
+    }
+}
+
+static void rop3_simd_rows(uint8_t rop3, pixman_image_t *d, pixman_image_t *s,
+                           SpicePoint *src_pos, const uint8_t *tile, int tile_rows,
+                           int bytes_pp)
+{
+    int width = pixman_image_get_width(d);
+    int height = pixman_image_get_height(d);
+    uint8_t *dest_line = (uint8_t *)pixman_image_get_data(d);
+    int dest_stride = pixman_image_get_stride(d);
+    int src_stride = pixman_image_get_stride(s);
+    uint8_t *src_line = (uint8_t *)pixman_image_get_data(s) + src_pos->y * src_stride +
+                        src_pos->x * bytes_pp;
+    int row_size = width * bytes_pp;
+    Rop3Masks masks;
+    int y;
+
+    rop3_masks_init(&masks, rop3);
+    for (y = 0; y < height; y++, dest_line += dest_stride, src_line += src_stride) {
+        rop3_row_handler(dest_line, src_line, tile + (y % tile_rows) * row_size,
+                         row_size, &masks);
+    }
+}
+
+static int rop3_use_simd(uint8_t rop3, pixman_image_t *d)
+{
+    /* the handlers are only there for the operations depending on all of
+     * D, S and P, keep refusing the others */
+    return rop3_row_handler != NULL && rop3_simd_enabled &&
+           rop3_with_color_handlers_32[rop3] != default_rop3_withe_color_handler &&
+           pixman_image_get_width(d) > 0 && pixman_image_get_height(d) > 0;
+}
+
+static void rop3_simd_with_pattern(uint8_t rop3, pixman_image_t *d, pixman_image_t *s,
+                                   SpicePoint *src_pos, pixman_image_t *p,
+                                   SpicePoint *pat_pos, int bytes_pp)
+{
+    int width = pixman_image_get_width(d);
+    int pat_width = pixman_image_get_width(p);
+    int pat_height = pixman_image_get_height(p);
+    int rows = MIN(pat_height, pixman_image_get_height(d));
+    int pat_x = (pat_pos->x % pat_width + pat_width) % pat_width;
+    int pat_y = (pat_pos->y % pat_height + pat_height) % pat_height;
+    uint8_t *tile;
+
+    tile = spice_malloc_n(rows, width * bytes_pp);
+    rop3_tile_pattern(tile, width, rows, bytes_pp, p, pat_x, pat_y);
+    rop3_simd_rows(rop3, d, s, src_pos, tile, rows, bytes_pp);
+    free(tile);
+}
+
+static void rop3_simd_with_color(uint8_t rop3, pixman_image_t *d, pixman_image_t *s,
+                                 SpicePoint *src_pos, uint32_t rgb, int bytes_pp)
+{
+    int width = pixman_image_get_width(d);
+    uint8_t *tile;
+    int i;
+
+    tile = spice_malloc_n(width, bytes_pp);
+    if (bytes_pp == 4) {
+        uint32_t *line = (uint32_t *)tile;
+        for (i = 0; i < width; i++) {
+            line[i] = rgb;
+        }
+    } else {
+        uint16_t *line = (uint16_t *)tile;
+        for (i = 0; i < width; i++) {
+            line[i] = rgb;
+        }
+    }
+    rop3_simd_rows(rop3, d, s, src_pos, tile, 1, bytes_pp);
+    free(tile);
+}
+
 #define ROP3_FILL_HANDLERS(op, index)                       \
     rop3_with_pattern_handlers_32[index] = rop3_handle_p32_##op; \
     rop3_with_pattern_handlers_16[index] = rop3_handle_p16_##op; \
@@ -609,6 +815,20 @@ SPICE_CONSTRUCTOR_FUNC(rop3_global_init)
         rop3_test_handlers_32[i]();
         rop3_test_handlers_16[i]();
     }
+
+#ifdef SPICE_X86_SIMD
+    if (spice_cpu_supports("avx2")) {
+        rop3_row_handler = rop3_row_avx2;
+    } else if (spice_cpu_supports("sse2")) {
+        rop3_row_handler = rop3_row_sse2;
+    }
+#endif
+}
+
+int rop3_set_simd_enabled(int enabled)
+{
+    rop3_simd_enabled = enabled;
+    return rop3_row_handler != NULL;
 }
 
 void do_rop3_with_pattern(uint8_t rop3, pixman_image_t *d, pixman_image_t *s, SpicePoint *src_pos,
@@ -620,7 +840,9 @@ void do_rop3_with_pattern(uint8_t rop3, pixman_image_t *d, pixman_image_t *s, Sp
     spice_assert(bpp == spice_pixman_image_get_bpp(s));
     spice_assert(bpp == spice_pixman_image_get_bpp(p));
 
-    if (bpp == 32) {
+    if (rop3_use_simd(rop3, d)) {
+        rop3_simd_with_pattern(rop3, d, s, src_pos, p, pat_pos, bpp / 8);
+    } else if (bpp == 32) {
         rop3_with_pattern_handlers_32[rop3](d, s, src_pos, p, pat_pos);
     } else {
         rop3_with_pattern_handlers_16[rop3](d, s, src_pos, p, pat_pos);
@@ -635,7 +857,9 @@ void do_rop3_with_color(uint8_t rop3, pixman_image_t *d, pixman_image_t *s, Spic
     bpp = spice_pixman_image_get_bpp(d);
     spice_assert(bpp == spice_pixman_image_get_bpp(s));
 
-    if (bpp == 32) {
+    if (rop3_use_simd(rop3, d)) {
+        rop3_simd_with_color(rop3, d, s, src_pos, rgb, bpp / 8);
+    } else if (bpp == 32) {
         rop3_with_color_handlers_32[rop3](d, s, src_pos, rgb);
     } else {
         rop3_with_color_handlers_16[rop3](d, s, src_pos, rgb);
@@ -32,6 +32,10 @@ void do_rop3_with_pattern(uint8_t rop3, pixman_image_t *d, pixman_image_t *s, Sp
 void do_rop3_with_color(uint8_t rop3, pixman_image_t *d, pixman_image_t *s, SpicePoint *src_pos,
                         uint32_t rgb);
 
+/* Enable or disable the SIMD code paths (enabled by default), mostly useful to
+ * compare them with the C ones. Returns whether this CPU has them at all. */
+int rop3_set_simd_enabled(int enabled);
+
 SPICE_END_DECLS
 
 #endif
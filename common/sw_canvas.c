@@ -34,8 +34,53 @@ struct SwCanvas {
     uint32_t *private_data;
     int private_data_size;
     pixman_image_t *image;
+    /* area modified since the last canvas_take_damage() */
+    pixman_region32_t damage;
 };
 
+static void canvas_add_damage(SwCanvas *canvas, pixman_region32_t *region)
+{
+    pixman_region32_union(&canvas->damage, &canvas->damage, region);
+}
+
+static void canvas_add_damage_rects(SwCanvas *canvas,
+                                    pixman_box32_t *rects, int n_rects)
+{
+    pixman_region32_t region;
+
+    if (n_rects == 0) {
+        return;
+    }
+    pixman_region32_init_rects(&region, rects, n_rects);
+    canvas_add_damage(canvas, &region);
+    pixman_region32_fini(&region);
+}
+
+/* Spans are tiny and numerous (strokes), only their bounding box is
+ * accounted as damaged */
+static void canvas_add_damage_spans(SwCanvas *canvas, SpicePoint *points,
+                                    int *widths, int n_spans)
+{
+    int x1, y1, x2, y2;
+    int i;
+
+    if (n_spans == 0) {
+        return;
+    }
+    x1 = points[0].x;
+    y1 = points[0].y;
+    x2 = points[0].x + widths[0];
+    y2 = points[0].y + 1;
+    for (i = 1; i < n_spans; i++) {
+        x1 = MIN(x1, points[i].x);
+        y1 = MIN(y1, points[i].y);
+        x2 = MAX(x2, points[i].x + widths[i]);
+        y2 = MAX(y2, points[i].y + 1);
+    }
+    pixman_region32_union_rect(&canvas->damage, &canvas->damage,
+                               x1, y1, x2 - x1, y2 - y1);
+}
+
 static pixman_image_t *canvas_get_pixman_brush(SwCanvas *canvas,
                                                SpiceBrush *brush)
 {
@@ -63,7 +108,7 @@ static pixman_image_t *canvas_get_pixman_brush(SwCanvas *canvas,
             surface = surface_canvas->image;
             surface = pixman_image_ref(surface);
         } else {
-            surface = canvas_get_image(&canvas->base, brush->u.pattern.pat, FALSE);
+            surface = canvas_get_pattern(&canvas->base, brush->u.pattern.pat);
         }
         pixman_transform_init_translate(&t,
                                         pixman_int_to_fixed(-brush->u.pattern.pos.x),
@@ -106,6 +151,72 @@ static pixman_image_t *get_image(SpiceCanvas *canvas, int force_opaque)
     return sw_canvas->image;
 }
 
+static void image_changed(SpiceCanvas *spice_canvas, pixman_region32_t *region)
+{
+    canvas_add_damage((SwCanvas *)spice_canvas, region);
+}
+
+/* In a vertical scroll the columns don't interact, so the rectangles of
+ * consecutive bands with the same horizontal extent are merged into taller
+ * ones, the full width ones then being copied as a single block. Copying
+ * the merged rectangles in the order of their top edge still reads every
+ * pixel before it gets overwritten. */
+static void copy_region_vertical(SwCanvas *canvas,
+                                 pixman_box32_t *rects, int n_rects,
+                                 int dy)
+{
+    pixman_box32_t *boxes;
+    int *open_buf, *open, *next_open, *swap;
+    int n_boxes = 0, n_open = 0;
+    int i;
+
+    boxes = spice_new(pixman_box32_t, n_rects);
+    open_buf = spice_new(int, n_rects * 2);
+    open = open_buf;
+    next_open = open_buf + n_rects;
+
+    i = 0;
+    while (i < n_rects) {
+        int band_y1 = rects[i].y1;
+        int n_next = 0;
+        int k = 0;
+
+        /* the boxes ending at the previous band are in x order, as are the
+         * rectangles of this one */
+        for (; i < n_rects && rects[i].y1 == band_y1; i++) {
+            while (k < n_open && boxes[open[k]].x1 < rects[i].x1) {
+                k++;
+            }
+            if (k < n_open && boxes[open[k]].x1 == rects[i].x1 &&
+                boxes[open[k]].x2 == rects[i].x2 && boxes[open[k]].y2 == band_y1) {
+                boxes[open[k]].y2 = rects[i].y2;
+                next_open[n_next++] = open[k++];
+            } else {
+                boxes[n_boxes] = rects[i];
+                next_open[n_next++] = n_boxes++;
+            }
+        }
+
+        swap = open;
+        open = next_open;
+        next_open = swap;
+        n_open = n_next;
+    }
+
+    /* boxes are sorted by y1 */
+    for (i = 0; i < n_boxes; i++) {
+        pixman_box32_t *box = &boxes[dy > 0 ? n_boxes - 1 - i : i];
+
+        spice_pixman_copy_rect(canvas->image,
+                               box->x1, box->y1 - dy,
+                               box->x2 - box->x1, box->y2 - box->y1,
+                               box->x1, box->y1);
+    }
+
+    free(open_buf);
+    free(boxes);
+}
+
 static void copy_region(SpiceCanvas *spice_canvas,
                         pixman_region32_t *dest_region,
                         int dx, int dy)
@@ -115,8 +226,14 @@ static void copy_region(SpiceCanvas *spice_canvas,
     int n_rects;
     int i, j, end_line;
 
+    canvas_add_damage(canvas, dest_region);
     dest_rects = pixman_region32_rectangles(dest_region, &n_rects);
 
+    if (dx == 0 && dy != 0 && n_rects > 1) {
+        copy_region_vertical(canvas, dest_rects, n_rects, dy);
+        return;
+    }
+
     if (dy > 0) {
         if (dx >= 0) {
             /* south-east: copy x and y in reverse order */
@@ -189,6 +306,7 @@ static void fill_solid_spans(SpiceCanvas *spice_canvas,
     SwCanvas *canvas = (SwCanvas *)spice_canvas;
     int i;
 
+    canvas_add_damage_spans(canvas, points, widths, n_spans);
    for (i = 0; i < n_spans; i++) {
         spice_pixman_fill_rect(canvas->image,
                                points[i].x, points[i].y,
@@ -206,6 +324,7 @@ static void fill_solid_rects(SpiceCanvas *spice_canvas,
     SwCanvas *canvas = (SwCanvas *)spice_canvas;
     int i;
 
+    canvas_add_damage_rects(canvas, rects, n_rects);
    for (i = 0; i < n_rects; i++) {
         spice_pixman_fill_rect(canvas->image,
                                rects[i].x1, rects[i].y1,
@@ -224,6 +343,7 @@ static void fill_solid_rects_rop(SpiceCanvas *spice_canvas,
     SwCanvas *canvas = (SwCanvas *)spice_canvas;
     int i;
 
+    canvas_add_damage_rects(canvas, rects, n_rects);
    for (i = 0; i < n_rects; i++) {
         spice_pixman_fill_rect_rop(canvas->image,
                                    rects[i].x1, rects[i].y1,
@@ -233,6 +353,42 @@ static void fill_solid_rects_rop(SpiceCanvas *spice_canvas,
     }
 }
 
+static int draw_solid_lines(SpiceCanvas *spice_canvas,
+                            pixman_region32_t *region,
+                            SpicePoint *points,
+                            int n_points,
+                            uint32_t color,
+                            SpiceROP rop)
+{
+    SwCanvas *canvas = (SwCanvas *)spice_canvas;
+    pixman_region32_t damage;
+    pixman_box32_t *rects;
+    int n_rects;
+    int x1, y1, x2, y2;
+    int i;
+
+    rects = pixman_region32_rectangles(region, &n_rects);
+    if (!spice_pixman_draw_zero_lines(canvas->image, rects, n_rects,
+                                      points, n_points, color, rop)) {
+        return FALSE;
+    }
+
+    x1 = x2 = points[0].x;
+    y1 = y2 = points[0].y;
+    for (i = 1; i < n_points; i++) {
+        x1 = MIN(x1, points[i].x);
+        y1 = MIN(y1, points[i].y);
+        x2 = MAX(x2, points[i].x);
+        y2 = MAX(y2, points[i].y);
+    }
+    pixman_region32_init_rect(&damage, x1, y1,
+                              (unsigned)x2 - x1 + 1, (unsigned)y2 - y1 + 1);
+    pixman_region32_intersect(&damage, &damage, region);
+    canvas_add_damage(canvas, &damage);
+    pixman_region32_fini(&damage);
+    return TRUE;
+}
+
 static void __fill_tiled_rects(SpiceCanvas *spice_canvas,
                                pixman_box32_t *rects,
                                int n_rects,
@@ -242,6 +398,7 @@ static void __fill_tiled_rects(SpiceCanvas *spice_canvas,
     SwCanvas *canvas = (SwCanvas *)spice_canvas;
     int i;
 
+    canvas_add_damage_rects(canvas, rects, n_rects);
     for (i = 0; i < n_rects; i++) {
         spice_pixman_tile_rect(canvas->image,
                                rects[i].x1, rects[i].y1,
@@ -281,6 +438,7 @@ static void __fill_tiled_rects_rop(SpiceCanvas *spice_canvas,
     SwCanvas *canvas = (SwCanvas *)spice_canvas;
     int i;
 
+    canvas_add_damage_rects(canvas, rects, n_rects);
     for (i = 0; i < n_rects; i++) {
         spice_pixman_tile_rect_rop(canvas->image,
                                    rects[i].x1, rects[i].y1,
@@ -372,6 +530,7 @@ static void __blit_image(SpiceCanvas *spice_canvas,
     pixman_box32_t *rects;
     int n_rects, i;
 
+    canvas_add_damage(canvas, region);
     rects = pixman_region32_rectangles(region, &n_rects);
 
     for (i = 0; i < n_rects; i++) {
@@ -420,6 +579,7 @@ static void __blit_image_rop(SpiceCanvas *spice_canvas,
     pixman_box32_t *rects;
     int n_rects, i;
 
+    canvas_add_damage(canvas, region);
     rects = pixman_region32_rectangles(region, &n_rects);
 
     for (i = 0; i < n_rects; i++) {
@@ -473,8 +633,25 @@ static void __scale_image(SpiceCanvas *spice_canvas,
 {
     SwCanvas *canvas = (SwCanvas *)spice_canvas;
     pixman_transform_t transform;
+    pixman_box32_t *rects;
+    int n_rects;
     pixman_fixed_t fsx, fsy;
 
+    spice_return_if_fail(scale_mode == SPICE_IMAGE_SCALE_MODE_INTERPOLATE ||
+                         scale_mode == SPICE_IMAGE_SCALE_MODE_NEAREST);
+
+    canvas_add_damage(canvas, region);
+
+    rects = pixman_region32_rectangles(region, &n_rects);
+    if (spice_pixman_scale_rop(canvas->image, src,
+                               src_x, src_y, src_width, src_height,
+                               dest_x, dest_y, dest_width, dest_height,
+                               rects, n_rects,
+                               scale_mode == SPICE_IMAGE_SCALE_MODE_INTERPOLATE,
+                               SPICE_ROP_COPY, 0)) {
+        return;
+    }
+
     fsx = ((pixman_fixed_48_16_t) src_width * 65536) / dest_width;
     fsy = ((pixman_fixed_48_16_t) src_height * 65536) / dest_height;
 
@@ -487,8 +664,6 @@ static void __scale_image(SpiceCanvas *spice_canvas,
 
     pixman_image_set_transform(src, &transform);
     pixman_image_set_repeat(src, PIXMAN_REPEAT_NONE);
-    spice_return_if_fail(scale_mode == SPICE_IMAGE_SCALE_MODE_INTERPOLATE ||
-                         scale_mode == SPICE_IMAGE_SCALE_MODE_NEAREST);
     pixman_image_set_filter(src,
                             (scale_mode == SPICE_IMAGE_SCALE_MODE_NEAREST) ?
                             PIXMAN_FILTER_NEAREST : PIXMAN_FILTER_GOOD,
@@ -551,14 +726,26 @@ static void __scale_image_rop(SpiceCanvas *spice_canvas,
     pixman_fixed_t fsx, fsy;
     pixman_format_code_t format;
 
+    spice_return_if_fail(scale_mode == SPICE_IMAGE_SCALE_MODE_INTERPOLATE ||
+                         scale_mode == SPICE_IMAGE_SCALE_MODE_NEAREST);
+
+    /* scale and apply the rop line by line, without the scaled copy */
+    rects = pixman_region32_rectangles(region, &n_rects);
+    if (spice_pixman_scale_rop(canvas->image, src,
+                               src_x, src_y, src_width, src_height,
+                               dest_x, dest_y, dest_width, dest_height,
+                               rects, n_rects,
+                               scale_mode == SPICE_IMAGE_SCALE_MODE_INTERPOLATE,
+                               rop, 0)) {
+        canvas_add_damage(canvas, region);
+        return;
+    }
+
     fsx = ((pixman_fixed_48_16_t) src_width * 65536) / dest_width;
     fsy = ((pixman_fixed_48_16_t) src_height * 65536) / dest_height;
 
     spice_return_if_fail(spice_pixman_image_get_format(src, &format));
-    scaled = pixman_image_create_bits(format,
-                                      dest_width,
-                                      dest_height,
-                                      NULL, 0);
+    scaled = surface_create(format, dest_width, dest_height, TRUE);
 
     pixman_region32_translate(region, -dest_x, -dest_y);
     pixman_image_set_clip_region32(scaled, region);
@@ -570,8 +757,6 @@ static void __scale_image_rop(SpiceCanvas *spice_canvas,
 
     pixman_image_set_transform(src, &transform);
     pixman_image_set_repeat(src, PIXMAN_REPEAT_NONE);
-    spice_return_if_fail(scale_mode == SPICE_IMAGE_SCALE_MODE_INTERPOLATE ||
-                         scale_mode == SPICE_IMAGE_SCALE_MODE_NEAREST);
     pixman_image_set_filter(src,
                             (scale_mode == SPICE_IMAGE_SCALE_MODE_NEAREST) ?
                             PIXMAN_FILTER_NEAREST : PIXMAN_FILTER_GOOD,
@@ -591,6 +776,7 @@ static void __scale_image_rop(SpiceCanvas *spice_canvas,
     /* Translate back */
     pixman_region32_translate(region, dest_x, dest_y);
 
+    canvas_add_damage(canvas, region);
     rects = pixman_region32_rectangles(region, &n_rects);
 
     for (i = 0; i < n_rects; i++) {
@@ -667,6 +853,7 @@ static void __blend_image(SpiceCanvas *spice_canvas,
 
     dest = canvas_get_as_surface(canvas, dest_has_alpha);
 
+    canvas_add_damage(canvas, region);
     pixman_image_set_clip_region32(dest, region);
 
     mask = NULL;
@@ -755,6 +942,7 @@ static void __blend_scale_image(SpiceCanvas *spice_canvas,
 
     dest = canvas_get_as_surface(canvas, dest_has_alpha);
 
+    canvas_add_damage(canvas, region);
     pixman_image_set_clip_region32(dest, region);
 
     pixman_transform_init_scale(&transform, fsx, fsy);
@@ -850,6 +1038,7 @@ static void __colorkey_image(SpiceCanvas *spice_canvas,
     pixman_box32_t *rects;
     int n_rects, i;
 
+    canvas_add_damage(canvas, region);
     rects = pixman_region32_rectangles(region, &n_rects);
 
     for (i = 0; i < n_rects; i++) {
@@ -909,14 +1098,20 @@ static void __colorkey_scale_image(SpiceCanvas *spice_canvas,
     pixman_fixed_t fsx, fsy;
     pixman_format_code_t format;
 
+    rects = pixman_region32_rectangles(region, &n_rects);
+    if (spice_pixman_scale_colorkey(canvas->image, src,
+                                    src_x, src_y, src_width, src_height,
+                                    dest_x, dest_y, dest_width, dest_height,
+                                    rects, n_rects, transparent_color)) {
+        canvas_add_damage(canvas, region);
+        return;
+    }
+
     fsx = ((pixman_fixed_48_16_t) src_width * 65536) / dest_width;
     fsy = ((pixman_fixed_48_16_t) src_height * 65536) / dest_height;
 
     spice_return_if_fail(spice_pixman_image_get_format(src, &format));
-    scaled = pixman_image_create_bits(format,
-                                      dest_width,
-                                      dest_height,
-                                      NULL, 0);
+    scaled = surface_create(format, dest_width, dest_height, TRUE);
 
     pixman_region32_translate(region, -dest_x, -dest_y);
     pixman_image_set_clip_region32(scaled, region);
@@ -946,6 +1141,7 @@ static void __colorkey_scale_image(SpiceCanvas *spice_canvas,
     /* Translate back */
     pixman_region32_translate(region, dest_x, dest_y);
 
+    canvas_add_damage(canvas, region);
     rects = pixman_region32_rectangles(region, &n_rects);
 
     for (i = 0; i < n_rects; i++) {
@@ -1001,6 +1197,7 @@ static void canvas_put_image(SpiceCanvas *spice_canvas,
     uint32_t dest_height;
     double sx, sy;
     pixman_transform_t transform;
+    pixman_region32_t damage;
 
     src = pixman_image_create_bits(PIXMAN_x8r8g8b8,
                                    src_width,
@@ -1016,6 +1213,13 @@ static void canvas_put_image(SpiceCanvas *spice_canvas,
     dest_width = dest->right - dest->left;
     dest_height = dest->bottom - dest->top;
 
+    pixman_region32_init_rect(&damage, dest->left, dest->top, dest_width, dest_height);
+    if (clip) {
+        pixman_region32_intersect(&damage, &damage, (pixman_region32_t *)clip);
+    }
+    canvas_add_damage(canvas, &damage);
+    pixman_region32_fini(&damage);
+
     if (dest_width != src_width || dest_height != src_height) {
         sx = (double)(src_width) / (dest_width);
         sy = (double)(src_height) / (dest_height);
@@ -1110,6 +1314,7 @@ static void canvas_draw_text(SpiceCanvas *spice_canvas, SpiceRect *bbox,
 
     str_mask = canvas_get_str_mask(&canvas->base, str, depth, &pos);
     if (brush) {
+        canvas_add_damage(canvas, &dest_region);
         pixman_image_set_clip_region32(canvas->image, &dest_region);
 
         pixman_image_composite32(PIXMAN_OP_OVER,
@@ -1162,6 +1367,9 @@ static void canvas_read_bits(SpiceCanvas *spice_canvas, uint8_t *dest,
 static void canvas_clear(SpiceCanvas *spice_canvas)
 {
     SwCanvas *canvas = (SwCanvas *)spice_canvas;
+    pixman_region32_union_rect(&canvas->damage, &canvas->damage, 0, 0,
+                               pixman_image_get_width(canvas->image),
+                               pixman_image_get_height(canvas->image));
     spice_pixman_fill_rect(canvas->image,
                            0, 0,
                            pixman_image_get_width(canvas->image),
@@ -1176,6 +1384,7 @@ static void canvas_destroy(SpiceCanvas *spice_canvas)
         return;
     }
     pixman_image_unref(canvas->image);
+    pixman_region32_fini(&canvas->damage);
     canvas_base_destroy(&canvas->base);
     free(canvas->private_data);
     free(canvas);
@@ -1216,6 +1425,7 @@ static SpiceCanvas *canvas_create_common(pixman_image_t *image,
     canvas->private_data_size = 0;
 
     canvas->image = image;
+    pixman_region32_init(&canvas->damage);
 
     return (SpiceCanvas *)canvas;
 }
@@ -1249,6 +1459,17 @@ SpiceCanvas *canvas_create_for_data(int width, int height, uint32_t format,
                                 zlib_decoder);
 }
 
+void canvas_take_damage(SpiceCanvas *spice_canvas, QRegion *damage)
+{
+    SwCanvas *canvas = (SwCanvas *)spice_canvas;
+
+    pixman_region32_intersect_rect(damage, &canvas->damage, 0, 0,
+                                   pixman_image_get_width(canvas->image),
+                                   pixman_image_get_height(canvas->image));
+    pixman_region32_fini(&canvas->damage);
+    pixman_region32_init(&canvas->damage);
+}
+
 SPICE_CONSTRUCTOR_FUNC(sw_canvas_global_init) //unsafe global function
 {
     canvas_base_init_ops(&sw_canvas_ops);
@@ -1261,6 +1482,7 @@ SPICE_CONSTRUCTOR_FUNC(sw_canvas_global_init) //unsafe global function
     sw_canvas_ops.fill_solid_spans = fill_solid_spans;
     sw_canvas_ops.fill_solid_rects = fill_solid_rects;
     sw_canvas_ops.fill_solid_rects_rop = fill_solid_rects_rop;
+    sw_canvas_ops.draw_solid_lines = draw_solid_lines;
     sw_canvas_ops.fill_tiled_rects = fill_tiled_rects;
     sw_canvas_ops.fill_tiled_rects_from_surface = fill_tiled_rects_from_surface;
     sw_canvas_ops.fill_tiled_rects_rop = fill_tiled_rects_rop;
@@ -1283,4 +1505,5 @@ SPICE_CONSTRUCTOR_FUNC(sw_canvas_global_init) //unsafe global function
     sw_canvas_ops.colorkey_scale_image_from_surface = colorkey_scale_image_from_surface;
     sw_canvas_ops.copy_region = copy_region;
     sw_canvas_ops.get_image = get_image;
+    sw_canvas_ops.image_changed = image_changed;
 }
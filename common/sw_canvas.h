@@ -40,6 +40,9 @@ SpiceCanvas *canvas_create_for_data(int width, int height, uint32_t format, uint
                            , SpiceZlibDecoder *zlib_decoder
                            );
 
+/* Stores in damage (which must be initialized) the area of the canvas
+ * modified since the previous call, and resets the accumulated damage */
+void canvas_take_damage(SpiceCanvas *canvas, QRegion *damage);
 
 SPICE_END_DECLS
 
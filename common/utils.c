@@ -64,3 +64,93 @@ spice_genum_get_value(GType enum_type, const char *nick,
 
     g_return_val_if_reached(default_value);
 }
+
+typedef struct BandsRun {
+    GMutex lock;
+    GCond done_cond;
+    int pending;
+} BandsRun;
+
+typedef struct BandTask {
+    SpiceBandFunc func;
+    void *job;
+    int y1;
+    int y2;
+    BandsRun *run;
+} BandTask;
+
+static void band_worker(gpointer data, G_GNUC_UNUSED gpointer user_data)
+{
+    BandTask *task = data;
+    BandsRun *run = task->run;
+
+    task->func(task->job, task->y1, task->y2);
+
+    g_mutex_lock(&run->lock);
+    if (--run->pending == 0) {
+        g_cond_signal(&run->done_cond);
+    }
+    g_mutex_unlock(&run->lock);
+}
+
+static GThreadPool *bands_pool_get(void)
+{
+    static GThreadPool *pool = NULL;
+
+    if (g_once_init_enter(&pool)) {
+        /* the calling thread does a band too */
+        g_once_init_leave(&pool, g_thread_pool_new(band_worker, NULL,
+                                                   MAX(g_get_num_processors() - 1, 1),
+                                                   FALSE, NULL));
+    }
+    return pool;
+}
+
+void
+spice_run_bands(SpiceBandFunc func, void *jobs, size_t job_size, int n_jobs,
+                int y1, int y2, int line_align)
+{
+    GThreadPool *pool;
+    BandTask *tasks;
+    BandsRun run;
+    int band_lines, n_tasks, i;
+
+    g_return_if_fail(n_jobs > 0 && line_align > 0);
+
+    band_lines = ((y2 - y1 + line_align - 1) / line_align + n_jobs - 1) / n_jobs * line_align;
+    if (band_lines >= y2 - y1) {
+        func(jobs, y1, y2);
+        return;
+    }
+
+    tasks = g_new(BandTask, n_jobs);
+    n_tasks = 0;
+    for (i = 1; i < n_jobs && y1 + i * band_lines < y2; i++) {
+        BandTask *task = &tasks[n_tasks++];
+
+        task->func = func;
+        task->job = (guint8 *)jobs + i * job_size;
+        task->y1 = y1 + i * band_lines;
+        task->y2 = MIN(task->y1 + band_lines, y2);
+        task->run = &run;
+    }
+
+    g_mutex_init(&run.lock);
+    g_cond_init(&run.done_cond);
+    run.pending = n_tasks;
+    pool = bands_pool_get();
+    for (i = 0; i < n_tasks; i++) {
+        g_thread_pool_push(pool, &tasks[i], NULL);
+    }
+
+    func(jobs, y1, y1 + band_lines);
+
+    g_mutex_lock(&run.lock);
+    while (run.pending > 0) {
+        g_cond_wait(&run.done_cond, &run.lock);
+    }
+    g_mutex_unlock(&run.lock);
+    g_cond_clear(&run.done_cond);
+    g_mutex_clear(&run.lock);
+    g_free(tasks);
+}
@@ -28,6 +28,17 @@ const char *spice_genum_get_nick(GType enum_type, gint value);
 int spice_genum_get_value(GType enum_type, const char *nick,
                           gint default_value);
 
+typedef void (*SpiceBandFunc)(void *job, int y1, int y2);
+
+/* Splits the lines [y1, y2) in up to n_jobs bands of a multiple of
+ * line_align lines and calls func(job, band_y1, band_y2) for each of them.
+ * jobs is an array of n_jobs elements of job_size bytes, one per band.
+ * The first band is done on the calling thread and the other ones on a
+ * thread pool shared by all the callers, created on first use.
+ * Returns once all the bands are done. */
+void spice_run_bands(SpiceBandFunc func, void *jobs, size_t job_size, int n_jobs,
+                     int y1, int y2, int line_align);
+
 G_END_DECLS
 
 #endif //H_SPICE_COMMON_UTILS
@@ -153,6 +153,44 @@ AC_DEFUN([SPICE_CHECK_OPUS], [
 ])
 
 
+# SPICE_CHECK_JPEG
+# ----------------
+# Check for the availability of libjpeg-turbo. If found, it will return the flags to use
+# in the JPEG_CFLAGS and JPEG_LIBS variables, and it will define a
+# HAVE_JPEG preprocessor symbol as well as a HAVE_JPEG Makefile conditional.
+# ----------------
+AC_DEFUN([SPICE_CHECK_JPEG], [
+    AC_ARG_ENABLE([jpeg],
+      AS_HELP_STRING([--enable-jpeg=@<:@yes/no/auto@:>@],
+                     [Enable the libjpeg-turbo JPEG decoder @<:@default=auto@:>@]),
+      [],
+      [enable_jpeg="auto"])
+
+    have_jpeg="no"
+    if test "x$enable_jpeg" != "xno"; then
+        PKG_CHECK_MODULES([JPEG], [libjpeg >= 1.2], [have_jpeg=yes], [have_jpeg=no])
+
+        if test "x$have_jpeg" = "xyes"; then
+          # IJG libjpeg 9 also passes the version check, the decoder needs
+          # the libjpeg-turbo colour space extensions
+          old_CFLAGS="$CFLAGS"
+          CFLAGS="$CFLAGS $JPEG_CFLAGS"
+          AC_CHECK_DECL([JCS_EXTENSIONS], [], [have_jpeg=no], [
+#include <stdio.h>
+#include <jpeglib.h>
+])
+          CFLAGS="$old_CFLAGS"
+        fi
+        if test "x$enable_jpeg" = "xyes" && test "x$have_jpeg" != "xyes"; then
+            AC_MSG_ERROR([--enable-jpeg has been specified, but libjpeg-turbo is missing])
+        fi
+    fi
+
+    AM_CONDITIONAL([HAVE_JPEG], [test "x$have_jpeg" = "xyes"])
+    AM_COND_IF([HAVE_JPEG], AC_DEFINE([HAVE_JPEG], [1], [Define if we have libjpeg-turbo]))
+])
+
+
 # SPICE_CHECK_PIXMAN
 # ------------------
 # Check for the availability of pixman. If found, it will return the flags to
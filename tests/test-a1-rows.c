@@ -0,0 +1,148 @@
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/* Check the SIMD a1 glyph rows give the same bytes as the C ones */
+#include <config.h>
+
+#include <string.h>
+#include <glib.h>
+
+#include "common/pixman_utils.h"
+
+/* rows from a single byte to a few vectors with a tail, starting anywhere */
+#define TEST_MAX_LEN 100
+#define TEST_MAX_OFFSET 31
+/* bytes after the row which must be left alone */
+#define TEST_GUARD 33
+#define TEST_BUF_SIZE (TEST_MAX_OFFSET + TEST_MAX_LEN + 1 + TEST_GUARD)
+
+static uint8_t src[TEST_BUF_SIZE];
+static uint8_t ref[TEST_BUF_SIZE];
+static uint8_t res[TEST_BUF_SIZE];
+
+static void fill_random(uint8_t *buf, int size)
+{
+    int i;
+
+    for (i = 0; i < size; i++) {
+        buf[i] = g_test_rand_int_range(0, 256);
+    }
+}
+
+static void assert_same_bytes(const char *what, int len, int src_offset, int dest_offset)
+{
+    if (memcmp(ref, res, sizeof(ref)) != 0) {
+        g_error("%s: mismatch, len %d, src offset %d, dest offset %d", what, len,
+                src_offset, dest_offset);
+    }
+}
+
+static void test_a1_reverse(void)
+{
+    int len, invert;
+
+    if (!spice_pixman_set_simd_enabled(TRUE)) {
+        g_test_skip("no SIMD support");
+        return;
+    }
+    for (len = 1; len <= TEST_MAX_LEN; len++) {
+        for (invert = 0; invert <= 1; invert++) {
+            int src_offset = g_test_rand_int_range(0, TEST_MAX_OFFSET + 1);
+            int dest_offset = g_test_rand_int_range(0, TEST_MAX_OFFSET + 1);
+
+            fill_random(src, sizeof(src));
+            fill_random(ref, sizeof(ref));
+            memcpy(res, ref, sizeof(ref));
+            spice_pixman_set_simd_enabled(FALSE);
+            spice_a1_reverse_row(ref + dest_offset, src + src_offset, len, invert);
+            spice_pixman_set_simd_enabled(TRUE);
+            spice_a1_reverse_row(res + dest_offset, src + src_offset, len, invert);
+            assert_same_bytes("reverse", len, src_offset, dest_offset);
+
+            /* glyphs are also reversed in place */
+            spice_pixman_set_simd_enabled(FALSE);
+            spice_a1_reverse_row(ref + dest_offset, ref + dest_offset, len, invert);
+            spice_pixman_set_simd_enabled(TRUE);
+            spice_a1_reverse_row(res + dest_offset, res + dest_offset, len, invert);
+            assert_same_bytes("reverse in place", len, dest_offset, dest_offset);
+        }
+    }
+}
+
+static void test_a1_invert(void)
+{
+    int len;
+
+    if (!spice_pixman_set_simd_enabled(TRUE)) {
+        g_test_skip("no SIMD support");
+        return;
+    }
+    for (len = 1; len <= TEST_MAX_LEN; len++) {
+        int src_offset = g_test_rand_int_range(0, TEST_MAX_OFFSET + 1);
+        int dest_offset = g_test_rand_int_range(0, TEST_MAX_OFFSET + 1);
+
+        fill_random(src, sizeof(src));
+        fill_random(ref, sizeof(ref));
+        memcpy(res, ref, sizeof(ref));
+        spice_pixman_set_simd_enabled(FALSE);
+        spice_a1_invert_row(ref + dest_offset, src + src_offset, len);
+        spice_pixman_set_simd_enabled(TRUE);
+        spice_a1_invert_row(res + dest_offset, src + src_offset, len);
+        assert_same_bytes("invert", len, src_offset, dest_offset);
+    }
+}
+
+static void test_a1_or(void)
+{
+    int n_bits, shift;
+
+    if (!spice_pixman_set_simd_enabled(TRUE)) {
+        g_test_skip("no SIMD support");
+        return;
+    }
+    for (n_bits = 1; n_bits <= TEST_MAX_LEN * 8; n_bits += g_test_rand_int_range(1, 8)) {
+        for (shift = 0; shift < 8; shift++) {
+            int src_offset = g_test_rand_int_range(0, TEST_MAX_OFFSET + 1);
+            int dest_offset = g_test_rand_int_range(0, TEST_MAX_OFFSET + 1);
+            int n_src = (n_bits + 7) / 8;
+
+            fill_random(src, sizeof(src));
+            /* the bits past n_bits are 0 */
+            src[src_offset + n_src - 1] &= 0xff >> (n_src * 8 - n_bits);
+            fill_random(ref, sizeof(ref));
+            memcpy(res, ref, sizeof(ref));
+            spice_pixman_set_simd_enabled(FALSE);
+            spice_a1_or_row(ref + dest_offset, src + src_offset, n_bits, shift);
+            spice_pixman_set_simd_enabled(TRUE);
+            spice_a1_or_row(res + dest_offset, src + src_offset, n_bits, shift);
+            if (memcmp(ref, res, sizeof(ref)) != 0) {
+                g_error("or: mismatch, %d bits, shift %d, src offset %d, dest offset %d",
+                        n_bits, shift, src_offset, dest_offset);
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/a1-rows/reverse", test_a1_reverse);
+    g_test_add_func("/a1-rows/invert", test_a1_invert);
+    g_test_add_func("/a1-rows/or", test_a1_or);
+
+    return g_test_run();
+}
@@ -0,0 +1,255 @@
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/* Check the bitmap conversions give the same pixels as a pixman SRC
+ * composite from the bitmap format, and the SIMD rows the same pixels as the
+ * C ones */
+#include <config.h>
+
+#include <string.h>
+#include <glib.h>
+
+#include "common/pixman_utils.h"
+
+#define TEST_HEIGHT 5
+
+/* odd widths around the 4, 8, 16 and 32 pixels the kernels handle at once */
+static const int test_widths[] = { 1, 3, 5, 7, 9, 15, 17, 31, 33, 63, 65, 131 };
+
+static uint8_t *create_random_bitmap(int stride, int max_value)
+{
+    uint8_t *bitmap = g_malloc(stride * TEST_HEIGHT);
+    int i;
+
+    for (i = 0; i < stride * TEST_HEIGHT; i++) {
+        bitmap[i] = g_test_rand_int_range(0, max_value);
+    }
+    return bitmap;
+}
+
+/* Only the bits of the pixels in mask are compared */
+static void assert_same_pixels(pixman_image_t *a, pixman_image_t *b, const char *what,
+                               int src_format, int width, uint32_t mask)
+{
+    int bpp = PIXMAN_FORMAT_BPP(pixman_image_get_format(a));
+    int stride = pixman_image_get_stride(a);
+    uint8_t *line_a = (uint8_t *)pixman_image_get_data(a);
+    uint8_t *line_b = (uint8_t *)pixman_image_get_data(b);
+    int x, y;
+
+    g_assert_cmpint(pixman_image_get_format(a), ==, pixman_image_get_format(b));
+    for (y = 0; y < pixman_image_get_height(a); y++, line_a += stride, line_b += stride) {
+        for (x = 0; x < width; x++) {
+            uint32_t pixel_a, pixel_b;
+
+            if (bpp == 32) {
+                pixel_a = ((uint32_t *)line_a)[x];
+                pixel_b = ((uint32_t *)line_b)[x];
+            } else {
+                pixel_a = ((uint16_t *)line_a)[x];
+                pixel_b = ((uint16_t *)line_b)[x];
+            }
+            if ((pixel_a & mask) != (pixel_b & mask)) {
+                g_error("%s: bitmap format %d to %08x: mismatch at %d,%d, width %d: "
+                        "%08x != %08x", what, src_format, pixman_image_get_format(a),
+                        x, y, width, pixel_a, pixel_b);
+            }
+        }
+    }
+}
+
+/* What the conversion has to match: the bitmap in its own format,
+ * composited into the destination format */
+static pixman_image_t *convert_with_pixman(pixman_format_code_t dest_format, int src_format,
+                                           int flags, int width, uint8_t *src, int src_stride,
+                                           uint32_t palette_surface_format,
+                                           SpicePalette *palette)
+{
+    pixman_image_t *src_image, *dest_image;
+
+    src_image = spice_bitmap_to_pixman(NULL, src_format, flags, width, TEST_HEIGHT,
+                                       src, src_stride, palette_surface_format, palette);
+    dest_image = pixman_image_create_bits(dest_format, width, TEST_HEIGHT, NULL, 0);
+    g_assert_nonnull(dest_image);
+    pixman_image_composite32(PIXMAN_OP_SRC,
+                             src_image, NULL, dest_image,
+                             0, 0,
+                             0, 0,
+                             0, 0,
+                             width, TEST_HEIGHT);
+    pixman_image_unref(src_image);
+    return dest_image;
+}
+
+/* converts the bitmap with the C rows, compared with pixman on the bits of
+ * the destination depth, then with the SIMD ones, both top down and bottom
+ * up */
+static void check_convert(pixman_format_code_t dest_format, int src_format,
+                          int width, uint8_t *src, int src_stride,
+                          uint32_t palette_surface_format, SpicePalette *palette)
+{
+    uint32_t depth_mask = (uint32_t)((UINT64_C(1) << PIXMAN_FORMAT_DEPTH(dest_format)) - 1);
+    int flags;
+
+    for (flags = 0; flags <= SPICE_BITMAP_FLAGS_TOP_DOWN; flags += SPICE_BITMAP_FLAGS_TOP_DOWN) {
+        pixman_image_t *pixman_ref, *ref, *res;
+
+        spice_pixman_set_simd_enabled(FALSE);
+        pixman_ref = convert_with_pixman(dest_format, src_format, flags, width,
+                                         src, src_stride, palette_surface_format, palette);
+        ref = spice_bitmap_convert_to_pixman(dest_format, NULL, src_format, flags,
+                                             width, TEST_HEIGHT, src, src_stride,
+                                             palette_surface_format, palette);
+        assert_same_pixels(pixman_ref, ref, "pixman", src_format, width, depth_mask);
+        spice_pixman_set_simd_enabled(TRUE);
+        res = spice_bitmap_convert_to_pixman(dest_format, NULL, src_format, flags,
+                                             width, TEST_HEIGHT, src, src_stride,
+                                             palette_surface_format, palette);
+        assert_same_pixels(ref, res, "simd", src_format, width, 0xffffffff);
+        pixman_image_unref(pixman_ref);
+        pixman_image_unref(ref);
+        pixman_image_unref(res);
+    }
+}
+
+static void test_convert_24_to_32(void)
+{
+    guint w;
+
+    for (w = 0; w < G_N_ELEMENTS(test_widths); w++) {
+        int width = test_widths[w];
+        /* keep the source rows unaligned */
+        int stride = width * 3 + 1;
+        uint8_t *src = create_random_bitmap(stride, 256);
+
+        check_convert(PIXMAN_x8r8g8b8, SPICE_BITMAP_FMT_24BIT, width, src, stride, 0, NULL);
+        g_free(src);
+    }
+}
+
+static void test_convert_8_to_32(void)
+{
+    SpicePalette *palette = g_malloc(sizeof(SpicePalette) + 256 * sizeof(uint32_t));
+    guint w;
+    int i;
+
+    for (i = 0; i < 256; i++) {
+        palette->ents[i] = g_test_rand_int();
+    }
+    for (w = 0; w < G_N_ELEMENTS(test_widths); w++) {
+        int width = test_widths[w];
+        int stride = width + 1;
+        uint8_t *src = create_random_bitmap(stride, 256);
+        uint8_t *small_src = create_random_bitmap(stride, 16);
+
+        /* a full palette is used in place, a smaller one is copied */
+        palette->num_ents = 256;
+        check_convert(PIXMAN_x8r8g8b8, SPICE_BITMAP_FMT_8BIT, width, src, stride,
+                      SPICE_SURFACE_FMT_32_xRGB, palette);
+        palette->num_ents = 16;
+        check_convert(PIXMAN_x8r8g8b8, SPICE_BITMAP_FMT_8BIT, width, small_src, stride,
+                      SPICE_SURFACE_FMT_32_xRGB, palette);
+        g_free(src);
+        g_free(small_src);
+    }
+    g_free(palette);
+}
+
+static void test_convert_16_to_32(void)
+{
+    guint w;
+
+    for (w = 0; w < G_N_ELEMENTS(test_widths); w++) {
+        int width = test_widths[w];
+        int stride = width * 2 + 2;
+        uint8_t *src = create_random_bitmap(stride, 256);
+
+        check_convert(PIXMAN_x8r8g8b8, SPICE_BITMAP_FMT_16BIT, width, src, stride, 0, NULL);
+        check_convert(PIXMAN_a8r8g8b8, SPICE_BITMAP_FMT_16BIT, width, src, stride, 0, NULL);
+        g_free(src);
+    }
+}
+
+static void test_convert_to_555(void)
+{
+    guint w;
+
+    for (w = 0; w < G_N_ELEMENTS(test_widths); w++) {
+        int width = test_widths[w];
+        int stride = width * 4 + 4;
+        uint8_t *src = create_random_bitmap(stride, 256);
+
+        check_convert(PIXMAN_x1r5g5b5, SPICE_BITMAP_FMT_32BIT, width, src, stride, 0, NULL);
+        check_convert(PIXMAN_x1r5g5b5, SPICE_BITMAP_FMT_RGBA, width, src, stride, 0, NULL);
+        check_convert(PIXMAN_x1r5g5b5, SPICE_BITMAP_FMT_24BIT, width, src + 1,
+                      width * 3 + 1, 0, NULL);
+        g_free(src);
+    }
+}
+
+/* every destination the canvas uses from every bitmap format, whether it is
+ * converted directly or through pixman */
+static void test_convert_all_formats(void)
+{
+    static const pixman_format_code_t dest_formats[] = {
+        PIXMAN_x8r8g8b8, PIXMAN_a8r8g8b8, PIXMAN_x1r5g5b5,
+    };
+    static const struct {
+        int format;
+        int bpp;
+    } src_formats[] = {
+        { SPICE_BITMAP_FMT_8BIT, 8 },
+        { SPICE_BITMAP_FMT_16BIT, 16 },
+        { SPICE_BITMAP_FMT_24BIT, 24 },
+        { SPICE_BITMAP_FMT_32BIT, 32 },
+        { SPICE_BITMAP_FMT_RGBA, 32 },
+    };
+    SpicePalette *palette = g_malloc(sizeof(SpicePalette) + 256 * sizeof(uint32_t));
+    guint d, f, w;
+    int i;
+
+    palette->num_ents = 256;
+    for (i = 0; i < 256; i++) {
+        palette->ents[i] = g_test_rand_int();
+    }
+    for (d = 0; d < G_N_ELEMENTS(dest_formats); d++) {
+        for (f = 0; f < G_N_ELEMENTS(src_formats); f++) {
+            for (w = 0; w < G_N_ELEMENTS(test_widths); w += 3) {
+                int width = test_widths[w];
+                int stride = SPICE_ALIGN(width * src_formats[f].bpp / 8, 4) + 4;
+                uint8_t *src = create_random_bitmap(stride, 256);
+
+                check_convert(dest_formats[d], src_formats[f].format, width, src, stride,
+                              SPICE_SURFACE_FMT_32_xRGB, palette);
+                g_free(src);
+            }
+        }
+    }
+    g_free(palette);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/bitmap-convert/24-to-32", test_convert_24_to_32);
+    g_test_add_func("/bitmap-convert/8-to-32", test_convert_8_to_32);
+    g_test_add_func("/bitmap-convert/16-to-32", test_convert_16_to_32);
+    g_test_add_func("/bitmap-convert/to-555", test_convert_to_555);
+    g_test_add_func("/bitmap-convert/all-formats", test_convert_all_formats);
+
+    return g_test_run();
+}
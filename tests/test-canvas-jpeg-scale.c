@@ -0,0 +1,276 @@
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/* Check the canvas asks the JPEG decoder for a reduced size only when a
+ * whole uncached image is drawn scaled down, and draws the smaller image
+ * over the whole destination */
+#include <config.h>
+
+#include <string.h>
+#include <glib.h>
+
+#include "common/sw_canvas.h"
+#include "common/mem.h"
+
+#define CANVAS_WIDTH 200
+#define CANVAS_HEIGHT 150
+
+#define IMAGE_WIDTH 96
+#define IMAGE_HEIGHT 64
+
+/* the red of the decoded pixels, blue goes from 0 to 255 along the lines */
+#define TEST_RED 0x33
+
+/* Scales down like libjpeg, by the smallest n/8 giving at least the target
+ * size, and records the sizes asked for */
+typedef struct {
+    SpiceJpegDecoder base;
+    int target_width;
+    int target_height;
+    int width;
+    int height;
+    int n_decodes;
+} TestJpegDecoder;
+
+typedef struct {
+    SpiceImageCache base;
+    int n_puts;
+    int put_width;
+    int put_height;
+} TestImageCache;
+
+static void test_jpeg_set_target_size(SpiceJpegDecoder *spice_decoder, int width, int height)
+{
+    TestJpegDecoder *decoder = SPICE_CONTAINEROF(spice_decoder, TestJpegDecoder, base);
+
+    decoder->target_width = width;
+    decoder->target_height = height;
+}
+
+static void test_jpeg_begin_decode(SpiceJpegDecoder *spice_decoder, uint8_t *data,
+                                   int data_size, int *out_width, int *out_height)
+{
+    TestJpegDecoder *decoder = SPICE_CONTAINEROF(spice_decoder, TestJpegDecoder, base);
+    int num;
+
+    for (num = 1; num < 8; num++) {
+        if ((IMAGE_WIDTH * num + 7) / 8 >= decoder->target_width &&
+            (IMAGE_HEIGHT * num + 7) / 8 >= decoder->target_height) {
+            break;
+        }
+    }
+    decoder->width = (IMAGE_WIDTH * num + 7) / 8;
+    decoder->height = (IMAGE_HEIGHT * num + 7) / 8;
+    *out_width = decoder->width;
+    *out_height = decoder->height;
+}
+
+static void test_jpeg_decode(SpiceJpegDecoder *spice_decoder, uint8_t *dest, int stride,
+                             int format)
+{
+    TestJpegDecoder *decoder = SPICE_CONTAINEROF(spice_decoder, TestJpegDecoder, base);
+    int x, y;
+
+    g_assert_cmpint(format, ==, SPICE_BITMAP_FMT_32BIT);
+    for (y = 0; y < decoder->height; y++) {
+        uint32_t *line = (uint32_t *)(dest + y * stride);
+
+        for (x = 0; x < decoder->width; x++) {
+            line[x] = (TEST_RED << 16) | (x * 255 / MAX(decoder->width - 1, 1));
+        }
+    }
+    decoder->n_decodes++;
+}
+
+static SpiceJpegDecoderOps test_jpeg_ops = {
+    .begin_decode = test_jpeg_begin_decode,
+    .decode = test_jpeg_decode,
+    .set_target_size = test_jpeg_set_target_size,
+};
+
+static void image_cache_put(SpiceImageCache *spice_cache, uint64_t id, pixman_image_t *surface)
+{
+    TestImageCache *cache = SPICE_CONTAINEROF(spice_cache, TestImageCache, base);
+
+    cache->n_puts++;
+    cache->put_width = pixman_image_get_width(surface);
+    cache->put_height = pixman_image_get_height(surface);
+}
+
+static pixman_image_t *image_cache_get(SpiceImageCache *spice_cache, uint64_t id)
+{
+    g_return_val_if_reached(NULL);
+}
+
+static const SpiceImageCacheOps image_cache_ops = {
+    .put = image_cache_put,
+    .get = image_cache_get,
+    .put_lossy = image_cache_put,
+    .replace_lossy = image_cache_put,
+    .get_lossless = image_cache_get,
+};
+
+static SpiceImage *create_image(uint8_t flags)
+{
+    static uint8_t data[16];
+    SpiceImage *image = spice_new0(SpiceImage, 1);
+
+    image->descriptor.id = 1;
+    image->descriptor.type = SPICE_IMAGE_TYPE_JPEG;
+    image->descriptor.flags = flags;
+    image->descriptor.width = IMAGE_WIDTH;
+    image->descriptor.height = IMAGE_HEIGHT;
+    image->u.jpeg.data_size = sizeof(data);
+    image->u.jpeg.data = spice_chunks_new_linear(data, sizeof(data));
+    return image;
+}
+
+static void destroy_image(SpiceImage *image)
+{
+    spice_chunks_destroy(image->u.jpeg.data);
+    free(image);
+}
+
+/* The whole bbox, and nothing else, has the decoded pixels, with the blue
+ * growing along the lines */
+static void assert_drawn(const uint32_t *data, const SpiceRect *bbox)
+{
+    int x, y;
+
+    for (y = 0; y < CANVAS_HEIGHT; y++) {
+        const uint32_t *line = data + y * CANVAS_WIDTH;
+
+        for (x = 0; x < CANVAS_WIDTH; x++) {
+            if (x < bbox->left || x >= bbox->right || y < bbox->top || y >= bbox->bottom) {
+                g_assert_cmphex(line[x], ==, 0);
+                continue;
+            }
+            g_assert_cmphex((line[x] >> 16) & 0xff, ==, TEST_RED);
+            if (x > bbox->left) {
+                g_assert_cmpuint(line[x] & 0xff, >=, line[x - 1] & 0xff);
+            }
+        }
+        if (y >= bbox->top && y < bbox->bottom) {
+            g_assert_cmphex(line[bbox->left] & 0xff, <, 0x40);
+            g_assert_cmphex(line[bbox->right - 1] & 0xff, >, 0xc0);
+        }
+    }
+}
+
+static void check_draw(SpiceImage *image, const SpiceRect *src_area, const SpiceRect *bbox,
+                       SpiceROP rop, int target_width, int target_height)
+{
+    uint32_t *data = g_new0(uint32_t, CANVAS_WIDTH * CANVAS_HEIGHT);
+    TestJpegDecoder decoder;
+    TestImageCache cache;
+    SpiceClip clip = { SPICE_CLIP_TYPE_NONE, NULL };
+    SpiceRect dest = *bbox;
+    SpiceCopy copy;
+    SpiceCanvas *canvas;
+
+    memset(&decoder, 0, sizeof(decoder));
+    decoder.base.ops = &test_jpeg_ops;
+    /* left over from another user of the decoder */
+    decoder.target_width = 1;
+    decoder.target_height = 1;
+    memset(&cache, 0, sizeof(cache));
+    cache.base.ops = &image_cache_ops;
+
+    canvas = canvas_create_for_data(CANVAS_WIDTH, CANVAS_HEIGHT, SPICE_SURFACE_FMT_32_xRGB,
+                                    (uint8_t *)data, CANVAS_WIDTH * 4, &cache.base, NULL,
+                                    NULL, NULL, &decoder.base, NULL);
+    g_assert_nonnull(canvas);
+
+    memset(&copy, 0, sizeof(copy));
+    copy.src_bitmap = image;
+    copy.src_area = *src_area;
+    copy.rop_descriptor = rop == SPICE_ROP_COPY ? SPICE_ROPD_OP_PUT : SPICE_ROPD_OP_OR;
+    copy.scale_mode = SPICE_IMAGE_SCALE_MODE_NEAREST;
+    canvas->ops->draw_copy(canvas, &dest, &clip, &copy);
+
+    g_assert_cmpint(decoder.n_decodes, ==, 1);
+    g_assert_cmpint(decoder.target_width, ==, target_width);
+    g_assert_cmpint(decoder.target_height, ==, target_height);
+    if (image->descriptor.flags & SPICE_IMAGE_FLAGS_CACHE_ME) {
+        /* the cache always gets the full image */
+        g_assert_cmpint(cache.n_puts, ==, 1);
+        g_assert_cmpint(cache.put_width, ==, IMAGE_WIDTH);
+        g_assert_cmpint(cache.put_height, ==, IMAGE_HEIGHT);
+    } else {
+        g_assert_cmpint(cache.n_puts, ==, 0);
+    }
+    if (src_area->left == 0 && src_area->right == IMAGE_WIDTH) {
+        assert_drawn(data, bbox);
+    }
+
+    canvas->ops->destroy(canvas);
+    g_free(data);
+}
+
+static void test_jpeg_scale_down(void)
+{
+    static const SpiceRect whole = { 0, 0, IMAGE_WIDTH, IMAGE_HEIGHT };
+    /* decoded at exactly the drawn size, then at 3/8 and 5/8 of the image
+     * size, still scaled to the drawn size */
+    static const SpiceRect bboxes[] = {
+        { 10, 20, 10 + IMAGE_WIDTH / 2, 20 + IMAGE_HEIGHT / 2 },
+        { 7, 3, 7 + 33, 3 + 20 },
+        { 100, 50, 100 + 55, 50 + 17 },
+    };
+    SpiceImage *image = create_image(0);
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS(bboxes); i++) {
+        const SpiceRect *bbox = &bboxes[i];
+
+        check_draw(image, &whole, bbox, SPICE_ROP_COPY,
+                   bbox->right - bbox->left, bbox->bottom - bbox->top);
+        check_draw(image, &whole, bbox, SPICE_ROP_OR,
+                   bbox->right - bbox->left, bbox->bottom - bbox->top);
+    }
+    destroy_image(image);
+}
+
+static void test_jpeg_full_size(void)
+{
+    static const SpiceRect whole = { 0, 0, IMAGE_WIDTH, IMAGE_HEIGHT };
+    static const SpiceRect part = { 8, 8, IMAGE_WIDTH, IMAGE_HEIGHT / 2 };
+    static const SpiceRect same = { 40, 30, 40 + IMAGE_WIDTH, 30 + IMAGE_HEIGHT };
+    static const SpiceRect larger = { 0, 0, CANVAS_WIDTH, CANVAS_HEIGHT };
+    static const SpiceRect smaller = { 5, 5, 5 + IMAGE_WIDTH / 4, 5 + IMAGE_HEIGHT / 4 };
+    SpiceImage *image = create_image(0);
+    SpiceImage *cached_image = create_image(SPICE_IMAGE_FLAGS_CACHE_ME);
+
+    /* not scaled, scaled up, or only part of the image */
+    check_draw(image, &whole, &same, SPICE_ROP_COPY, 0, 0);
+    check_draw(image, &whole, &larger, SPICE_ROP_COPY, 0, 0);
+    check_draw(image, &part, &smaller, SPICE_ROP_COPY, 0, 0);
+    /* the cached image is scaled by the canvas */
+    check_draw(cached_image, &whole, &smaller, SPICE_ROP_COPY, 0, 0);
+
+    destroy_image(image);
+    destroy_image(cached_image);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/canvas-jpeg-scale/down", test_jpeg_scale_down);
+    g_test_add_func("/canvas-jpeg-scale/full-size", test_jpeg_full_size);
+
+    return g_test_run();
+}
@@ -0,0 +1,380 @@
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/* Check drawing images decoded ahead by the canvas prefetch gives the same
+ * pixels and the same image cache updates, in the same order, as decoding
+ * them when drawn, also when the prefetched jobs are dropped */
+#include <config.h>
+
+#include <string.h>
+#include <glib.h>
+
+#include "common/sw_canvas.h"
+#include "common/quic.h"
+#include "common/lz.h"
+#include "common/mem.h"
+
+#define CANVAS_WIDTH 200
+#define CANVAS_HEIGHT 150
+
+typedef struct {
+    SpiceImageCache base;
+    GString *puts;
+} TestImageCache;
+
+typedef struct {
+    int image;
+    SpiceRect src_area;
+    SpiceRect bbox;
+} TestDraw;
+
+/* 32 and 16 bits images, compressed with QUIC and LZ, two of them to be
+ * cached */
+static const struct {
+    uint8_t type;
+    int bpp;
+    int width;
+    int height;
+    int cache_me;
+} test_images[] = {
+    { SPICE_IMAGE_TYPE_QUIC, 32, 64, 48, FALSE },
+    { SPICE_IMAGE_TYPE_QUIC, 16, 37, 29, TRUE },
+    { SPICE_IMAGE_TYPE_LZ_RGB, 32, 50, 41, TRUE },
+    { SPICE_IMAGE_TYPE_LZ_RGB, 16, 33, 60, FALSE },
+};
+
+/* plain and scaled copies, the first image is drawn twice */
+static const TestDraw test_draws[] = {
+    { 0, { 0, 0, 64, 48 }, { 0, 0, 48, 64 } },
+    { 1, { 0, 0, 37, 29 }, { 70, 10, 107, 39 } },
+    { 2, { 5, 3, 45, 40 }, { 120, 0, 200, 74 } },
+    { 3, { 0, 0, 33, 60 }, { 10, 80, 43, 140 } },
+    { 0, { 10, 10, 60, 40 }, { 60, 90, 110, 120 } },
+};
+
+static SpiceImage *images[G_N_ELEMENTS(test_images)];
+
+static SPICE_GNUC_NORETURN SPICE_GNUC_PRINTF(2, 3) void
+quic_usr_error(QuicUsrContext *usr, const char *fmt, ...)
+{
+    g_assert_not_reached();
+}
+
+static SPICE_GNUC_PRINTF(2, 3) void
+quic_usr_warn(QuicUsrContext *usr, const char *fmt, ...)
+{
+}
+
+static void *quic_usr_malloc(QuicUsrContext *usr, int size)
+{
+    return g_malloc(size);
+}
+
+static void quic_usr_free(QuicUsrContext *usr, void *ptr)
+{
+    g_free(ptr);
+}
+
+/* the encoders are given room for the whole image */
+static int quic_usr_more_space(QuicUsrContext *usr, uint32_t **io_ptr, int rows_completed)
+{
+    g_return_val_if_reached(0);
+}
+
+static int quic_usr_more_lines(QuicUsrContext *usr, uint8_t **lines)
+{
+    g_return_val_if_reached(0);
+}
+
+static SPICE_GNUC_NORETURN SPICE_GNUC_PRINTF(2, 3) void
+lz_usr_error(LzUsrContext *usr, const char *fmt, ...)
+{
+    g_assert_not_reached();
+}
+
+static SPICE_GNUC_PRINTF(2, 3) void
+lz_usr_warn(LzUsrContext *usr, const char *fmt, ...)
+{
+}
+
+static void *lz_usr_malloc(LzUsrContext *usr, int size)
+{
+    return g_malloc(size);
+}
+
+static void lz_usr_free(LzUsrContext *usr, void *ptr)
+{
+    g_free(ptr);
+}
+
+static int lz_usr_more_space(LzUsrContext *usr, uint8_t **io_ptr)
+{
+    g_return_val_if_reached(0);
+}
+
+static int lz_usr_more_lines(LzUsrContext *usr, uint8_t **lines)
+{
+    g_return_val_if_reached(0);
+}
+
+static uint8_t *encode_quic(QuicImageType type, int width, int height,
+                            uint8_t *lines, int stride, int *size)
+{
+    QuicUsrContext usr = {
+        .error = quic_usr_error,
+        .warn = quic_usr_warn,
+        .info = quic_usr_warn,
+        .malloc = quic_usr_malloc,
+        .free = quic_usr_free,
+        .more_space = quic_usr_more_space,
+        .more_lines = quic_usr_more_lines,
+    };
+    QuicContext *quic = quic_create(&usr);
+    int n_words = stride * height + 1024;
+    uint32_t *data = spice_malloc(n_words * 4);
+
+    g_assert_nonnull(quic);
+    *size = quic_encode(quic, type, width, height, lines, height, stride, data, n_words) * 4;
+    g_assert_cmpint(*size, >, 0);
+    quic_destroy(quic);
+    return (uint8_t *)data;
+}
+
+static uint8_t *encode_lz(LzImageType type, int width, int height,
+                          uint8_t *lines, int stride, int *size)
+{
+    LzUsrContext usr = {
+        .error = lz_usr_error,
+        .warn = lz_usr_warn,
+        .info = lz_usr_warn,
+        .malloc = lz_usr_malloc,
+        .free = lz_usr_free,
+        .more_space = lz_usr_more_space,
+        .more_lines = lz_usr_more_lines,
+    };
+    LzContext *lz = lz_create(&usr);
+    int n_bytes = stride * height + 1024;
+    uint8_t *data = spice_malloc(n_bytes);
+
+    g_assert_nonnull(lz);
+    *size = lz_encode(lz, type, width, height, TRUE, lines, height, stride, data, n_bytes);
+    g_assert_cmpint(*size, >, 0);
+    lz_destroy(lz);
+    return data;
+}
+
+/* Gradients with some noise, the low bits of each pixel are random */
+static SpiceImage *create_image(uint64_t id, uint8_t type, int bpp, int width, int height,
+                                int cache_me)
+{
+    SpiceImage *image = spice_new0(SpiceImage, 1);
+    int stride = width * bpp / 8;
+    uint8_t *lines = g_malloc(stride * height);
+    uint8_t *data;
+    int x, y, size;
+
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) {
+            uint32_t pixel = ((x * 255 / width) << 16) | ((y * 255 / height) << 8) |
+                             ((x + y) & 0xff);
+
+            pixel ^= g_test_rand_int() & 0x030303;
+            if (bpp == 32) {
+                ((uint32_t *)(lines + y * stride))[x] = pixel;
+            } else {
+                ((uint16_t *)(lines + y * stride))[x] = pixel & 0x7fff;
+            }
+        }
+    }
+
+    if (type == SPICE_IMAGE_TYPE_QUIC) {
+        data = encode_quic(bpp == 32 ? QUIC_IMAGE_TYPE_RGB32 : QUIC_IMAGE_TYPE_RGB16,
+                           width, height, lines, stride, &size);
+        image->u.quic.data_size = size;
+        image->u.quic.data = spice_chunks_new_linear(data, size);
+        image->u.quic.data->flags |= SPICE_CHUNKS_FLAGS_FREE;
+    } else {
+        data = encode_lz(bpp == 32 ? LZ_IMAGE_TYPE_RGB32 : LZ_IMAGE_TYPE_RGB16,
+                         width, height, lines, stride, &size);
+        image->u.lz_rgb.data_size = size;
+        image->u.lz_rgb.data = spice_chunks_new_linear(data, size);
+        image->u.lz_rgb.data->flags |= SPICE_CHUNKS_FLAGS_FREE;
+    }
+    g_free(lines);
+
+    image->descriptor.id = id;
+    image->descriptor.type = type;
+    image->descriptor.flags = cache_me ? SPICE_IMAGE_FLAGS_CACHE_ME : 0;
+    image->descriptor.width = width;
+    image->descriptor.height = height;
+    return image;
+}
+
+static void destroy_image(SpiceImage *image)
+{
+    /* the QUIC and LZ data share the same layout */
+    spice_chunks_destroy(image->u.quic.data);
+    free(image);
+}
+
+/* The cache records what is put, and in which order */
+static void image_cache_put(SpiceImageCache *spice_cache, uint64_t id, pixman_image_t *surface)
+{
+    TestImageCache *cache = SPICE_CONTAINEROF(spice_cache, TestImageCache, base);
+    int width = pixman_image_get_width(surface);
+    int height = pixman_image_get_height(surface);
+    int stride = pixman_image_get_stride(surface);
+    int row_size = width * PIXMAN_FORMAT_BPP(pixman_image_get_format(surface)) / 8;
+    uint8_t *line = (uint8_t *)pixman_image_get_data(surface);
+    uint32_t hash = 2166136261U;
+    int x, y;
+
+    for (y = 0; y < height; y++, line += stride) {
+        for (x = 0; x < row_size; x++) {
+            hash = (hash ^ line[x]) * 16777619U;
+        }
+    }
+    g_string_append_printf(cache->puts, "%" G_GUINT64_FORMAT " %x %dx%d %08x\n", id,
+                           pixman_image_get_format(surface), width, height, hash);
+}
+
+static pixman_image_t *image_cache_get(SpiceImageCache *spice_cache, uint64_t id)
+{
+    g_return_val_if_reached(NULL);
+}
+
+static void image_cache_put_lossy(SpiceImageCache *spice_cache, uint64_t id,
+                                  pixman_image_t *surface)
+{
+    g_assert_not_reached();
+}
+
+static const SpiceImageCacheOps image_cache_ops = {
+    .put = image_cache_put,
+    .get = image_cache_get,
+    .put_lossy = image_cache_put_lossy,
+    .replace_lossy = image_cache_put_lossy,
+    .get_lossless = image_cache_get,
+};
+
+static SpiceCanvas *create_canvas(uint8_t *data, TestImageCache *cache)
+{
+    SpiceCanvas *canvas;
+
+    cache->base.ops = &image_cache_ops;
+    cache->puts = g_string_new(NULL);
+    memset(data, 0, CANVAS_WIDTH * CANVAS_HEIGHT * 4);
+    canvas = canvas_create_for_data(CANVAS_WIDTH, CANVAS_HEIGHT, SPICE_SURFACE_FMT_32_xRGB,
+                                    data, CANVAS_WIDTH * 4, &cache->base, NULL, NULL,
+                                    NULL, NULL, NULL);
+    g_assert_nonnull(canvas);
+    return canvas;
+}
+
+static void draw(SpiceCanvas *canvas, int first, int last)
+{
+    int i;
+
+    for (i = first; i < last; i++) {
+        const TestDraw *test_draw = &test_draws[i];
+        SpiceClip clip = { SPICE_CLIP_TYPE_NONE, NULL };
+        SpiceRect bbox = test_draw->bbox;
+        SpiceCopy copy;
+
+        memset(&copy, 0, sizeof(copy));
+        copy.src_bitmap = images[test_draw->image];
+        copy.src_area = test_draw->src_area;
+        copy.rop_descriptor = SPICE_ROPD_OP_PUT;
+        copy.scale_mode = SPICE_IMAGE_SCALE_MODE_NEAREST;
+        canvas->ops->draw_copy(canvas, &bbox, &clip, &copy);
+    }
+}
+
+static void assert_same_draws(const uint8_t *ref_data, const TestImageCache *ref_cache,
+                              const uint8_t *data, const TestImageCache *cache)
+{
+    g_assert_cmpstr(cache->puts->str, ==, ref_cache->puts->str);
+    g_assert_true(memcmp(data, ref_data, CANVAS_WIDTH * CANVAS_HEIGHT * 4) == 0);
+}
+
+static void test_prefetch(void)
+{
+    uint8_t *ref_data = g_malloc(CANVAS_WIDTH * CANVAS_HEIGHT * 4);
+    uint8_t *data = g_malloc(CANVAS_WIDTH * CANVAS_HEIGHT * 4);
+    TestImageCache ref_cache, cache;
+    SpiceCanvas *canvas;
+    int n_draws = G_N_ELEMENTS(test_draws);
+
+    canvas = create_canvas(ref_data, &ref_cache);
+    draw(canvas, 0, n_draws);
+    canvas->ops->destroy(canvas);
+    g_assert_cmpuint(ref_cache.puts->len, >, 0);
+
+    /* every image decoded ahead */
+    canvas = create_canvas(data, &cache);
+    canvas->ops->prefetch_images(canvas, images, G_N_ELEMENTS(images));
+    draw(canvas, 0, n_draws);
+    assert_same_draws(ref_data, &ref_cache, data, &cache);
+    canvas->ops->destroy(canvas);
+    g_string_free(cache.puts, TRUE);
+
+    /* the prefetched images are dropped with their jobs still pending,
+     * before or after some of them were drawn */
+    canvas = create_canvas(data, &cache);
+    canvas->ops->prefetch_images(canvas, images, G_N_ELEMENTS(images));
+    canvas->ops->prefetch_reset(canvas);
+    draw(canvas, 0, 2);
+    canvas->ops->prefetch_images(canvas, images, G_N_ELEMENTS(images));
+    draw(canvas, 2, 3);
+    canvas->ops->prefetch_reset(canvas);
+    draw(canvas, 3, n_draws);
+    assert_same_draws(ref_data, &ref_cache, data, &cache);
+    canvas->ops->destroy(canvas);
+    g_string_free(cache.puts, TRUE);
+
+    /* pending jobs are also dropped by the canvas destruction */
+    canvas = create_canvas(data, &cache);
+    canvas->ops->prefetch_images(canvas, images, G_N_ELEMENTS(images));
+    canvas->ops->destroy(canvas);
+    g_string_free(cache.puts, TRUE);
+
+    g_string_free(ref_cache.puts, TRUE);
+    g_free(ref_data);
+    g_free(data);
+}
+
+int main(int argc, char **argv)
+{
+    guint i;
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    for (i = 0; i < G_N_ELEMENTS(test_images); i++) {
+        images[i] = create_image(i + 1, test_images[i].type, test_images[i].bpp,
+                                 test_images[i].width, test_images[i].height,
+                                 test_images[i].cache_me);
+    }
+
+    g_test_add_func("/canvas-prefetch/draw", test_prefetch);
+
+    ret = g_test_run();
+
+    for (i = 0; i < G_N_ELEMENTS(images); i++) {
+        destroy_image(images[i]);
+    }
+    return ret;
+}
@@ -0,0 +1,199 @@
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/* Check the surfaces pixel buffer pool: buffers are reused within their
+ * size class and cleared when asked for, flushed on request, and the
+ * surfaces get the strides their users expect */
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "common/canvas_utils.h"
+
+/* the pool settings of canvas_utils.c */
+#define POOL_ALIGN 64
+#define POOL_CLASS_MAX_FREE 4
+#define POOL_MAX_SIZE ((size_t)64 * 1024 * 1024)
+
+static void fill_surface(pixman_image_t *surface)
+{
+    int stride = pixman_image_get_stride(surface);
+    uint8_t *line = (uint8_t *)pixman_image_get_data(surface);
+    int y;
+
+    for (y = 0; y < pixman_image_get_height(surface); y++, line += stride) {
+        memset(line, 0xa5, abs(stride));
+    }
+}
+
+static void assert_surface_zero(pixman_image_t *surface)
+{
+    int stride = pixman_image_get_stride(surface);
+    int row_size = (pixman_image_get_width(surface) *
+                    PIXMAN_FORMAT_BPP(pixman_image_get_format(surface)) + 7) / 8;
+    uint8_t *line = (uint8_t *)pixman_image_get_data(surface);
+    int x, y;
+
+    for (y = 0; y < pixman_image_get_height(surface); y++, line += stride) {
+        for (x = 0; x < row_size; x++) {
+            g_assert_cmpint(line[x], ==, 0);
+        }
+    }
+}
+
+static void test_pool_classes(void)
+{
+    static const int heights[] = { 1, 7, 30, 100, 511, 2000 };
+    guint i;
+
+    /* the same size always gets its buffer back, while a size in another
+     * class does not take it */
+    for (i = 0; i < G_N_ELEMENTS(heights); i++) {
+        pixman_image_t *surface;
+        uint8_t *data;
+
+        surface_pool_flush();
+        surface = surface_create(PIXMAN_a8r8g8b8, 1024, heights[i], TRUE);
+        data = (uint8_t *)pixman_image_get_data(surface);
+        pixman_image_unref(surface);
+        g_assert_cmpint(surface_pool_get_n_free(NULL), ==, 1);
+
+        surface = surface_create(PIXMAN_a8r8g8b8, 1024, heights[i], TRUE);
+        g_assert_true((uint8_t *)pixman_image_get_data(surface) == data);
+        g_assert_cmpint(surface_pool_get_n_free(NULL), ==, 0);
+        pixman_image_unref(surface);
+
+        surface = surface_create(PIXMAN_a8r8g8b8, 1024, heights[i] * 3, TRUE);
+        g_assert_cmpint(surface_pool_get_n_free(NULL), ==, 1);
+        pixman_image_unref(surface);
+    }
+    surface_pool_flush();
+}
+
+static void test_pool_reuse(void)
+{
+    pixman_image_t *surface;
+    uint8_t *data;
+    size_t cached;
+
+    surface_pool_flush();
+    surface = surface_create(PIXMAN_x8r8g8b8, 100, 50, TRUE);
+    data = (uint8_t *)pixman_image_get_data(surface);
+    fill_surface(surface);
+    pixman_image_unref(surface);
+    g_assert_cmpint(surface_pool_get_n_free(&cached), ==, 1);
+    g_assert_cmpuint(cached, >, 0);
+
+    /* a slightly smaller size of the same class gets the same buffer,
+     * cleared again for a top down surface */
+    surface = surface_create(PIXMAN_x8r8g8b8, 100, 48, TRUE);
+    g_assert_true((uint8_t *)pixman_image_get_data(surface) == data);
+    g_assert_cmpint(surface_pool_get_n_free(&cached), ==, 0);
+    g_assert_cmpuint(cached, ==, 0);
+    assert_surface_zero(surface);
+    pixman_image_unref(surface);
+
+    /* another class allocates a new buffer */
+    surface = surface_create(PIXMAN_x8r8g8b8, 400, 50, TRUE);
+    g_assert_cmpint(surface_pool_get_n_free(NULL), ==, 1);
+    pixman_image_unref(surface);
+    g_assert_cmpint(surface_pool_get_n_free(NULL), ==, 2);
+
+    surface_pool_flush();
+}
+
+static void test_pool_limits(void)
+{
+    pixman_image_t *surfaces[POOL_CLASS_MAX_FREE + 2];
+    pixman_image_t *large;
+    size_t cached;
+    guint i;
+
+    surface_pool_flush();
+    for (i = 0; i < G_N_ELEMENTS(surfaces); i++) {
+        surfaces[i] = surface_create(PIXMAN_a8r8g8b8, 64, 64, TRUE);
+    }
+    for (i = 0; i < G_N_ELEMENTS(surfaces); i++) {
+        pixman_image_unref(surfaces[i]);
+    }
+    /* only a few buffers are kept per class */
+    g_assert_cmpint(surface_pool_get_n_free(NULL), ==, POOL_CLASS_MAX_FREE);
+
+    /* and none past the largest class */
+    large = surface_create(PIXMAN_a8, POOL_MAX_SIZE / 1024 + 64, 1024, TRUE);
+    pixman_image_unref(large);
+    g_assert_cmpint(surface_pool_get_n_free(NULL), ==, POOL_CLASS_MAX_FREE);
+
+    surface_pool_flush();
+    g_assert_cmpint(surface_pool_get_n_free(&cached), ==, 0);
+    g_assert_cmpuint(cached, ==, 0);
+}
+
+static void test_pool_strides(void)
+{
+    static const pixman_format_code_t formats[] = {
+        PIXMAN_a8r8g8b8, PIXMAN_x8r8g8b8, PIXMAN_r8g8b8, PIXMAN_x1r5g5b5,
+        PIXMAN_r5g6b5, PIXMAN_a8, PIXMAN_a1,
+    };
+    guint f;
+    int width;
+
+    for (f = 0; f < G_N_ELEMENTS(formats); f++) {
+        int bpp = PIXMAN_FORMAT_BPP(formats[f]);
+
+        for (width = 1; width <= 130; width += 3) {
+            pixman_image_t *surface;
+            int stride;
+
+            /* top down rows are aligned for the SIMD kernels */
+            surface = surface_create(formats[f], width, 9, TRUE);
+            stride = pixman_image_get_stride(surface);
+            g_assert_cmpint(stride % POOL_ALIGN, ==, 0);
+            g_assert_cmpint(stride, >=, (width * bpp + 7) / 8);
+            g_assert_cmpuint((uintptr_t)pixman_image_get_data(surface) % POOL_ALIGN, ==, 0);
+            assert_surface_zero(surface);
+            fill_surface(surface);
+            pixman_image_unref(surface);
+
+            /* bottom up rows are packed as the decoders write them */
+            surface = surface_create(formats[f], width, 9, FALSE);
+            stride = pixman_image_get_stride(surface);
+            g_assert_cmpint(stride, <, 0);
+            if (formats[f] == PIXMAN_a1) {
+                g_assert_cmpint(-stride, ==, SPICE_ALIGN(width, 32) / 8);
+            } else {
+                g_assert_cmpint(-stride, ==, SPICE_ALIGN(width * bpp / 8, 4));
+            }
+            fill_surface(surface);
+            pixman_image_unref(surface);
+        }
+    }
+    surface_pool_flush();
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/canvas-utils/pool-classes", test_pool_classes);
+    g_test_add_func("/canvas-utils/pool-reuse", test_pool_reuse);
+    g_test_add_func("/canvas-utils/pool-limits", test_pool_limits);
+    g_test_add_func("/canvas-utils/pool-strides", test_pool_strides);
+
+    return g_test_run();
+}
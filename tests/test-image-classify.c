@@ -0,0 +1,143 @@
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/* Check the codec picked for a few typical kinds of content */
+#include <config.h>
+
+#include <glib.h>
+
+#include "common/image_classify.h"
+
+#define TEST_WIDTH 300
+#define TEST_HEIGHT 200
+
+/* dark text-like marks on a light background */
+static uint32_t ui_pixel(int x, int y)
+{
+    if (y > 20 && y < 30 && x % 7 < 2) {
+        return 0x202020;
+    }
+    return y < 15 ? 0x3465a4 : 0xeeeeec;
+}
+
+/* smooth gradient with a bit of noise, as in a photo */
+static uint32_t photo_pixel(int x, int y)
+{
+    int noise = g_test_rand_int_range(-3, 4);
+    int r = CLAMP(x * 255 / TEST_WIDTH + noise, 0, 255);
+    int g = CLAMP(y * 255 / TEST_HEIGHT + noise, 0, 255);
+    int b = CLAMP((x + y) * 255 / (TEST_WIDTH + TEST_HEIGHT) - noise, 0, 255);
+
+    return (r << 16) | (g << 8) | b;
+}
+
+/* a flat window next to a photo */
+static uint32_t mixed_pixel(int x, int y)
+{
+    return x < TEST_WIDTH / 2 ? 0xeeeeec : photo_pixel(x, y);
+}
+
+/* thin lines over a photo, every other line inverted */
+static uint32_t line_art_pixel(int x, int y)
+{
+    return y % 2 ? photo_pixel(x, y) : photo_pixel(x, y) ^ 0xffffff;
+}
+
+static pixman_image_t *create_image(pixman_format_code_t format,
+                                    uint32_t (*pixel)(int x, int y), uint32_t alpha)
+{
+    pixman_image_t *image = pixman_image_create_bits(format, TEST_WIDTH, TEST_HEIGHT, NULL, 0);
+    int stride = pixman_image_get_stride(image) / 4;
+    uint32_t *data = pixman_image_get_data(image);
+    int x, y;
+
+    g_assert_nonnull(image);
+    for (y = 0; y < TEST_HEIGHT; y++) {
+        for (x = 0; x < TEST_WIDTH; x++) {
+            data[y * stride + x] = pixel(x, y) | (alpha << 24);
+        }
+    }
+    return image;
+}
+
+static SpiceImageType classify(pixman_format_code_t format, uint32_t (*pixel)(int x, int y),
+                               uint32_t alpha, int allow_lossy)
+{
+    pixman_image_t *image = create_image(format, pixel, alpha);
+    SpiceImageClass result;
+
+    g_assert_true(spice_image_classify(image, NULL, allow_lossy, &result));
+    g_assert_cmpuint(result.samples, >, 0);
+    g_assert_cmpfloat(result.expected_ratio, >=, 1.0);
+    g_assert_cmpint(result.uses_alpha, ==, alpha != 0xff && PIXMAN_FORMAT_A(format) != 0);
+    pixman_image_unref(image);
+    return result.type;
+}
+
+static void test_classify_ui(void)
+{
+    g_assert_cmpint(classify(PIXMAN_x8r8g8b8, ui_pixel, 0, TRUE), ==, SPICE_IMAGE_TYPE_LZ_RGB);
+    g_assert_cmpint(classify(PIXMAN_x8r8g8b8, ui_pixel, 0, FALSE), ==, SPICE_IMAGE_TYPE_LZ_RGB);
+}
+
+static void test_classify_photo(void)
+{
+    g_assert_cmpint(classify(PIXMAN_x8r8g8b8, photo_pixel, 0, FALSE), ==, SPICE_IMAGE_TYPE_QUIC);
+    g_assert_cmpint(classify(PIXMAN_x8r8g8b8, photo_pixel, 0, TRUE), ==, SPICE_IMAGE_TYPE_JPEG);
+    g_assert_cmpint(classify(PIXMAN_a8r8g8b8, photo_pixel, 0xff, TRUE), ==, SPICE_IMAGE_TYPE_JPEG);
+    g_assert_cmpint(classify(PIXMAN_a8r8g8b8, photo_pixel, 0x80, TRUE), ==,
+                    SPICE_IMAGE_TYPE_JPEG_ALPHA);
+}
+
+static void test_classify_mixed(void)
+{
+    g_assert_cmpint(classify(PIXMAN_x8r8g8b8, mixed_pixel, 0, TRUE), ==, SPICE_IMAGE_TYPE_LZ4);
+}
+
+static void test_classify_line_art(void)
+{
+    g_assert_cmpint(classify(PIXMAN_x8r8g8b8, line_art_pixel, 0, TRUE), ==,
+                    SPICE_IMAGE_TYPE_LZ_RGB);
+    g_assert_cmpint(classify(PIXMAN_x8r8g8b8, line_art_pixel, 0, FALSE), ==,
+                    SPICE_IMAGE_TYPE_LZ_RGB);
+}
+
+static void test_classify_unsupported(void)
+{
+    pixman_image_t *image = pixman_image_create_bits(PIXMAN_a8, 16, 16, NULL, 0);
+    SpiceRect empty = { 4, 4, 4, 8 };
+    SpiceImageClass result;
+
+    g_assert_false(spice_image_classify(image, NULL, TRUE, &result));
+    pixman_image_unref(image);
+
+    image = pixman_image_create_bits(PIXMAN_x8r8g8b8, 16, 16, NULL, 0);
+    g_assert_false(spice_image_classify(image, &empty, TRUE, &result));
+    pixman_image_unref(image);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/image-classify/ui", test_classify_ui);
+    g_test_add_func("/image-classify/photo", test_classify_photo);
+    g_test_add_func("/image-classify/mixed", test_classify_mixed);
+    g_test_add_func("/image-classify/line-art", test_classify_line_art);
+    g_test_add_func("/image-classify/unsupported", test_classify_unsupported);
+
+    return g_test_run();
+}
@@ -0,0 +1,204 @@
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/* Check the JPEG decoder gives the pixels of a plain libjpeg RGB decode */
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <jpeglib.h>
+
+#include "common/jpeg_decoder.h"
+
+#define TEST_WIDTH 203
+#define TEST_HEIGHT 77
+
+static uint8_t *compress_image(unsigned long *size)
+{
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    uint8_t *line = g_malloc(TEST_WIDTH * 3);
+    unsigned char *jpeg = NULL;
+    int x;
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    *size = 0;
+    jpeg_mem_dest(&cinfo, &jpeg, size);
+    cinfo.image_width = TEST_WIDTH;
+    cinfo.image_height = TEST_HEIGHT;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_start_compress(&cinfo, TRUE);
+    while (cinfo.next_scanline < cinfo.image_height) {
+        JSAMPROW row = line;
+
+        for (x = 0; x < TEST_WIDTH; x++) {
+            line[x * 3] = x;
+            line[x * 3 + 1] = cinfo.next_scanline * 3;
+            line[x * 3 + 2] = g_test_rand_int();
+        }
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    g_free(line);
+    return jpeg;
+}
+
+/* decode to RGB lines with libjpeg itself */
+static uint8_t *reference_decode(uint8_t *jpeg, unsigned long size, int scale_num,
+                                 int *width, int *height)
+{
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    uint8_t *rgb;
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, jpeg, size);
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.scale_num = scale_num;
+    cinfo.scale_denom = 8;
+    cinfo.out_color_space = JCS_RGB;
+    jpeg_start_decompress(&cinfo);
+    *width = cinfo.output_width;
+    *height = cinfo.output_height;
+    rgb = g_malloc(*width * *height * 3);
+    while (cinfo.output_scanline < cinfo.output_height) {
+        JSAMPROW row = rgb + cinfo.output_scanline * *width * 3;
+
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return rgb;
+}
+
+static void check_decode(SpiceJpegDecoder *decoder, uint8_t *jpeg, unsigned long size,
+                         int scale_num, int format)
+{
+    int bytes_pp = format == SPICE_BITMAP_FMT_16BIT ? 2 : format == SPICE_BITMAP_FMT_24BIT ? 3 : 4;
+    int width, height, ref_width, ref_height, stride, x, y;
+    uint8_t *rgb, *dest;
+
+    rgb = reference_decode(jpeg, size, scale_num, &ref_width, &ref_height);
+
+    decoder->ops->begin_decode(decoder, jpeg, size, &width, &height);
+    g_assert_cmpint(width, ==, ref_width);
+    g_assert_cmpint(height, ==, ref_height);
+
+    stride = (width * bytes_pp + 3) & ~3;
+    dest = g_malloc0(stride * height);
+    decoder->ops->decode(decoder, dest, stride, format);
+
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) {
+            const uint8_t *expected = rgb + (y * width + x) * 3;
+            const uint8_t *pixel = dest + y * stride + x * bytes_pp;
+
+            if (format == SPICE_BITMAP_FMT_16BIT) {
+                uint16_t p = pixel[0] | (pixel[1] << 8);
+
+                g_assert_cmphex(p, ==, ((expected[0] >> 3) << 10) |
+                                       ((expected[1] >> 3) << 5) | (expected[2] >> 3));
+                continue;
+            }
+            g_assert_cmphex(pixel[0], ==, expected[2]);
+            g_assert_cmphex(pixel[1], ==, expected[1]);
+            g_assert_cmphex(pixel[2], ==, expected[0]);
+            if (bytes_pp == 4) {
+                g_assert_cmphex(pixel[3], ==, 0xff);
+            }
+        }
+    }
+    g_free(dest);
+    g_free(rgb);
+}
+
+static void test_jpeg_decode(void)
+{
+    SpiceJpegDecoder *decoder = spice_jpeg_decoder_new();
+    unsigned long size;
+    uint8_t *jpeg = compress_image(&size);
+
+    g_assert_nonnull(decoder);
+
+    /* the same decoder is used for all the images */
+    check_decode(decoder, jpeg, size, 8, SPICE_BITMAP_FMT_32BIT);
+    check_decode(decoder, jpeg, size, 8, SPICE_BITMAP_FMT_RGBA);
+    check_decode(decoder, jpeg, size, 8, SPICE_BITMAP_FMT_24BIT);
+    check_decode(decoder, jpeg, size, 8, SPICE_BITMAP_FMT_16BIT);
+
+    free(jpeg);
+    spice_jpeg_decoder_free(decoder);
+}
+
+static void test_jpeg_decode_scaled(void)
+{
+    SpiceJpegDecoder *decoder = spice_jpeg_decoder_new();
+    unsigned long size;
+    uint8_t *jpeg = compress_image(&size);
+
+    /* the smallest scale at least as large as the target */
+    spice_jpeg_decoder_set_target_size(decoder, TEST_WIDTH / 2, TEST_HEIGHT / 2);
+    check_decode(decoder, jpeg, size, 4, SPICE_BITMAP_FMT_32BIT);
+    spice_jpeg_decoder_set_target_size(decoder, TEST_WIDTH / 2 + 2, 0);
+    check_decode(decoder, jpeg, size, 5, SPICE_BITMAP_FMT_32BIT);
+    spice_jpeg_decoder_set_target_size(decoder, 1, 1);
+    check_decode(decoder, jpeg, size, 1, SPICE_BITMAP_FMT_16BIT);
+    spice_jpeg_decoder_set_target_size(decoder, 0, 0);
+    check_decode(decoder, jpeg, size, 8, SPICE_BITMAP_FMT_32BIT);
+
+    free(jpeg);
+    spice_jpeg_decoder_free(decoder);
+}
+
+static void test_jpeg_decode_invalid(void)
+{
+    SpiceJpegDecoder *decoder = spice_jpeg_decoder_new();
+    unsigned long size;
+    uint8_t *jpeg = compress_image(&size);
+    uint8_t garbage[64];
+    int width, height;
+
+    memset(garbage, 0x55, sizeof(garbage));
+    g_test_expect_message(G_LOG_DOMAIN, G_LOG_LEVEL_WARNING, "jpeg decoding failed*");
+    decoder->ops->begin_decode(decoder, garbage, sizeof(garbage), &width, &height);
+    g_test_assert_expected_messages();
+    g_assert_cmpint(width, ==, 0);
+    g_assert_cmpint(height, ==, 0);
+
+    /* the decoder is still usable after an error */
+    check_decode(decoder, jpeg, size, 8, SPICE_BITMAP_FMT_32BIT);
+
+    free(jpeg);
+    spice_jpeg_decoder_free(decoder);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/jpeg-decoder/decode", test_jpeg_decode);
+    g_test_add_func("/jpeg-decoder/scaled", test_jpeg_decode_scaled);
+    g_test_add_func("/jpeg-decoder/invalid", test_jpeg_decode_invalid);
+
+    return g_test_run();
+}
@@ -0,0 +1,263 @@
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/* Check span groups paint the same pixels as the per scanline bucket code
+ * they replaced: the union of the spans within the group y range, each
+ * pixel once, sorted. Also check the direct zero width line drawing gives
+ * the pixels of spice_canvas_zero_line() */
+#include "common/lines.c"
+
+#include <glib.h>
+
+#include "common/pixman_utils.h"
+
+#define TEST_WIDTH 64
+#define TEST_HEIGHT 48
+/* spans can start left of 0 and go past the right edge */
+#define TEST_MARGIN 16
+#define TEST_STRIDE (TEST_WIDTH + 2 * TEST_MARGIN)
+
+static uint8_t painted[TEST_HEIGHT + 2 * TEST_MARGIN][TEST_STRIDE];
+static uint8_t expected[TEST_HEIGHT + 2 * TEST_MARGIN][TEST_STRIDE];
+
+static void fill_spans(SPICE_GNUC_UNUSED lineGC *gc, int num_spans, SpicePoint *points,
+                       int *widths, int sorted, SPICE_GNUC_UNUSED int foreground)
+{
+    int i, x;
+
+    g_assert_true(sorted);
+    for (i = 0; i < num_spans; i++) {
+        if (i > 0) {
+            g_assert_cmpint(points[i].y, >=, points[i - 1].y);
+            if (points[i].y == points[i - 1].y) {
+                /* unique spans don't touch each other */
+                g_assert_cmpint(points[i].x, >, points[i - 1].x + widths[i - 1]);
+            }
+        }
+        g_assert_cmpint(widths[i], >, 0);
+        for (x = points[i].x; x < points[i].x + widths[i]; x++) {
+            painted[points[i].y + TEST_MARGIN][x + TEST_MARGIN]++;
+        }
+    }
+}
+
+static void fill_rects(SPICE_GNUC_UNUSED lineGC *gc, SPICE_GNUC_UNUSED int num_rects,
+                       SPICE_GNUC_UNUSED pixman_rectangle32_t *rects,
+                       SPICE_GNUC_UNUSED int foreground)
+{
+    g_assert_not_reached();
+}
+
+static lineGCOps test_ops = { fill_spans, fill_rects };
+
+/* Appends a Spans whose first and last points are within the picture but
+ * whose other points can be anywhere, the group y range only comes from
+ * the first and last points */
+static void append_random_spans(SpanGroup *group)
+{
+    Spans spans;
+    int i;
+
+    spans.count = g_test_rand_int_range(1, 24);
+    spans.points = spice_new(SpicePoint, spans.count);
+    spans.widths = spice_new(int, spans.count);
+    for (i = 0; i < spans.count; i++) {
+        spans.points[i].x = g_test_rand_int_range(-TEST_MARGIN, TEST_WIDTH);
+        spans.widths[i] = g_test_rand_int_range(1, TEST_MARGIN);
+        if (i == 0 || i == spans.count - 1) {
+            spans.points[i].y = g_test_rand_int_range(0, TEST_HEIGHT);
+        } else {
+            spans.points[i].y = g_test_rand_int_range(-TEST_MARGIN, TEST_HEIGHT + TEST_MARGIN);
+        }
+    }
+    if (spans.points[0].y > spans.points[spans.count - 1].y) {
+        SpicePoint point = spans.points[0];
+
+        spans.points[0] = spans.points[spans.count - 1];
+        spans.points[spans.count - 1] = point;
+    }
+    miAppendSpans(group, NULL, &spans);
+}
+
+static void check_span_group(SpiceSpanArena *arena)
+{
+    lineGC gc;
+    SpanGroup group;
+    int n_spans = g_test_rand_int_range(2, 8);
+    int i, j, x;
+
+    memset(&gc, 0, sizeof(gc));
+    gc.width = TEST_WIDTH;
+    gc.height = TEST_HEIGHT;
+    gc.ops = &test_ops;
+    gc.span_arena = arena;
+
+    memset(painted, 0, sizeof(painted));
+    memset(expected, 0, sizeof(expected));
+    miInitSpanGroup(&group);
+    for (i = 0; i < n_spans; i++) {
+        append_random_spans(&group);
+    }
+
+    for (i = 0; i < group.count; i++) {
+        Spans *spans = &group.group[i];
+
+        for (j = 0; j < spans->count; j++) {
+            SpicePoint *point = &spans->points[j];
+
+            if (point->y < group.ymin || point->y > group.ymax) {
+                continue;
+            }
+            for (x = point->x; x < point->x + spans->widths[j]; x++) {
+                expected[point->y + TEST_MARGIN][x + TEST_MARGIN] = 1;
+            }
+        }
+    }
+
+    miFillUniqueSpanGroup(&gc, &group, TRUE);
+    miFreeSpanGroup(&group);
+
+    g_assert_cmpint(memcmp(painted, expected, sizeof(painted)), ==, 0);
+}
+
+static void test_lines_span_group(void)
+{
+    SpiceSpanArena arena;
+    int i;
+
+    memset(&arena, 0, sizeof(arena));
+    for (i = 0; i < 500; i++) {
+        check_span_group(&arena);
+        check_span_group(NULL);
+    }
+    spice_canvas_span_arena_fini(&arena);
+}
+
+/* what the spans of spice_canvas_zero_line() are drawn to */
+static struct {
+    pixman_image_t *image;
+    const pixman_box32_t *clip_rects;
+    int n_clip_rects;
+    uint32_t color;
+    SpiceROP rop;
+} zero_line_dest;
+
+static void fill_zero_line_spans(SPICE_GNUC_UNUSED lineGC *gc, int num_spans,
+                                 SpicePoint *points, int *widths,
+                                 SPICE_GNUC_UNUSED int sorted, int foreground)
+{
+    int i, j;
+
+    g_assert_true(foreground);
+    for (i = 0; i < num_spans; i++) {
+        for (j = 0; j < zero_line_dest.n_clip_rects; j++) {
+            const pixman_box32_t *clip = &zero_line_dest.clip_rects[j];
+            int x1 = MAX(points[i].x, clip->x1);
+            int x2 = MIN(points[i].x + widths[i], clip->x2);
+
+            if (points[i].y < clip->y1 || points[i].y >= clip->y2 || x1 >= x2) {
+                continue;
+            }
+            spice_pixman_fill_rect_rop(zero_line_dest.image, x1, points[i].y, x2 - x1, 1,
+                                       zero_line_dest.color, zero_line_dest.rop);
+        }
+    }
+}
+
+static lineGCOps zero_line_ops = { fill_zero_line_spans, fill_rects };
+
+static pixman_image_t *create_random_image(pixman_format_code_t format)
+{
+    pixman_image_t *image = pixman_image_create_bits(format, TEST_WIDTH, TEST_HEIGHT, NULL, 0);
+    uint8_t *data = (uint8_t *)pixman_image_get_data(image);
+    int i;
+
+    for (i = 0; i < pixman_image_get_stride(image) * TEST_HEIGHT; i++) {
+        data[i] = g_test_rand_int();
+    }
+    return image;
+}
+
+static void check_zero_lines(pixman_format_code_t format)
+{
+    /* a full clip, then separate bands and boxes */
+    static const pixman_box32_t full_clip[] = {
+        { 0, 0, TEST_WIDTH, TEST_HEIGHT },
+    };
+    static const pixman_box32_t band_clip[] = {
+        { 2, 1, 20, 9 }, { 30, 1, 63, 9 },
+        { 0, 12, TEST_WIDTH, 13 },
+        { 5, 20, 6, 40 }, { 7, 20, 50, 40 },
+    };
+    pixman_image_t *ref = create_random_image(format);
+    pixman_image_t *res = pixman_image_create_bits(format, TEST_WIDTH, TEST_HEIGHT, NULL, 0);
+    int size = pixman_image_get_stride(ref) * TEST_HEIGHT;
+    SpicePoint points[6];
+    lineGC gc;
+    int i, n_points, clip;
+
+    memset(&gc, 0, sizeof(gc));
+    gc.width = TEST_WIDTH;
+    gc.height = TEST_HEIGHT;
+    gc.lineStyle = LineSolid;
+    gc.capStyle = CapNotLast;
+    gc.joinStyle = JoinMiter;
+    gc.ops = &zero_line_ops;
+
+    memcpy(pixman_image_get_data(res), pixman_image_get_data(ref), size);
+    n_points = g_test_rand_int_range(2, G_N_ELEMENTS(points) + 1);
+    for (i = 0; i < n_points; i++) {
+        points[i].x = g_test_rand_int_range(-TEST_MARGIN, TEST_WIDTH + TEST_MARGIN);
+        points[i].y = g_test_rand_int_range(-TEST_MARGIN, TEST_HEIGHT + TEST_MARGIN);
+    }
+    clip = g_test_rand_int_range(0, 2);
+    zero_line_dest.clip_rects = clip ? band_clip : full_clip;
+    zero_line_dest.n_clip_rects = clip ? G_N_ELEMENTS(band_clip) : G_N_ELEMENTS(full_clip);
+    zero_line_dest.color = g_test_rand_int();
+    zero_line_dest.rop = g_test_rand_int_range(0, 16);
+    gc.alu = zero_line_dest.rop;
+
+    zero_line_dest.image = ref;
+    spice_canvas_zero_line(&gc, CoordModeOrigin, n_points, points);
+    g_assert_true(spice_pixman_draw_zero_lines(res, zero_line_dest.clip_rects,
+                                               zero_line_dest.n_clip_rects,
+                                               points, n_points,
+                                               zero_line_dest.color, zero_line_dest.rop));
+
+    g_assert_cmpint(memcmp(pixman_image_get_data(ref), pixman_image_get_data(res), size), ==, 0);
+    pixman_image_unref(ref);
+    pixman_image_unref(res);
+}
+
+static void test_lines_zero_direct(void)
+{
+    int i;
+
+    for (i = 0; i < 2000; i++) {
+        check_zero_lines(PIXMAN_x8r8g8b8);
+        check_zero_lines(PIXMAN_x1r5g5b5);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/lines/span-group", test_lines_span_group);
+    g_test_add_func("/lines/zero-direct", test_lines_zero_direct);
+
+    return g_test_run();
+}
@@ -0,0 +1,277 @@
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/* Check the shifts found by the motion detection and that copying
+ * copy_region then the damage from the new frame rebuilds the new frame.
+ * Also check the blocks reported by the frame differencing */
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "common/motion.h"
+
+#define TEST_WIDTH 200
+#define TEST_HEIGHT 150
+
+static pixman_image_t *create_random_image(pixman_format_code_t format, int width, int height)
+{
+    pixman_image_t *image = pixman_image_create_bits(format, width, height, NULL, 0);
+    uint8_t *data;
+    int size, i;
+
+    g_assert_nonnull(image);
+    data = (uint8_t *)pixman_image_get_data(image);
+    size = pixman_image_get_stride(image) * height;
+    for (i = 0; i < size; i++) {
+        data[i] = g_test_rand_int_range(0, 256);
+    }
+    return image;
+}
+
+static pixman_image_t *copy_image(pixman_image_t *image)
+{
+    pixman_image_t *copy;
+
+    copy = pixman_image_create_bits(pixman_image_get_format(image),
+                                    pixman_image_get_width(image),
+                                    pixman_image_get_height(image),
+                                    NULL, 0);
+    g_assert_nonnull(copy);
+    memcpy(pixman_image_get_data(copy), pixman_image_get_data(image),
+           pixman_image_get_stride(image) * pixman_image_get_height(image));
+    return copy;
+}
+
+static void copy_pixels(pixman_image_t *dest, pixman_image_t *src,
+                        int x1, int y1, int x2, int y2, int dx, int dy)
+{
+    int bpp = PIXMAN_FORMAT_BPP(pixman_image_get_format(dest)) / 8;
+    int stride = pixman_image_get_stride(dest);
+    uint8_t *dest_data = (uint8_t *)pixman_image_get_data(dest);
+    uint8_t *src_data = (uint8_t *)pixman_image_get_data(src);
+    int y;
+
+    for (y = y1; y < y2; y++) {
+        memcpy(dest_data + y * stride + x1 * bpp,
+               src_data + (y - dy) * stride + (x1 - dx) * bpp,
+               (x2 - x1) * bpp);
+    }
+}
+
+/* shift the area of image by (dx, dy), filling the exposed part with new
+ * random pixels */
+static pixman_image_t *scroll_image(pixman_image_t *image, const SpiceRect *area,
+                                    int dx, int dy)
+{
+    pixman_image_t *scrolled = create_random_image(pixman_image_get_format(image),
+                                                   TEST_WIDTH, TEST_HEIGHT);
+    pixman_image_t *res = copy_image(image);
+
+    copy_pixels(res, scrolled, area->left, area->top, area->right, area->bottom, 0, 0);
+    copy_pixels(res, image,
+                MAX(area->left, area->left + dx), MAX(area->top, area->top + dy),
+                MIN(area->right, area->right + dx), MIN(area->bottom, area->bottom + dy),
+                dx, dy);
+    pixman_image_unref(scrolled);
+    return res;
+}
+
+static int region_area(QRegion *region)
+{
+    pixman_box32_t *boxes;
+    int i, n, area = 0;
+
+    boxes = pixman_region32_rectangles(region, &n);
+    for (i = 0; i < n; i++) {
+        area += (boxes[i].x2 - boxes[i].x1) * (boxes[i].y2 - boxes[i].y1);
+    }
+    return area;
+}
+
+/* replay what a client would do with the result */
+static void check_motion(pixman_image_t *old_image, pixman_image_t *new_image,
+                         SpiceMotion *motion)
+{
+    pixman_image_t *res = copy_image(old_image);
+    pixman_box32_t *boxes;
+    int i, n;
+
+    boxes = pixman_region32_rectangles(&motion->copy_region, &n);
+    for (i = 0; i < n; i++) {
+        copy_pixels(res, old_image, boxes[i].x1, boxes[i].y1, boxes[i].x2, boxes[i].y2,
+                    motion->dx, motion->dy);
+    }
+    boxes = pixman_region32_rectangles(&motion->damage, &n);
+    for (i = 0; i < n; i++) {
+        copy_pixels(res, new_image, boxes[i].x1, boxes[i].y1, boxes[i].x2, boxes[i].y2, 0, 0);
+    }
+    g_assert_cmpint(memcmp(pixman_image_get_data(res), pixman_image_get_data(new_image),
+                           pixman_image_get_stride(res) * TEST_HEIGHT), ==, 0);
+    pixman_image_unref(res);
+}
+
+static void test_motion_shift(pixman_format_code_t format, int dx, int dy)
+{
+    SpiceRect area = { 10, 20, 190, 140 };
+    pixman_image_t *old_image = create_random_image(format, TEST_WIDTH, TEST_HEIGHT);
+    pixman_image_t *new_image = scroll_image(old_image, &area, dx, dy);
+    SpiceMotion motion;
+    pixman_box32_t *extents;
+
+    /* a small change in the scrolled part */
+    copy_pixels(new_image, old_image, 50, 60, 53, 61, 5, 7);
+
+    spice_motion_init(&motion);
+    g_assert_true(spice_motion_detect(old_image, new_image, NULL, 0, &motion));
+    g_assert_cmpint(motion.dx, ==, dx);
+    g_assert_cmpint(motion.dy, ==, dy);
+    check_motion(old_image, new_image, &motion);
+
+    g_assert_true(spice_motion_detect(old_image, new_image, &area, 0, &motion));
+    g_assert_cmpint(motion.dx, ==, dx);
+    g_assert_cmpint(motion.dy, ==, dy);
+    check_motion(old_image, new_image, &motion);
+
+    /* the damage is the exposed part plus the change */
+    extents = pixman_region32_extents(&motion.damage);
+    g_assert_cmpint(extents->x1, >=, area.left);
+    g_assert_cmpint(extents->y1, >=, area.top);
+    g_assert_cmpint(extents->x2, <=, area.right);
+    g_assert_cmpint(extents->y2, <=, area.bottom);
+    g_assert_cmpint(region_area(&motion.damage), <,
+                    (area.right - area.left) * (area.bottom - area.top) / 2);
+
+    /* out of the allowed range */
+    g_assert_false(spice_motion_detect(old_image, new_image, &area,
+                                       MAX(abs(dx), abs(dy)) - 1, &motion));
+    g_assert_cmpint(motion.dx, ==, 0);
+    g_assert_cmpint(motion.dy, ==, 0);
+    check_motion(old_image, new_image, &motion);
+
+    spice_motion_destroy(&motion);
+    pixman_image_unref(old_image);
+    pixman_image_unref(new_image);
+}
+
+static void test_motion_vertical(void)
+{
+    test_motion_shift(PIXMAN_x8r8g8b8, 0, -13);
+    test_motion_shift(PIXMAN_x8r8g8b8, 0, 40);
+    test_motion_shift(PIXMAN_r5g6b5, 0, 7);
+}
+
+static void test_motion_horizontal(void)
+{
+    test_motion_shift(PIXMAN_x8r8g8b8, 9, 0);
+    test_motion_shift(PIXMAN_r5g6b5, -21, 0);
+    test_motion_shift(PIXMAN_r8g8b8, 17, 0);
+}
+
+static void test_motion_none(void)
+{
+    pixman_image_t *old_image = create_random_image(PIXMAN_x8r8g8b8, TEST_WIDTH, TEST_HEIGHT);
+    pixman_image_t *new_image = copy_image(old_image);
+    SpiceMotion motion;
+    pixman_box32_t *extents;
+
+    spice_motion_init(&motion);
+    g_assert_false(spice_motion_detect(old_image, new_image, NULL, 0, &motion));
+    g_assert_false(pixman_region32_not_empty(&motion.damage));
+
+    copy_pixels(new_image, old_image, 30, 40, 70, 45, 3, 1);
+    g_assert_false(spice_motion_detect(old_image, new_image, NULL, 0, &motion));
+    g_assert_false(pixman_region32_not_empty(&motion.copy_region));
+    extents = pixman_region32_extents(&motion.damage);
+    g_assert_cmpint(extents->y1, ==, 40);
+    g_assert_cmpint(extents->y2, ==, 45);
+    check_motion(old_image, new_image, &motion);
+
+    spice_motion_destroy(&motion);
+    pixman_image_unref(old_image);
+    pixman_image_unref(new_image);
+}
+
+/* every block must be in the damage if and only if it changed */
+static void check_diff(pixman_image_t *old_image, pixman_image_t *new_image,
+                       int block_size, QRegion *damage)
+{
+    int bpp = PIXMAN_FORMAT_BPP(pixman_image_get_format(old_image)) / 8;
+    int stride = pixman_image_get_stride(old_image);
+    uint8_t *old_data = (uint8_t *)pixman_image_get_data(old_image);
+    uint8_t *new_data = (uint8_t *)pixman_image_get_data(new_image);
+    int bx, by, y;
+
+    for (by = 0; by < TEST_HEIGHT; by += block_size) {
+        for (bx = 0; bx < TEST_WIDTH; bx += block_size) {
+            int len = (MIN(bx + block_size, TEST_WIDTH) - bx) * bpp;
+            gboolean changed = FALSE;
+
+            for (y = by; y < MIN(by + block_size, TEST_HEIGHT); y++) {
+                changed |= memcmp(old_data + y * stride + bx * bpp,
+                                  new_data + y * stride + bx * bpp, len) != 0;
+            }
+            g_assert_cmpint(pixman_region32_contains_point(damage, bx, by, NULL), ==, changed);
+        }
+    }
+}
+
+static void test_diff(void)
+{
+    static const int block_sizes[] = { 16, 7, 64 };
+    pixman_image_t *old_image = create_random_image(PIXMAN_x8r8g8b8, TEST_WIDTH, TEST_HEIGHT);
+    pixman_image_t *new_image = copy_image(old_image);
+    QRegion damage;
+    guint i;
+    int n;
+
+    pixman_region32_init(&damage);
+    for (i = 0; i < G_N_ELEMENTS(block_sizes); i++) {
+        g_assert_false(spice_diff_images(old_image, new_image, NULL, block_sizes[i], 1, &damage));
+        g_assert_false(pixman_region32_not_empty(&damage));
+    }
+
+    for (n = 0; n < 20; n++) {
+        int x = g_test_rand_int_range(0, TEST_WIDTH - 8);
+        int y = g_test_rand_int_range(0, TEST_HEIGHT - 8);
+
+        copy_pixels(new_image, old_image, x, y,
+                    x + g_test_rand_int_range(1, 8), y + g_test_rand_int_range(1, 8), 1, 1);
+    }
+    for (i = 0; i < G_N_ELEMENTS(block_sizes); i++) {
+        g_assert_true(spice_diff_images(old_image, new_image, NULL, block_sizes[i], 1, &damage));
+        check_diff(old_image, new_image, block_sizes[i], &damage);
+        g_assert_true(spice_diff_images(old_image, new_image, NULL, block_sizes[i], 4, &damage));
+        check_diff(old_image, new_image, block_sizes[i], &damage);
+    }
+
+    pixman_region32_fini(&damage);
+    pixman_image_unref(old_image);
+    pixman_image_unref(new_image);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/motion/vertical", test_motion_vertical);
+    g_test_add_func("/motion/horizontal", test_motion_horizontal);
+    g_test_add_func("/motion/none", test_motion_none);
+    g_test_add_func("/motion/diff", test_diff);
+
+    return g_test_run();
+}
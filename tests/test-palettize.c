@@ -0,0 +1,169 @@
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/* Check low colour images are converted to palette bitmaps which go
+ * through the LZ palette encoding unchanged */
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "common/palettize.h"
+#include "common/lz.h"
+
+#define TEST_WIDTH 101
+#define TEST_HEIGHT 37
+
+static SPICE_GNUC_NORETURN SPICE_GNUC_PRINTF(2, 3) void
+lz_error(LzUsrContext *usr, const char *fmt, ...)
+{
+    g_error("lz error");
+}
+
+static SPICE_GNUC_PRINTF(2, 3) void
+lz_message(LzUsrContext *usr, const char *fmt, ...)
+{
+}
+
+static void *lz_malloc(LzUsrContext *usr, int size)
+{
+    return g_malloc(size);
+}
+
+static void lz_free(LzUsrContext *usr, void *ptr)
+{
+    g_free(ptr);
+}
+
+static int lz_no_more(LzUsrContext *usr, uint8_t **io_ptr)
+{
+    return 0;
+}
+
+static LzUsrContext lz_usr = {
+    lz_error,
+    lz_message,
+    lz_message,
+    lz_malloc,
+    lz_free,
+    lz_no_more,
+    lz_no_more,
+};
+
+/* runs of n_colors distinct colours, with junk in the unused byte */
+static uint32_t *create_image(int n_colors)
+{
+    uint32_t *data = g_new(uint32_t, TEST_WIDTH * TEST_HEIGHT);
+    uint32_t *colors = g_new(uint32_t, n_colors);
+    int i, color = 0;
+
+    for (i = 0; i < n_colors; i++) {
+        colors[i] = (g_test_rand_int() & 0xff0000) | i;
+    }
+    for (i = 0; i < TEST_WIDTH * TEST_HEIGHT; i++) {
+        if (i < n_colors) {
+            color = i;
+        } else if (g_test_rand_int_range(0, 5) == 0) {
+            color = g_test_rand_int_range(0, n_colors);
+        }
+        data[i] = colors[color] ^ (g_test_rand_int() & 0xff000000);
+    }
+    g_free(colors);
+    return data;
+}
+
+static void check_lz(SpiceBitmap *bitmap, const uint32_t *data)
+{
+    LzContext *lz = lz_create(&lz_usr);
+    int size = bitmap->data->data_size + 1024;
+    uint8_t *compressed = g_malloc(size);
+    uint32_t *decoded;
+    LzImageType type;
+    int width, height, n_pixels, top_down, x, y;
+
+    size = lz_encode(lz, spice_palettized_lz_type(bitmap), bitmap->x, bitmap->y, TRUE,
+                     bitmap->data->chunk[0].data, bitmap->y, bitmap->stride,
+                     compressed, size);
+    g_assert_cmpint(size, >, 0);
+
+    lz_decode_begin(lz, compressed, size, &type, &width, &height, &n_pixels, &top_down,
+                    bitmap->palette);
+    g_assert_cmpint(type, ==, spice_palettized_lz_type(bitmap));
+    g_assert_cmpint(width, ==, TEST_WIDTH);
+    g_assert_cmpint(height, ==, TEST_HEIGHT);
+    decoded = g_new(uint32_t, n_pixels);
+    lz_decode(lz, LZ_IMAGE_TYPE_RGB32, (uint8_t *)decoded);
+
+    /* palette lines are decoded including their padding bits */
+    for (y = 0; y < TEST_HEIGHT; y++) {
+        for (x = 0; x < TEST_WIDTH; x++) {
+            g_assert_cmphex(decoded[y * (n_pixels / height) + x] & 0xffffff, ==,
+                            data[y * TEST_WIDTH + x] & 0xffffff);
+        }
+    }
+
+    g_free(decoded);
+    g_free(compressed);
+    lz_destroy(lz);
+}
+
+static void test_palettize_colors(int n_colors, int expected_format)
+{
+    uint32_t *data = create_image(n_colors);
+    SpiceBitmap *bitmap;
+
+    bitmap = spice_palettize_rgb32((uint8_t *)data, TEST_WIDTH * 4,
+                                   TEST_WIDTH, TEST_HEIGHT, 256);
+    g_assert_nonnull(bitmap);
+    g_assert_cmpint(bitmap->format, ==, expected_format);
+    g_assert_cmpint(bitmap->palette->num_ents, ==, n_colors);
+    check_lz(bitmap, data);
+    spice_palettized_bitmap_free(bitmap);
+
+    /* too many colours */
+    g_assert_null(spice_palettize_rgb32((uint8_t *)data, TEST_WIDTH * 4,
+                                        TEST_WIDTH, TEST_HEIGHT, n_colors - 1));
+    g_free(data);
+}
+
+static void test_palettize(void)
+{
+    test_palettize_colors(2, SPICE_BITMAP_FMT_1BIT_BE);
+    test_palettize_colors(11, SPICE_BITMAP_FMT_4BIT_BE);
+    test_palettize_colors(16, SPICE_BITMAP_FMT_4BIT_BE);
+    test_palettize_colors(17, SPICE_BITMAP_FMT_8BIT);
+    test_palettize_colors(256, SPICE_BITMAP_FMT_8BIT);
+}
+
+static void test_palettize_too_many(void)
+{
+    uint32_t *data = create_image(257);
+
+    g_assert_null(spice_palettize_rgb32((uint8_t *)data, TEST_WIDTH * 4,
+                                        TEST_WIDTH, TEST_HEIGHT, 256));
+    g_free(data);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/palettize/colors", test_palettize);
+    g_test_add_func("/palettize/too-many", test_palettize_too_many);
+
+    return g_test_run();
+}
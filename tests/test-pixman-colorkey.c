@@ -0,0 +1,171 @@
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/* Check the SIMD color key rows give the same pixels as the C ones, for
+ * plain and scaled color key blits */
+#include <config.h>
+
+#include <string.h>
+#include <glib.h>
+
+#include "common/pixman_utils.h"
+
+#define TEST_HEIGHT 7
+
+/* odd widths around the 4, 8 and 16 pixels the kernels handle at once, and
+ * past the chunks of the scaled blits */
+static const int test_widths[] = { 1, 3, 5, 7, 9, 15, 17, 31, 33, 70, 300 };
+
+/* the key is only compared on the 24 bits of color in 32 bits images */
+static const uint32_t test_keys[] = { 0x00123456, 0xff123456, 0x7fff };
+
+/* pixels picked among a few colors, so that many of them are the key with
+ * or without the alpha bits */
+static pixman_image_t *create_keyed_image(pixman_format_code_t format, int width, int height,
+                                          uint32_t key)
+{
+    pixman_image_t *image = pixman_image_create_bits(format, width, height, NULL, 0);
+    int stride, x, y;
+
+    g_assert_nonnull(image);
+    stride = pixman_image_get_stride(image);
+    for (y = 0; y < height; y++) {
+        uint8_t *line = (uint8_t *)pixman_image_get_data(image) + y * stride;
+
+        for (x = 0; x < width; x++) {
+            uint32_t pixel = g_test_rand_int();
+
+            switch (g_test_rand_int_range(0, 3)) {
+            case 0:
+                pixel = key;
+                break;
+            case 1:
+                pixel = (key & 0xffffff) | (pixel & 0xff000000);
+                break;
+            }
+            if (PIXMAN_FORMAT_BPP(format) == 32) {
+                ((uint32_t *)line)[x] = pixel;
+            } else {
+                ((uint16_t *)line)[x] = pixel;
+            }
+        }
+    }
+    return image;
+}
+
+static pixman_image_t *copy_image(pixman_image_t *image)
+{
+    pixman_image_t *copy;
+
+    copy = pixman_image_create_bits(pixman_image_get_format(image),
+                                    pixman_image_get_width(image),
+                                    pixman_image_get_height(image),
+                                    NULL, 0);
+    g_assert_nonnull(copy);
+    memcpy(pixman_image_get_data(copy), pixman_image_get_data(image),
+           pixman_image_get_stride(image) * pixman_image_get_height(image));
+    return copy;
+}
+
+static void assert_same_pixels(pixman_image_t *a, pixman_image_t *b,
+                               const char *what, int width, uint32_t key)
+{
+    int row_size = pixman_image_get_width(a) * PIXMAN_FORMAT_BPP(pixman_image_get_format(a)) / 8;
+    int stride = pixman_image_get_stride(a);
+    uint8_t *line_a = (uint8_t *)pixman_image_get_data(a);
+    uint8_t *line_b = (uint8_t *)pixman_image_get_data(b);
+    int y;
+
+    for (y = 0; y < pixman_image_get_height(a); y++, line_a += stride, line_b += stride) {
+        if (memcmp(line_a, line_b, row_size) != 0) {
+            g_error("%s key %08x: mismatch on line %d, width %d, bpp %d", what, key, y, width,
+                    PIXMAN_FORMAT_BPP(pixman_image_get_format(a)));
+        }
+    }
+}
+
+static void test_colorkey_format(pixman_format_code_t format)
+{
+    guint w, k;
+
+    for (w = 0; w < G_N_ELEMENTS(test_widths); w++) {
+        int width = test_widths[w];
+
+        for (k = 0; k < G_N_ELEMENTS(test_keys); k++) {
+            uint32_t key = test_keys[k];
+            /* the blits start at odd places in both images */
+            pixman_image_t *dest = create_keyed_image(format, width + 5, TEST_HEIGHT + 3, key);
+            pixman_image_t *src = create_keyed_image(format, width + 7, TEST_HEIGHT + 4, key);
+            pixman_image_t *ref = copy_image(dest);
+            pixman_image_t *res = copy_image(dest);
+            pixman_box32_t boxes[] = {
+                { 0, 0, width + 5, 2 },
+                { 1, 2, width + 4, TEST_HEIGHT + 3 },
+            };
+            int scaled_width = g_test_rand_int_range(1, width + 7);
+
+            spice_pixman_set_simd_enabled(FALSE);
+            spice_pixman_blit_colorkey(ref, src, 5, 3, 3, 2, width, TEST_HEIGHT, key);
+            spice_pixman_set_simd_enabled(TRUE);
+            spice_pixman_blit_colorkey(res, src, 5, 3, 3, 2, width, TEST_HEIGHT, key);
+            assert_same_pixels(ref, res, "blit", width, key);
+
+            /* down and up scales */
+            spice_pixman_set_simd_enabled(FALSE);
+            g_assert_true(spice_pixman_scale_colorkey(ref, src, 1, 1, scaled_width, 3,
+                                                      3, 1, width, TEST_HEIGHT,
+                                                      boxes, G_N_ELEMENTS(boxes), key));
+            spice_pixman_set_simd_enabled(TRUE);
+            g_assert_true(spice_pixman_scale_colorkey(res, src, 1, 1, scaled_width, 3,
+                                                      3, 1, width, TEST_HEIGHT,
+                                                      boxes, G_N_ELEMENTS(boxes), key));
+            assert_same_pixels(ref, res, "scale", width, key);
+
+            pixman_image_unref(ref);
+            pixman_image_unref(res);
+            pixman_image_unref(dest);
+            pixman_image_unref(src);
+        }
+    }
+}
+
+static void test_colorkey_32(void)
+{
+    if (!spice_pixman_set_simd_enabled(TRUE)) {
+        g_test_skip("no SIMD support");
+        return;
+    }
+    test_colorkey_format(PIXMAN_x8r8g8b8);
+}
+
+static void test_colorkey_16(void)
+{
+    if (!spice_pixman_set_simd_enabled(TRUE)) {
+        g_test_skip("no SIMD support");
+        return;
+    }
+    test_colorkey_format(PIXMAN_x1r5g5b5);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/pixman-colorkey/32bpp", test_colorkey_32);
+    g_test_add_func("/pixman-colorkey/16bpp", test_colorkey_16);
+
+    return g_test_run();
+}
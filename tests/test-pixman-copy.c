@@ -0,0 +1,197 @@
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/* Check the streaming SIMD copy of large vertical scrolls gives the same
+ * pixels as the C one, whatever the direction and overlap of the copy and
+ * the order of the lines in memory */
+#include <config.h>
+
+#include <string.h>
+#include <glib.h>
+
+#include "common/pixman_utils.h"
+
+/* the streaming copy is only used for blocks of at least 2 MiB */
+#define STREAM_MIN_SIZE (2 * 1024 * 1024)
+
+static void release_bits(pixman_image_t *image, void *bits)
+{
+    g_free(bits);
+}
+
+/* Lines are 32 bits aligned as pixman does, bottom up images have a
+ * negative stride like the decoded bitmaps */
+static pixman_image_t *create_image(pixman_format_code_t format, int width, int height,
+                                    int top_down)
+{
+    int stride = (PIXMAN_FORMAT_BPP(format) * width + 31) / 32 * 4;
+    uint8_t *bits = g_malloc(stride * height);
+    pixman_image_t *image;
+
+    if (top_down) {
+        image = pixman_image_create_bits(format, width, height, (uint32_t *)bits, stride);
+    } else {
+        image = pixman_image_create_bits(format, width, height,
+                                         (uint32_t *)(bits + (height - 1) * stride), -stride);
+    }
+    g_assert_nonnull(image);
+    pixman_image_set_destroy_function(image, release_bits, bits);
+    return image;
+}
+
+/* The lowest address of the image lines, and their size */
+static uint8_t *image_bits(pixman_image_t *image)
+{
+    int stride = pixman_image_get_stride(image);
+    uint8_t *bits = (uint8_t *)pixman_image_get_data(image);
+
+    return stride < 0 ? bits + (pixman_image_get_height(image) - 1) * stride : bits;
+}
+
+static int image_size(pixman_image_t *image)
+{
+    return ABS(pixman_image_get_stride(image)) * pixman_image_get_height(image);
+}
+
+static pixman_image_t *create_random_image(pixman_format_code_t format, int width, int height,
+                                           int top_down)
+{
+    pixman_image_t *image = create_image(format, width, height, top_down);
+    uint32_t *data = (uint32_t *)image_bits(image);
+    int size = image_size(image) / 4;
+    int i;
+
+    for (i = 0; i < size; i++) {
+        data[i] = g_test_rand_int();
+    }
+    return image;
+}
+
+static pixman_image_t *copy_image(pixman_image_t *image)
+{
+    pixman_image_t *copy;
+
+    copy = create_image(pixman_image_get_format(image),
+                        pixman_image_get_width(image),
+                        pixman_image_get_height(image),
+                        pixman_image_get_stride(image) > 0);
+    memcpy(image_bits(copy), image_bits(image), image_size(image));
+    return copy;
+}
+
+/* Scrolls the whole width of the image by dy lines, with the C then the
+ * SIMD copy */
+static void check_scroll(pixman_image_t *image, int src_y, int height, int dy)
+{
+    int width = pixman_image_get_width(image);
+    pixman_image_t *ref = copy_image(image);
+    pixman_image_t *res = copy_image(image);
+
+    spice_pixman_set_simd_enabled(FALSE);
+    spice_pixman_copy_rect(ref, 0, src_y, width, height, 0, src_y + dy);
+    spice_pixman_set_simd_enabled(TRUE);
+    spice_pixman_copy_rect(res, 0, src_y, width, height, 0, src_y + dy);
+    if (memcmp(image_bits(ref), image_bits(res), image_size(image)) != 0) {
+        g_error("scroll by %d of %d lines from %d: mismatch, width %d, bpp %d, stride %d",
+                dy, height, src_y, width, PIXMAN_FORMAT_BPP(pixman_image_get_format(image)),
+                pixman_image_get_stride(image));
+    }
+    pixman_image_unref(ref);
+    pixman_image_unref(res);
+}
+
+static void test_copy_format(pixman_format_code_t format, int width, int top_down,
+                             const int *dys, int n_dys)
+{
+    int line_size = PIXMAN_FORMAT_BPP(format) / 8 * width;
+    /* a little more than the streaming size for the largest scroll */
+    int height = (STREAM_MIN_SIZE + line_size - 1) / line_size + 101;
+    pixman_image_t *image = create_random_image(format, width, height, top_down);
+    int stride = ABS(pixman_image_get_stride(image));
+    /* the fewest lines making a streamed block, the last line is not
+     * copied up to the stride */
+    int stream_lines = (STREAM_MIN_SIZE - line_size + stride - 1) / stride + 1;
+    int i;
+
+    for (i = 0; i < n_dys; i++) {
+        int dy = dys[i];
+
+        check_scroll(image, MAX(-dy, 0), height - ABS(dy), dy);
+        check_scroll(image, MAX(-dy, 0), stream_lines, dy);
+        check_scroll(image, MAX(-dy, 0), stream_lines - 1, dy);
+    }
+    pixman_image_unref(image);
+}
+
+static void test_copy_32(void)
+{
+    static const int dys[] = { 1, -1, 3, -5, 16, -100 };
+
+    if (!spice_pixman_set_simd_enabled(TRUE)) {
+        g_test_skip("no SIMD support");
+        return;
+    }
+    /* lines are not 16 bytes aligned */
+    test_copy_format(PIXMAN_x8r8g8b8, 1001, TRUE, dys, G_N_ELEMENTS(dys));
+}
+
+static void test_copy_16(void)
+{
+    static const int dys[] = { 1, -1, 7, -7 };
+
+    if (!spice_pixman_set_simd_enabled(TRUE)) {
+        g_test_skip("no SIMD support");
+        return;
+    }
+    test_copy_format(PIXMAN_x1r5g5b5, 1001, TRUE, dys, G_N_ELEMENTS(dys));
+}
+
+static void test_copy_narrow(void)
+{
+    /* 16 bytes lines, copies closer than 64 bytes overlap within a chunk */
+    static const int dys[] = { 1, -2, 3, 4, -4, 5, -101 };
+
+    if (!spice_pixman_set_simd_enabled(TRUE)) {
+        g_test_skip("no SIMD support");
+        return;
+    }
+    test_copy_format(PIXMAN_a8, 13, TRUE, dys, G_N_ELEMENTS(dys));
+}
+
+static void test_copy_bottom_up(void)
+{
+    static const int dys[] = { 1, -1, 16, -100 };
+
+    if (!spice_pixman_set_simd_enabled(TRUE)) {
+        g_test_skip("no SIMD support");
+        return;
+    }
+    /* the lines go down in memory, as in the decoded bitmaps */
+    test_copy_format(PIXMAN_x8r8g8b8, 1001, FALSE, dys, G_N_ELEMENTS(dys));
+    test_copy_format(PIXMAN_r5g6b5, 333, FALSE, dys, G_N_ELEMENTS(dys));
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/pixman-copy/32bpp", test_copy_32);
+    g_test_add_func("/pixman-copy/16bpp", test_copy_16);
+    g_test_add_func("/pixman-copy/narrow", test_copy_narrow);
+    g_test_add_func("/pixman-copy/bottom-up", test_copy_bottom_up);
+
+    return g_test_run();
+}
@@ -0,0 +1,175 @@
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/* Check the SIMD solid, tiled and copy rop rows give the same results as
+ * the C handlers for every operation */
+#include <config.h>
+
+#include <string.h>
+#include <glib.h>
+
+#include "common/pixman_utils.h"
+
+#define TEST_HEIGHT 11
+/* the rectangles start at an odd place in the destination */
+#define TEST_X 3
+#define TEST_Y 2
+
+/* up to 300 pixels to go past one stack buffer of tile lines */
+static const int test_widths[] = { 1, 3, 8, 15, 17, 33, 70, 300 };
+
+/* from a single pixel to tile lines too large for the stack buffer */
+static const struct {
+    int width, height;
+} test_tiles[] = { { 1, 1 }, { 5, 3 }, { 8, 8 }, { 300, 2 } };
+
+static pixman_image_t *create_random_image(pixman_format_code_t format, int width, int height)
+{
+    pixman_image_t *image = pixman_image_create_bits(format, width, height, NULL, 0);
+    uint8_t *data;
+    int size, i;
+
+    g_assert_nonnull(image);
+    data = (uint8_t *)pixman_image_get_data(image);
+    size = pixman_image_get_stride(image) * height;
+    for (i = 0; i < size; i++) {
+        data[i] = g_test_rand_int_range(0, 256);
+    }
+    return image;
+}
+
+static pixman_image_t *copy_image(pixman_image_t *image)
+{
+    pixman_image_t *copy;
+
+    copy = pixman_image_create_bits(pixman_image_get_format(image),
+                                    pixman_image_get_width(image),
+                                    pixman_image_get_height(image),
+                                    NULL, 0);
+    g_assert_nonnull(copy);
+    memcpy(pixman_image_get_data(copy), pixman_image_get_data(image),
+           pixman_image_get_stride(image) * pixman_image_get_height(image));
+    return copy;
+}
+
+static void assert_same_pixels(pixman_image_t *a, pixman_image_t *b,
+                               const char *what, int rop, int width)
+{
+    int row_size = pixman_image_get_width(a) * PIXMAN_FORMAT_BPP(pixman_image_get_format(a)) / 8;
+    int stride = pixman_image_get_stride(a);
+    uint8_t *line_a = (uint8_t *)pixman_image_get_data(a);
+    uint8_t *line_b = (uint8_t *)pixman_image_get_data(b);
+    int y;
+
+    for (y = 0; y < pixman_image_get_height(a); y++, line_a += stride, line_b += stride) {
+        if (memcmp(line_a, line_b, row_size) != 0) {
+            g_error("%s rop %d: mismatch on line %d, width %d, bpp %d", what, rop, y, width,
+                    PIXMAN_FORMAT_BPP(pixman_image_get_format(a)));
+        }
+    }
+}
+
+static void test_rop_format(pixman_format_code_t format)
+{
+    guint w, t;
+    int rop;
+
+    for (w = 0; w < G_N_ELEMENTS(test_widths); w++) {
+        int width = test_widths[w];
+        pixman_image_t *dest = create_random_image(format, width + TEST_X + 4,
+                                                   TEST_HEIGHT + TEST_Y + 1);
+        pixman_image_t *src = create_random_image(format, width + 7, TEST_HEIGHT + 4);
+        uint32_t color = g_test_rand_int();
+
+        for (rop = 0; rop < 16; rop++) {
+            pixman_image_t *ref, *res;
+
+            ref = copy_image(dest);
+            res = copy_image(dest);
+            spice_pixman_set_simd_enabled(FALSE);
+            spice_pixman_fill_rect_rop(ref, TEST_X, TEST_Y, width, TEST_HEIGHT, color, rop);
+            spice_pixman_set_simd_enabled(TRUE);
+            spice_pixman_fill_rect_rop(res, TEST_X, TEST_Y, width, TEST_HEIGHT, color, rop);
+            assert_same_pixels(ref, res, "solid", rop, width);
+
+            spice_pixman_set_simd_enabled(FALSE);
+            spice_pixman_blit_rop(ref, src, 5, 3, TEST_X, TEST_Y, width, TEST_HEIGHT, rop);
+            spice_pixman_set_simd_enabled(TRUE);
+            spice_pixman_blit_rop(res, src, 5, 3, TEST_X, TEST_Y, width, TEST_HEIGHT, rop);
+            assert_same_pixels(ref, res, "copy", rop, width);
+
+            for (t = 0; t < G_N_ELEMENTS(test_tiles); t++) {
+                pixman_image_t *tile = create_random_image(format, test_tiles[t].width,
+                                                           test_tiles[t].height);
+                int offset_x = g_test_rand_int_range(-20, 20);
+                int offset_y = g_test_rand_int_range(-20, 20);
+
+                spice_pixman_set_simd_enabled(FALSE);
+                spice_pixman_tile_rect_rop(ref, TEST_X, TEST_Y, width, TEST_HEIGHT,
+                                           tile, offset_x, offset_y, rop);
+                spice_pixman_set_simd_enabled(TRUE);
+                spice_pixman_tile_rect_rop(res, TEST_X, TEST_Y, width, TEST_HEIGHT,
+                                           tile, offset_x, offset_y, rop);
+                assert_same_pixels(ref, res, "tiled", rop, width);
+                pixman_image_unref(tile);
+            }
+
+            pixman_image_unref(ref);
+            pixman_image_unref(res);
+        }
+
+        pixman_image_unref(dest);
+        pixman_image_unref(src);
+    }
+}
+
+static void test_rop_32(void)
+{
+    if (!spice_pixman_set_simd_enabled(TRUE)) {
+        g_test_skip("no SIMD support");
+        return;
+    }
+    test_rop_format(PIXMAN_x8r8g8b8);
+}
+
+static void test_rop_16(void)
+{
+    if (!spice_pixman_set_simd_enabled(TRUE)) {
+        g_test_skip("no SIMD support");
+        return;
+    }
+    test_rop_format(PIXMAN_x1r5g5b5);
+}
+
+static void test_rop_8(void)
+{
+    if (!spice_pixman_set_simd_enabled(TRUE)) {
+        g_test_skip("no SIMD support");
+        return;
+    }
+    test_rop_format(PIXMAN_a8);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/pixman-rop/32bpp", test_rop_32);
+    g_test_add_func("/pixman-rop/16bpp", test_rop_16);
+    g_test_add_func("/pixman-rop/8bpp", test_rop_8);
+
+    return g_test_run();
+}
@@ -0,0 +1,246 @@
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/* Check the scaler gives the same pixels as a pixman transform */
+#include <config.h>
+
+#include <string.h>
+#include <glib.h>
+
+#include "common/pixman_utils.h"
+
+#define SRC_WIDTH 61
+#define SRC_HEIGHT 47
+
+static pixman_image_t *create_random_image(pixman_format_code_t format, int width, int height)
+{
+    pixman_image_t *image = pixman_image_create_bits(format, width, height, NULL, 0);
+    uint8_t *data = (uint8_t *)pixman_image_get_data(image);
+    int i;
+
+    g_assert_nonnull(image);
+    for (i = 0; i < pixman_image_get_stride(image) * height; i++) {
+        data[i] = g_test_rand_int();
+    }
+    /* pixman writes the padding bit as 0 */
+    if (format == PIXMAN_x1r5g5b5) {
+        for (i = 0; i < pixman_image_get_stride(image) * height / 2; i++) {
+            ((uint16_t *)data)[i] &= 0x7fff;
+        }
+    }
+    return image;
+}
+
+typedef struct {
+    int src_x, src_y, src_width, src_height;
+    int dest_x, dest_y, dest_width, dest_height;
+} TestArea;
+
+static const TestArea test_areas[] = {
+    { 3, 5, SRC_WIDTH - 7, SRC_HEIGHT - 9, 0, 0, SRC_WIDTH, SRC_HEIGHT },
+    { 3, 5, SRC_WIDTH - 7, SRC_HEIGHT - 9, 0, 0, 157, 113 },
+    { 3, 5, SRC_WIDTH - 7, SRC_HEIGHT - 9, 0, 0, 23, 17 },
+    { 3, 5, SRC_WIDTH - 7, SRC_HEIGHT - 9, 0, 0, 200, 11 },
+    /* large enough to be split over threads */
+    { 3, 5, SRC_WIDTH - 7, SRC_HEIGHT - 9, 0, 0, 800, 600 },
+    /* source areas touching the edges of the image, where the pixels past
+     * them do not exist */
+    { 0, 0, SRC_WIDTH, SRC_HEIGHT, 0, 0, 157, 113 },
+    { 0, 0, SRC_WIDTH, SRC_HEIGHT, 0, 0, 23, 17 },
+    { 0, 0, 20, 13, 0, 0, 100, 70 },
+    { SRC_WIDTH - 20, SRC_HEIGHT - 15, 20, 15, 0, 0, 90, 40 },
+    { SRC_WIDTH - 9, 0, 9, SRC_HEIGHT, 0, 0, 31, 120 },
+    { 0, SRC_HEIGHT - 5, SRC_WIDTH, 5, 0, 0, 200, 9 },
+    /* destination areas away from the origin */
+    { 3, 5, SRC_WIDTH - 7, SRC_HEIGHT - 9, 9, 6, 157, 113 },
+    { 3, 5, SRC_WIDTH - 7, SRC_HEIGHT - 9, 1, 1, 800, 600 },
+    { SRC_WIDTH - 20, SRC_HEIGHT - 15, 20, 15, 11, 2, 90, 40 },
+    { 0, 0, 20, 13, 5, 3, 100, 70 },
+};
+
+static pixman_image_t *copy_image(pixman_image_t *image)
+{
+    pixman_image_t *copy;
+
+    copy = pixman_image_create_bits(pixman_image_get_format(image),
+                                    pixman_image_get_width(image),
+                                    pixman_image_get_height(image),
+                                    NULL, 0);
+    g_assert_nonnull(copy);
+    memcpy(pixman_image_get_data(copy), pixman_image_get_data(image),
+           pixman_image_get_stride(image) * pixman_image_get_height(image));
+    return copy;
+}
+
+/* scale the src area to the dest area as sw_canvas used to do */
+static void pixman_scale(pixman_image_t *dest, pixman_image_t *src, const TestArea *area,
+                         int bilinear)
+{
+    pixman_transform_t transform;
+
+    pixman_transform_init_scale(&transform,
+                                ((pixman_fixed_48_16_t) area->src_width * 65536) /
+                                area->dest_width,
+                                ((pixman_fixed_48_16_t) area->src_height * 65536) /
+                                area->dest_height);
+    pixman_transform_translate(&transform, NULL,
+                               pixman_int_to_fixed(area->src_x),
+                               pixman_int_to_fixed(area->src_y));
+    pixman_image_set_transform(src, &transform);
+    pixman_image_set_repeat(src, PIXMAN_REPEAT_NONE);
+    pixman_image_set_filter(src, bilinear ? PIXMAN_FILTER_GOOD : PIXMAN_FILTER_NEAREST, NULL, 0);
+    pixman_image_composite32(PIXMAN_OP_SRC, src, NULL, dest,
+                             0, 0, 0, 0, area->dest_x, area->dest_y,
+                             area->dest_width, area->dest_height);
+    pixman_transform_init_identity(&transform);
+    pixman_image_set_transform(src, &transform);
+}
+
+/* the x bits of the pixels are not compared */
+static void check_same(pixman_image_t *expected, pixman_image_t *image, const TestArea *area,
+                       int bilinear)
+{
+    pixman_format_code_t format = pixman_image_get_format(image);
+    uint32_t mask = (uint32_t)((UINT64_C(1) << PIXMAN_FORMAT_DEPTH(format)) - 1);
+    int stride = pixman_image_get_stride(image);
+    int x, y;
+
+    for (y = 0; y < pixman_image_get_height(image); y++) {
+        const uint8_t *a = (uint8_t *)pixman_image_get_data(expected) + y * stride;
+        const uint8_t *b = (uint8_t *)pixman_image_get_data(image) + y * stride;
+
+        for (x = 0; x < pixman_image_get_width(image); x++) {
+            uint32_t pixel_a, pixel_b;
+
+            if (PIXMAN_FORMAT_BPP(format) == 32) {
+                pixel_a = ((const uint32_t *)a)[x];
+                pixel_b = ((const uint32_t *)b)[x];
+            } else {
+                pixel_a = ((const uint16_t *)a)[x];
+                pixel_b = ((const uint16_t *)b)[x];
+            }
+            if ((pixel_a & mask) != (pixel_b & mask)) {
+                g_error("format %08x, %s, %dx%d at %d,%d to %dx%d at %d,%d: "
+                        "mismatch at %d,%d: %08x != %08x", format,
+                        bilinear ? "bilinear" : "nearest",
+                        area->src_width, area->src_height, area->src_x, area->src_y,
+                        area->dest_width, area->dest_height, area->dest_x, area->dest_y,
+                        x, y, pixel_a, pixel_b);
+            }
+        }
+    }
+}
+
+static void test_scale_area(pixman_format_code_t format, const TestArea *area, int bilinear)
+{
+    pixman_image_t *src = create_random_image(format, SRC_WIDTH, SRC_HEIGHT);
+    /* some pixels around the dest area which must be left alone */
+    int width = area->dest_x + area->dest_width + 3;
+    int height = area->dest_y + area->dest_height + 2;
+    pixman_image_t *initial = create_random_image(format, width, height);
+    pixman_image_t *expected = copy_image(initial);
+    pixman_image_t *image = copy_image(initial);
+    pixman_image_t *xored = copy_image(initial);
+    pixman_box32_t box = { 0, 0, width, height };
+    int stride = pixman_image_get_stride(image);
+    uint8_t *xored_data = (uint8_t *)pixman_image_get_data(xored);
+    uint8_t *initial_data = (uint8_t *)pixman_image_get_data(initial);
+    int i;
+
+    pixman_scale(expected, src, area, bilinear);
+
+    g_assert_true(spice_pixman_scale_rop(image, src, area->src_x, area->src_y,
+                                         area->src_width, area->src_height,
+                                         area->dest_x, area->dest_y,
+                                         area->dest_width, area->dest_height, &box, 1,
+                                         bilinear, SPICE_ROP_COPY, 4));
+    check_same(expected, image, area, bilinear);
+
+    /* the rop is applied to the scaled pixels */
+    g_assert_true(spice_pixman_scale_rop(xored, src, area->src_x, area->src_y,
+                                         area->src_width, area->src_height,
+                                         area->dest_x, area->dest_y,
+                                         area->dest_width, area->dest_height, &box, 1,
+                                         bilinear, SPICE_ROP_XOR, 4));
+    for (i = 0; i < stride * height; i++) {
+        xored_data[i] ^= initial_data[i];
+    }
+    /* which leaves 0 outside of the dest area */
+    memset(initial_data, 0, stride * height);
+    pixman_scale(initial, src, area, bilinear);
+    check_same(initial, xored, area, bilinear);
+
+    pixman_image_unref(xored);
+    pixman_image_unref(image);
+    pixman_image_unref(expected);
+    pixman_image_unref(initial);
+    pixman_image_unref(src);
+}
+
+static void test_scale_format(pixman_format_code_t format)
+{
+    int bilinear;
+    guint i;
+
+    for (bilinear = 0; bilinear < 2; bilinear++) {
+        for (i = 0; i < G_N_ELEMENTS(test_areas); i++) {
+            test_scale_area(format, &test_areas[i], bilinear);
+        }
+    }
+}
+
+static void test_scale_32(void)
+{
+    test_scale_format(PIXMAN_a8r8g8b8);
+    test_scale_format(PIXMAN_x8r8g8b8);
+}
+
+static void test_scale_16(void)
+{
+    test_scale_format(PIXMAN_r5g6b5);
+    test_scale_format(PIXMAN_x1r5g5b5);
+}
+
+static void test_scale_unsupported(void)
+{
+    pixman_image_t *src = pixman_image_create_bits(PIXMAN_a8r8g8b8, 16, 16, NULL, 0);
+    pixman_image_t *dest = pixman_image_create_bits(PIXMAN_r5g6b5, 16, 16, NULL, 0);
+    pixman_box32_t box = { 0, 0, 16, 16 };
+
+    /* different formats */
+    g_assert_false(spice_pixman_scale_rop(dest, src, 0, 0, 16, 16, 0, 0, 16, 16,
+                                          &box, 1, TRUE, SPICE_ROP_COPY, 1));
+    /* source area outside of the image */
+    g_assert_false(spice_pixman_scale_rop(src, src, 8, 0, 16, 16, 0, 0, 16, 16,
+                                          &box, 1, TRUE, SPICE_ROP_COPY, 1));
+    /* scaling an image into itself */
+    g_assert_false(spice_pixman_scale_rop(src, src, 0, 0, 8, 8, 0, 0, 16, 16,
+                                          &box, 1, TRUE, SPICE_ROP_COPY, 1));
+
+    pixman_image_unref(dest);
+    pixman_image_unref(src);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/pixman-scale/32bpp", test_scale_32);
+    g_test_add_func("/pixman-scale/16bpp", test_scale_16);
+    g_test_add_func("/pixman-scale/unsupported", test_scale_unsupported);
+
+    return g_test_run();
+}
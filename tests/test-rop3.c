@@ -0,0 +1,163 @@
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/* Check the SIMD rop3 code gives the same results as the C handlers for
+ * every operation */
+#include <config.h>
+
+#include <string.h>
+#include <glib.h>
+
+#include "common/rop3.h"
+
+#define TEST_HEIGHT 11
+
+static const int test_widths[] = { 1, 3, 8, 15, 17, 33, 70 };
+
+/* only the operations depending on all of D, S and P have handlers */
+static gboolean rop3_is_ternary(int rop3)
+{
+    return (((rop3 >> 1) ^ rop3) & 0x55) &&
+           (((rop3 >> 2) ^ rop3) & 0x33) &&
+           (((rop3 >> 4) ^ rop3) & 0x0f);
+}
+
+static pixman_image_t *create_random_image(pixman_format_code_t format, int width, int height)
+{
+    pixman_image_t *image = pixman_image_create_bits(format, width, height, NULL, 0);
+    uint8_t *data;
+    int size, i;
+
+    g_assert_nonnull(image);
+    data = (uint8_t *)pixman_image_get_data(image);
+    size = pixman_image_get_stride(image) * height;
+    for (i = 0; i < size; i++) {
+        data[i] = g_test_rand_int_range(0, 256);
+    }
+    return image;
+}
+
+static pixman_image_t *copy_image(pixman_image_t *image)
+{
+    pixman_image_t *copy;
+
+    copy = pixman_image_create_bits(pixman_image_get_format(image),
+                                    pixman_image_get_width(image),
+                                    pixman_image_get_height(image),
+                                    NULL, 0);
+    g_assert_nonnull(copy);
+    memcpy(pixman_image_get_data(copy), pixman_image_get_data(image),
+           pixman_image_get_stride(image) * pixman_image_get_height(image));
+    return copy;
+}
+
+static void assert_same_pixels(pixman_image_t *a, pixman_image_t *b, int rop3)
+{
+    int row_size = pixman_image_get_width(a) * PIXMAN_FORMAT_BPP(pixman_image_get_format(a)) / 8;
+    int stride = pixman_image_get_stride(a);
+    uint8_t *line_a = (uint8_t *)pixman_image_get_data(a);
+    uint8_t *line_b = (uint8_t *)pixman_image_get_data(b);
+    int y;
+
+    for (y = 0; y < pixman_image_get_height(a); y++, line_a += stride, line_b += stride) {
+        if (memcmp(line_a, line_b, row_size) != 0) {
+            g_error("rop3 0x%02x: mismatch on line %d, width %d, bpp %d", rop3, y,
+                    pixman_image_get_width(a), PIXMAN_FORMAT_BPP(pixman_image_get_format(a)));
+        }
+    }
+}
+
+static void test_rop3_format(pixman_format_code_t format)
+{
+    guint w;
+    int rop3;
+
+    for (w = 0; w < G_N_ELEMENTS(test_widths); w++) {
+        int width = test_widths[w];
+        SpicePoint src_pos = { 5, 3 };
+        SpicePoint pat_pos = { 6, 2 };
+        SpicePoint odd_pat_pos = { 3, 1 };
+        pixman_image_t *dest = create_random_image(format, width, TEST_HEIGHT);
+        pixman_image_t *src = create_random_image(format, width + 7, TEST_HEIGHT + 4);
+        pixman_image_t *pat = create_random_image(format, 8, 8);
+        pixman_image_t *odd_pat = create_random_image(format, 5, 3);
+        uint32_t color = g_test_rand_int();
+
+        for (rop3 = 0; rop3 < 256; rop3++) {
+            pixman_image_t *ref, *res;
+
+            if (!rop3_is_ternary(rop3)) {
+                continue;
+            }
+
+            ref = copy_image(dest);
+            res = copy_image(dest);
+            rop3_set_simd_enabled(FALSE);
+            do_rop3_with_pattern(rop3, ref, src, &src_pos, pat, &pat_pos);
+            rop3_set_simd_enabled(TRUE);
+            do_rop3_with_pattern(rop3, res, src, &src_pos, pat, &pat_pos);
+            assert_same_pixels(ref, res, rop3);
+
+            rop3_set_simd_enabled(FALSE);
+            do_rop3_with_pattern(rop3, ref, src, &src_pos, odd_pat, &odd_pat_pos);
+            rop3_set_simd_enabled(TRUE);
+            do_rop3_with_pattern(rop3, res, src, &src_pos, odd_pat, &odd_pat_pos);
+            assert_same_pixels(ref, res, rop3);
+
+            rop3_set_simd_enabled(FALSE);
+            do_rop3_with_color(rop3, ref, src, &src_pos, color);
+            rop3_set_simd_enabled(TRUE);
+            do_rop3_with_color(rop3, res, src, &src_pos, color);
+            assert_same_pixels(ref, res, rop3);
+
+            pixman_image_unref(ref);
+            pixman_image_unref(res);
+        }
+
+        pixman_image_unref(dest);
+        pixman_image_unref(src);
+        pixman_image_unref(pat);
+        pixman_image_unref(odd_pat);
+    }
+}
+
+static void test_rop3_32(void)
+{
+    if (!rop3_set_simd_enabled(TRUE)) {
+        g_test_skip("no SIMD support");
+        return;
+    }
+    test_rop3_format(PIXMAN_x8r8g8b8);
+}
+
+static void test_rop3_16(void)
+{
+    if (!rop3_set_simd_enabled(TRUE)) {
+        g_test_skip("no SIMD support");
+        return;
+    }
+    test_rop3_format(PIXMAN_x1r5g5b5);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/rop3/32bpp", test_rop3_32);
+    g_test_add_func("/rop3/16bpp", test_rop3_16);
+
+    return g_test_run();
+}